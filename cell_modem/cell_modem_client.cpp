@@ -3,9 +3,13 @@
 #include <Arduino.h>
 #include <etl/chrono.h>
 #include <etl/circular_buffer.h>
+#include <etl/delegate.h>
 #include <etl/format.h>
+#include <etl/queue.h>
 #include <etl/string.h>
 #include <etl/string_utilities.h>
+#include <etl/vector.h>
+#include <limits.h>
 #include <memory>
 #include <ok_logging.h>
 
@@ -15,8 +19,14 @@ static const OkLoggingContext OK_CONTEXT("cell_modem_client");
 
 class CellModemClientDef : public CellModemClient {
  public:
-  CellModemClientDef(HardwareSerial* s, etl::string_view mqtt)
-    : serial(s), mqtt_server(mqtt) {}
+  CellModemClientDef(HardwareSerial* s, CellModemMQTTConfig const& mqtt)
+    : serial(s), mqtt_server(mqtt.server), mqtt_port(mqtt.port),
+      mqtt_client_id(mqtt.client_id), mqtt_user(mqtt.user),
+      mqtt_password(mqtt.password), mqtt_keepalive(mqtt.keepalive_secs),
+      max_message_size(mqtt.max_message_size),
+      flow_control(mqtt.hardware_flow_control) {
+    status.data_rate = UART_RATE;  // Until measured
+  }
 
   CellModemStatus const& poll() override {
     for (int avail = 0; avail || ((avail = serial->available()) > 0); --avail) {
@@ -28,14 +38,8 @@ class CellModemClientDef : public CellModemClient {
       if (ch < 0) {
         OK_ERROR("Serial read error: available=%d ch=%d", avail, ch);
         break;
-      } else if (in_expect > 0) {
-        in_buf.push_back(ch);
-        if (in_buf.size() >= in_expect) {
-          OK_DETAIL("Input block: %s", input_summary().c_str());
-          handle_input();
-          in_buf.clear();
-          in_expect = 0;
-        }
+      } else if (msg_part != MessagePart::NONE) {
+        take_message_byte(ch);
       } else if (ch == '\r' || ch == '\n') {
         if (!in_buf.empty()) {
           OK_DETAIL("Input: %s", input_summary().c_str());
@@ -43,136 +47,848 @@ class CellModemClientDef : public CellModemClient {
           in_buf.clear();
         }
       } else if (ch < 32 || ch >= 256) {
-        OK_ERROR("Bad input char (state=%d): 0x02x", state, ch);
+        OK_ERROR("Bad input char: 0x%02x", ch);
         in_buf.clear();
       } else {
         in_buf.push_back(ch);
       }
     }
 
+    // Pass along whatever payload arrived, rather than waiting to fill up
+    if (msg_part == MessagePart::PAYLOAD) flush_message_chunk(false);
+
     auto const now = etl::chrono::steady_clock::now();
-    if (state != State::IDLE && now >= state_deadline) {
-      OK_ERROR("Command timeout (state=%d), polling", state);
-      state = State::IDLE;
+    if ((command_sent || data_mode) && now >= deadline) {
+      if (data_mode) {
+        OK_ERROR("Data mode timeout (%d bytes unsent)", pub_left);
+        if (pub_left == 0) slow_data_rate();  // Sent, but the modem lost some
+        drop_publish_data();  // Can't tell how much the modem took
+        data_mode = false;
+      } else {
+        OK_ERROR("Command timeout: %s", commands.front().text.c_str());
+        if (++timeouts >= 3) escalate("Modem not responding");
+        late_until = now + LATE_REPLY_WAIT;  // Don't mistake it for the next
+        finish_command(Reply::TIMEOUT);
+      }
       next_status_poll = {};  // Poll until we get a response
     }
 
-    if (state == State::IDLE && out_complete >= out_buf.size()) {
-      out_complete = 0;
-      out_buf.clear();
-      state_deadline = now + 1_s;
-      if (status.hardware.empty()) {
-        out_buf = "AT+CGMM\r\n";
-        state = State::AT_CGMM_WAIT;
-      } else if (status.imeisv.empty()) {
-        out_buf = "AT+CGSN=2\r\n";
-        state = State::AT_CGSN_WAIT;
-      } else if (status.versions[0].empty()) {
-        out_buf = "AT+CGMR\r\n";
-        state = State::AT_CGMR_WAIT;
-      } else if (status.versions[1].empty()) {
-        out_buf = "AT#XSMVER\r\n";
-        state = State::AT_XSMVER_WAIT;
-      } else if (now >= next_status_poll) {
-        next_status_poll = now + 30_s;
-        out_buf = "AT%XMONITOR\r\n";
-        state = State::AT_XMONITOR_WAIT;
+    if (mqtt_state == MQTTState::CONNECTING && now >= mqtt_deadline) {
+      OK_ERROR("No CONNACK from broker, retrying");
+      mqtt_state = MQTTState::OFF;
+      mqtt_deadline = now + 10_s;
+      count_mqtt_failure();
+    }
+
+    if (link == Link::SEARCHING && now >= link_deadline) {
+      escalate("Not registered");
+    } else if (link == Link::WAITING && now >= link_deadline) {
+      escalate("Modem did not restart");
+    }
+
+    // One command at a time on the wire (the modem requires it), but the
+    // next queued command goes out as soon as the last one completes
+    if (
+      !command_sent && !data_mode && out_complete >= out_buf.size() &&
+      now >= late_until
+    ) {
+      if (commands.empty()) plan_commands(now);
+      if (!commands.empty()) {
+        auto const& command = commands.front();
+        out_buf = command.text;
+        out_buf.append("\r\n");
+        out_complete = 0;
+        command_sent = true;
+        deadline = now + command.timeout;
       }
-      // TODO: more outgoing
     }
 
-    while (out_complete < out_buf.size() && serial->availableForWrite() > 0) {
-      serial->write(out_buf[out_complete++]);
+    int credit = data_credit(now);
+    while (serial->availableForWrite() > 0) {
+      if (out_complete < out_buf.size()) {
+        serial->write(out_buf[out_complete++]);
+      } else if (data_mode && pub_left > 0 && credit <= 0) {
+        ++status.data_stalls;  // Let the modem catch up
+        break;
+      } else if (data_mode && pub_left > 0) {
+        serial->write(pub_data.front());
+        pub_data.pop();
+        --pub_left;  // Modem exits data mode after <len> bytes
+        --credit;
+        ++data_sent;
+        deadline = now + 5_s;  // Times out lack of progress, not size
+      } else {
+        break;
+      }
     }
 
     return status;
   }
 
+  bool publish(
+    etl::string_view topic, etl::string_view payload, int qos, bool retain
+  ) override {
+    if (topic.empty() || topic.size() > MAX_TOPIC_SIZE) {
+      OK_ERROR("Bad publish topic length (%d)", (int) topic.size());
+      return false;
+    }
+    if (topic.find('"') != etl::string_view::npos) {
+      OK_ERROR("Bad publish topic (has '\"')");
+      return false;
+    }
+    if (payload.size() > MAX_PUBLISH_SIZE || qos < 0 || qos > 2) {
+      OK_ERROR("Bad publish (%db qos=%d)", (int) payload.size(), qos);
+      return false;
+    }
+    if (pub_queue.full() || pub_data.available() < payload.size()) {
+      OK_ERROR("Publish queue full, dropping %db", (int) payload.size());
+      return false;
+    }
+
+    pub_queue.emplace();
+    auto* pub = &pub_queue.back();
+    pub->topic = topic;
+    pub->size = payload.size();
+    pub->qos = qos;
+    pub->retain = retain;
+    for (char const ch : payload) pub_data.push(ch);
+    return true;
+  }
+
+  bool subscribe(etl::string_view filter, int qos) override {
+    if (filter.empty() || filter.size() > MAX_TOPIC_SIZE ||
+        filter.find('"') != etl::string_view::npos ||
+        qos < 0 || qos > 2 || subscriptions.full()) {
+      OK_ERROR("Bad subscription (%d topic bytes)", (int) filter.size());
+      return false;
+    }
+
+    subscriptions.emplace_back();
+    subscriptions.back().filter = filter;
+    subscriptions.back().qos = qos;
+    return true;  // Sent once connected (or right away if connected)
+  }
+
+  void set_message_handler(CellModemMessageHandler handler) override {
+    message_handler = handler;
+  }
+
  private:
   using duration = etl::chrono::steady_clock::duration;
   using time_point = etl::chrono::steady_clock::time_point;
 
   HardwareSerial* const serial;
   etl::string<128> const mqtt_server;
+  int const mqtt_port;
+  etl::string<64> const mqtt_client_id;
+  etl::string<64> const mqtt_user;
+  etl::string<64> const mqtt_password;
+  int const mqtt_keepalive;
+  int const max_message_size;
+
+  enum class MQTTState { OFF, CONFIGURED, CONNECTING, CONNECTED };
 
-  enum class State {
-    IDLE,
-    AT_CGMM_WAIT,
-    AT_CGMR_WAIT,
-    AT_CGSN_WAIT,
-    AT_XMONITOR_WAIT,
-    AT_XSMVER_WAIT,
-    OK_WAIT,
+  static constexpr int MAX_TOPIC_SIZE = 128;  // Per the SM MQTT limits
+  static constexpr char const* SYSTEM_MODE = "AT%XSYSTEMMODE=1,0,0,0";  // LTE-M
+
+  static constexpr auto REGISTER_TIMEOUT = 120_s;
+  static constexpr auto RESTART_TIMEOUT = 30_s;  // For INIT or Ready
+  static constexpr auto CONNECT_TIMEOUT = 30_s;  // #XMQTTCON waits for CONNACK
+  static constexpr auto LATE_REPLY_WAIT = 2_s;   // After a command timeout
+  static constexpr duration HOLD_DOWNS[] = { 0_s, 60_s, 300_s, 900_s };
+
+  struct PendingPublish {
+    etl::string<MAX_TOPIC_SIZE> topic;
+    int size;
+    int qos;
+    bool retain;
   };
 
-  State state = State::IDLE;
-  time_point state_deadline = {};
+  enum class Reply { OK, ERROR, TIMEOUT };
+  using LineHandler = etl::delegate<void(etl::string_view)>;
+  using DoneHandler = etl::delegate<void(Reply)>;
+
+  // A queued AT command, with handlers for its response and completion
+  struct Command {
+    etl::string<256> text;     // Without the trailing CRLF
+    etl::string_view prefix;   // Marks response lines ("" = untagged text)
+    LineHandler on_line;
+    DoneHandler on_done;       // After OK, ERROR or timeout
+    duration timeout;
+  };
+
+  // Unsolicited result codes, recognized wherever they arrive
+  struct URCRoute {
+    char const* prefix;
+    void (CellModemClientDef::*handler)(etl::string_view rest);
+  };
+
+  etl::queue<Command, 8> commands;
+  bool command_sent = false;  // Front command is out, awaiting OK/ERROR
+  bool data_mode = false;     // Sending publish payload, until #XDATAMODE
+  time_point deadline = {};   // For the command or data mode
+  time_point late_until = {};  // A timed-out command's reply may yet come
   time_point next_status_poll = {};
   CellModemStatus status;
 
+  // Connection supervisor: bring-up phases, plus the reset ladder
+  enum class Link {
+    START,       // Modem state unknown: session setup and identification
+    RADIO_OFF,   // Needs CEREG=5, system mode and CFUN=1 (after any CFUN=0)
+    SEARCHING,   // Radio on, waiting for +CEREG home or roaming
+    REGISTERED,  // MQTT can connect
+    WAITING,     // For #XMODEM: INIT or Ready after a reset
+  };
+
+  static constexpr int MAX_STEP = 3;  // Flight bounce, modem reset, SiP reset
+
+  Link link = Link::START;
+  time_point link_deadline = {};  // Retry (RADIO_OFF) or give up (others)
+  int step_wanted = 0;            // Ladder rung to run next (0 = none)
+  time_point hold_until = {};     // Next rung waits for this
+  int timeouts = 0;               // Consecutive command timeouts
+  int mqtt_failures = 0;          // Consecutive failed connect attempts
+  bool link_down = false;         // MQTT was lost, timing the recovery
+  time_point down_since = {};
+
+  MQTTState mqtt_state = MQTTState::OFF;
+  time_point mqtt_deadline = {};  // CONNACK timeout, or retry time if OFF
+
+  etl::queue<PendingPublish, 16> pub_queue;
+  etl::circular_buffer<char, 16384> pub_data;  // Payloads, in queue order
+  int pub_left = 0;  // Payload bytes of the current publish left to write
+
+  // Data-mode pacing. Without flow control, bytes the Serial Modem hasn't
+  // drained sit in its UART RX slab (3 x 2KB), and overflow is silently
+  // lost. Payload written, less what the modem should have drained at
+  // its measured rate, is kept under the slab size (less some margin).
+  static constexpr int RX_SLACK = 6144 - 1024;
+  static constexpr int UART_RATE = 11520;  // 115200 8N1, bytes/sec
+  static constexpr int MIN_MEASURE_SIZE = 2048;  // Smaller is all latency
+
+  bool const flow_control;
+  time_point data_start = {};  // When data mode (the current publish) began
+  int data_sent = 0;           // Payload bytes written since then
+
+  struct Subscription {
+    etl::string<MAX_TOPIC_SIZE> filter;
+    int qos;
+  };
+
+  etl::vector<Subscription, 8> subscriptions;
+  size_t sub_next = 0;       // Next to (re)subscribe after connecting
+  bool sub_pending = false;  // Waiting for SUBACK (they can't be correlated)
+
+  // #XMQTTMSG framing: header line, topic, CRLF, raw payload, CRLF
+  enum class MessagePart {
+    NONE, HEADER_LF, TOPIC, TOPIC_CRLF, PAYLOAD, PAYLOAD_CRLF
+  };
+
+  static constexpr int CHUNK_SIZE = 256;
+
+  CellModemMessageHandler message_handler;
+  MessagePart msg_part = MessagePart::NONE;
+  int msg_part_left = 0;     // Bytes left in the current part
+  etl::string<MAX_TOPIC_SIZE> msg_topic;
+  int msg_size = 0;          // Payload size from the header
+  int msg_offset = 0;        // Payload bytes passed to the handler so far
+  etl::string<CHUNK_SIZE> msg_chunk;
+
   etl::string<8192> in_buf;
-  int in_expect = 0;
 
   etl::string<256> out_buf;
   int out_complete = 0;
 
   void handle_input() {
-    if (in_expect > 0) {
-      // TODO: handle
+    auto const line = etl::trim_view_whitespace(etl::string_view(in_buf));
+    if (command_sent) {
+      auto const& command = commands.front();
+      if (line.compare("OK") == 0) return finish_command(Reply::OK);
+      if (line.compare("ERROR") == 0 || line.starts_with("+CME ERROR:")) {
+        auto const& text = command.text;
+        OK_ERROR("%s failed: %s", text.c_str(), input_summary().c_str());
+        return finish_command(Reply::ERROR);
+      }
+      if (!command.prefix.empty() && line.starts_with(command.prefix)) {
+        if (command.on_line.is_valid()) command.on_line(line);
+        return;
+      }
+    }
+
+    for (auto const& route : URC_ROUTES) {
+      etl::string_view rest = line;
+      if (eat_token(&rest, route.prefix)) return (this->*route.handler)(rest);
+    }
+
+    bool const final = line.compare("OK") == 0 ||
+        line.compare("ERROR") == 0 || line.starts_with("+CME ERROR:");
+    if (!command_sent && final && late_until != time_point{}) {
+      OK_NOTE("Late reply (after timeout): %s", input_summary().c_str());
+      late_until = {};  // Nothing more to wait for
       return;
     }
 
-    etl::string_view rest(in_buf);
-    switch (state) {
-      case State::IDLE: {
+    if (command_sent && commands.front().prefix.empty()) {
+      auto const& command = commands.front();
+      if (command.on_line.is_valid()) command.on_line(line);
+      return;
+    }
+
+    OK_ERROR("Unexpected input: %s", input_summary().c_str());
+  }
+
+  void finish_command(Reply reply) {
+    if (reply != Reply::TIMEOUT) timeouts = 0;
+    if (reply == Reply::OK && status.mqtt_connected) step_wanted = 0;
+    auto const on_done = commands.front().on_done;
+    commands.pop();
+    command_sent = false;
+    if (on_done.is_valid()) on_done(reply);  // May queue more commands
+  }
+
+  bool add_command(
+    etl::string_view text, etl::string_view prefix = "",
+    LineHandler on_line = {}, DoneHandler on_done = {},
+    duration timeout = 1_s
+  ) {
+    if (commands.full()) {
+      OK_ERROR("Command queue full: %.*s", (int) text.size(), text.data());
+      return false;
+    }
+
+    commands.emplace();
+    auto* command = &commands.back();
+    command->text = text;
+    command->prefix = prefix;
+    command->on_line = on_line;
+    command->on_done = on_done;
+    command->timeout = timeout;
+    return true;
+  }
+
+  using Def = CellModemClientDef;
+
+  template <void (Def::*M)(etl::string_view)>
+  LineHandler line_fn() { return LineHandler::create<Def, M>(*this); }
+
+  template <void (Def::*M)(Reply)>
+  DoneHandler done_fn() { return DoneHandler::create<Def, M>(*this); }
+
+  void plan_commands(time_point now) {
+    etl::string<256> text;
+    auto out = etl::back_inserter(text);
+    if (step_wanted > 0 && now >= hold_until) {
+      start_recovery_step(now);
+    } else if (link == Link::START) {
+      // Session setup and identification go out back to back
+      add_command("ATE0");
+      add_command("AT+CMEE=1");
+      add_command("AT+CGMM", "", line_fn<&Def::on_cgmm>());
+      add_command("AT+CGSN=2", "+CGSN:", line_fn<&Def::on_cgsn>());
+      add_command("AT+CGMR", "", line_fn<&Def::on_cgmr>());
+      add_command(
+        "AT#XSMVER", "#XSMVER:", line_fn<&Def::on_xsmver>(),
+        done_fn<&Def::on_identify_done>()
+      );
+    } else if (link == Link::RADIO_OFF && now >= link_deadline) {
+      // Registration URCs reset at CFUN=0; system mode only sets at CFUN=0/4
+      add_command("AT+CEREG=5");
+      add_command(SYSTEM_MODE);
+      add_command("AT+CFUN=1", "", {}, done_fn<&Def::on_cfun_done>(), 5_s);
+    } else if (
+      link == Link::REGISTERED && mqtt_state == MQTTState::OFF &&
+      now >= mqtt_deadline
+    ) {
+      etl::string_view id(mqtt_client_id);
+      if (id.empty()) id = etl::string_view(status.imeisv);
+      etl::format_to(out, "AT#XMQTTCFG=\"{}\",{},1", id, mqtt_keepalive);
+      add_command(text, "", {}, done_fn<&Def::on_xmqttcfg_done>());
+    } else if (mqtt_state == MQTTState::CONFIGURED) {
+      etl::format_to(
+        out, "AT#XMQTTCON=1,\"{}\",\"{}\",\"{}\",{}",
+        etl::string_view(mqtt_user), etl::string_view(mqtt_password),
+        etl::string_view(mqtt_server), mqtt_port
+      );
+      add_command(
+        text, "", {}, done_fn<&Def::on_xmqttcon_done>(), CONNECT_TIMEOUT
+      );
+    } else if (
+      mqtt_state == MQTTState::CONNECTED && !sub_pending &&
+      sub_next < subscriptions.size()
+    ) {
+      auto const& sub = subscriptions[sub_next];
+      etl::format_to(
+        out, "AT#XMQTTSUB=\"{}\",{}", etl::string_view(sub.filter), sub.qos
+      );
+      add_command(text, "", {}, done_fn<&Def::on_xmqttsub_done>());
+    } else if (mqtt_state == MQTTState::CONNECTED && !pub_queue.empty()) {
+      // Counted data mode: raw payload follows OK, no escaping/terminator
+      auto const& pub = pub_queue.front();
+      etl::format_to(
+        out, "AT#XMQTTPUB=\"{}\",\"\",{},{},{}",
+        etl::string_view(pub.topic), pub.qos, pub.retain ? 1 : 0, pub.size
+      );
+      add_command(text, "", {}, done_fn<&Def::on_xmqttpub_done>());
+    } else if (
+      (link == Link::SEARCHING || link == Link::REGISTERED) &&
+      now >= next_status_poll
+    ) {
+      next_status_poll = now + 30_s;
+      add_command("AT%XMONITOR", "%XMONITOR:", line_fn<&Def::on_xmonitor>());
+    }
+  }
+
+  void on_cgmm(etl::string_view line) {
+    status.hardware = line.empty() ? "-" : line;
+  }
+
+  void on_cgmr(etl::string_view line) {
+    status.versions[0] = line.empty() ? "-" : line;
+  }
+
+  void on_cgsn(etl::string_view rest) {
+    etl::string_view value;
+    if (eat_token(&rest, "+CGSN:") && parse_quoted(&rest, &value)) {
+      status.imeisv = value.empty() ? "-" : value;
+    } else {
+      OK_ERROR("Bad CGSN reply: %s", input_summary().c_str());
+    }
+  }
+
+  void on_xsmver(etl::string_view rest) {
+    etl::string_view sm_version, ncs_version, cust_version;
+    if (
+      eat_token(&rest, "#XSMVER:") && parse_quoted(&rest, &sm_version) &&
+      eat_token(&rest, ",") && parse_quoted(&rest, &ncs_version) &&
+      eat_token(&rest, ",") && parse_quoted(&rest, &cust_version)
+    ) {
+      status.versions[1] = sm_version.empty() ? "-" : sm_version;
+      status.versions[2] = ncs_version.empty() ? "-" : ncs_version;
+      status.versions[3] = cust_version.empty() ? "-" : cust_version;
+    } else {
+      OK_ERROR("Bad #XSMVER reply: %s", input_summary().c_str());
+    }
+  }
+
+  void on_xmonitor(etl::string_view rest) {
+    int reg = 0;
+    if (eat_token(&rest, "%XMONITOR:") && parse_int(&rest, &reg)) {
+      set_registration(reg);
+    } else {
+      OK_ERROR("Bad %%XMONITOR reply: %s", input_summary().c_str());
+    }
+  }
+
+  void on_identify_done(Reply reply) {
+    if (reply != Reply::TIMEOUT && link == Link::START) {
+      link = Link::RADIO_OFF;  // Errors just mean unsupported; carry on
+    }
+  }
+
+  void on_cfun_done(Reply reply) {
+    auto const now = etl::chrono::steady_clock::now();
+    if (reply == Reply::OK) {
+      link = Link::SEARCHING;
+      link_deadline = now + REGISTER_TIMEOUT;
+      next_status_poll = {};  // Check registration right away
+    } else if (reply == Reply::ERROR) {
+      link_deadline = now + 10_s;
+      escalate("Radio won't turn on");
+    }
+  }
+
+  void on_xmqttcfg_done(Reply reply) {
+    if (reply == Reply::OK) {
+      mqtt_state = MQTTState::CONFIGURED;
+    } else {
+      mqtt_deadline = etl::chrono::steady_clock::now() + 10_s;
+    }
+  }
+
+  void on_xmqttcon_done(Reply reply) {
+    auto const now = etl::chrono::steady_clock::now();
+    if (reply == Reply::OK) {
+      mqtt_state = MQTTState::CONNECTING;  // CONNACK comes as #XMQTTEVT
+      mqtt_deadline = now + 30_s;
+    } else {
+      mqtt_state = MQTTState::OFF;  // e.g. not registered yet
+      mqtt_deadline = now + 10_s;
+      count_mqtt_failure();
+    }
+  }
+
+  void on_xmqttsub_done(Reply reply) {
+    if (reply == Reply::OK) {
+      sub_pending = true;  // SUBACK comes as #XMQTTEVT
+    } else {
+      set_mqtt_disconnected();
+    }
+  }
+
+  void on_xmqttpub_done(Reply reply) {
+    if (reply == Reply::OK) {
+      pub_left = pub_queue.front().size;  // Now in data mode
+      pub_queue.pop();
+      data_mode = true;
+      data_start = etl::chrono::steady_clock::now();
+      data_sent = 0;
+      deadline = data_start + 5_s;
+    } else {
+      OK_ERROR("Publish refused, reconnecting");  // -ENOTCONN
+      set_mqtt_disconnected();  // Message stays queued for retry
+    }
+  }
+
+  void on_cereg_urc(etl::string_view rest) {
+    int reg = 0;
+    if (parse_int(&rest, &reg)) {
+      OK_DETAIL("Registration status %d", reg);
+      set_registration(reg);
+    } else {
+      OK_ERROR("Bad +CEREG: %s", input_summary().c_str());
+    }
+  }
+
+  void on_xmqttevt_urc(etl::string_view rest) {
+    int type = 0, result = 0;
+    if (!parse_int(&rest, &type) || !eat_token(&rest, ",") ||
+        !parse_int(&rest, &result)) {
+      OK_ERROR("Bad #XMQTTEVT: %s", input_summary().c_str());
+      return;
+    }
+    handle_mqtt_event(type, result);
+  }
+
+  void on_xmqttmsg_urc(etl::string_view rest) {
+    int topic_size = 0;
+    if (!parse_int(&rest, &topic_size) || !eat_token(&rest, ",") ||
+        !parse_int(&rest, &msg_size) || topic_size < 0 || msg_size < 0) {
+      OK_ERROR("Bad #XMQTTMSG: %s", input_summary().c_str());
+      return;
+    }
+
+    // Header line ended at CR; the LF and body are read by byte count
+    msg_topic.clear();
+    msg_chunk.clear();
+    msg_offset = 0;
+    msg_part_left = topic_size;
+    msg_part = MessagePart::HEADER_LF;
+  }
+
+  void on_xdatamode_urc(etl::string_view rest) {
+    int result = 0;
+    if (!data_mode) {
+      OK_ERROR("Unexpected #XDATAMODE: %s", input_summary().c_str());
+    } else if (!parse_int(&rest, &result) || result != 0 || pub_left > 0) {
+      OK_ERROR("Data mode failed: %s", input_summary().c_str());
+      slow_data_rate();
+    } else {
+      ++status.mqtt_published;
+      if (data_sent >= MIN_MEASURE_SIZE) measure_data_rate();
+    }
+    drop_publish_data();
+    data_mode = false;  // Next publish goes out right away
+  }
+
+  // Payload bytes that can be written now without overrunning the modem
+  int data_credit(time_point now) const {
+    if (!data_mode || flow_control) return RX_SLACK;  // Or CTS holds us off
+    using etl::chrono::milliseconds;
+    auto const elapsed = etl::chrono::duration_cast<milliseconds>(
+      now - data_start
+    );
+    int64_t const drained = elapsed.count() * status.data_rate / 1000;
+    int64_t const credit = RX_SLACK - (data_sent - drained);
+    return credit < RX_SLACK ? credit : RX_SLACK;
+  }
+
+  // #XDATAMODE comes once the modem has taken the whole payload, so
+  // size over time-to-completion is a floor on the rate it drains at
+  void measure_data_rate() {
+    using etl::chrono::milliseconds;
+    auto const now = etl::chrono::steady_clock::now();
+    auto const elapsed = etl::chrono::duration_cast<milliseconds>(
+      now - data_start
+    );
+    int const measured = data_sent * 1000LL / (elapsed.count() + 1);
+    int const rate = (status.data_rate * 3 + measured) / 4;  // Smoothed
+    status.data_rate = rate < UART_RATE ? rate : UART_RATE;
+  }
+
+  void slow_data_rate() {  // Bytes were probably lost; back off
+    if (status.data_rate > UART_RATE / 8) status.data_rate /= 2;
+  }
+
+  void on_xmodem_urc(etl::string_view rest) {
+    OK_ERROR("Modem event: %s", input_summary().c_str());
+    auto const now = etl::chrono::steady_clock::now();
+    if (eat_token(&rest, "SHUTDOWN")) {
+      ++status.modem_restarts;
+      link = Link::WAITING;  // MQTT is gone; INIT should follow
+      link_deadline = now + RESTART_TIMEOUT;
+      status.registration = -1;
+      set_mqtt_disconnected();
+    } else if (eat_token(&rest, "INIT")) {
+      link = Link::RADIO_OFF;  // Auto-connect is off, so redo radio bring-up
+      link_deadline = {};
+      status.registration = -1;
+      set_mqtt_disconnected();
+    }
+  }
+
+  void on_ready_urc(etl::string_view) {
+    OK_NOTE("Serial modem (re)started, resetting state");
+    while (!commands.empty()) commands.pop();  // Their replies won't come
+    command_sent = data_mode = false;
+    late_until = {};
+    drop_publish_data();
+    ++status.modem_restarts;
+    status.registration = -1;
+    link = Link::START;  // Echo and error format are back to defaults
+    set_mqtt_disconnected();
+  }
+
+  void set_registration(int reg) {
+    status.registration = reg;
+    bool const up = (reg == 1 || reg == 5);  // Home or roaming
+    if (up && link == Link::SEARCHING) {
+      link = Link::REGISTERED;
+      mqtt_deadline = {};  // Connect now rather than after the retry delay
+    } else if (!up && link == Link::REGISTERED) {
+      link = Link::SEARCHING;  // The modem keeps looking on its own
+      link_deadline = etl::chrono::steady_clock::now() + REGISTER_TIMEOUT;
+    }
+  }
+
+  // Asks for the next rung of the reset ladder, run once the hold-down
+  // from the previous rung (if any) has passed
+  void escalate(char const* why) {
+    if (step_wanted > 0) return;  // Already asked
+    int const step = status.recovery_step + 1;
+    step_wanted = step < MAX_STEP ? step : MAX_STEP;
+    OK_ERROR("%s, recovery step %d", why, step_wanted);
+  }
+
+  void start_recovery_step(time_point now) {
+    int const step = status.recovery_step = step_wanted;
+    step_wanted = 0;
+    hold_until = now + HOLD_DOWNS[step];
+    timeouts = 0;
+    set_mqtt_disconnected();
+    switch (step) {
+      case 1:
+        OK_NOTE("Recovery: flight mode bounce (CFUN=4/1)");
+        ++status.flight_bounces;
+        add_command("AT+CFUN=4", "", {}, done_fn<&Def::on_step_done>(), 5_s);
+        add_command("AT+CFUN=1", "", {}, done_fn<&Def::on_cfun_done>(), 5_s);
         break;
-      }
-      case State::AT_CGMM_WAIT: {
-        status.hardware = etl::trim_view_whitespace(rest);
-        if (status.hardware.empty()) status.hardware = "-";
-        state = State::OK_WAIT;
+      case 2:
+        OK_NOTE("Recovery: modem reset (#XMODEMRESET)");
+        ++status.modem_resets;
+        add_command(
+          "AT#XMODEMRESET", "#XMODEMRESET:",
+          line_fn<&Def::on_xmodemreset>(), done_fn<&Def::on_step_done>(), 10_s
+        );
         break;
-      }
-      case State::AT_CGMR_WAIT: {
-        status.versions[0] = etl::trim_view_whitespace(rest);
-        if (status.versions[0].empty()) status.versions[0] = "-";
-        state = State::OK_WAIT;
+      default:
+        OK_NOTE("Recovery: system reset (#XRESET)");
+        ++status.system_resets;
+        add_command("AT#XRESET", "", {}, done_fn<&Def::on_step_done>(), 5_s);
         break;
-      }
-      case State::AT_CGSN_WAIT: {
-        etl::string_view value;
-        if (eat_token(&rest, "+CGSN:") && parse_quoted(&rest, &value)) {
-          status.imeisv = value.empty() ? "-" : value;
+    }
+  }
+
+  void on_xmodemreset(etl::string_view rest) {
+    int result = 0;
+    if (!eat_token(&rest, "#XMODEMRESET:") || !parse_int(&rest, &result) ||
+        result != 0) {
+      OK_ERROR("Modem reset failed: %s", input_summary().c_str());
+      step_failed();
+    }
+  }
+
+  void on_step_done(Reply reply) {
+    if (reply != Reply::OK) return step_failed();
+    if (step_wanted > 0) return;  // Failed along the way
+    auto const now = etl::chrono::steady_clock::now();
+    if (status.recovery_step == 2) {
+      link = Link::RADIO_OFF;  // #XMODEMRESET leaves the modem at CFUN=0
+      link_deadline = {};
+    } else if (status.recovery_step == MAX_STEP) {
+      link = Link::WAITING;  // For Ready
+      link_deadline = now + RESTART_TIMEOUT;
+    }
+  }
+
+  // A rung that fails outright moves straight on to the next one,
+  // except the last, which is retried only after its hold-down
+  void step_failed() {
+    if (status.recovery_step < MAX_STEP) hold_until = {};
+    escalate("Recovery step failed");
+  }
+
+  void count_mqtt_failure() {
+    if (link == Link::REGISTERED && ++mqtt_failures >= 5) {
+      mqtt_failures = 0;
+      escalate("MQTT connect keeps failing");
+    }
+  }
+
+  static constexpr URCRoute URC_ROUTES[] = {
+    { "+CEREG:", &Def::on_cereg_urc },
+    { "#XMQTTEVT:", &Def::on_xmqttevt_urc },
+    { "#XMQTTMSG:", &Def::on_xmqttmsg_urc },
+    { "#XDATAMODE:", &Def::on_xdatamode_urc },
+    { "#XMODEM:", &Def::on_xmodem_urc },
+    { "Ready", &Def::on_ready_urc },
+  };
+
+  void handle_mqtt_event(int type, int result) {
+    switch (type) {
+      case 0:  // CONNACK
+        if (result == 0) {
+          OK_NOTE("MQTT connected to %s:%d", mqtt_server.c_str(), mqtt_port);
+          mqtt_state = MQTTState::CONNECTED;
+          status.mqtt_connected = true;
+          ++status.mqtt_connects;
+          set_link_recovered();
         } else {
-          OK_ERROR("Bad CGSN reply: %s", input_summary().c_str());
+          OK_ERROR("MQTT connect failed (%d)", result);
+          set_mqtt_disconnected();
+          count_mqtt_failure();
         }
-        state = State::OK_WAIT;
         break;
-      }
-      case State::AT_XSMVER_WAIT: {
-        etl::string_view sm_version, ncs_version, cust_version;
-        if (
-          eat_token(&rest, "#XSMVER:") && parse_quoted(&rest, &sm_version) &&
-          eat_token(&rest, ",") && parse_quoted(&rest, &ncs_version) &&
-          eat_token(&rest, ",") && parse_quoted(&rest, &cust_version)
-        ) {
-          status.versions[1] = sm_version.empty() ? "-" : sm_version;
-          status.versions[2] = ncs_version.empty() ? "-" : ncs_version;
-          status.versions[3] = cust_version.empty() ? "-" : cust_version;
+      case 1:  // DISCONNECT
+        OK_ERROR("MQTT disconnected (%d)", result);
+        set_mqtt_disconnected();
+        break;
+      case 3:  // PUBACK
+        if (result == 0) ++status.mqtt_publish_acks;
+        break;
+      case 7:  // SUBACK
+        if (result < 0) OK_ERROR("MQTT subscribe failed (%d)", result);
+        if (sub_pending) ++sub_next;  // Skip failures rather than loop
+        sub_pending = false;
+        break;
+      default:
+        if (result < 0) OK_ERROR("MQTT event %d failed (%d)", type, result);
+        break;
+    }
+  }
+
+  void set_mqtt_disconnected() {
+    auto const now = etl::chrono::steady_clock::now();
+    if (status.mqtt_connected && !link_down) {
+      link_down = true;  // Start timing the outage
+      down_since = now;
+    }
+
+    sub_next = 0;  // Resubscribe after reconnecting (clean session)
+    sub_pending = false;
+    mqtt_state = MQTTState::OFF;
+    mqtt_deadline = now + 10_s;
+    status.mqtt_connected = false;
+  }
+
+  void set_link_recovered() {
+    step_wanted = 0;
+    status.recovery_step = 0;  // Hold-down stays, in case of flapping
+    mqtt_failures = 0;
+    if (!link_down) return;
+
+    using etl::chrono::milliseconds;
+    auto const now = etl::chrono::steady_clock::now();
+    auto const down = now - down_since;
+    link_down = false;
+    ++status.recoveries;
+    status.last_recovery_millis =
+      etl::chrono::duration_cast<milliseconds>(down).count();
+    if (status.last_recovery_millis > status.max_recovery_millis) {
+      status.max_recovery_millis = status.last_recovery_millis;
+    }
+    OK_NOTE("MQTT recovered after %dms", status.last_recovery_millis);
+  }
+
+  void take_message_byte(char ch) {
+    switch (msg_part) {
+      case MessagePart::NONE:
+        break;
+      case MessagePart::HEADER_LF:
+        msg_part = MessagePart::TOPIC;
+        if (msg_part_left == 0) start_message_part(MessagePart::TOPIC_CRLF);
+        if (ch != '\n') take_message_byte(ch);  // Tolerate bare CR
+        break;
+      case MessagePart::TOPIC:
+        if (!msg_topic.full()) msg_topic.push_back(ch);
+        if (--msg_part_left == 0) start_message_part(MessagePart::TOPIC_CRLF);
+        break;
+      case MessagePart::TOPIC_CRLF:
+      case MessagePart::PAYLOAD_CRLF:
+        if (ch != '\r' && ch != '\n') {
+          OK_ERROR("Bad #XMQTTMSG delimiter (0x%02x)", ch);
+        }
+        if (--msg_part_left > 0) break;
+        if (msg_part == MessagePart::TOPIC_CRLF) {
+          start_message_part(MessagePart::PAYLOAD);
         } else {
-          OK_ERROR("Bad #XSMVER reply: %s", input_summary().c_str());
+          msg_part = MessagePart::NONE;
         }
-        state = State::OK_WAIT;
         break;
-      }
-      case State::OK_WAIT: {
-        if (!eat_token(&rest, "OK")) {
-          OK_ERROR("Bad input (state=%d): %s", state, input_summary().c_str());
+      case MessagePart::PAYLOAD:
+        if (msg_offset + (int) msg_chunk.size() < max_message_size) {
+          msg_chunk.push_back(ch);  // Past the cap, bytes are just dropped
         }
-        state = State::IDLE;
+        if (msg_chunk.full()) flush_message_chunk(false);
+        if (--msg_part_left == 0) start_message_part(MessagePart::PAYLOAD_CRLF);
+        break;
+    }
+  }
+
+  void start_message_part(MessagePart part) {
+    msg_part = part;
+    switch (part) {
+      case MessagePart::TOPIC_CRLF:
+      case MessagePart::PAYLOAD_CRLF:
+        msg_part_left = 2;
         break;
+      case MessagePart::PAYLOAD:
+        msg_part_left = msg_size;
+        if (msg_size == 0) start_message_part(MessagePart::PAYLOAD_CRLF);
+        break;
+      default:
+        break;
+    }
+
+    if (part == MessagePart::PAYLOAD_CRLF) {
+      ++status.mqtt_received;
+      if (msg_size > max_message_size) {
+        OK_ERROR(
+          "Inbound message too big (%db > %db), truncated",
+          msg_size, max_message_size
+        );
+        ++status.mqtt_truncated;
       }
+      flush_message_chunk(true);
+    }
+  }
+
+  void flush_message_chunk(bool last) {
+    if (msg_chunk.empty() && !last) return;
+    if (message_handler.is_valid()) {
+      CellModemMessageChunk chunk;
+      chunk.topic = etl::string_view(msg_topic);
+      chunk.data = etl::string_view(msg_chunk);
+      chunk.offset = msg_offset;
+      chunk.size = msg_size;
+      chunk.last = last;
+      message_handler(chunk);
     }
+    msg_offset += msg_chunk.size();
+    msg_chunk.clear();
+  }
+
+  void drop_publish_data() {
+    for (; pub_left > 0; --pub_left) pub_data.pop();
   }
 
   etl::string<40> input_summary() const {
@@ -197,6 +913,24 @@ class CellModemClientDef : public CellModemClient {
     return true;
   }
 
+  static bool parse_int(etl::string_view* str, int* out) {
+    auto view = etl::trim_view_whitespace_left(*str);
+    bool const negative = !view.empty() && view.front() == '-';
+    if (negative) view.remove_prefix(1);
+    if (view.empty() || view.front() < '0' || view.front() > '9') return false;
+
+    int value = 0;
+    while (!view.empty() && view.front() >= '0' && view.front() <= '9') {
+      int const digit = view.front() - '0';
+      if (value > (INT_MAX - digit) / 10) return false;  // Would overflow
+      value = value * 10 + digit;
+      view.remove_prefix(1);
+    }
+    *out = negative ? -value : value;
+    *str = view;
+    return true;
+  }
+
   static bool parse_quoted(etl::string_view* str, etl::string_view* out) {
     auto view = *str;
     if (!eat_token(&view, "\"")) return false;
@@ -210,7 +944,15 @@ class CellModemClientDef : public CellModemClient {
 
 etl::unique_ptr<CellModemClient> make_cell_modem_client(
   arduino::HardwareSerial* serial, etl::string_view mqtt_server
+) {
+  CellModemMQTTConfig mqtt;
+  mqtt.server = mqtt_server;
+  return make_cell_modem_client(serial, mqtt);
+}
+
+etl::unique_ptr<CellModemClient> make_cell_modem_client(
+  arduino::HardwareSerial* serial, CellModemMQTTConfig const& mqtt
 ) {
   OK_FATAL_IF(serial == nullptr);
-  return etl::unique_ptr(new CellModemClientDef(serial, mqtt_server));
+  return etl::unique_ptr(new CellModemClientDef(serial, mqtt));
 }
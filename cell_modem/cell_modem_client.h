@@ -3,6 +3,7 @@
 
 #pragma once
 
+#include <etl/delegate.h>
 #include <etl/string.h>
 #include <memory>
 
@@ -12,15 +13,78 @@ struct CellModemStatus {
   etl::string<32> hardware;
   etl::string<32> imeisv;
   etl::string<32> versions[4];  // baseband, nordic SDK, serial app, customer
+  int registration = -1;        // +CEREG <stat> (1 = home, 5 = roaming)
+
+  int recovery_step = 0;        // Reset ladder rung last used (0 = none)
+  int flight_bounces = 0;       // CFUN=4/1 recoveries tried
+  int modem_resets = 0;         // #XMODEMRESET recoveries tried
+  int system_resets = 0;        // #XRESET recoveries tried
+  int modem_restarts = 0;       // #XMODEM: SHUTDOWN or Ready seen
+  int recoveries = 0;           // MQTT reconnects after losing the link
+  int last_recovery_millis = 0; // Downtime before the latest reconnect
+  int max_recovery_millis = 0;
+
+  bool mqtt_connected = false;
+  int mqtt_connects = 0;        // Successful #XMQTTCON (CONNACK) count
+  int mqtt_published = 0;       // Publishes fully handed to the modem
+  int mqtt_publish_acks = 0;    // PUBACKs seen (QoS 1 only)
+  int mqtt_received = 0;        // Inbound messages (#XMQTTMSG)
+  int mqtt_truncated = 0;       // Inbound messages cut at max_message_size
+  int data_rate = 0;            // Estimated modem data-mode drain, bytes/sec
+  int data_stalls = 0;          // Polls where payload writes were held back
+};
+
+struct CellModemMQTTConfig {
+  etl::string_view server;      // Broker host name
+  int port = 1883;
+  etl::string_view client_id;   // Empty to use the modem's IMEISV
+  etl::string_view user;
+  etl::string_view password;
+  int keepalive_secs = 400;
+  int max_message_size = 4096;  // Inbound payload past this is dropped
+  bool hardware_flow_control = false;  // RTS/CTS set up by the caller
 };
 
+// Part of an inbound message, passed to the handler as bytes arrive
+struct CellModemMessageChunk {
+  etl::string_view topic;   // Truncated to 128 bytes
+  etl::string_view data;    // Payload bytes [offset, offset + data.size())
+  int offset;
+  int size;                 // Whole payload size as sent by the broker
+  bool last;                // Final chunk (may end early if truncated)
+};
+
+using CellModemMessageHandler =
+  etl::delegate<void(CellModemMessageChunk const&)>;
+
 class CellModemClient {
  public:
+  static constexpr int MAX_PUBLISH_SIZE = 7680;  // Under SM data buffer (8K)
+
   virtual ~CellModemClient() = default;
   virtual CellModemStatus const& poll() = 0;
+
+  // Queues a message to send (in order) once connected to the broker.
+  // Returns false if the topic is invalid or the queue is full.
+  virtual bool publish(
+    etl::string_view topic, etl::string_view payload,
+    int qos = 0, bool retain = false
+  ) = 0;
+
+  // Adds a topic filter to subscribe to on every (re)connect.
+  virtual bool subscribe(etl::string_view filter, int qos = 0) = 0;
+
+  // Called (from poll()) with inbound payloads in chunks as they arrive,
+  // so whole messages are never buffered.
+  virtual void set_message_handler(CellModemMessageHandler) = 0;
 };
 
 etl::unique_ptr<CellModemClient> make_cell_modem_client(
   arduino::HardwareSerial* serial,
   etl::string_view mqtt_server
 );
+
+etl::unique_ptr<CellModemClient> make_cell_modem_client(
+  arduino::HardwareSerial* serial,
+  CellModemMQTTConfig const& mqtt
+);
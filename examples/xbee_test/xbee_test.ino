@@ -1,9 +1,14 @@
+#include <algorithm>
+
 #include <Arduino.h>
 
 #include <ok_little_layout.h>
 #include <ok_logging.h>
 
 #include "src/blub_station.h"
+#include "src/metrics.h"
+#include "src/task_scheduler.h"
+#include "src/trace_log.h"
 #include "src/xbee_api.h"
 #include "src/xbee_mqtt_adapter.h"
 #include "src/xbee_radio.h"
@@ -15,19 +20,30 @@ static const OkLoggingContext OK_CONTEXT("xbee_test");
 static XBeeStatusMonitor* monitor = nullptr;
 static XBeeSocketKeeper* keeper = nullptr;
 static XBeeMQTTAdapter* mqtt = nullptr;
+static int test_topic = -1;
+static int metrics_topic = -1;
+static bool metrics_due = false;
+static int trace_topic = -1;
+static int trace_left = 0;  // Trace log bytes still to publish
 
-static long last_loop_millis = 0;
+static TaskScheduler* scheduler = nullptr;
+static int xbee_task = -1;
 
-void on_message(mqtt_response_publish const& message) {
-  OK_NOTE("MQTT message %.*s", message.topic_name_size, message.topic_name);
+static void on_command(mqtt_response_publish const& message) {
+  OK_NOTE("MQTT command %.*s", message.topic_name_size, message.topic_name);
+  static char const TRACE[] = "blub/test/command/trace";
+  if (message.topic_name_size == sizeof(TRACE) - 1 &&
+      !memcmp(message.topic_name, TRACE, sizeof(TRACE) - 1)) {
+    trace_left = TRACE_LOG_SIZE;
+  }
 }
 
-void loop() {
+static bool xbee_ready() { return xbee_radio->has_pending_io(); }
+
+static void poll_xbee() {
   using namespace XBeeAPI;
   static Frame in, out;
 
-  auto const loop_millis = millis();
-
   while (xbee_radio->poll_for_frame(&in)) {
     monitor->on_incoming(in);
     keeper->on_incoming(in);
@@ -40,6 +56,34 @@ void loop() {
   while (mqtt->incoming_to_outgoing(in, xbee_radio->outgoing_space(), &out)) {
     xbee_radio->add_outgoing(out);
   }
+  if (metrics_due) {
+    int capacity = 0;
+    auto* data = mqtt->begin_publish(
+        metrics_topic, 0, xbee_radio->outgoing_space(), &out, &capacity);
+    if (data != nullptr) {  // Otherwise not connected or busy, try again
+      mqtt->commit_publish(metrics_snapshot((char*) data, capacity));
+      xbee_radio->add_outgoing(out);
+      metrics_due = false;
+    }
+  }
+
+  // Deferred log records (src/trace_log.h), raw, for
+  // other/decode_trace_log.py --raw; empty unless BLUB_LOG_DEFERRED=1
+  if (trace_left > 0) {
+    int capacity = 0;
+    auto* data = mqtt->begin_publish(
+        trace_topic, 0, xbee_radio->outgoing_space(), &out, &capacity);
+    if (data != nullptr) {  // Bounded, since sending adds records too
+      int const size = trace_log_take(data, std::min(capacity, trace_left));
+      if (size == 0) {
+        mqtt->cancel_publish();
+        trace_left = 0;
+      } else if (mqtt->commit_publish(size)) {
+        xbee_radio->add_outgoing(out);
+        trace_left -= size;
+      }
+    }
+  }
   while (monitor->maybe_make_outgoing(xbee_radio->outgoing_space(), &out)) {
     xbee_radio->add_outgoing(out);
   }
@@ -54,10 +98,15 @@ void loop() {
         nullptr, nullptr, 0,
         "blub", "blub",
         MQTT_CONNECT_CLEAN_SESSION, 400);
-    mqtt_publish(
-        mqtt->client(), "blub/test", "Hello World!", 12, MQTT_PUBLISH_QOS_1);
+    mqtt->subscribe_topics();
+    mqtt->publish(test_topic, "Hello World!", 12, MQTT_PUBLISH_QOS_1);
   }
 
+  // The UART has no TX-empty interrupt; come back as its FIFO drains
+  if (xbee_radio->has_pending_output()) scheduler->wake_within(xbee_task, 2);
+}
+
+static void update_screen() {
   auto const& st = monitor->status();
   if (!xbee_radio->raw_serial()) {
     status_layout->line_printf(1, "\f9No XBee found");
@@ -83,14 +132,24 @@ void loop() {
           st.received_power, st.received_quality, st.assoc_text());
     }
   }
+}
 
-  if (last_loop_millis > 0) {
-    auto const delay = loop_millis - last_loop_millis;
-    if (delay > 2)
-      OK_NOTE("loop time %ld ms", loop_millis - last_loop_millis);
-  }
+static void log_loop_metrics() {
+  auto const& m = scheduler->metrics();
+  OK_NOTE(
+      "loop: %lu passes, %lu wakes, %.2f%% busy, max %lu us",
+      (unsigned long) m.passes, (unsigned long) m.wakeups,
+      m.duty_cycle() * 100, (unsigned long) m.max_pass_micros);
+  scheduler->reset_metrics();
+}
 
-  last_loop_millis = loop_millis;
+static void request_metrics() {
+  metrics_due = true;
+  scheduler->wake(xbee_task);
+}
+
+void loop() {
+  scheduler->run_once();
 }
 
 void setup() {
@@ -99,5 +158,20 @@ void setup() {
   monitor = make_xbee_status_monitor();
   keeper = make_xbee_socket_keeper(
       "egnor-2020.ofb.net", 1883, XBeeAPI::SocketCreate::Protocol::TCP);
-  mqtt = make_xbee_mqtt_adapter(512, 512, on_message);
+  mqtt = make_xbee_mqtt_adapter(512, 512);
+  test_topic = mqtt->add_topic("blub/test");
+  metrics_topic = mqtt->add_topic("blub/test/metrics");
+  trace_topic = mqtt->add_topic("blub/test/trace");
+  mqtt->add_topic(
+      "blub/test/command/#",
+      XBeeMQTTAdapter::MessageHandler::create<on_command>());
+
+  using Task = TaskScheduler::Task;
+  scheduler = make_task_scheduler();
+  xbee_task = scheduler->add_ready_task(
+      Task::create<poll_xbee>(),
+      TaskScheduler::Ready::create<xbee_ready>(), 100);
+  scheduler->add_timer(Task::create<update_screen>(), 250);
+  scheduler->add_timer(Task::create<log_loop_metrics>(), 10000, 10000);
+  scheduler->add_timer(Task::create<request_metrics>(), 60000, 60000);
 }
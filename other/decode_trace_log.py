@@ -0,0 +1,139 @@
+#!/usr/bin/env python3
+
+# Decodes deferred trace log records (shared_src/trace_log.h) using the
+# firmware ELF, which holds the format strings the records point to.
+# Reads "#TRACE# <hex>" lines from serial logs, or raw records (--raw).
+
+import argparse
+import re
+import signal
+import struct
+import sys
+from pathlib import Path
+
+CONVERSION_RE = re.compile(
+    r"%([-+ #0]*)(\*|\d+)?(?:\.(\*|\d*))?(hh|h|ll|l|j|z|t|L)?([a-zA-Z%])"
+)
+
+
+class Firmware:
+    def __init__(self, path):
+        self.data = Path(path).read_bytes()
+        if self.data[:4] != b"\x7fELF" or self.data[5] != 1:
+            raise ValueError(f"{path}: not a little-endian ELF file")
+        self.wide = self.data[4] == 2  # ELF64 (a host build)
+        if self.wide:
+            header, section = "<40xQ10xHH", "<4xIQQQQ"
+        else:
+            header, section = "<32xI10xHH", "<4xIIIII"
+        shoff, shentsize, shnum = struct.unpack_from(header, self.data)
+
+        self.sections = []  # (address, offset, size)
+        for i in range(shnum):
+            type, flags, address, offset, size = struct.unpack_from(
+                section, self.data, shoff + i * shentsize
+            )
+            # Constant data only: loaded (ALLOC), not WRITE, not NOBITS
+            if type != 8 and flags & 3 == 2 and address:
+                self.sections.append((address, offset, size))
+
+    def string(self, address):
+        for start, offset, size in self.sections:
+            if start <= address < start + size:
+                at = offset + address - start
+                end = self.data.index(b"\0", at, offset + size)
+                return self.data[at:end].decode("utf-8", "replace")
+        return None
+
+
+def format_record(firmware, record):
+    when, address = struct.unpack_from("<II", record, 1)
+    format = firmware.string(address)
+    if format is None:
+        return f"{when / 1e6:12.6f} <unknown format 0x{address:08x}>"
+
+    args, at = record[9:], 0
+
+    def take(size, code):
+        nonlocal at
+        (value,) = struct.unpack_from(code, args, at)
+        at += size
+        return value
+
+    def convert(match):
+        flags, width, precision, length, conv = match.groups()
+        if conv == "%":
+            return "%"
+        if width == "*":
+            width = str(take(4, "<i"))
+        if precision == "*":
+            precision = str(take(4, "<i"))
+        spec = "%" + flags + (width or "")
+        spec += "" if precision is None else "." + (precision or "0")
+
+        if conv in "fFeEgGaA":
+            value = take(8, "<d")
+            return value.hex() if conv in "aA" else (spec + conv) % value
+        if conv in "sp":
+            pointer = take(4, "<I")
+            if conv == "p":
+                return (spec + "s") % f"0x{pointer:x}"
+            text = firmware.string(pointer)
+            text = f"<0x{pointer:08x}>" if text is None else text
+            return (spec + "s") % text
+
+        wide = length in ("ll", "j") or (
+            length in ("l", "z", "t") and firmware.wide  # 64-bit host long
+        )
+        code = "q" if wide else "i"
+        code = code if conv in "di" else code.upper()
+        value = take(8 if wide else 4, "<" + code)
+        return (spec + ("d" if conv in "iu" else conv)) % value
+
+    try:
+        message = CONVERSION_RE.sub(convert, format)
+    except (struct.error, TypeError, ValueError) as e:
+        return f"{when / 1e6:12.6f} <bad arguments for {format!r}: {e}>"
+    if at != len(args):
+        message += f" <{len(args) - at} extra argument bytes>"
+    return f"{when / 1e6:12.6f} {message}"
+
+
+def records_from_bytes(data):
+    at = 0
+    while at < len(data):
+        size = data[at]
+        if size < 9 or at + size > len(data):
+            raise ValueError(f"bad record at byte {at} (size {size})")
+        yield data[at : at + size]
+        at += size
+
+
+def records_from_log(lines):
+    for line in lines:
+        _, marker, hex = line.partition("#TRACE# ")
+        if marker:
+            yield from records_from_bytes(bytes.fromhex(hex.strip()))
+
+
+def main(args):
+    firmware = Firmware(args.elf)
+    for path in args.input or ["-"]:
+        file = sys.stdin.buffer if path == "-" else open(path, "rb")
+        with file:
+            if args.raw:
+                records = records_from_bytes(file.read())
+            else:
+                text = file.read().decode("utf-8", "replace")
+                records = records_from_log(text.splitlines())
+            for record in records:
+                print(format_record(firmware, record))
+
+
+if __name__ == "__main__":
+    signal.signal(signal.SIGINT, signal.SIG_DFL)  # sane ^C behavior
+    parser = argparse.ArgumentParser(description="Decode trace log records")
+    parser.add_argument("elf", help="Firmware .elf (as built, not .uf2)")
+    parser.add_argument("input", nargs="*", help="Logs to decode (or stdin)")
+    parser.add_argument("--raw", action="store_true", help="Binary records")
+    main(parser.parse_args())
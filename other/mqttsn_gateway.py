@@ -0,0 +1,270 @@
+#!/usr/bin/env python3
+
+# Minimal MQTT-SN (v1.2) gateway for testing xbee_mqttsn_client.
+# Routes publishes between MQTT-SN clients (and optionally an MQTT broker),
+# buffers messages for sleeping clients, and accepts QoS -1 publishes
+# to predefined topic IDs from unconnected clients.
+
+import argparse
+import asyncio
+import logging
+import signal
+import struct
+
+CONNECT, CONNACK, REGISTER, REGACK = 0x04, 0x05, 0x0A, 0x0B
+PUBLISH, PUBACK, SUBSCRIBE, SUBACK = 0x0C, 0x0D, 0x12, 0x13
+PINGREQ, PINGRESP, DISCONNECT = 0x16, 0x17, 0x18
+
+QOS_MASK, QOS_1, QOS_M1 = 0x60, 0x20, 0x60
+TOPIC_NORMAL, TOPIC_PREDEFINED, TOPIC_SHORT = 0x00, 0x01, 0x02
+ACCEPTED, INVALID_TOPIC, NOT_SUPPORTED = 0x00, 0x02, 0x03
+
+logger = logging.getLogger("mqttsn")
+
+
+def pack(type, body=b""):
+    if len(body) + 2 < 256:
+        return bytes([len(body) + 2, type]) + body
+    return struct.pack(">BHB", 1, len(body) + 4, type) + body
+
+
+def unpack(data):
+    if len(data) >= 3 and data[0] == 1:
+        length, hdr = struct.unpack(">H", data[1:3])[0], 3
+    else:
+        length, hdr = (data[0] if data else 0), 1
+    if length < hdr + 1 or length > len(data):
+        raise ValueError(f"bad length {length} ({len(data)} bytes)")
+    return data[hdr], data[hdr + 1 : length]
+
+
+def topic_matches(filter, topic):
+    f, t = filter.split("/"), topic.split("/")
+    for i, level in enumerate(f):
+        if level == "#":
+            return True
+        if i >= len(t) or level not in ("+", t[i]):
+            return False
+    return len(f) == len(t)
+
+
+class Client:
+    def __init__(self, addr, client_id):
+        self.addr = addr
+        self.client_id = client_id
+        self.topic_ids = {}  # name -> id (registered with this client)
+        self.filters = []  # (filter, qos)
+        self.asleep = False
+        self.buffered = []  # (topic, payload) held while asleep
+
+
+class Gateway(asyncio.DatagramProtocol):
+    def __init__(self, predefined={}, forward=None):
+        self.predefined = dict(predefined)  # id -> name
+        self.forward = forward  # Called as forward(topic, payload)
+        self.clients = {}  # addr -> Client
+        self.next_topic_id = 0x100
+        self.next_msg_id = 1
+        self.transport = None
+
+    def connection_made(self, transport):
+        self.transport = transport
+
+    def datagram_received(self, data, addr):
+        try:
+            type, body = unpack(data)
+        except ValueError as e:
+            logger.warning("%s: %s", addr, e)
+            return
+
+        handler = {
+            CONNECT: self.on_connect,
+            REGISTER: self.on_register,
+            REGACK: lambda *a: None,
+            PUBLISH: self.on_publish,
+            PUBACK: lambda *a: None,
+            SUBSCRIBE: self.on_subscribe,
+            PINGREQ: self.on_pingreq,
+            DISCONNECT: self.on_disconnect,
+        }.get(type)
+        if not handler:
+            logger.warning("%s: unsupported type 0x%02x", addr, type)
+        else:
+            handler(addr, body)
+
+    def send(self, addr, type, body=b""):
+        self.transport.sendto(pack(type, body), addr)
+
+    def take_msg_id(self):
+        self.next_msg_id = self.next_msg_id % 0xFFFF + 1
+        return self.next_msg_id
+
+    def topic_id(self, name):
+        for id, n in self.predefined.items():
+            if n == name:
+                return id
+        for client in self.clients.values():
+            if name in client.topic_ids:
+                return client.topic_ids[name]
+        self.next_topic_id += 1
+        return self.next_topic_id
+
+    def on_connect(self, addr, body):
+        flags, protocol, duration = struct.unpack(">BBH", body[:4])
+        client_id = body[4:].decode("utf-8", "replace")
+        old = self.clients.get(addr)
+        client = Client(addr, client_id)
+        if old and old.client_id == client_id and old.asleep:
+            client.buffered = old.buffered  # Waking up, not a new session
+            client.filters = old.filters
+        self.clients[addr] = client
+        logger.info("%s: CONNECT %r keepalive=%ds", addr, client_id, duration)
+        self.send(addr, CONNACK, bytes([ACCEPTED]))
+        self.flush_buffered(client)
+
+    def on_register(self, addr, body):
+        _, msg_id = struct.unpack(">HH", body[:4])
+        name = body[4:].decode("utf-8", "replace")
+        client = self.clients.get(addr)
+        if not client:
+            ack = struct.pack(">HHB", 0, msg_id, NOT_SUPPORTED)
+            self.send(addr, REGACK, ack)
+            return
+        id = client.topic_ids.setdefault(name, self.topic_id(name))
+        logger.info("%s: REGISTER %r => #%d", addr, name, id)
+        self.send(addr, REGACK, struct.pack(">HHB", id, msg_id, ACCEPTED))
+
+    def on_publish(self, addr, body):
+        flags, topic_id, msg_id = struct.unpack(">BHH", body[:5])
+        payload = body[5:]
+        client = self.clients.get(addr)
+        topic_type = flags & 0x03
+        if topic_type == TOPIC_SHORT:
+            name = body[1:3].decode("utf-8", "replace")
+        elif topic_type == TOPIC_PREDEFINED:
+            name = self.predefined.get(topic_id)
+        elif client:
+            names = {id: n for n, id in client.topic_ids.items()}
+            name = names.get(topic_id)
+        else:
+            name = None
+
+        qos = flags & QOS_MASK
+        if not client and qos != QOS_M1:
+            logger.warning("%s: PUBLISH without CONNECT", addr)
+            return
+        if name is None:
+            logger.warning("%s: PUBLISH to unknown topic #%d", addr, topic_id)
+            if qos == QOS_1:
+                ack = struct.pack(">HHB", topic_id, msg_id, INVALID_TOPIC)
+                self.send(addr, PUBACK, ack)
+            return
+
+        logger.info("%s: PUBLISH %r (%d bytes)", addr, name, len(payload))
+        if qos == QOS_1:
+            ack = struct.pack(">HHB", topic_id, msg_id, ACCEPTED)
+            self.send(addr, PUBACK, ack)
+        self.route(name, payload)
+        if self.forward:
+            self.forward(name, payload)
+
+    def on_subscribe(self, addr, body):
+        flags, msg_id = struct.unpack(">BH", body[:3])
+        filter = body[3:].decode("utf-8", "replace")
+        client = self.clients.get(addr)
+        if not client:
+            return
+        qos = 1 if (flags & QOS_MASK) == QOS_1 else 0
+        client.filters.append((filter, qos))
+        id = 0
+        if "+" not in filter and "#" not in filter:
+            id = client.topic_ids.setdefault(filter, self.topic_id(filter))
+        logger.info("%s: SUBSCRIBE %r (qos %d)", addr, filter, qos)
+        ack = struct.pack(">BHHB", qos << 5, id, msg_id, ACCEPTED)
+        self.send(addr, SUBACK, ack)
+
+    def on_pingreq(self, addr, body):
+        client = self.clients.get(addr)
+        if client and client.asleep:
+            count = len(client.buffered)
+            logger.info("%s: check-in (%d buffered)", addr, count)
+            self.flush_buffered(client)
+        self.send(addr, PINGRESP)
+
+    def on_disconnect(self, addr, body):
+        client = self.clients.get(addr)
+        if client and len(body) >= 2:
+            (duration,) = struct.unpack(">H", body[:2])
+            logger.info("%s: sleeping %ds", addr, duration)
+            client.asleep = True
+        elif client:
+            logger.info("%s: DISCONNECT", addr)
+            del self.clients[addr]
+        self.send(addr, DISCONNECT)
+
+    def route(self, name, payload):
+        for client in self.clients.values():
+            if any(topic_matches(f, name) for f, _ in client.filters):
+                if client.asleep:
+                    client.buffered.append((name, payload))
+                else:
+                    self.deliver(client, name, payload)
+
+    def deliver(self, client, name, payload):
+        if name not in client.topic_ids:
+            id = client.topic_ids[name] = self.topic_id(name)
+            body = struct.pack(">HH", id, self.take_msg_id()) + name.encode()
+            self.send(client.addr, REGISTER, body)
+        id = client.topic_ids[name]
+        body = struct.pack(">BHH", TOPIC_NORMAL, id, 0) + payload
+        self.send(client.addr, PUBLISH, body)
+
+    def flush_buffered(self, client):
+        buffered, client.buffered = client.buffered, []
+        for name, payload in buffered:
+            self.deliver(client, name, payload)
+
+
+def parse_predefined(arg):
+    id, _, name = arg.partition("=")
+    if not id.isdigit() or not name:
+        raise argparse.ArgumentTypeError(f"Expected ID=TOPIC: {arg}")
+    return int(id), name
+
+
+async def main(args):
+    forward = None
+    if args.forward:
+        import paho.mqtt.client  # Only needed when forwarding
+
+        api_version = paho.mqtt.client.CallbackAPIVersion.VERSION2
+        mqtt = paho.mqtt.client.Client(callback_api_version=api_version)
+        host, _, port = args.forward.rpartition(":")
+        mqtt.connect_async(host, int(port))
+        mqtt.loop_start()
+        forward = lambda topic, payload: mqtt.publish(topic, payload)
+
+    gateway = Gateway(dict(args.predefined), forward)
+    loop = asyncio.get_running_loop()
+    await loop.create_datagram_endpoint(
+        lambda: gateway, local_addr=("0.0.0.0", args.port)
+    )
+    logger.info("Listening on UDP port %d", args.port)
+    await asyncio.Event().wait()
+
+
+if __name__ == "__main__":
+    signal.signal(signal.SIGINT, signal.SIG_DFL)  # sane ^C behavior
+    logging.basicConfig(level=logging.INFO)
+    parser = argparse.ArgumentParser(description="MQTT-SN test gateway")
+    parser.add_argument("--port", type=int, default=1884, help="UDP port")
+    parser.add_argument(
+        "--predefined",
+        type=parse_predefined,
+        nargs="*",
+        default=[],
+        help="Predefined topic IDs (ID=TOPIC)",
+    )
+    parser.add_argument("--forward", help="Forward publishes to HOST:PORT")
+    args = parser.parse_args()
+    asyncio.run(main(args))
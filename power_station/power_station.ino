@@ -1,3 +1,4 @@
+#include <algorithm>
 #include <array>
 #include <cmath>
 #include <optional>
@@ -9,6 +10,8 @@
 #include <ok_logging.h>
 
 #include "src/blub_station.h"
+#include "src/task_scheduler.h"
+#include "src/trace_log.h"
 #include "src/xbee_api.h"
 #include "src/xbee_mqtt_adapter.h"
 #include "src/xbee_radio.h"
@@ -20,9 +23,20 @@ static const OkLoggingContext OK_CONTEXT("power_station");
 static XBeeStatusMonitor* xbee_monitor = nullptr;
 static XBeeSocketKeeper* socket_keeper = nullptr;
 static XBeeMQTTAdapter* mqtt = nullptr;
+static int status_topic = -1;
+static int trace_topic = -1;
+static int trace_left = 0;  // Trace log bytes still to publish
 
-static long next_mqtt_millis = 0;
-static long next_screen_millis = 0;
+static TaskScheduler* scheduler = nullptr;
+static int xbee_task = -1;
+static bool status_due = false;
+
+// Modem cyclic sleep (radio-on time dominates the power budget);
+// MQTT traffic is held for the wake windows
+static constexpr uint32_t RADIO_SLEEP_MILLIS = 60000;
+static constexpr uint32_t RADIO_WAKE_MILLIS = 10000;
+static constexpr int MQTT_KEEPALIVE_SECS = 400;
+static_assert(MQTT_KEEPALIVE_SECS * 1000 > 2 * RADIO_SLEEP_MILLIS);
 
 struct meter {
   int i2c_address;
@@ -36,8 +50,26 @@ std::array<meter, 3> meters{{
   {INA228_I2CADDR_DEFAULT + 4, "Panel"},
 }};
 
-static void on_mqtt_incoming(mqtt_response_publish const& message) {
-  OK_NOTE("MQTT incoming: %.*s", message.topic_name_size, message.topic_name);
+static bool xbee_ready() { return xbee_radio->has_pending_io(); }
+
+// Publishes deferred log records (src/trace_log.h) a frame at a time, raw,
+// for other/decode_trace_log.py --raw; empty unless BLUB_LOG_DEFERRED=1
+static void publish_trace(XBeeAPI::Frame* out) {
+  if (trace_left <= 0) return;
+  int capacity = 0;
+  auto* data = mqtt->begin_publish(
+      trace_topic, 0, xbee_radio->outgoing_space(), out, &capacity);
+  if (data == nullptr) return;  // Not connected or busy, try again
+
+  // Bounded, since sending adds records of its own
+  int const size = trace_log_take(data, std::min(capacity, trace_left));
+  if (size == 0) {
+    mqtt->cancel_publish();
+    trace_left = 0;
+    return;
+  }
+  if (mqtt->commit_publish(size)) xbee_radio->add_outgoing(*out);
+  trace_left -= size;
 }
 
 static void poll_xbee() {
@@ -49,26 +81,33 @@ static void poll_xbee() {
       xbee_radio->add_outgoing(out);
   }
 
-  in.clear();
-  while (mqtt->incoming_to_outgoing(in, xbee_radio->outgoing_space(), &out))
-    xbee_radio->add_outgoing(out);
+  // The monitor runs regardless, to probe for the modem waking up
   while (xbee_monitor->maybe_make_outgoing(xbee_radio->outgoing_space(), &out))
     xbee_radio->add_outgoing(out);
-  while (socket_keeper->maybe_make_outgoing(xbee_radio->outgoing_space(), &out))
-    xbee_radio->add_outgoing(out);
 
-  if (socket_keeper->socket() != mqtt->active_socket()) {
-    mqtt->use_socket(socket_keeper->socket());
-    mqtt_connect(
-        mqtt->client(), "BLUB Power Station",
-        nullptr, nullptr, 0,
-        "blub", "blub",
-        MQTT_CONNECT_CLEAN_SESSION, 400);
-  }
+  if (xbee_monitor->radio_awake()) {  // Socket data is lost while asleep
+    in.clear();
+    while (mqtt->incoming_to_outgoing(in, xbee_radio->outgoing_space(), &out))
+      xbee_radio->add_outgoing(out);
+    while (socket_keeper->maybe_make_outgoing(
+        xbee_radio->outgoing_space(), &out)) {
+      xbee_radio->add_outgoing(out);
+    }
+
+    if (socket_keeper->socket() != mqtt->active_socket()) {
+      mqtt->use_socket(socket_keeper->socket());
+      mqtt_connect(
+          mqtt->client(), "BLUB Power Station",
+          nullptr, nullptr, 0,
+          "blub", "blub",
+          MQTT_CONNECT_CLEAN_SESSION, MQTT_KEEPALIVE_SECS);
+    }
+    publish_trace(&out);
 
-  if (mqtt->active_socket() >= 0 && mqtt->client()->error != MQTT_OK) {
-    OK_ERROR("MQTT error: %s", mqtt_error_str(mqtt->client()->error));
-    socket_keeper->reconnect();
+    if (mqtt->check_error()) {
+      OK_ERROR("MQTT error: %s", mqtt_error_str(mqtt->client()->error));
+      socket_keeper->reconnect();
+    }
   }
 
   if ((millis() - mqtt->last_receive_millis()) > 10 * 60 * 1000) {
@@ -77,6 +116,9 @@ static void poll_xbee() {
     delay(1000);
     rp2040.reboot();
   }
+
+  // The UART has no TX-empty interrupt; come back as its FIFO drains
+  if (xbee_radio->has_pending_output()) scheduler->wake_within(xbee_task, 2);
 }
 
 static void update_screen() {
@@ -153,8 +195,10 @@ static void update_screen() {
   auto const now = millis();
   int const wait_sec = (now - mqtt->last_receive_millis()) / 1000;
   if (socket_keeper->socket() < 0) {
+    auto const health = socket_keeper->health();
     status_layout->line_printf(
-      ln++, "\f9\bSocket\b not connected (%ds)", wait_sec);
+      ln++, "\f9\bSocket\b %s (%ds)",
+      XBeeSocketKeeper::health_text(health), wait_sec);
   } else if (mqtt->active_socket() < 0) {
     status_layout->line_printf(ln++, "\f9\bMQTT\b not active (%ds)", wait_sec);
   } else if (mqtt->client()->error != MQTT_OK) {
@@ -165,14 +209,23 @@ static void update_screen() {
     status_layout->line_printf(
       ln++, "\f9\bMQTT\b connecting... (%ds)", wait_sec);
   } else {
-    auto const typ = mqtt->client()->typical_response_time;
-    status_layout->line_printf(ln++, "\f9\bMQTT\b OK ping=%.2fs", typ);
+    int const typ = mqtt->client()->typical_response_time;
+    status_layout->line_printf(ln++, "\f9\bMQTT\b OK ping=%dms", typ);
   }
 }
 
+static void request_status() { status_due = true; }
+
+static bool status_ready() {
+  return status_due && xbee_monitor->radio_awake();
+}
+
 static void update_mqtt() {
+  if (!status_ready()) return;  // Wait for the modem's next wake window
+  status_due = false;
+
   JsonDocument doc;
-  doc["uptime"] = std::round(millis() * 1e-2f) * 0.1;
+  doc["uptime"] = (time_us_64() / 100000) * 0.1;  // Doesn't wrap
 
   auto json_meters = doc["power"];
   for (auto& meter : meters) {
@@ -192,38 +245,49 @@ static void update_mqtt() {
   json_cell["tech"] = xst.technology_text();
   json_cell["RSRP"] = xst.received_power;
   json_cell["RSRQ"] = xst.received_quality;
+  json_cell["sleep"] = xst.sleep_mode_text();
+
+  auto const& loopm = scheduler->metrics();
+  auto json_loop = doc["loop"];
+  json_loop["duty"] = std::round(loopm.duty_cycle() * 1000) * 0.1;  // %
+  json_loop["max_ms"] = std::round(loopm.max_pass_micros * 0.1) * 0.01;
+  json_loop["wakes"] = loopm.wakeups;
+  scheduler->reset_metrics();  // Report each interval separately
+
+  auto const& sockm = socket_keeper->metrics();
+  auto json_socket = doc["socket"];
+  json_socket["tries"] = sockm.attempts;
+  json_socket["OK"] = sockm.successes;
+  json_socket["ms"] = sockm.typical_connect_millis;
+  using FailureClass = XBeeSocketKeeper::FailureClass;
+  for (int fc = 0; fc < XBeeSocketKeeper::FAILURE_CLASSES; ++fc) {
+    if (sockm.failures[fc] == 0) continue;
+    auto const fc_text = XBeeSocketKeeper::failure_text(FailureClass(fc));
+    json_socket["fail"][fc_text] = sockm.failures[fc];
+  }
 
-  char message[512];
-  auto const size = serializeJson(doc, message, sizeof(message) - 1);
-  mqtt_publish(
-      mqtt->client(), "blub/power_station",
-      message, size, MQTT_PUBLISH_QOS_1);
+  // Serialize straight into an outgoing frame if possible, else via MQTT-C
+  static XBeeAPI::Frame frame;
+  int capacity = 0;
+  auto* payload = mqtt->begin_publish(
+      status_topic, 1, xbee_radio->outgoing_space(), &frame, &capacity);
+  int const size = measureJson(doc);
+  if (payload && size < capacity) {  // Room for the NUL too
+    serializeJson(doc, reinterpret_cast<char*>(payload), capacity);
+    if (mqtt->commit_publish(size)) xbee_radio->add_outgoing(frame);
+  } else {
+    mqtt->cancel_publish();  // If begun; MQTT-C takes it from here
+    char message[512];
+    auto const size = serializeJson(doc, message, sizeof(message) - 1);
+    mqtt->publish(status_topic, message, size, MQTT_PUBLISH_QOS_1);
+  }
+  trace_left = TRACE_LOG_SIZE;  // Then the trace log, if any
+  scheduler->wake(xbee_task);  // Send it now, not at the next poll
 }
 
 void loop() {
   rp2040.wdt_reset();
-  poll_xbee();
-
-  int const now = millis();
-  if (now >= next_screen_millis) {
-    next_screen_millis += 500;
-    update_screen();
-  }
-
-  if (now >= next_mqtt_millis) {
-    next_mqtt_millis += 30000;
-    update_mqtt();
-  }
-
-  // Reboot before millis rollover
-  if (now > 0x7FFFFFFF - 1000) {
-    OK_NOTE("Rebooting before millis rollover!");
-    status_layout->line_printf(0, "\f9\bROLLOVER - REBOOTING");
-    delay(1000);
-    rp2040.reboot();
-  }
-
-  delay(1);
+  scheduler->run_once(1000);  // Runs due tasks, then idles until the next
 }
 
 void setup() {
@@ -248,11 +312,35 @@ void setup() {
     rp2040.reboot();
   }
 
-  xbee_monitor = make_xbee_status_monitor();
+  // Statically allocated, to keep the heap unfragmented over long uptimes
+  // (blub_station_init() allocates only the radio, screen and UART FIFO)
+  static XBeeStatusMonitorStorage monitor_storage;
+  static XBeeSocketKeeperStorage keeper_storage;
+  static XBeeMQTTAdapterStorage mqtt_storage;
+  static uint8_t mqtt_tx[512], mqtt_rx[512];
+  xbee_monitor = make_xbee_status_monitor(&monitor_storage);
   socket_keeper = make_xbee_socket_keeper(
+      &keeper_storage,
       "egnor-2020.ofb.net", 1883, XBeeAPI::SocketCreate::Protocol::TCP);
-  mqtt = make_xbee_mqtt_adapter(512, 512, on_mqtt_incoming);
+  mqtt = make_xbee_mqtt_adapter(
+      &mqtt_storage, mqtt_tx, sizeof(mqtt_tx), mqtt_rx, sizeof(mqtt_rx));
+  status_topic = mqtt->add_topic("blub/power_station");
+  trace_topic = mqtt->add_topic("blub/power_station/trace");
+
+  using Task = TaskScheduler::Task;
+  static TaskSchedulerStorage scheduler_storage;
+  scheduler = make_task_scheduler(&scheduler_storage);
+  xbee_task = scheduler->add_ready_task(
+      Task::create<poll_xbee>(),
+      TaskScheduler::Ready::create<xbee_ready>(), 100);
+  scheduler->add_timer(Task::create<update_screen>(), 500);
+  scheduler->add_timer(Task::create<request_status>(), 30000);
+  scheduler->add_ready_task(
+      Task::create<update_mqtt>(),
+      TaskScheduler::Ready::create<status_ready>(), 1000);
+
+  xbee_monitor->configure_sleep(
+      XBeeStatusMonitor::CYCLIC_SLEEP, RADIO_SLEEP_MILLIS, RADIO_WAKE_MILLIS);
 
-  next_mqtt_millis = next_screen_millis = millis();
   rp2040.wdt_begin(5000);  // 5 second on-chip hardware watchdog (pet in loop())
 }
@@ -90,17 +90,22 @@ uint16_t __mqtt_next_pid(struct mqtt_client *client) {
     /* LFSR taps taken from: https://en.wikipedia.org/wiki/Linear-feedback_shift_register */
     
     do {
-        struct mqtt_queued_message *curr;
+        static const enum MQTTControlPacketType types[] = {
+            MQTT_CONTROL_PUBLISH, MQTT_CONTROL_PUBACK, MQTT_CONTROL_PUBREC,
+            MQTT_CONTROL_PUBREL, MQTT_CONTROL_PUBCOMP, MQTT_CONTROL_SUBSCRIBE,
+            MQTT_CONTROL_UNSUBSCRIBE
+        };
+        size_t t;
         unsigned lsb = client->pid_lfsr & 1;
         (client->pid_lfsr) >>= 1;
         if (lsb) {
             client->pid_lfsr ^= 0xB400u;
         }
 
-        /* check that the PID is unique */
+        /* check that the PID is unique (by index lookup per control type) */
         pid_exists = 0;
-        for(curr = mqtt_mq_get(&(client->mq), 0); curr >= client->mq.queue_tail; --curr) {
-            if (curr->packet_id == client->pid_lfsr) {
+        for(t = 0; t < sizeof(types) / sizeof(types[0]); ++t) {
+            if (mqtt_mq_find(&client->mq, types[t], &client->pid_lfsr) != NULL) {
                 pid_exists = 1;
                 break;
             }
@@ -137,7 +142,7 @@ enum MQTTErrors mqtt_init(struct mqtt_client *client,
     client->response_timeout = 30;
     client->number_of_timeouts = 0;
     client->number_of_keep_alives = 0;
-    client->typical_response_time = -1.0f;
+    client->typical_response_time = -1;
     client->publish_response_callback = publish_response_callback;
     client->pid_lfsr = 0;
     client->send_offset = 0;
@@ -170,7 +175,7 @@ void mqtt_init_reconnect(struct mqtt_client *client,
     client->response_timeout = 30;
     client->number_of_timeouts = 0;
     client->number_of_keep_alives = 0;
-    client->typical_response_time = -1.0f;
+    client->typical_response_time = -1;
     client->publish_response_callback = publish_response_callback;
     client->pid_lfsr = 0;
     client->send_offset = 0;
@@ -302,6 +307,42 @@ enum MQTTErrors mqtt_publish(struct mqtt_client *client,
     return MQTT_OK;
 }
 
+enum MQTTErrors mqtt_publish_encoded(struct mqtt_client *client,
+                                     const uint8_t* encoded_topic,
+                                     size_t encoded_topic_size,
+                                     const void* application_message,
+                                     size_t application_message_size,
+                                     uint8_t publish_flags)
+{
+    struct mqtt_queued_message *msg;
+    ssize_t rv;
+    uint16_t packet_id;
+    MQTT_PAL_MUTEX_LOCK(&client->mutex);
+    packet_id = __mqtt_next_pid(client);
+
+
+    /* try to pack the message */
+    MQTT_CLIENT_TRY_PACK(
+        rv, msg, client, 
+        mqtt_pack_publish_request_encoded(
+            client->mq.curr, client->mq.curr_sz,
+            encoded_topic,
+            encoded_topic_size,
+            packet_id,
+            application_message,
+            application_message_size,
+            publish_flags
+        ), 
+        1
+    );
+    /* save the control type and packet id of the message */
+    msg->control_type = MQTT_CONTROL_PUBLISH;
+    msg->packet_id = packet_id;
+
+    MQTT_PAL_MUTEX_UNLOCK(&client->mutex);
+    return MQTT_OK;
+}
+
 ssize_t __mqtt_puback(struct mqtt_client *client, uint16_t packet_id) {
     ssize_t rv;
     struct mqtt_queued_message *msg;
@@ -504,12 +545,39 @@ enum MQTTErrors mqtt_disconnect(struct mqtt_client *client)
     return MQTT_OK;
 }
 
+/* PAL time since a timestamp, valid across counter wraparound */
+static int32_t __mqtt_elapsed(mqtt_pal_time_t since)
+{
+    return (int32_t) (MQTT_PAL_TIME() - since);
+}
+
+/* exponential average (weight 1/8) in integer PAL time units */
+static void __mqtt_update_response_time(struct mqtt_client *client, const struct mqtt_queued_message *msg)
+{
+    int32_t elapsed = __mqtt_elapsed(msg->time_sent);
+    if (client->typical_response_time < 0) {
+        client->typical_response_time = elapsed;
+    } else {
+        client->typical_response_time = (7 * client->typical_response_time + elapsed) / 8;
+    }
+}
+
+/* track the earliest ack deadline so idle __mqtt_send calls can skip the scan */
+static void __mqtt_note_timeout(struct mqtt_message_queue *mq, mqtt_pal_time_t deadline)
+{
+    if (!mq->timeout_pending || (int32_t) (deadline - mq->next_timeout) < 0) {
+        mq->next_timeout = deadline;
+        mq->timeout_pending = 1;
+    }
+}
+
 ssize_t __mqtt_send(struct mqtt_client *client) 
 {
     uint8_t inspected;
-    ssize_t len;
     int inflight_qos2 = 0;
-    int i = 0;
+    struct mqtt_queued_message *msg;
+    struct mqtt_message_queue *mq = &client->mq;
+    const int32_t timeout = client->response_timeout * MQTT_PAL_TIME_PER_SEC;
     
     MQTT_PAL_MUTEX_LOCK(&client->mutex);
     
@@ -518,17 +586,25 @@ ssize_t __mqtt_send(struct mqtt_client *client)
         return client->error;
     }
 
+    /* skip the scan if nothing is unsent, partly sent, or due for resend */
+    if (mq->unsent == 0 && client->send_offset == 0 &&
+        (!mq->timeout_pending || __mqtt_elapsed(mq->next_timeout) <= 0)) {
+        msg = NULL;
+    } else {
+        msg = mq->head;
+        mq->timeout_pending = 0;
+    }
+
     /* loop through all messages in the queue */
-    len = mqtt_mq_length(&client->mq);
-    for(; i < len; ++i) {
-        struct mqtt_queued_message *msg = mqtt_mq_get(&client->mq, i);
+    for(; msg != NULL; msg = mqtt_mq_next(mq, msg)) {
         int resend = 0;
+        const int was_unsent = (msg->state == MQTT_QUEUED_UNSENT);
         if (msg->state == MQTT_QUEUED_UNSENT) {
             /* message has not been sent to lets send it */
             resend = 1;
         } else if (msg->state == MQTT_QUEUED_AWAITING_ACK) {
             /* check for timeout */
-            if (MQTT_PAL_TIME() > msg->time_sent + client->response_timeout) {
+            if (__mqtt_elapsed(msg->time_sent) > timeout) {
                 resend = 1;
                 client->number_of_timeouts += 1;
                 client->send_offset = 0;
@@ -550,6 +626,9 @@ ssize_t __mqtt_send(struct mqtt_client *client)
 
         /* goto next message if we don't need to send */
         if (!resend) {
+            if (msg->state == MQTT_QUEUED_AWAITING_ACK) {
+                __mqtt_note_timeout(mq, msg->time_sent + timeout);
+            }
             continue;
         }
 
@@ -627,12 +706,18 @@ ssize_t __mqtt_send(struct mqtt_client *client)
             MQTT_PAL_MUTEX_UNLOCK(&client->mutex);
             return MQTT_ERROR_MALFORMED_REQUEST;
         }
+
+        if (was_unsent) {
+            --mq->unsent;
+        }
+        if (msg->state == MQTT_QUEUED_AWAITING_ACK) {
+            __mqtt_note_timeout(mq, msg->time_sent + timeout);
+        }
     }
 
     /* check for keep-alive */
     {
-        mqtt_pal_time_t keep_alive_timeout = client->time_of_last_send + (mqtt_pal_time_t)((float)(client->keep_alive));
-        if (MQTT_PAL_TIME() > keep_alive_timeout) {
+        if (__mqtt_elapsed(client->time_of_last_send) > (int32_t)client->keep_alive * MQTT_PAL_TIME_PER_SEC) {
           ssize_t rv = __mqtt_ping(client);
           if (rv != MQTT_OK) {
             client->error = (enum MQTTErrors)rv;
@@ -646,6 +731,36 @@ ssize_t __mqtt_send(struct mqtt_client *client)
     return MQTT_OK;
 }
 
+enum MQTTErrors mqtt_track_sent_publish(struct mqtt_client *client,
+                                        const uint8_t *packet,
+                                        size_t size,
+                                        uint16_t packet_id)
+{
+    struct mqtt_queued_message *msg;
+    MQTT_PAL_MUTEX_LOCK(&client->mutex);
+    if (client->mq.curr_sz < size) {
+        mqtt_mq_clean(&client->mq);
+        if (client->mq.curr_sz < size) {
+            MQTT_PAL_MUTEX_UNLOCK(&client->mutex);
+            return MQTT_ERROR_SEND_BUFFER_IS_FULL;
+        }
+    }
+
+    memcpy(client->mq.curr, packet, size);
+    client->mq.curr[0] |= MQTT_PUBLISH_DUP;  /* any resend is a duplicate */
+    msg = mqtt_mq_register(&client->mq, size);
+    msg->control_type = MQTT_CONTROL_PUBLISH;
+    msg->packet_id = packet_id;
+    msg->state = MQTT_QUEUED_AWAITING_ACK;
+    --client->mq.unsent;
+
+    client->time_of_last_send = MQTT_PAL_TIME();
+    msg->time_sent = client->time_of_last_send;
+    __mqtt_note_timeout(&client->mq, msg->time_sent + client->response_timeout * MQTT_PAL_TIME_PER_SEC);
+    MQTT_PAL_MUTEX_UNLOCK(&client->mutex);
+    return MQTT_OK;
+}
+
 ssize_t __mqtt_recv(struct mqtt_client *client)
 {
     struct mqtt_response response;
@@ -730,7 +845,7 @@ ssize_t __mqtt_recv(struct mqtt_client *client)
                 }
                 msg->state = MQTT_QUEUED_COMPLETE;
                 /* initialize typical response time */
-                client->typical_response_time = (float) (MQTT_PAL_TIME() - msg->time_sent);
+                client->typical_response_time = __mqtt_elapsed(msg->time_sent);
                 /* check that connection was successful */
                 if (response.decoded.connack.return_code != MQTT_CONNACK_ACCEPTED) {
                     if (response.decoded.connack.return_code == MQTT_CONNACK_REFUSED_IDENTIFIER_REJECTED) {
@@ -778,7 +893,7 @@ ssize_t __mqtt_recv(struct mqtt_client *client)
                 }
                 msg->state = MQTT_QUEUED_COMPLETE;
                 /* update response time */
-                client->typical_response_time = 0.875f * (client->typical_response_time) + 0.125f * (float) (MQTT_PAL_TIME() - msg->time_sent);
+                __mqtt_update_response_time(client, msg);
                 break;
             case MQTT_CONTROL_PUBREC:
                 /* check if this is a duplicate */
@@ -794,7 +909,7 @@ ssize_t __mqtt_recv(struct mqtt_client *client)
                 }
                 msg->state = MQTT_QUEUED_COMPLETE;
                 /* update response time */
-                client->typical_response_time = 0.875f * (client->typical_response_time) + 0.125f * (float) (MQTT_PAL_TIME() - msg->time_sent);
+                __mqtt_update_response_time(client, msg);
                 /* stage PUBREL */
                 rv = __mqtt_pubrel(client, response.decoded.pubrec.packet_id);
                 if (rv != MQTT_OK) {
@@ -813,7 +928,7 @@ ssize_t __mqtt_recv(struct mqtt_client *client)
                 }
                 msg->state = MQTT_QUEUED_COMPLETE;
                 /* update response time */
-                client->typical_response_time = 0.875f * (client->typical_response_time) + 0.125f * (float) (MQTT_PAL_TIME() - msg->time_sent);
+                __mqtt_update_response_time(client, msg);
                 /* stage PUBCOMP */
                 rv = __mqtt_pubcomp(client, response.decoded.pubrec.packet_id);
                 if (rv != MQTT_OK) {
@@ -832,7 +947,7 @@ ssize_t __mqtt_recv(struct mqtt_client *client)
                 }
                 msg->state = MQTT_QUEUED_COMPLETE;
                 /* update response time */
-                client->typical_response_time = 0.875f * (client->typical_response_time) + 0.125f * (float) (MQTT_PAL_TIME() - msg->time_sent);
+                __mqtt_update_response_time(client, msg);
                 break;
             case MQTT_CONTROL_SUBACK:
                 /* release associated SUBSCRIBE */
@@ -844,7 +959,7 @@ ssize_t __mqtt_recv(struct mqtt_client *client)
                 }
                 msg->state = MQTT_QUEUED_COMPLETE;
                 /* update response time */
-                client->typical_response_time = 0.875f * (client->typical_response_time) + 0.125f * (float) (MQTT_PAL_TIME() - msg->time_sent);
+                __mqtt_update_response_time(client, msg);
                 /* check that subscription was successful (not currently only one subscribe at a time) */
                 if (response.decoded.suback.return_codes[0] == MQTT_SUBACK_FAILURE) {
                     client->error = MQTT_ERROR_SUBSCRIBE_FAILED;
@@ -862,7 +977,7 @@ ssize_t __mqtt_recv(struct mqtt_client *client)
                 }
                 msg->state = MQTT_QUEUED_COMPLETE;
                 /* update response time */
-                client->typical_response_time = 0.875f * (client->typical_response_time) + 0.125f * (float) (MQTT_PAL_TIME() - msg->time_sent);
+                __mqtt_update_response_time(client, msg);
                 break;
             case MQTT_CONTROL_PINGRESP:
                 /* release associated PINGREQ */
@@ -874,7 +989,7 @@ ssize_t __mqtt_recv(struct mqtt_client *client)
                 }
                 msg->state = MQTT_QUEUED_COMPLETE;
                 /* update response time */
-                client->typical_response_time = 0.875f * (client->typical_response_time) + 0.125f * (float) (MQTT_PAL_TIME() - msg->time_sent);
+                __mqtt_update_response_time(client, msg);
                 break;
             default:
                 client->error = MQTT_ERROR_MALFORMED_RESPONSE;
@@ -1270,8 +1385,11 @@ ssize_t mqtt_pack_ping_request(uint8_t *buf, size_t bufsz) {
 }
 
 /* PUBLISH */
-ssize_t mqtt_pack_publish_request(uint8_t *buf, size_t bufsz,
+/* packs with either topic_name or a pre-encoded (length-prefixed) topic */
+static ssize_t __mqtt_pack_publish(uint8_t *buf, size_t bufsz,
                                   const char* topic_name,
+                                  const uint8_t* encoded_topic,
+                                  size_t encoded_topic_size,
                                   uint16_t packet_id,
                                   const void* application_message,
                                   size_t application_message_size,
@@ -1284,7 +1402,7 @@ ssize_t mqtt_pack_publish_request(uint8_t *buf, size_t bufsz,
     uint8_t inspected_qos;
 
     /* check for null pointers */
-    if(buf == NULL || topic_name == NULL) {
+    if(buf == NULL || (topic_name == NULL && encoded_topic == NULL)) {
         return MQTT_ERROR_NULLPTR;
     }
 
@@ -1295,7 +1413,11 @@ ssize_t mqtt_pack_publish_request(uint8_t *buf, size_t bufsz,
     fixed_header.control_type = MQTT_CONTROL_PUBLISH;
 
     /* calculate remaining length */
-    remaining_length = (uint32_t)__mqtt_packed_cstrlen(topic_name);
+    if (encoded_topic != NULL) {
+        remaining_length = (uint32_t)encoded_topic_size;
+    } else {
+        remaining_length = (uint32_t)__mqtt_packed_cstrlen(topic_name);
+    }
     if (inspected_qos > 0) {
         remaining_length += 2;
     }
@@ -1328,7 +1450,12 @@ ssize_t mqtt_pack_publish_request(uint8_t *buf, size_t bufsz,
     }
 
     /* pack variable header */
-    buf += __mqtt_pack_str(buf, topic_name);
+    if (encoded_topic != NULL) {
+        memcpy(buf, encoded_topic, encoded_topic_size);
+        buf += encoded_topic_size;
+    } else {
+        buf += __mqtt_pack_str(buf, topic_name);
+    }
     if (inspected_qos > 0) {
         buf += __mqtt_pack_uint16(buf, packet_id);
     }
@@ -1340,6 +1467,31 @@ ssize_t mqtt_pack_publish_request(uint8_t *buf, size_t bufsz,
     return buf - start;
 }
 
+ssize_t mqtt_pack_publish_request(uint8_t *buf, size_t bufsz,
+                                  const char* topic_name,
+                                  uint16_t packet_id,
+                                  const void* application_message,
+                                  size_t application_message_size,
+                                  uint8_t publish_flags)
+{
+    return __mqtt_pack_publish(buf, bufsz, topic_name, NULL, 0, packet_id,
+                               application_message, application_message_size,
+                               publish_flags);
+}
+
+ssize_t mqtt_pack_publish_request_encoded(uint8_t *buf, size_t bufsz,
+                                          const uint8_t* encoded_topic,
+                                          size_t encoded_topic_size,
+                                          uint16_t packet_id,
+                                          const void* application_message,
+                                          size_t application_message_size,
+                                          uint8_t publish_flags)
+{
+    return __mqtt_pack_publish(buf, bufsz, NULL, encoded_topic, encoded_topic_size,
+                               packet_id, application_message,
+                               application_message_size, publish_flags);
+}
+
 ssize_t mqtt_unpack_publish_response(struct mqtt_response *mqtt_response, const uint8_t *buf)
 {    
     const uint8_t *const start = buf;
@@ -1613,80 +1765,221 @@ ssize_t mqtt_pack_unsubscribe_request(uint8_t *buf, size_t bufsz, unsigned int p
 }
 
 /* MESSAGE QUEUE */
+
+/* records (header + packet) start on pointer-aligned addresses */
+#define MQTT_MQ_ALIGN_DOWN(p) ((uint8_t*) ((uintptr_t) (p) & ~(uintptr_t) (sizeof(void*) - 1)))
+#define MQTT_MQ_ALIGN_UP(p) MQTT_MQ_ALIGN_DOWN((uint8_t*) (p) + sizeof(void*) - 1)
+
+static uint8_t* __mqtt_mq_record_end(const struct mqtt_queued_message *msg)
+{
+    return MQTT_MQ_ALIGN_UP(msg->start + msg->size);
+}
+
+/* recompute curr/curr_sz, wrapping when there's more room at the start */
+static void __mqtt_mq_update_curr(struct mqtt_message_queue *mq)
+{
+    uint8_t *next, *end;
+    const size_t header = sizeof(struct mqtt_queued_message);
+
+    if (mq->mem_start == NULL) {
+        mq->curr = NULL;
+        mq->curr_sz = 0;
+        return;
+    }
+
+    if (mq->tail == NULL) {
+        next = (uint8_t*) mq->mem_start;
+        end = (uint8_t*) mq->mem_end;
+    } else {
+        next = __mqtt_mq_record_end(mq->tail);
+        if (mq->wrap != NULL) {
+            if (next == mq->wrap) next = (uint8_t*) mq->mem_start;
+            end = (uint8_t*) mq->head;
+        } else if ((uint8_t*) mq->mem_end - next < (uint8_t*) mq->head - (uint8_t*) mq->mem_start) {
+            mq->wrap = next;
+            next = (uint8_t*) mq->mem_start;
+            end = (uint8_t*) mq->head;
+        } else {
+            end = (uint8_t*) mq->mem_end;
+        }
+    }
+
+    mq->curr = next + header;
+    mq->curr_sz = (size_t) (end - next) > header ? (size_t) (end - next) - header : 0;
+}
+
+static int __mqtt_mq_indexed_type(const struct mqtt_queued_message *msg)
+{
+    switch (msg->control_type) {
+    case MQTT_CONTROL_PUBLISH:
+        return (msg->start[0] & MQTT_PUBLISH_QOS_MASK) != 0;  /* QoS 0 has no ID */
+    case MQTT_CONTROL_PUBACK:
+    case MQTT_CONTROL_PUBREC:
+    case MQTT_CONTROL_PUBREL:
+    case MQTT_CONTROL_PUBCOMP:
+    case MQTT_CONTROL_SUBSCRIBE:
+    case MQTT_CONTROL_UNSUBSCRIBE:
+        return 1;
+    default:
+        return 0;
+    }
+}
+
+static size_t __mqtt_mq_slot(enum MQTTControlPacketType control_type, uint16_t packet_id)
+{
+    return ((size_t) packet_id * 31u + (size_t) control_type) & (MQTT_MQ_INDEX_SIZE - 1);
+}
+
+static void __mqtt_mq_index_add(struct mqtt_message_queue *mq, struct mqtt_queued_message *msg)
+{
+    size_t slot = __mqtt_mq_slot(msg->control_type, msg->packet_id);
+    size_t probes = 0;
+    for (; probes < MQTT_MQ_INDEX_SIZE; ++probes) {
+        if (mq->index[slot] == NULL) {
+            mq->index[slot] = msg;
+            return;
+        }
+        slot = (slot + 1) & (MQTT_MQ_INDEX_SIZE - 1);
+    }
+    mq->index_overflow = 1;
+}
+
+/* linear probing deletion: shift later entries back into the gap */
+static void __mqtt_mq_index_remove(struct mqtt_message_queue *mq, const struct mqtt_queued_message *msg)
+{
+    size_t gap = __mqtt_mq_slot(msg->control_type, msg->packet_id);
+    size_t probes = 0, i;
+    while (mq->index[gap] != msg) {
+        if (mq->index[gap] == NULL || ++probes == MQTT_MQ_INDEX_SIZE) return;
+        gap = (gap + 1) & (MQTT_MQ_INDEX_SIZE - 1);
+    }
+
+    mq->index[gap] = NULL;
+    for (i = (gap + 1) & (MQTT_MQ_INDEX_SIZE - 1); mq->index[i] != NULL; i = (i + 1) & (MQTT_MQ_INDEX_SIZE - 1)) {
+        const struct mqtt_queued_message *other = mq->index[i];
+        size_t home = __mqtt_mq_slot(other->control_type, other->packet_id);
+        /* move it if its home slot is not cyclically within (gap, i] */
+        if (((i - home) & (MQTT_MQ_INDEX_SIZE - 1)) >= ((i - gap) & (MQTT_MQ_INDEX_SIZE - 1))) {
+            mq->index[gap] = mq->index[i];
+            mq->index[i] = NULL;
+            gap = i;
+        }
+    }
+}
+
+/* packet IDs are assigned after mqtt_mq_register, so index lazily */
+static void __mqtt_mq_index_sync(struct mqtt_message_queue *mq)
+{
+    for (; mq->unindexed != NULL; mq->unindexed = mqtt_mq_next(mq, mq->unindexed)) {
+        if (__mqtt_mq_indexed_type(mq->unindexed)) {
+            __mqtt_mq_index_add(mq, mq->unindexed);
+        }
+    }
+}
+
 void mqtt_mq_init(struct mqtt_message_queue *mq, void *buf, size_t bufsz) 
 {  
-    mq->mem_start = buf;
-    mq->mem_end = (uint8_t *)buf + bufsz;
-    mq->curr = (uint8_t *)buf;
-    mq->queue_tail = (struct mqtt_queued_message *)mq->mem_end;
-    mq->curr_sz = buf == NULL ? 0 : mqtt_mq_currsz(mq);
+    size_t i;
+    if (buf == NULL) {
+        mq->mem_start = mq->mem_end = NULL;
+    } else {
+        mq->mem_start = MQTT_MQ_ALIGN_UP(buf);
+        mq->mem_end = MQTT_MQ_ALIGN_DOWN((uint8_t *)buf + bufsz);
+        if (mq->mem_end < mq->mem_start) mq->mem_end = mq->mem_start;
+    }
+    mq->head = mq->tail = mq->unindexed = NULL;
+    mq->wrap = NULL;
+    mq->length = mq->unsent = 0;
+    mq->timeout_pending = 0;
+    mq->index_overflow = 0;
+    for (i = 0; i < MQTT_MQ_INDEX_SIZE; ++i) mq->index[i] = NULL;
+    __mqtt_mq_update_curr(mq);
 }
 
 struct mqtt_queued_message* mqtt_mq_register(struct mqtt_message_queue *mq, size_t nbytes)
 {
-    /* make queued message header */
-    --(mq->queue_tail);
-    mq->queue_tail->start = mq->curr;
-    mq->queue_tail->size = nbytes;
-    mq->queue_tail->state = MQTT_QUEUED_UNSENT;
+    /* make queued message header, just before the packed bytes */
+    struct mqtt_queued_message *msg = ((struct mqtt_queued_message*) mq->curr) - 1;
+    msg->start = mq->curr;
+    msg->size = nbytes;
+    msg->state = MQTT_QUEUED_UNSENT;
+    msg->packet_id = 0;
+
+    if (mq->head == NULL) mq->head = msg;
+    if (mq->unindexed == NULL) mq->unindexed = msg;
+    mq->tail = msg;
+    ++mq->length;
+    ++mq->unsent;
 
     /* move curr and recalculate curr_sz */
-    mq->curr += nbytes;
-    mq->curr_sz = (size_t) (mqtt_mq_currsz(mq));
-
-    return mq->queue_tail;
+    __mqtt_mq_update_curr(mq);
+    return msg;
 }
 
 void mqtt_mq_clean(struct mqtt_message_queue *mq) {
-    struct mqtt_queued_message *new_head;
-
-    for(new_head = mqtt_mq_get(mq, 0); new_head >= mq->queue_tail; --new_head) {
-        if (new_head->state != MQTT_QUEUED_COMPLETE) break;
-    }
-    
-    /* check if everything can be removed */
-    if (new_head < mq->queue_tail) {
-        mq->curr = (uint8_t *)mq->mem_start;
-        mq->queue_tail = (struct mqtt_queued_message *)mq->mem_end;
-        mq->curr_sz = (size_t) (mqtt_mq_currsz(mq));
-        return;
-    } else if (new_head == mqtt_mq_get(mq, 0)) {
-        /* do nothing */
-        return;
-    }
+    while (mq->head != NULL && mq->head->state == MQTT_QUEUED_COMPLETE) {
+        struct mqtt_queued_message *done = mq->head;
+        if (done == mq->unindexed) {
+            mq->unindexed = mqtt_mq_next(mq, done);
+        } else if (__mqtt_mq_indexed_type(done)) {
+            __mqtt_mq_index_remove(mq, done);
+        }
 
-    /* move buffered data */
-    {
-        size_t n = (size_t) (mq->curr - new_head->start);
-        size_t removing = (size_t) (new_head->start - (uint8_t*) mq->mem_start);
-        memmove(mq->mem_start, new_head->start, n);
-        mq->curr = (unsigned char*)mq->mem_start + n;
-      
+        --mq->length;
+        if (done == mq->tail) {
+            /* everything can be removed; start over at the front */
+            mqtt_mq_init(mq, mq->mem_start, (size_t) ((uint8_t*) mq->mem_end - (uint8_t*) mq->mem_start));
+            return;
+        }
 
-        /* move queue */
-        {
-            ssize_t new_tail_idx = new_head - mq->queue_tail;
-            memmove(mqtt_mq_get(mq, new_tail_idx), mq->queue_tail, sizeof(struct mqtt_queued_message) * (size_t) ((new_tail_idx + 1)));
-            mq->queue_tail = mqtt_mq_get(mq, new_tail_idx);
-          
-            {
-                /* bump back start's */
-                ssize_t i = 0;
-                for(; i < new_tail_idx + 1; ++i) {
-                    mqtt_mq_get(mq, i)->start -= removing;
-                }
-            }
+        mq->head = mqtt_mq_next(mq, done);
+        if ((uint8_t*) mq->head == (uint8_t*) mq->mem_start) {
+            mq->wrap = NULL;
         }
     }
 
     /* get curr_sz */
-    mq->curr_sz = (size_t) (mqtt_mq_currsz(mq));
+    __mqtt_mq_update_curr(mq);
+}
+
+struct mqtt_queued_message* mqtt_mq_next(const struct mqtt_message_queue *mq, const struct mqtt_queued_message *msg)
+{
+    uint8_t *next;
+    if (msg == mq->tail) return NULL;
+    next = __mqtt_mq_record_end(msg);
+    if (next == mq->wrap) next = (uint8_t*) mq->mem_start;
+    return (struct mqtt_queued_message*) next;
 }
 
-struct mqtt_queued_message* mqtt_mq_find(const struct mqtt_message_queue *mq, enum MQTTControlPacketType control_type, const uint16_t *packet_id)
+struct mqtt_queued_message* mqtt_mq_get(const struct mqtt_message_queue *mq, size_t index)
+{
+    struct mqtt_queued_message *curr = mq->head;
+    for (; curr != NULL && index > 0; --index) {
+        curr = mqtt_mq_next(mq, curr);
+    }
+    return curr;
+}
+
+struct mqtt_queued_message* mqtt_mq_find(struct mqtt_message_queue *mq, enum MQTTControlPacketType control_type, const uint16_t *packet_id)
 {
     struct mqtt_queued_message *curr;
-    for(curr = mqtt_mq_get(mq, 0); curr >= mq->queue_tail; --curr) {
+    if (packet_id != NULL) {
+        __mqtt_mq_index_sync(mq);
+        if (!mq->index_overflow) {
+            size_t slot = __mqtt_mq_slot(control_type, *packet_id);
+            size_t probes = 0;
+            for (; probes < MQTT_MQ_INDEX_SIZE && mq->index[slot] != NULL; ++probes) {
+                curr = mq->index[slot];
+                if (curr->control_type == control_type && curr->packet_id == *packet_id) {
+                    return curr;
+                }
+                slot = (slot + 1) & (MQTT_MQ_INDEX_SIZE - 1);
+            }
+            return NULL;
+        }
+    }
+
+    for(curr = mq->head; curr != NULL; curr = mqtt_mq_next(mq, curr)) {
         if (curr->control_type == control_type) {
             if ((packet_id == NULL && curr->state != MQTT_QUEUED_COMPLETE) ||
                 (packet_id != NULL && *packet_id == curr->packet_id)) {
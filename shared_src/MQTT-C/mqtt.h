@@ -779,6 +779,22 @@ ssize_t mqtt_pack_publish_request(uint8_t *buf, size_t bufsz,
                                   size_t application_message_size,
                                   uint8_t publish_flags);
 
+/**
+ * @brief Like mqtt_pack_publish_request, with a pre-encoded topic.
+ * @ingroup packers
+ *
+ * @param[in] encoded_topic The topic as packed in a PUBLISH: a 2-byte
+ *            big-endian length, then the name (no terminator).
+ * @param[in] encoded_topic_size The size of \p encoded_topic in bytes.
+ */
+ssize_t mqtt_pack_publish_request_encoded(uint8_t *buf, size_t bufsz,
+                                          const uint8_t* encoded_topic,
+                                          size_t encoded_topic_size,
+                                          uint16_t packet_id,
+                                          const void* application_message,
+                                          size_t application_message_size,
+                                          uint8_t publish_flags);
+
 /**
  * @brief Serialize a PUBACK, PUBREC, PUBREL, or PUBCOMP packet and put it in \p buf.
  * @ingroup packers
@@ -960,12 +976,29 @@ struct mqtt_queued_message {
     uint16_t packet_id;
 };
 
+#ifndef MQTT_MQ_INDEX_SIZE
+/**
+ * @brief Slots in the message queue's packet ID index (a power of two).
+ * @ingroup details
+ *
+ * @note If more messages with packet IDs are queued than this, lookups fall
+ *       back to scanning the queue until it empties.
+ */
+#define MQTT_MQ_INDEX_SIZE 16
+#endif
+
 /**
  * @brief A message queue.
  * @ingroup details
  * 
  * @note This struct is used internally to manage sending messages.
  * @note The only members the user should use are \c curr and \c curr_sz. 
+ *
+ * Messages are kept in a ring: each is a mqtt_queued_message header followed
+ * by the packed bytes. Completed messages are released from the head without
+ * moving anything, and the ring wraps to the start of the buffer when there
+ * is more room there than at the end. Messages with packet IDs are indexed
+ * for constant-time acknowledgement lookup.
  */
 struct mqtt_message_queue {
     /** 
@@ -990,18 +1023,38 @@ struct mqtt_message_queue {
      * @brief The number of bytes that can be written to \c curr.
      * 
      * @note curr_sz will decrease by more than the number of bytes you write to 
-     *       \c curr. This is because the mqtt_queued_message structs share the 
-     *       same memory (and thus, a mqtt_queued_message must be allocated in 
-     *       the message queue's memory whenever a new message is registered).  
+     *       \c curr. This is because each message is preceded by its
+     *       mqtt_queued_message header in the same memory.
      */
     size_t curr_sz;
-    
-    /**
-     * @brief The tail of the array of mqtt_queued_messages's.
-     * 
-     * @note This member should not be used manually.
-     */
-    struct mqtt_queued_message *queue_tail;
+
+    /** @brief The oldest message, or \c NULL if the queue is empty. */
+    struct mqtt_queued_message *head;
+
+    /** @brief The newest message, or \c NULL if the queue is empty. */
+    struct mqtt_queued_message *tail;
+
+    /** @brief Where messages stop before continuing at \c mem_start, or \c NULL. */
+    uint8_t *wrap;
+
+    /** @brief The number of messages in the queue. */
+    size_t length;
+
+    /** @brief The number of messages in the MQTT_QUEUED_UNSENT state. */
+    size_t unsent;
+
+    /** @brief Earliest ack timeout, if \c timeout_pending (see __mqtt_send). */
+    mqtt_pal_time_t next_timeout;
+    int timeout_pending;
+
+    /** @brief The oldest message not yet in \c index, or \c NULL. */
+    struct mqtt_queued_message *unindexed;
+
+    /** @brief Set if \c index ran out of slots (cleared when the queue empties). */
+    int index_overflow;
+
+    /** @brief Open-addressed table of messages by (control type, packet ID). */
+    struct mqtt_queued_message *index[MQTT_MQ_INDEX_SIZE];
 };
 
 /**
@@ -1058,30 +1111,32 @@ struct mqtt_queued_message* mqtt_mq_register(struct mqtt_message_queue *mq, size
  * @relates mqtt_message_queue
  * @returns The found message. \c NULL if the message was not found.
  */
-struct mqtt_queued_message* mqtt_mq_find(const struct mqtt_message_queue *mq, enum MQTTControlPacketType control_type, const uint16_t *packet_id);
+struct mqtt_queued_message* mqtt_mq_find(struct mqtt_message_queue *mq, enum MQTTControlPacketType control_type, const uint16_t *packet_id);
+
+/**
+ * @brief Returns the message after \p msg (oldest to newest), or \c NULL.
+ * @ingroup details
+ */
+struct mqtt_queued_message* mqtt_mq_next(const struct mqtt_message_queue *mq, const struct mqtt_queued_message *msg);
 
 /**
- * @brief Returns the mqtt_queued_message at \p index.
+ * @brief Returns the mqtt_queued_message at \p index (0 is the oldest).
  * @ingroup details
  * 
- * @param mq_ptr A pointer to the message queue.
+ * @param mq The message queue.
  * @param index The index of the message. 
  *
+ * @note This walks the queue; iterate with mqtt_mq_next where possible.
+ *
  * @returns The mqtt_queued_message at \p index.
  */
-#define mqtt_mq_get(mq_ptr, index) (((struct mqtt_queued_message*) ((mq_ptr)->mem_end)) - 1 - index)
+struct mqtt_queued_message* mqtt_mq_get(const struct mqtt_message_queue *mq, size_t index);
 
 /**
  * @brief Returns the number of messages in the message queue, \p mq_ptr.
  * @ingroup details
  */
-#define mqtt_mq_length(mq_ptr) (((struct mqtt_queued_message*) ((mq_ptr)->mem_end)) - (mq_ptr)->queue_tail)
-
-/**
- * @brief Used internally to recalculate the \c curr_sz.
- * @ingroup details
- */
-#define mqtt_mq_currsz(mq_ptr) (((mq_ptr)->curr >= (uint8_t*) ((mq_ptr)->queue_tail - 1)) ? 0 : ((uint8_t*) ((mq_ptr)->queue_tail - 1)) - (mq_ptr)->curr)
+#define mqtt_mq_length(mq_ptr) ((mq_ptr)->length)
 
 /* CLIENT */
 
@@ -1150,9 +1205,10 @@ struct mqtt_client {
      * @brief Approximately much time it has typically taken to receive responses from the 
      *        broker.
      * 
-     * @note This is tracked using a exponential-averaging.
+     * @note This is tracked using a exponential-averaging, in PAL time units
+     *       (milliseconds here); -1 until the first response.
      */
-    float typical_response_time;
+    int32_t typical_response_time;
 
     /**
      * @brief The callback that is called whenever a publish is received from the broker.
@@ -1491,6 +1547,44 @@ enum MQTTErrors mqtt_publish(struct mqtt_client *client,
                              size_t application_message_size,
                              uint8_t publish_flags);
 
+/**
+ * @brief Publish with a topic encoded ahead of time.
+ * @ingroup api
+ * 
+ * Same as mqtt_publish, but the topic is already in wire format (a 2-byte
+ * big-endian length, then the name), so it isn't measured and re-encoded
+ * for every message.
+ * 
+ * @returns \c MQTT_OK upon success, an \ref MQTTErrors otherwise.
+ */
+enum MQTTErrors mqtt_publish_encoded(struct mqtt_client *client,
+                                     const uint8_t* encoded_topic,
+                                     size_t encoded_topic_size,
+                                     const void* application_message,
+                                     size_t application_message_size,
+                                     uint8_t publish_flags);
+
+/**
+ * @brief Track a QoS 1 PUBLISH the application sent by itself.
+ * @ingroup api
+ * 
+ * For transports that serialize publishes directly (bypassing mqtt_publish),
+ * this queues a copy of the already-sent packet as awaiting its PUBACK, so it
+ * is retransmitted (with the DUP flag) on timeout like any other.
+ * 
+ * @param[in,out] client The MQTT client.
+ * @param[in] packet The complete PUBLISH packet as sent.
+ * @param[in] size The size of \p packet in bytes.
+ * @param[in] packet_id The packet ID used (from __mqtt_next_pid).
+ * 
+ * @returns \c MQTT_OK upon success, \c MQTT_ERROR_SEND_BUFFER_IS_FULL if there
+ *          is no room for the copy.
+ */
+enum MQTTErrors mqtt_track_sent_publish(struct mqtt_client *client,
+                                        const uint8_t *packet,
+                                        size_t size,
+                                        uint16_t packet_id);
+
 /**
  * @brief Acknowledge an ingree publish with QOS==1.
  * @ingroup details
@@ -11,24 +11,29 @@
 #include <stddef.h>
 #include <stdint.h>
 #include <string.h>
+#include <sys/types.h>  // ssize_t
 
 #if defined(__cplusplus)
 extern "C" {
 #endif
 
 typedef void *mqtt_pal_socket_handle;
-typedef int ssize_t;
 
 ssize_t mqtt_pal_sendall(mqtt_pal_socket_handle, void const*, size_t, int fl);
 ssize_t mqtt_pal_recvall(mqtt_pal_socket_handle, void*, size_t, int fl);
 
-typedef struct {} mqtt_pal_mutex_t;  // Dummy (single threaded)
+// Dummy (single threaded), but not empty: C and C++ size empty structs
+// differently, which would shift mqtt_client fields between mqtt.c and C++
+typedef struct { char unused; } mqtt_pal_mutex_t;
 static void MQTT_PAL_MUTEX_INIT(mqtt_pal_mutex_t*) {}
 static void MQTT_PAL_MUTEX_LOCK(mqtt_pal_mutex_t*) {}
 static void MQTT_PAL_MUTEX_UNLOCK(mqtt_pal_mutex_t*) {}
 
-typedef float mqtt_pal_time_t;
+// Integer milliseconds (no soft-float on M0+); wraps after ~49 days,
+// so mqtt.c only ever compares differences (see __mqtt_elapsed)
+typedef uint32_t mqtt_pal_time_t;
 mqtt_pal_time_t MQTT_PAL_TIME(void);
+#define MQTT_PAL_TIME_PER_SEC 1000
 
 static uint16_t MQTT_PAL_HTONS(uint16_t x) { return (x >> 8) | (x << 8); }
 static uint16_t MQTT_PAL_NTOHS(uint16_t x) { return MQTT_PAL_HTONS(x); }
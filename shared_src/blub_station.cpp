@@ -33,6 +33,8 @@ class DummyXBee : public XBeeRadio {
     virtual int outgoing_space() const override { return 0; }
     virtual void add_outgoing(XBeeAPI::Frame const&) override {}
     virtual bool poll_for_frame(XBeeAPI::Frame*) override { return false; }
+    virtual bool has_pending_io() const override { return false; }
+    virtual bool has_pending_output() const override { return false; }
     virtual HardwareSerial* raw_serial() const override { return nullptr; }
 };
 
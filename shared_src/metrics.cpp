@@ -0,0 +1,94 @@
+#include "metrics.h"
+
+#include <stdarg.h>
+#include <stdio.h>
+
+#include <Arduino.h>
+#include <ok_logging.h>
+
+static const OkLoggingContext OK_CONTEXT("metrics");
+
+// Constant-initialized, so they're set before any metric's constructor runs
+static MetricsCounter const* first_counter = nullptr;
+static MetricsHistogram const* first_histogram = nullptr;
+
+MetricsCounter::MetricsCounter(char const* name)
+  : name(name), next(first_counter) { first_counter = this; }
+
+MetricsHistogram::MetricsHistogram(char const* name)
+  : name(name), next(first_histogram) { first_histogram = this; }
+
+MetricsCounter const* metrics_counters() { return first_counter; }
+MetricsHistogram const* metrics_histograms() { return first_histogram; }
+
+namespace {
+
+// Appends to a buffer, keeping room for the closing brace; a metric that
+// doesn't fit is rolled back whole
+struct Writer {
+  char* buf;
+  int size;
+  int length = 0;
+  bool full = false;
+
+  bool append(char const* format, ...) {
+    if (full) return false;
+    va_list args;
+    va_start(args, format);
+    int const n = vsnprintf(buf + length, size - 1 - length, format, args);
+    va_end(args);
+    if (n < 0 || length + n >= size - 1) {
+      full = true;
+      return false;
+    }
+    length += n;
+    return true;
+  }
+};
+
+}  // namespace
+
+int metrics_snapshot(char* buf, int size) {
+  if (size < 3) return 0;
+  Writer out{buf, size};
+  char const* comma = ",";  // Before every entry but the first
+  if (!out.append("{\"ms\":%lu", (unsigned long) millis())) {
+    out.length = 0;
+    out.full = false;
+    out.append("{");
+    comma = "";
+  }
+
+  for (auto const* c = first_counter; c != nullptr; c = c->next) {
+    int const start = out.length;
+    if (out.append("%s\"%s\":%lu", comma, c->name, (unsigned long) c->value)) {
+      comma = ",";
+    } else {
+      out.length = start;
+    }
+  }
+
+  for (auto const* h = first_histogram; h != nullptr; h = h->next) {
+    int used = MetricsHistogram::BUCKETS;
+    while (used > 0 && h->buckets[used - 1] == 0) --used;
+
+    int const start = out.length;
+    out.append(
+        "%s\"%s\":{\"n\":%lu,\"sum\":%llu,\"max\":%lu,\"b\":[",
+        comma, h->name, (unsigned long) h->count, (unsigned long long) h->sum,
+        (unsigned long) h->max);
+    for (int b = 0; b < used; ++b) {
+      out.append(b ? ",%lu" : "%lu", (unsigned long) h->buckets[b]);
+    }
+    if (out.append("]}")) {
+      comma = ",";
+    } else {
+      out.length = start;
+    }
+  }
+
+  if (out.full) OK_ERROR("Snapshot truncated (%d bytes)", size);
+  buf[out.length++] = '}';
+  buf[out.length] = '\0';
+  return out.length;
+}
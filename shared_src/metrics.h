@@ -0,0 +1,56 @@
+// Counters and latency histograms for hot paths, to see how firmware
+// performs in the field. Metrics are file-scope statics that register
+// themselves at startup (no heap); recording is O(1). Values only grow,
+// so a receiver diffs successive snapshots (and lost ones cost nothing).
+
+#pragma once
+
+#include <stdint.h>
+
+// A monotonic event or byte count
+class MetricsCounter {
+ public:
+  explicit MetricsCounter(char const* name);  // Static string, e.g. "x.y"
+  MetricsCounter(MetricsCounter const&) = delete;
+
+  void add(uint32_t n = 1) { value += n; }
+
+  char const* const name;
+  uint32_t value = 0;
+  MetricsCounter const* const next;  // Registration order, newest first
+};
+
+// Counts recorded values in log2 buckets: [0] holds 0, [b] holds
+// 2^(b-1) .. 2^b-1, and the last bucket everything above. The unit is
+// the caller's (name it, e.g. "loop.pass_us").
+class MetricsHistogram {
+ public:
+  static constexpr int BUCKETS = 20;
+
+  explicit MetricsHistogram(char const* name);
+  MetricsHistogram(MetricsHistogram const&) = delete;
+
+  void record(uint32_t v) {
+    int const b = v ? 32 - __builtin_clz(v) : 0;
+    ++buckets[b < BUCKETS ? b : BUCKETS - 1];
+    ++count;
+    sum += v;
+    if (v > max) max = v;
+  }
+
+  char const* const name;
+  uint32_t count = 0;
+  uint64_t sum = 0;
+  uint32_t max = 0;
+  uint32_t buckets[BUCKETS] = {};
+  MetricsHistogram const* const next;  // Registration order, newest first
+};
+
+MetricsCounter const* metrics_counters();  // List heads, or nullptr
+MetricsHistogram const* metrics_histograms();
+
+// Writes every metric as compact JSON (for a metrics topic) and returns its
+// length, like {"ms":123,"x.y":4,"loop.pass_us":{"n":2,"sum":9,"max":8,
+// "b":[0,1,0,0,1]}} (trailing empty buckets omitted). If the buffer is
+// too small, the metrics that fit are written and the JSON still closes.
+int metrics_snapshot(char* buf, int size);
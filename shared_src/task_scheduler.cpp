@@ -0,0 +1,148 @@
+#include "task_scheduler.h"
+
+#include <new>
+
+#include <Arduino.h>
+#include <ok_logging.h>
+#include <pico/time.h>
+
+#include "metrics.h"
+
+static const OkLoggingContext OK_CONTEXT("task_scheduler");
+
+static MetricsHistogram pass_histogram("loop.pass_us");  // Passes that ran
+
+class TaskSchedulerDef : public TaskScheduler {
+ public:
+  virtual int add_timer(
+      Task task, uint32_t period_millis, uint32_t delay_millis) override {
+    return add(task, Ready(), period_millis, delay_millis);
+  }
+
+  virtual int add_ready_task(
+      Task task, Ready ready, uint32_t poll_millis) override {
+    return add(task, ready, poll_millis, 0);
+  }
+
+  virtual void wake(int task) override {
+    OK_FATAL_IF(task < 0 || task >= task_count);
+    tasks[task].woken = true;
+  }
+
+  virtual void wake_within(int task, uint32_t delay_millis) override {
+    OK_FATAL_IF(task < 0 || task >= task_count);
+    auto* t = &tasks[task];
+    uint32_t const at = millis() + delay_millis;
+    if (long(at - t->next_millis) < 0) t->next_millis = at;
+  }
+
+  virtual void run_once(uint32_t max_idle_millis) override {
+    uint32_t const pass_start = micros();
+    uint32_t const now = millis();
+    bool ran = false;
+    for (int i = 0; i < task_count; ++i) {
+      auto* t = &tasks[i];
+      bool const timed = long(now - t->next_millis) >= 0;
+      if (!timed && !t->woken && !(t->ready.is_valid() && t->ready())) {
+        continue;
+      }
+
+      t->woken = false;
+      if (t->ready.is_valid()) {
+        t->next_millis = now + t->period_millis;  // Poll relative to run
+      } else if (timed) {
+        t->next_millis += t->period_millis;  // Keep cadence steady
+        if (long(now - t->next_millis) >= 0) {
+          t->next_millis = now + t->period_millis;  // Far behind, skip
+        }
+      }
+
+      t->task();
+      ++stats.runs;
+      ran = true;
+    }
+
+    uint32_t const idle_start = micros();
+    uint32_t const pass_micros = idle_start - pass_start;
+    if (ran) {
+      ++stats.passes;
+      stats.busy_micros += pass_micros;
+      pass_histogram.record(pass_micros);
+      if (pass_micros > stats.max_pass_micros) {
+        stats.max_pass_micros = pass_micros;
+      }
+    }
+
+    uint32_t deadline = now + max_idle_millis;
+    for (int i = 0; i < task_count; ++i) {
+      if (long(tasks[i].next_millis - deadline) < 0) {
+        deadline = tasks[i].next_millis;
+      }
+    }
+
+    // Sleep (WFE) until the deadline or any interrupt, such as UART receive.
+    // An interrupt between the readiness check and WFE sets the event flag,
+    // so WFE returns immediately and no wakeup is lost. Dormant mode would
+    // stop the UART clock and drop incoming bytes, so it isn't used.
+    while (!any_ready()) {
+      long const remaining = long(deadline - millis());
+      if (remaining <= 0) break;
+      auto const until = make_timeout_time_ms(remaining);
+      if (!best_effort_wfe_or_timeout(until)) ++stats.wakeups;
+    }
+    stats.idle_micros += micros() - idle_start;
+  }
+
+  virtual Metrics const& metrics() const override { return stats; }
+  virtual void reset_metrics() override { stats = {}; }
+
+ private:
+  struct Entry {
+    Task task;
+    Ready ready;
+    uint32_t period_millis = 0;
+    uint32_t next_millis = 0;
+    bool woken = false;
+  };
+
+  Entry tasks[MAX_TASKS];
+  int task_count = 0;
+  Metrics stats;
+
+  int add(Task task, Ready ready, uint32_t period, uint32_t delay) {
+    if (task_count >= MAX_TASKS) {
+      OK_ERROR("Too many tasks (max %d)", MAX_TASKS);
+      return -1;
+    }
+
+    OK_FATAL_IF(!task.is_valid() || period == 0);
+    auto* t = &tasks[task_count];
+    t->task = task;
+    t->ready = ready;
+    t->period_millis = period;
+    t->next_millis = millis() + delay;
+    return task_count++;
+  }
+
+  bool any_ready() const {
+    for (int i = 0; i < task_count; ++i) {
+      auto const& t = tasks[i];
+      if (t.woken || (t.ready.is_valid() && t.ready())) return true;
+    }
+    return false;
+  }
+};
+
+float TaskScheduler::Metrics::duty_cycle() const {
+  uint64_t const total = busy_micros + idle_micros;
+  return total ? float(busy_micros) / total : 0.0f;
+}
+
+TaskScheduler* make_task_scheduler() {
+  return new TaskSchedulerDef();
+}
+
+TaskScheduler* make_task_scheduler(TaskSchedulerStorage* mem) {
+  static_assert(sizeof(TaskSchedulerDef) <= sizeof(*mem));
+  return new (mem->bytes) TaskSchedulerDef();
+}
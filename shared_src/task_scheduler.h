@@ -0,0 +1,62 @@
+// Cooperative main-loop scheduler: periodic timers, plus tasks that run
+// when a cheap readiness check passes (UART data waiting, etc).
+// Between passes the CPU sleeps (WFE) until the next deadline or an
+// interrupt, instead of spinning through every component on each loop().
+
+#pragma once
+
+#include <stdint.h>
+
+#include <etl/delegate.h>
+
+class TaskScheduler {
+ public:
+  using Task = etl::delegate<void()>;
+  using Ready = etl::delegate<bool()>;
+  static constexpr int MAX_TASKS = 16;
+
+  struct Metrics {
+    uint32_t passes = 0;           // Scheduler passes that ran something
+    uint32_t runs = 0;             // Individual task invocations
+    uint64_t busy_micros = 0;      // Time spent in tasks
+    uint64_t idle_micros = 0;      // Time spent waiting for work
+    uint32_t max_pass_micros = 0;  // Longest single pass
+    uint32_t wakeups = 0;          // Times idle sleep was interrupted
+
+    float duty_cycle() const;      // busy / (busy + idle), 0 if no data
+  };
+
+  virtual ~TaskScheduler() = default;
+
+  // Runs `task` every `period_millis`, first after `delay_millis`.
+  // Returns a task ID (or -1 if MAX_TASKS is exceeded).
+  virtual int add_timer(
+      Task, uint32_t period_millis, uint32_t delay_millis = 0) = 0;
+
+  // Runs `task` whenever `ready` returns true, and at least every
+  // `poll_millis` (for timeouts inside the task). `ready` is checked
+  // every pass and while idle, so it must be fast and side-effect free.
+  virtual int add_ready_task(Task, Ready, uint32_t poll_millis) = 0;
+
+  // Makes a task run on the next pass, regardless of timer or readiness
+  // (e.g. after queueing data that the task should send).
+  virtual void wake(int task) = 0;
+
+  // Makes a task run within `delay_millis`, if not due sooner (e.g. to
+  // refill a UART transmit FIFO, which has no interrupt to wake the idle).
+  virtual void wake_within(int task, uint32_t delay_millis) = 0;
+
+  // Runs tasks that are due, then idles until another one is due,
+  // for at most `max_idle_millis` (so the caller can pet a watchdog).
+  virtual void run_once(uint32_t max_idle_millis = 1000) = 0;
+
+  virtual Metrics const& metrics() const = 0;
+  virtual void reset_metrics() = 0;
+};
+
+TaskScheduler* make_task_scheduler();
+
+// Caller-provided space (e.g. a static) to make a scheduler without the
+// heap; destroy with ~TaskScheduler(), not delete.
+struct TaskSchedulerStorage { alignas(8) uint8_t bytes[1024]; };
+TaskScheduler* make_task_scheduler(TaskSchedulerStorage*);
@@ -0,0 +1,52 @@
+#include "trace_log.h"
+
+#include <Arduino.h>
+
+#include "metrics.h"
+
+static MetricsCounter dropped("trace.dropped");  // Records overwritten
+
+namespace trace_log_internal {
+
+uint8_t ring[TRACE_LOG_SIZE];
+uint32_t head = 0, tail = 0;
+
+void make_room(int size) {
+  while (TRACE_LOG_SIZE - (head - tail) < uint32_t(size)) {
+    tail += ring[tail & MASK];
+    dropped.add();
+  }
+}
+
+uint32_t now_micros() { return micros(); }
+
+}  // namespace trace_log_internal
+
+using namespace trace_log_internal;
+
+int trace_log_take(uint8_t* buf, int size) {
+  int taken = 0;
+  while (tail != head) {
+    int const record_size = ring[tail & MASK];
+    if (taken + record_size > size) break;
+    for (int i = 0; i < record_size; ++i) buf[taken++] = ring[tail++ & MASK];
+  }
+  return taken;
+}
+
+void trace_log_dump(Print* out) {
+  static char const DIGITS[] = "0123456789abcdef";
+  static char const PREFIX[] = "#TRACE# ";
+  uint8_t record[255];
+  char line[sizeof(PREFIX) + 2 * sizeof(record) + 1];
+  while (int const size = trace_log_take(record, ring[tail & MASK])) {
+    memcpy(line, PREFIX, sizeof(PREFIX) - 1);
+    int length = sizeof(PREFIX) - 1;
+    for (int i = 0; i < size; ++i) {
+      line[length++] = DIGITS[record[i] >> 4];
+      line[length++] = DIGITS[record[i] & 0xF];
+    }
+    line[length++] = '\n';
+    out->write(reinterpret_cast<uint8_t const*>(line), length);
+  }
+}
@@ -0,0 +1,154 @@
+// Cheaper OK Logging for hot paths. Include after <ok_logging.h> (in .cpp
+// files only); build flags then change what OK_DETAIL and OK_NOTE cost:
+//
+// - BLUB_LOG_MIN_LEVEL=1 (or 2) compiles OK_DETAIL (and OK_NOTE) away
+//   entirely; arguments are type-checked but never evaluated.
+// - BLUB_LOG_DEFERRED=1 makes OK_DETAIL append the format string's address
+//   and raw arguments to a RAM ring instead of formatting: a micros() read
+//   and a fixed-size copy per field (byte by byte if the record wraps).
+//   trace_log_dump() prints the ring as "#TRACE#" hex lines, and
+//   other/decode_trace_log.py formats them using the firmware ELF.
+//
+// For arduino-cli, pass e.g.
+//   --build-property compiler.cpp.extra_flags=-DBLUB_LOG_DEFERRED=1
+
+#pragma once
+
+#include <stdint.h>
+#include <string.h>
+
+#include <type_traits>
+
+#include <ok_logging.h>
+
+#ifndef BLUB_LOG_MIN_LEVEL
+#define BLUB_LOG_MIN_LEVEL 0  // 0 = DETAIL, 1 = NOTE, 2 = ERROR
+#endif
+
+#ifndef BLUB_LOG_DEFERRED
+#define BLUB_LOG_DEFERRED 0
+#endif
+
+#ifndef TRACE_LOG_SIZE
+#define TRACE_LOG_SIZE 4096  // Ring bytes, a power of 2
+#endif
+
+namespace arduino { class Print; }
+
+// Record format: <size:u8> <micros:u32> <format address:u32> <args...>,
+// little-endian. Integers and pointers take 4 bytes (8 if 64-bit), and
+// floating point 8 (as double). %s strings are recorded by address, so
+// only constant strings decode; others print as their address.
+#define TRACE_LOG(...) ({  \
+    if (false) trace_log_check(__VA_ARGS__);  \
+    trace_log_record(__VA_ARGS__);  \
+  })
+
+// Type-checks the message as printf would, then discards it
+#define TRACE_LOG_DISCARD(...) ({  \
+    if (false) trace_log_check(__VA_ARGS__);  \
+  })
+
+#if BLUB_LOG_MIN_LEVEL > 0
+#undef OK_DETAIL
+#define OK_DETAIL(...) TRACE_LOG_DISCARD(__VA_ARGS__)
+#elif BLUB_LOG_DEFERRED
+#undef OK_DETAIL
+#define OK_DETAIL(...) TRACE_LOG(__VA_ARGS__)
+#endif
+
+#if BLUB_LOG_MIN_LEVEL > 1
+#undef OK_NOTE
+#define OK_NOTE(...) TRACE_LOG_DISCARD(__VA_ARGS__)
+#endif
+
+// Copies out (and removes) whole records, oldest first; returns the bytes
+// taken (0 if empty or the first record doesn't fit)
+int trace_log_take(uint8_t* buf, int size);
+
+// Takes every record and prints it as "#TRACE# <hex>"
+void trace_log_dump(arduino::Print*);
+
+inline void trace_log_check(char const* format, ...)
+    __attribute__((format(printf, 1, 2)));
+inline void trace_log_check(char const*, ...) {}
+
+namespace trace_log_internal {
+
+static constexpr uint32_t MASK = TRACE_LOG_SIZE - 1;
+static_assert((TRACE_LOG_SIZE & MASK) == 0, "TRACE_LOG_SIZE not a power of 2");
+
+extern uint8_t ring[TRACE_LOG_SIZE];
+extern uint32_t head, tail;  // Free-running; head - tail bytes in use
+
+void make_room(int size);  // Drops the oldest records
+uint32_t now_micros();
+
+// Into the ring at a free-running index, wrapping byte by byte
+inline void put(uint32_t* at, void const* data, int size) {
+  auto const* bytes = static_cast<uint8_t const*>(data);
+  for (int i = 0; i < size; ++i) ring[(*at)++ & MASK] = bytes[i];
+}
+
+// Into a span known not to wrap
+inline void put(uint8_t** at, void const* data, int size) {
+  memcpy(*at, data, size);  // Constant size, so inlined
+  *at += size;
+}
+
+template <typename T>
+constexpr int arg_size() {
+  if constexpr (std::is_floating_point_v<T>) return sizeof(double);
+  if constexpr (std::is_integral_v<T> || std::is_enum_v<T>)
+    return sizeof(T) > 4 ? 8 : 4;
+  return 4;  // Pointer
+}
+
+template <typename At, typename T>
+inline void put_arg(At* at, T arg) {
+  if constexpr (std::is_floating_point_v<T>) {
+    double const v = arg;
+    put(at, &v, sizeof(v));
+  } else if constexpr (std::is_integral_v<T> || std::is_enum_v<T>) {
+    if constexpr (sizeof(T) > 4) {
+      uint64_t const v = static_cast<uint64_t>(arg);
+      put(at, &v, sizeof(v));
+    } else {
+      uint32_t const v = static_cast<uint32_t>(arg);  // Sign-extends
+      put(at, &v, sizeof(v));
+    }
+  } else {
+    uint32_t const v = (uint32_t) (uintptr_t) arg;
+    put(at, &v, sizeof(v));
+  }
+}
+
+template <typename At, typename... Args>
+inline void put_record(At* at, uint8_t size, char const* format, Args... args) {
+  uint32_t const when = now_micros();
+  uint32_t const address = (uint32_t) (uintptr_t) format;
+  put(at, &size, 1);
+  put(at, &when, 4);
+  put(at, &address, 4);
+  (put_arg(at, args), ...);
+}
+
+}  // namespace trace_log_internal
+
+template <typename... Args>
+inline void trace_log_record(char const* format, Args... args) {
+  using namespace trace_log_internal;
+  constexpr int size = 9 + (0 + ... + arg_size<Args>());
+  static_assert(size <= 255, "Too many trace log arguments");
+
+  if (TRACE_LOG_SIZE - (head - tail) < uint32_t(size)) make_room(size);
+  uint32_t const start = head & MASK;
+  if (start + size <= TRACE_LOG_SIZE) {
+    uint8_t* at = ring + start;
+    put_record(&at, size, format, args...);
+  } else {
+    uint32_t at = head;
+    put_record(&at, size, format, args...);
+  }
+  head += size;
+}
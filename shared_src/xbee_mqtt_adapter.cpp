@@ -1,35 +1,104 @@
 #include "xbee_mqtt_adapter.h"
 
 #include <algorithm>
+#include <array>
+#include <new>
 
 #include <Arduino.h>
 #include <ok_logging.h>
 
 #include "MQTT-C/mqtt_pal.h"
+#include "metrics.h"
+#include "trace_log.h"
 
 static const OkLoggingContext OK_CONTEXT("xbee_mqtt_adapter");
 
+static MetricsCounter bytes_in("mqtt.bytes_in");
+static MetricsCounter bytes_out("mqtt.bytes_out");  // Incl. resends
+static MetricsCounter publishes("mqtt.publishes");
+static MetricsCounter publishes_dropped("mqtt.publishes_dropped");
+static MetricsCounter transmit_errors("mqtt.transmit_errors");
+static MetricsHistogram ack_millis("mqtt.ack_ms");  // SocketSend to status
+
 using namespace XBeeAPI;
 
+// One SocketSend is kept in flight (and copied) until its TransmitStatus,
+// so a transient XBee error can be retried without breaking the TCP (or
+// TLS) stream; tearing down means a new handshake over cellular.
+// Zero-copy publishes are whole MQTT packets, so those are just dropped.
+static constexpr unsigned long TRANSMIT_TIMEOUT_MILLIS = 10 * 1000;
+static constexpr int TRANSMIT_RETRIES = 3;
+
+static constexpr int TOPIC_SLOTS = 2 * XBeeMQTTAdapter::MAX_TOPICS;
+
+static uint32_t topic_hash(char const* name, int size) {
+  uint32_t hash = 2166136261u;  // FNV-1a
+  for (int i = 0; i < size; ++i) hash = (hash ^ uint8_t(name[i])) * 16777619u;
+  return hash;
+}
+
+static bool has_wildcard(char const* name, int size) {
+  return memchr(name, '+', size) || memchr(name, '#', size);
+}
+
+static bool filter_matches(char const* f, int fsize, char const* t, int tsize) {
+  if (tsize > 0 && t[0] == '$' && fsize > 0 && (f[0] == '+' || f[0] == '#'))
+    return false;  // $SYS etc. don't match leading wildcards
+
+  int fi = 0, ti = 0;
+  while (fi < fsize) {
+    if (f[fi] == '#') return true;
+    if (ti == tsize && fsize - fi == 2 && f[fi] == '/' && f[fi + 1] == '#')
+      return true;  // "a/#" matches "a" too
+    if (f[fi] == '+') {
+      while (ti < tsize && t[ti] != '/') ++ti;
+      ++fi;
+    } else {
+      if (ti >= tsize || f[fi] != t[ti]) return false;
+      ++fi;
+      ++ti;
+    }
+  }
+  return ti == tsize;
+}
+
+static int varint_size(int value) {
+  return value < 0x80 ? 1 : value < 0x4000 ? 2 : value < 0x200000 ? 3 : 4;
+}
+
+static bool is_transient_transmit_error(uint8_t status) {
+  switch (status) {
+    case 0x21:  // NETWORK_FAILURE
+    case 0x31:  // INTERNAL_ERROR
+    case 0x32:  // RESOURCE_ERROR
+      return true;
+    default:
+      return false;
+  }
+}
+
 extern "C" { static void on_message(void**, struct mqtt_response_publish*); }
 
 class XBeeMQTTAdapterDef : public XBeeMQTTAdapter {
  public:
-  XBeeMQTTAdapterDef(
-      int tx_size, int rx_size,
-      std::function<void(mqtt_response_publish const&)> const& on_message) {
+  XBeeMQTTAdapterDef(uint8_t* tx, int tx_size, uint8_t* rx, int rx_size) {
     OK_NOTE("Starting: tx=%d, rx=%d", tx_size, rx_size);
-    tx_buf = new uint8_t[tx_buf_size = tx_size];
-    rx_buf = new uint8_t[rx_buf_size = rx_size];
-    message_callback = on_message;
+    owns_buffers = (tx == nullptr);
+    tx_buf = owns_buffers ? new uint8_t[tx_size] : tx;
+    rx_buf = owns_buffers ? new uint8_t[rx_size] : rx;
+    tx_buf_size = tx_size;
+    rx_buf_size = rx_size;
+    exact_slots.fill(-1);
     mqtt_init(&mqtt, this, tx_buf, tx_size, rx_buf, rx_size, ::on_message);
     mqtt.publish_response_callback_state = this;
   }
 
   virtual ~XBeeMQTTAdapterDef() override {
     OK_NOTE("Destroying");
-    delete[] tx_buf;
-    delete[] rx_buf;
+    if (owns_buffers) {
+      delete[] tx_buf;
+      delete[] rx_buf;
+    }
   }
 
   virtual bool incoming_to_outgoing(
@@ -48,27 +117,77 @@ class XBeeMQTTAdapterDef : public XBeeMQTTAdapter {
       }
     }
 
+    bool must_close = false;
     if (auto* stat = incoming.decode_as<TransmitStatus>()) {
-      if (stat->frame_id == 'Q') {
+      if (stat->frame_id == 'Q' && in_flight()) {
         if (stat->status == 0) {
           OK_DETAIL(">>>> XBee confirmed transmission");
-        } else if (socket >= 0) {
+          ack_millis.record(millis() - unacked_millis);
+          unacked_size = 0;
+          unacked_whole = false;
+        } else if (socket < 0) {
+          transmit_errors.add();
+          unacked_size = 0;
+          unacked_whole = false;
+        } else if (
+            is_transient_transmit_error(stat->status) && unacked_whole) {
+          OK_ERROR("Transmit error: %s, publish dropped", stat->status_text());
+          transmit_errors.add();
+          publishes_dropped.add();
+          unacked_whole = false;  // QoS 1 is resent by MQTT-C on timeout
+        } else if (
+            is_transient_transmit_error(stat->status) &&
+            unacked_retries < TRANSMIT_RETRIES) {
+          OK_ERROR("Transmit error: %s, retrying", stat->status_text());
+          transmit_errors.add();
+          ++unacked_retries;
+          unacked_resend = true;
+        } else {
           OK_ERROR("Transmit error: %s", stat->status_text());
-          if (outgoing) {
-            OK_DETAIL("Closing socket %d", socket);
-            auto* close = outgoing->setup_as<SocketClose>(0);
-            close->frame_id = 'Q';  // Our signature
-            close->socket = socket;
-            socket = -1;
-            return true;
-          }
+          transmit_errors.add();
+          must_close = true;
         }
       }
     }
 
+    if (in_flight() && !unacked_resend && socket >= 0 &&
+        millis() - unacked_millis > TRANSMIT_TIMEOUT_MILLIS) {
+      OK_ERROR("No transmit status from XBee");
+      transmit_errors.add();
+      must_close = true;
+    }
+
+    if (must_close) {
+      unacked_size = 0;
+      unacked_whole = false;
+      if (outgoing) {
+        OK_DETAIL("Closing socket %d", socket);
+        auto* close = outgoing->setup_as<SocketClose>(0);
+        close->frame_id = 'Q';  // Our signature
+        close->socket = socket;
+        socket = -1;
+        return true;
+      }
+    }
+
+    bool resent = false;
+    if (unacked_resend && outgoing && socket >= 0 &&
+        outgoing_space >= wire_size_of<SocketSend>(unacked_size)) {
+      OK_DETAIL(">> %d bytes resending to XBee", unacked_size);
+      auto* send = outgoing->setup_as<SocketSend>(unacked_size);
+      send->frame_id = 'Q';  // Our signature
+      send->socket = socket;
+      memcpy(send->data, unacked, unacked_size);
+      unacked_resend = false;
+      unacked_millis = millis();
+      bytes_out.add(unacked_size);
+      resent = true;
+      outgoing = nullptr;  // Still process incoming data below
+    }
+
     write_data = nullptr;
     write_filled = write_capacity = 0;
-    if (outgoing && socket >= 0) {
+    if (outgoing && socket >= 0 && !in_flight()) {
       auto *send = outgoing->setup_as<SocketSend>(0);
       send->frame_id = 'Q';  // Our signature
       send->socket = socket;
@@ -84,6 +203,7 @@ class XBeeMQTTAdapterDef : public XBeeMQTTAdapter {
         OK_DETAIL("<< %d bytes received from XBee", receive_size);
         read_data = receive->data;
         read_received = receive_size;
+        bytes_in.add(receive_size);
         receive_millis = millis();
       }
     }
@@ -99,9 +219,14 @@ class XBeeMQTTAdapterDef : public XBeeMQTTAdapter {
     if (write_filled > 0) {
       OK_DETAIL(">> %d bytes sending to XBee", write_filled);
       outgoing->payload_size += write_filled;
+      bytes_out.add(write_filled);
+      memcpy(unacked, write_data, write_filled);
+      unacked_size = write_filled;
+      unacked_retries = 0;
+      unacked_millis = millis();
       return true;
     } else {
-      return false;
+      return resent;
     }
   }
 
@@ -109,15 +234,177 @@ class XBeeMQTTAdapterDef : public XBeeMQTTAdapter {
     if (socket != this->socket) {
       OK_NOTE("Init with socket #%d", socket);
       this->socket = socket;
+      unacked_size = 0;
+      unacked_whole = false;
+      unacked_resend = false;
+      publish_data = nullptr;
       if (socket >= 0) {
         mqtt_reinit(&mqtt, this, tx_buf, tx_buf_size, rx_buf, rx_buf_size);
-        mqtt.typical_response_time = -1.0f;
+        mqtt.typical_response_time = -1;
       }
     }
   }
 
   virtual int active_socket() const override { return socket; }
 
+  virtual int add_topic(
+      char const* name, MessageHandler handler, int qos) override {
+    int const size = strlen(name);
+    if (topic_count >= MAX_TOPICS ||
+        names_used + 2 + size + 1 > TOPIC_NAME_SPACE) {
+      OK_ERROR("Can't add topic \"%s\" (%d already)", name, topic_count);
+      return -1;
+    }
+
+    int const index = topic_count++;
+    auto* topic = &topics[index];
+    topic->encoded_size = 2 + size;
+    topic->encoded = &names[names_used];
+    names_used += topic->encoded_size + 1;
+    topic->encoded[0] = size >> 8;
+    topic->encoded[1] = size & 0xFF;
+    memcpy(topic->encoded + 2, name, size + 1);  // NUL for logging
+    topic->hash = topic_hash(name, size);
+    topic->wildcard = has_wildcard(name, size);
+    topic->qos = qos;
+    topic->handler = handler;
+
+    if (topic->wildcard) {
+      wildcards[wildcard_count++] = index;
+    } else {
+      int slot = topic->hash % TOPIC_SLOTS;
+      while (exact_slots[slot] >= 0) slot = (slot + 1) % TOPIC_SLOTS;
+      exact_slots[slot] = index;
+    }
+    return index;
+  }
+
+  virtual void subscribe_topics() override {
+    for (int t = 0; t < topic_count; ++t) {
+      if (!topics[t].handler) continue;
+      OK_DETAIL("Subscribing: %s", topics[t].name());
+      mqtt_subscribe(&mqtt, topics[t].name(), topics[t].qos);
+    }
+  }
+
+  virtual MQTTErrors publish(
+      int t, void const* data, int size, uint8_t flags) override {
+    if (t < 0 || t >= topic_count || topics[t].wildcard) {
+      OK_ERROR("Bad topic #%d for publish", t);
+      return MQTT_ERROR_NULLPTR;
+    }
+    auto const err = mqtt_publish_encoded(
+        &mqtt, topics[t].encoded, topics[t].encoded_size, data, size, flags);
+    if (err == MQTT_OK) publishes.add();
+    return err;
+  }
+
+  virtual uint8_t* begin_publish(
+      int t, int qos, int outgoing_space, Frame* outgoing,
+      int* capacity) override {
+    publish_data = nullptr;
+    if (t < 0 || t >= topic_count || topics[t].wildcard) {
+      OK_ERROR("Bad topic #%d for publish", t);
+      return nullptr;
+    }
+    if (socket < 0 || in_flight() || unacked_resend || qos < 0 || qos > 1 ||
+        mqtt.error != MQTT_OK || mqtt.typical_response_time < 0 ||
+        mqtt.mq.unsent > 0 || mqtt.send_offset > 0) {
+      return nullptr;  // Not connected, or MQTT-C's own data goes first
+    }
+
+    auto const& topic = topics[t];
+    int const space = std::min(
+        outgoing_space - wire_size_of<SocketSend>(),
+        MAX_PAYLOAD - int(sizeof(SocketSend)));
+    publish_reserved = varint_size(space);  // Final size may be smaller
+    publish_vhdr = topic.encoded_size + (qos > 0 ? 2 : 0);
+    publish_capacity = space - 1 - publish_reserved - publish_vhdr;
+    if (qos > 0) {
+      if (mqtt.mq.curr_sz < size_t(space)) mqtt_mq_clean(&mqtt.mq);
+      int const copy_space = mqtt.mq.curr_sz;  // For the retained copy
+      publish_capacity = std::min(
+          publish_capacity, copy_space - 1 - publish_reserved - publish_vhdr);
+    }
+    if (publish_capacity <= 0) return nullptr;
+
+    auto* send = outgoing->setup_as<SocketSend>(0);
+    send->frame_id = 'Q';  // Our signature
+    send->socket = socket;
+    publish_frame = outgoing;
+    publish_data = send->data;
+    publish_qos = qos;
+
+    uint8_t* p = publish_data;
+    *p++ = MQTT_CONTROL_PUBLISH << 4 | (qos > 0 ? MQTT_PUBLISH_QOS_1 : 0);
+    p += publish_reserved;
+    memcpy(p, topic.encoded, topic.encoded_size);
+    p += topic.encoded_size;
+    if (qos > 0) p += 2;  // Packet ID, taken at commit
+
+    *capacity = publish_capacity;
+    return p;
+  }
+
+  virtual bool commit_publish(int payload_size) override {
+    if (!publish_data || payload_size < 0 || payload_size > publish_capacity) {
+      OK_ERROR("Bad publish commit (%d bytes)", payload_size);
+      publish_data = nullptr;
+      return false;
+    }
+
+    uint8_t* const data = publish_data;
+    uint16_t pid = 0;
+    if (publish_qos > 0) {
+      pid = __mqtt_next_pid(&mqtt);
+      uint8_t* const p = data + 1 + publish_reserved + publish_vhdr - 2;
+      p[0] = pid >> 8;
+      p[1] = pid & 0xFF;
+    }
+
+    // If the remaining-length field came out shorter than reserved (only
+    // when the payload is under 128 bytes), close the gap
+    int const remaining = publish_vhdr + payload_size;
+    int const length_size = varint_size(remaining);
+    if (length_size < publish_reserved) {
+      memmove(data + 1 + length_size, data + 1 + publish_reserved, remaining);
+    }
+    for (int i = 0, rest = remaining; i < length_size; ++i, rest >>= 7) {
+      data[1 + i] = (rest & 0x7F) | (i + 1 < length_size ? 0x80 : 0);
+    }
+
+    int const packet_size = 1 + length_size + remaining;
+    OK_DETAIL(">> %d bytes publishing to XBee", packet_size);
+    publish_frame->payload_size += packet_size;
+    publishes.add();
+    bytes_out.add(packet_size);
+    publish_data = nullptr;
+    unacked_whole = true;
+    unacked_retries = 0;
+    unacked_millis = millis();
+
+    if (publish_qos > 0) {
+      // Room was checked in begin_publish()
+      mqtt_track_sent_publish(&mqtt, data, packet_size, pid);
+    } else {
+      mqtt.time_of_last_send = MQTT_PAL_TIME();  // Counts for keepalive
+    }
+    return true;
+  }
+
+  virtual void cancel_publish() override { publish_data = nullptr; }
+
+  virtual bool check_error() override {
+    if (socket < 0 || mqtt.error == MQTT_OK) return false;
+    if (mqtt.error == MQTT_ERROR_SEND_BUFFER_IS_FULL) {
+      OK_ERROR("MQTT send buffer full, message dropped");
+      publishes_dropped.add();
+      mqtt.error = MQTT_OK;  // The connection itself is fine
+      return false;
+    }
+    return true;
+  }
+
   virtual mqtt_client* client() override { return &mqtt; }
 
   virtual unsigned long last_receive_millis() const override {
@@ -125,8 +412,32 @@ class XBeeMQTTAdapterDef : public XBeeMQTTAdapter {
   }
 
   void on_message(mqtt_response_publish const& publish) {
-    OK_DETAIL("Incoming: %.*s", publish.topic_name_size, publish.topic_name);
-    if (message_callback) message_callback(publish);
+    auto const* name = static_cast<char const*>(publish.topic_name);
+    int const size = publish.topic_name_size;
+    OK_DETAIL("Incoming: %.*s", size, name);
+
+    bool handled = false;
+    uint32_t const hash = topic_hash(name, size);
+    for (int slot = hash % TOPIC_SLOTS; exact_slots[slot] >= 0;
+         slot = (slot + 1) % TOPIC_SLOTS) {
+      auto const& topic = topics[exact_slots[slot]];
+      if (topic.hash == hash && topic.encoded_size == 2 + size &&
+          !memcmp(topic.name(), name, size)) {
+        if (topic.handler) topic.handler(publish);
+        handled = handled || topic.handler.is_valid();
+        break;
+      }
+    }
+
+    for (int w = 0; w < wildcard_count; ++w) {
+      auto const& topic = topics[wildcards[w]];
+      if (filter_matches(topic.name(), topic.encoded_size - 2, name, size)) {
+        if (topic.handler) topic.handler(publish);
+        handled = handled || topic.handler.is_valid();
+      }
+    }
+
+    if (!handled) OK_NOTE("Unhandled: %.*s", size, name);
   }
 
   ssize_t pal_sendall(void const* buf, size_t len) {
@@ -162,22 +473,61 @@ class XBeeMQTTAdapterDef : public XBeeMQTTAdapter {
 
   mqtt_client mqtt = {};
   uint8_t* tx_buf = nullptr, *rx_buf = nullptr;
+  bool owns_buffers = true;
   int tx_buf_size = 0, rx_buf_size = 0;
   int socket = -1;
   unsigned long receive_millis = 0;
 
-  std::function<void(mqtt_response_publish const&)> message_callback = nullptr;
+  uint8_t unacked[MAX_PAYLOAD];  // Copy of the in-flight SocketSend data
+  int unacked_size = 0;
+  bool unacked_whole = false;  // Zero-copy publish in flight (no copy)
+  int unacked_retries = 0;
+  bool unacked_resend = false;
+  unsigned long unacked_millis = 0;
+
+  Frame* publish_frame = nullptr;  // Between begin/commit_publish()
+  uint8_t* publish_data = nullptr;
+  int publish_reserved = 0, publish_vhdr = 0, publish_capacity = 0;
+  int publish_qos = 0;
+
+  struct Topic {
+    uint8_t* encoded = nullptr;  // In names: 16-bit length, name, NUL
+    int encoded_size = 0;
+    uint32_t hash = 0;
+    bool wildcard = false;
+    int qos = 0;
+    MessageHandler handler;
+
+    char const* name() const {
+      return reinterpret_cast<char const*>(encoded + 2);
+    }
+  };
+
+  std::array<Topic, MAX_TOPICS> topics;
+  int topic_count = 0;
+  std::array<uint8_t, TOPIC_NAME_SPACE> names;  // Encoded names, packed
+  int names_used = 0;
+  std::array<int8_t, TOPIC_SLOTS> exact_slots;  // Open-addressed by hash
+  std::array<int8_t, MAX_TOPICS> wildcards;
+  int wildcard_count = 0;
+
+  bool in_flight() const { return unacked_size > 0 || unacked_whole; }
 };
 
+XBeeMQTTAdapter* make_xbee_mqtt_adapter(int tx_size, int rx_size) {
+  return new XBeeMQTTAdapterDef(nullptr, tx_size, nullptr, rx_size);
+}
+
 XBeeMQTTAdapter* make_xbee_mqtt_adapter(
-    int tx_size, int rx_size,
-    std::function<void(mqtt_response_publish const&)> const& on_message) {
-  return new XBeeMQTTAdapterDef(tx_size, rx_size, on_message);
+    XBeeMQTTAdapterStorage* storage,
+    uint8_t* tx, int tx_size, uint8_t* rx, int rx_size) {
+  static_assert(sizeof(XBeeMQTTAdapterDef) <= sizeof(XBeeMQTTAdapterStorage));
+  return new (storage->bytes) XBeeMQTTAdapterDef(tx, tx_size, rx, rx_size);
 }
 
 extern "C" {
   mqtt_pal_time_t MQTT_PAL_TIME() {
-    return millis() * 1e-3f;
+    return millis();
   }
 
   static void on_message(
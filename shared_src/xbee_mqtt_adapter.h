@@ -2,13 +2,18 @@
 
 #pragma once
 
-#include <functional>
+#include <etl/delegate.h>
 
 #include "MQTT-C/mqtt.h"
 #include "xbee_api.h"
 
 class XBeeMQTTAdapter {
  public:
+  static constexpr int MAX_TOPICS = 16;
+  static constexpr int TOPIC_NAME_SPACE = 1024;  // Total, 3 + length each
+  // Non-owning and allocation-free: bind with MessageHandler::create<...>()
+  using MessageHandler = etl::delegate<void(mqtt_response_publish const&)>;
+
   virtual ~XBeeMQTTAdapter() {}
 
   virtual bool incoming_to_outgoing(
@@ -17,10 +22,47 @@ class XBeeMQTTAdapter {
 
   virtual void use_socket(int socket) = 0;
   virtual int active_socket() const = 0;
+
+  // Topics are registered at setup and then used by index (-1 if full).
+  // Names are encoded for the wire once, here. Inbound publishes go to the
+  // handler of every matching topic; a name with MQTT wildcards (+, #) is
+  // a subscription filter and can't be published to.
+  virtual int add_topic(
+      char const* name, MessageHandler = MessageHandler(), int qos = 0) = 0;
+  virtual void subscribe_topics() = 0;  // Those with handlers; after connect
+  virtual MQTTErrors publish(
+      int topic, void const* data, int size, uint8_t flags) = 0;
+
+  // Zero-copy publish: begin_publish() sets up the outgoing frame with the
+  // MQTT header and topic and returns where to write up to *capacity payload
+  // bytes, or nullptr if the connection or send window isn't ready (use
+  // mqtt_publish() then). commit_publish() completes the frame for
+  // XBeeRadio::add_outgoing(), or cancel_publish() drops it (if the payload
+  // won't fit, say). QoS 0 payloads are never copied; QoS 1 takes a packet
+  // ID at commit and leaves a copy in the MQTT-C queue for retransmission.
+  virtual uint8_t* begin_publish(
+      int topic, int qos, int outgoing_space,
+      XBeeAPI::Frame* outgoing, int* capacity) = 0;
+  virtual bool commit_publish(int payload_size) = 0;
+  virtual void cancel_publish() = 0;
+
+  // Clears MQTT client errors that leave the connection usable (a full
+  // send buffer); returns true if the connection must be restarted.
+  virtual bool check_error() = 0;
   virtual mqtt_client* client() = 0;
   virtual unsigned long last_receive_millis() const = 0;
 };
 
 XBeeMQTTAdapter* make_xbee_mqtt_adapter(
-    int send_buffer_size, int receive_buffer_size,
-    std::function<void(mqtt_response_publish const&)> const& message_callback);
+    int send_buffer_size, int receive_buffer_size);
+
+// Caller-provided space (e.g. a static) to make an adapter without the heap;
+// destroy with ~XBeeMQTTAdapter(), not delete. Buffers must outlive it.
+struct XBeeMQTTAdapterStorage {
+  alignas(8) uint8_t bytes[XBeeAPI::MAX_PAYLOAD + 2560];
+};
+
+XBeeMQTTAdapter* make_xbee_mqtt_adapter(
+    XBeeMQTTAdapterStorage*,
+    uint8_t* send_buffer, int send_buffer_size,
+    uint8_t* receive_buffer, int receive_buffer_size);
@@ -0,0 +1,782 @@
+#include "xbee_mqttsn_client.h"
+
+#include <algorithm>
+#include <array>
+#include <cstring>
+#include <new>
+
+#include <Arduino.h>
+#include <ok_logging.h>
+
+#include "trace_log.h"
+
+static const OkLoggingContext OK_CONTEXT("xbee_mqttsn_client");
+
+using namespace XBeeAPI;
+
+// MQTT-SN v1.2 message types and flags (only what we use)
+enum : uint8_t {
+  SN_CONNECT = 0x04, SN_CONNACK = 0x05,
+  SN_REGISTER = 0x0A, SN_REGACK = 0x0B,
+  SN_PUBLISH = 0x0C, SN_PUBACK = 0x0D,
+  SN_SUBSCRIBE = 0x12, SN_SUBACK = 0x13,
+  SN_PINGREQ = 0x16, SN_PINGRESP = 0x17,
+  SN_DISCONNECT = 0x18,
+};
+
+enum : uint8_t {
+  SN_FLAG_QOS_0 = 0x00, SN_FLAG_QOS_1 = 0x20, SN_FLAG_QOS_M1 = 0x60,
+  SN_FLAG_QOS_MASK = 0x60, SN_FLAG_DUP = 0x80,
+  SN_FLAG_CLEAN_SESSION = 0x04,
+  SN_TOPIC_NORMAL = 0x00, SN_TOPIC_PREDEFINED = 0x01, SN_TOPIC_SHORT = 0x02,
+  SN_TOPIC_TYPE_MASK = 0x03,
+};
+
+enum : uint8_t {
+  SN_ACCEPTED = 0x00, SN_CONGESTION = 0x01, SN_INVALID_TOPIC = 0x02,
+};
+
+static constexpr uint8_t SENT_QOS = 0x7F;  // Outbox record sent out of order
+
+static constexpr unsigned long RETRY_MILLIS = 10 * 1000;  // Spec's Tretry
+static constexpr int MAX_RETRIES = 4;                      // Spec's Nretry
+static constexpr unsigned long HOLDOFF_MILLIS = 60 * 1000;  // After failing
+static constexpr int MAX_TOPICS = 16;
+static constexpr int MAX_SUBSCRIPTIONS = 4;
+static constexpr int MAX_ACKS = 4;
+
+static uint16_t get16(uint8_t const* p) { return p[0] << 8 | p[1]; }
+static void put16(uint8_t* p, uint16_t v) { p[0] = v >> 8; p[1] = v & 0xFF; }
+
+class XBeeMQTTSNClientDef : public XBeeMQTTSNClient {
+ public:
+  XBeeMQTTSNClientDef(
+      char const* id, int keepalive, uint8_t* outbox_buf, int outbox_size,
+      MessageCallback on_message)
+    : message_callback(on_message) {
+    OK_NOTE("Starting: \"%s\" keepalive=%ds outbox=%d", id, keepalive,
+            outbox_size);
+    client_id_size = strlen(id);
+    client_id = save_name(id, client_id_size);
+    OK_FATAL_IF(client_id == nullptr);
+    keepalive_sec = keepalive;
+    outbox.allocate(outbox_size, outbox_buf);
+  }
+
+  virtual ~XBeeMQTTSNClientDef() override {
+    OK_NOTE("Destroying");
+    outbox.release();
+  }
+
+  virtual bool incoming_to_outgoing(
+      Frame const& incoming, int outgoing_space, Frame* outgoing) override {
+    int size;
+    if (auto* receive = incoming.decode_as<SocketReceive>(&size)) {
+      if (receive->socket == socket) handle_datagram(receive->data, size);
+    } else if (auto* rf = incoming.decode_as<SocketReceiveFrom>(&size)) {
+      if (rf->socket == socket) handle_datagram(rf->data, size);
+    } else if (auto* stat = incoming.decode_as<SocketStatus>()) {
+      if (stat->socket == socket && stat->status != SocketStatus::CONNECTED) {
+        OK_ERROR("Socket error: %s", stat->status_text());
+        use_socket(-1, nullptr, 0);
+      }
+    }
+
+    if (!outgoing || socket < 0) return false;
+
+    uint8_t* data;
+    int capacity;
+    if (send_to) {
+      auto* send = outgoing->setup_as<SocketSendTo>(0);
+      send->frame_id = 0;  // No TransmitStatus; MQTT-SN has its own retries
+      send->socket = socket;
+      memcpy(send->dest_ip, gateway_ip, 4);
+      send->dest_port = gateway_port;
+      data = send->data;
+      capacity = outgoing_space - wire_size_of<SocketSendTo>();
+    } else {
+      auto* send = outgoing->setup_as<SocketSend>(0);
+      send->frame_id = 0;
+      send->socket = socket;
+      data = send->data;
+      capacity = outgoing_space - wire_size_of<SocketSend>();
+    }
+
+    int const built = build_datagram(data, std::min(capacity, 255));
+    if (built <= 0) return false;
+    outgoing->payload_size += built;
+    last_send_millis = millis();
+    return true;
+  }
+
+  virtual void use_socket(int s, uint8_t const* ip4, int port) override {
+    if (s == socket) return;
+    OK_NOTE("Using socket #%d", s);
+    socket = s;
+    send_to = (ip4 != nullptr);
+    if (ip4) memcpy(gateway_ip, ip4, 4);
+    gateway_port = port;
+    if (current_state != ASLEEP) set_state(DISCONNECTED);
+  }
+
+  virtual int active_socket() const override { return socket; }
+  virtual State state() const override { return current_state; }
+
+  virtual int add_topic(char const* name, int predefined_id) override {
+    int const size = strlen(name);
+    int const found = find_topic(name, size);
+    if (found >= 0) return found;
+    char* const saved =
+        (topic_count < MAX_TOPICS) ? save_name(name, size) : nullptr;
+    if (saved == nullptr) {
+      OK_ERROR("Can't add topic \"%s\" (%d already)", name, topic_count);
+      return -1;
+    }
+    auto* topic = &topics[topic_count];
+    topic->name = saved;
+    topic->name_size = size;
+    topic->predefined = (predefined_id >= 0);
+    topic->id = topic->predefined ? predefined_id : 0;
+    return topic_count++;
+  }
+
+  virtual void subscribe(char const* filter, int qos) override {
+    char* const saved = (subscription_count < MAX_SUBSCRIPTIONS)
+        ? save_name(filter, strlen(filter)) : nullptr;
+    if (saved == nullptr) {
+      OK_ERROR("Can't subscribe \"%s\" (%d already)", filter,
+               subscription_count);
+      return;
+    }
+    auto* sub = &subscriptions[subscription_count++];
+    sub->filter = saved;
+    sub->qos = qos;
+    sub->done = false;
+  }
+
+  virtual bool publish(int t, void const* data, int size, int qos) override {
+    if (t < 0 || t >= topic_count || qos < -1 || qos > 1) {
+      OK_ERROR("Bad publish (topic=%d qos=%d)", t, qos);
+      return false;
+    }
+    if (qos == -1 && !topics[t].predefined) {
+      OK_ERROR("QoS -1 needs a predefined topic (\"%s\")", topics[t].name);
+      return false;
+    }
+    if (size > 255 - 7 || outbox.space() < size + 4) {
+      OK_ERROR("Outbox full (%d bytes), dropping publish", size);
+      return false;
+    }
+
+    uint8_t const header[4] = {
+      uint8_t(t), uint8_t(int8_t(qos)), uint8_t(size & 0xFF), uint8_t(size >> 8)
+    };
+    outbox.push(header, 4);
+    outbox.push(static_cast<uint8_t const*>(data), size);
+    return true;
+  }
+
+  virtual void sleep(int seconds) override {
+    sleep_seconds = seconds;
+    sleep_requested = true;
+    wake_requested = check_in_requested = false;
+  }
+
+  virtual void check_in() override { check_in_requested = true; }
+
+  virtual void wake() override {
+    wake_requested = true;
+    sleep_requested = false;
+  }
+
+  void set_state(State s) {
+    if (s != current_state) {
+      OK_DETAIL("State %s => %s", state_text(current_state), state_text(s));
+    }
+    current_state = s;
+    state_millis = millis();
+    retries = 0;
+    awaiting.type = 0;
+    ping_outstanding = false;
+  }
+
+ private:
+  struct Topic {
+    char* name = nullptr;  // In names, NUL-terminated
+    int name_size = 0;
+    uint16_t id = 0;  // 0 = not (yet) registered
+    bool predefined = false;
+  };
+
+  struct Subscription {
+    char* filter = nullptr;  // In names
+    int qos = 0;
+    bool done = false;
+  };
+
+  // Byte ring of outbox records: topic, qos, size (LE 16), data
+  struct ByteRing {
+    uint8_t* data = nullptr;
+    bool owned = false;  // Heap-allocated (no caller buffer)
+    int capacity = 0, head = 0, size = 0;
+
+    void allocate(int cap, uint8_t* buf) {
+      owned = (buf == nullptr);
+      data = owned ? new uint8_t[cap] : buf;
+      capacity = cap;
+    }
+
+    void release() { if (owned) delete[] data; }
+    int space() const { return capacity - size; }
+
+    void push(uint8_t const* in, int n) {
+      poke(size, in, n);
+      size += n;
+    }
+
+    void poke(int offset, uint8_t const* in, int n) {
+      for (int i = 0; i < n; ++i) data[(head + offset + i) % capacity] = in[i];
+    }
+
+    void peek(int offset, uint8_t* out, int n) const {
+      for (int i = 0; i < n; ++i) out[i] = data[(head + offset + i) % capacity];
+    }
+
+    void drop(int n) {
+      head = (head + n) % capacity;
+      size -= n;
+    }
+  };
+
+  std::array<char, NAME_SPACE> names;  // Client ID, topics, filters, packed
+  int names_used = 0;
+  char* client_id = nullptr;  // In names
+  int client_id_size = 0;
+  int keepalive_sec = 0;
+  MessageCallback message_callback;
+
+  int socket = -1;
+  bool send_to = false;
+  uint8_t gateway_ip[4] = {};
+  int gateway_port = 0;
+
+  State current_state = DISCONNECTED;
+  unsigned long state_millis = 0;
+  unsigned long last_send_millis = 0;
+  int retries = 0;
+  bool holding_off = false;  // Connecting failed, wait before retrying
+  bool ping_outstanding = false;
+  unsigned long ping_millis = 0;
+
+  int sleep_seconds = 0;
+  bool sleep_requested = false;
+  bool check_in_requested = false;
+  bool wake_requested = false;
+
+  std::array<Topic, MAX_TOPICS> topics;
+  int topic_count = 0;
+  std::array<Subscription, MAX_SUBSCRIPTIONS> subscriptions;
+  int subscription_count = 0;
+  ByteRing outbox;
+
+  // MQTT-SN allows one outstanding request (REGISTER/SUBSCRIBE/QoS 1 PUBLISH)
+  struct {
+    uint8_t type = 0;  // 0 = none
+    uint16_t msg_id = 0;
+    int index = 0;
+    unsigned long sent_millis = 0;
+  } awaiting;
+  uint16_t next_msg_id = 1;
+
+  // Replies owed to the gateway (REGACK, PUBACK)
+  struct Ack { uint8_t type; uint16_t topic_id, msg_id; uint8_t code; };
+  std::array<Ack, MAX_ACKS> acks;
+  int ack_count = 0;
+
+  // Copies a name into names, NUL-terminated; nullptr if out of space
+  char* save_name(char const* name, int size) {
+    if (names_used + size + 1 > NAME_SPACE) return nullptr;
+    char* const saved = &names[names_used];
+    memcpy(saved, name, size);
+    saved[size] = '\0';
+    names_used += size + 1;
+    return saved;
+  }
+
+  int find_topic(char const* name, int size) const {
+    for (int t = 0; t < topic_count; ++t) {
+      auto const& topic = topics[t];
+      if (topic.name_size == size && !memcmp(topic.name, name, size)) return t;
+    }
+    return -1;
+  }
+
+  int find_topic_id(uint16_t id) const {
+    if (id == 0) return -1;  // Unregistered topics have ID 0
+    for (int t = 0; t < topic_count; ++t) {
+      if (topics[t].id == id) return t;
+    }
+    return -1;
+  }
+
+  uint16_t take_msg_id() {
+    if (++next_msg_id == 0) next_msg_id = 1;
+    return next_msg_id;
+  }
+
+  void queue_ack(
+      uint8_t type, uint16_t topic_id, uint16_t msg_id, uint8_t code) {
+    if (ack_count >= MAX_ACKS) {
+      OK_ERROR("Too many acks pending, dropping (type 0x%02x)", type);
+      return;
+    }
+    acks[ack_count++] = {type, topic_id, msg_id, code};
+  }
+
+  void handle_datagram(uint8_t const* data, int size) {
+    int hdr = 1;
+    int length = (size > 0) ? data[0] : 0;
+    if (length == 1 && size >= 3) {
+      length = get16(data + 1);
+      hdr = 3;
+    }
+    if (length < hdr + 1 || length > size) {
+      OK_ERROR("Bad datagram (%d bytes, length %d)", size, length);
+      return;
+    }
+
+    uint8_t const type = data[hdr];
+    uint8_t const* body = data + hdr + 1;
+    int const body_size = length - hdr - 1;
+    switch (type) {
+      case SN_CONNACK:
+        if (body_size < 1) break;
+        if (current_state == CONNECTING && body[0] == SN_ACCEPTED) {
+          OK_NOTE("Connected to gateway");
+          for (int t = 0; t < topic_count; ++t) {
+            if (!topics[t].predefined) topics[t].id = 0;  // Clean session
+          }
+          for (int s = 0; s < subscription_count; ++s) {
+            subscriptions[s].done = false;
+          }
+          set_state(ACTIVE);
+        } else if (current_state == CONNECTING) {
+          OK_ERROR("Connection rejected (0x%02x)", body[0]);
+          holding_off = true;
+          set_state(DISCONNECTED);
+        }
+        return;
+
+      case SN_REGISTER: {
+        if (body_size < 4) break;
+        uint16_t const topic_id = get16(body);
+        char const* name = reinterpret_cast<char const*>(body + 4);
+        int const name_size = body_size - 4;
+        int t = find_topic(name, name_size);
+        if (t < 0 && topic_count < MAX_TOPICS) {
+          if (char* const saved = save_name(name, name_size)) {
+            t = topic_count++;
+            topics[t].name = saved;
+            topics[t].name_size = name_size;
+          }
+        }
+        if (t < 0) {
+          OK_ERROR("No room for #%d: %.*s", topic_id, name_size, name);
+          queue_ack(SN_REGACK, topic_id, get16(body + 2), SN_CONGESTION);
+          return;
+        }
+        topics[t].id = topic_id;
+        OK_DETAIL("Gateway registered #%d: %.*s", topic_id, name_size, name);
+        queue_ack(SN_REGACK, topic_id, get16(body + 2), SN_ACCEPTED);
+        return;
+      }
+
+      case SN_REGACK:
+        if (body_size < 5) break;
+        if (awaiting.type == SN_REGISTER &&
+            get16(body + 2) == awaiting.msg_id) {
+          auto* topic = &topics[awaiting.index];
+          if (body[4] == SN_ACCEPTED) {
+            topic->id = get16(body);
+            OK_DETAIL("Registered #%d: %s", topic->id, topic->name);
+          } else {
+            OK_ERROR("Register rejected (0x%02x): %s", body[4], topic->name);
+          }
+          awaiting.type = 0;
+        }
+        return;
+
+      case SN_PUBLISH: {
+        if (body_size < 5) break;
+        uint8_t const flags = body[0];
+        uint16_t const topic_id = get16(body + 1);
+        uint16_t const msg_id = get16(body + 3);
+        char const* name = nullptr;
+        int name_size = 0;
+        if ((flags & SN_TOPIC_TYPE_MASK) == SN_TOPIC_SHORT) {
+          name = reinterpret_cast<char const*>(body + 1);
+          name_size = 2;
+        } else if (int const t = find_topic_id(topic_id); t >= 0) {
+          name = topics[t].name;
+          name_size = topics[t].name_size;
+        }
+
+        if ((flags & SN_FLAG_QOS_MASK) == SN_FLAG_QOS_1) {
+          uint8_t const code = name ? SN_ACCEPTED : SN_INVALID_TOPIC;
+          queue_ack(SN_PUBACK, topic_id, msg_id, code);
+        }
+
+        if (name == nullptr) {
+          OK_ERROR("Publish to unknown topic #%d", topic_id);
+        } else {
+          OK_DETAIL(
+              "Incoming: %.*s (%d bytes)", name_size, name, body_size - 5);
+          if (message_callback) {
+            message_callback(name, name_size, body + 5, body_size - 5);
+          }
+        }
+        return;
+      }
+
+      case SN_PUBACK:
+        if (body_size < 5) break;
+        if (awaiting.type == SN_PUBLISH && get16(body + 2) == awaiting.msg_id) {
+          if (body[4] == SN_INVALID_TOPIC) {
+            OK_ERROR("Gateway forgot topic #%d, re-registering", get16(body));
+            topics[awaiting.index].id = 0;  // Keep message, retry later
+          } else {
+            if (body[4] != SN_ACCEPTED) {
+              OK_ERROR("Publish rejected (0x%02x), dropping", body[4]);
+            }
+            drop_outbox_record(0);
+          }
+          awaiting.type = 0;
+        }
+        return;
+
+      case SN_SUBACK:
+        if (body_size < 6) break;
+        if (awaiting.type == SN_SUBSCRIBE &&
+            get16(body + 3) == awaiting.msg_id) {
+          auto* sub = &subscriptions[awaiting.index];
+          if (body[5] == SN_ACCEPTED) {
+            uint16_t const topic_id = get16(body + 1);
+            OK_DETAIL("Subscribed: %s (#%d)", sub->filter, topic_id);
+            if (topic_id != 0) {
+              int const t = add_topic(sub->filter, -1);
+              if (t >= 0) topics[t].id = topic_id;
+            }
+          } else {
+            OK_ERROR("Subscribe rejected (0x%02x): %s", body[5], sub->filter);
+          }
+          sub->done = true;
+          awaiting.type = 0;
+        }
+        return;
+
+      case SN_PINGRESP:
+        ping_outstanding = false;
+        if (current_state == AWAKE) {
+          OK_DETAIL("Buffered messages delivered, back to sleep");
+          set_state(ASLEEP);
+        }
+        return;
+
+      case SN_DISCONNECT:
+        if (current_state != ASLEEP && current_state != AWAKE) {
+          OK_NOTE("Gateway disconnected");
+          set_state(DISCONNECTED);
+        }
+        return;
+
+      default:
+        OK_ERROR("Unexpected message type 0x%02x", type);
+        return;
+    }
+
+    OK_ERROR("Short message (type 0x%02x, %d bytes)", type, body_size);
+  }
+
+  int build_datagram(uint8_t* out, int capacity) {
+    if (capacity < 16) return 0;
+    unsigned long const now = millis();
+
+    if (ack_count > 0) {
+      auto const ack = acks[0];
+      std::copy(acks.begin() + 1, acks.begin() + ack_count--, acks.begin());
+      out[0] = 7;
+      out[1] = ack.type;  // REGACK and PUBACK have the same layout
+      put16(out + 2, ack.topic_id);
+      put16(out + 4, ack.msg_id);
+      out[6] = ack.code;
+      return 7;
+    }
+
+    switch (current_state) {
+      case DISCONNECTED:
+        if (holding_off && now - state_millis < HOLDOFF_MILLIS) {
+          return build_publish_without_session(out, capacity);
+        }
+        if (wake_requested || !sleep_requested) {
+          wake_requested = holding_off = false;
+          set_state(CONNECTING);
+          return build_connect(out, capacity);
+        }
+        return build_publish_without_session(out, capacity);
+
+      case CONNECTING:
+        if (now - state_millis > RETRY_MILLIS) {
+          if (++retries > MAX_RETRIES) {
+            OK_ERROR("No CONNACK from gateway, giving up for now");
+            holding_off = true;
+            set_state(DISCONNECTED);
+            return 0;
+          }
+          state_millis = now;
+          return build_connect(out, capacity);
+        }
+        return 0;
+
+      case ACTIVE:
+        return build_active(out, capacity, now);
+
+      case ASLEEP:
+        if (wake_requested) {
+          wake_requested = false;
+          set_state(CONNECTING);
+          return build_connect(out, capacity);
+        }
+        if (check_in_requested ||
+            now - state_millis > sleep_seconds * 900UL) {  // 90% of duration
+          check_in_requested = false;
+          set_state(AWAKE);
+          out[0] = 2 + client_id_size;
+          out[1] = SN_PINGREQ;
+          memcpy(out + 2, client_id, client_id_size);
+          OK_DETAIL("Checking in for buffered messages");
+          return out[0];
+        }
+        return build_publish_without_session(out, capacity);
+
+      case AWAKE:
+        if (now - state_millis > RETRY_MILLIS) {
+          OK_ERROR("No PINGRESP while awake, back to sleep");
+          set_state(ASLEEP);
+        }
+        return 0;
+    }
+    return 0;
+  }
+
+  int build_connect(uint8_t* out, int capacity) {
+    int const size = 6 + std::min(client_id_size, capacity - 6);
+    out[0] = size;
+    out[1] = SN_CONNECT;
+    out[2] = SN_FLAG_CLEAN_SESSION;
+    out[3] = 0x01;  // Protocol ID
+    put16(out + 4, keepalive_sec);
+    memcpy(out + 6, client_id, size - 6);
+    OK_DETAIL("Connecting as \"%s\"", client_id);
+    return size;
+  }
+
+  int build_active(uint8_t* out, int capacity, unsigned long now) {
+    if (sleep_requested && awaiting.type == 0) {
+      sleep_requested = false;
+      out[0] = 4;
+      out[1] = SN_DISCONNECT;
+      put16(out + 2, sleep_seconds);
+      OK_DETAIL("Sleeping for %ds", sleep_seconds);
+      set_state(ASLEEP);
+      return 4;
+    }
+
+    if (awaiting.type != 0) {
+      if (now - awaiting.sent_millis <= RETRY_MILLIS) return 0;
+      if (++retries > MAX_RETRIES) {
+        OK_ERROR("No reply (type 0x%02x), reconnecting", awaiting.type);
+        set_state(DISCONNECTED);
+        return 0;
+      }
+      OK_DETAIL("Retrying (type 0x%02x)", awaiting.type);
+      return resend_awaiting(out, capacity, now);
+    }
+
+    for (int t = 0; t < topic_count; ++t) {
+      auto const& topic = topics[t];
+      if (topic.id != 0 || topic.predefined) continue;
+      if (6 + topic.name_size > capacity) return 0;
+      awaiting = {SN_REGISTER, take_msg_id(), t, now};
+      retries = 0;
+      return build_register(out, t);
+    }
+
+    for (int s = 0; s < subscription_count; ++s) {
+      if (subscriptions[s].done) continue;
+      awaiting = {SN_SUBSCRIBE, take_msg_id(), s, now};
+      retries = 0;
+      return build_subscribe(out, capacity, s, false);
+    }
+
+    if (outbox.size > 0) {
+      int const built = build_outbox_publish(out, capacity, 0, false, now);
+      if (built != 0) return built;
+    }
+
+    if (ping_outstanding && now - ping_millis > RETRY_MILLIS * MAX_RETRIES) {
+      OK_ERROR("No PINGRESP, reconnecting");
+      set_state(DISCONNECTED);
+      return 0;
+    }
+
+    if (!ping_outstanding && keepalive_sec > 0 &&
+        now - last_send_millis >= keepalive_sec * 1000UL) {
+      ping_outstanding = true;
+      ping_millis = now;
+      out[0] = 2;
+      out[1] = SN_PINGREQ;
+      return 2;
+    }
+
+    return 0;
+  }
+
+  int resend_awaiting(uint8_t* out, int capacity, unsigned long now) {
+    awaiting.sent_millis = now;
+    switch (awaiting.type) {
+      case SN_REGISTER: return build_register(out, awaiting.index);
+      case SN_SUBSCRIBE:
+        return build_subscribe(out, capacity, awaiting.index, true);
+      case SN_PUBLISH:
+        return build_outbox_publish(out, capacity, 0, true, now);
+    }
+    return 0;
+  }
+
+  int build_register(uint8_t* out, int t) {
+    auto const& topic = topics[t];
+    out[0] = 6 + topic.name_size;
+    out[1] = SN_REGISTER;
+    put16(out + 2, 0);
+    put16(out + 4, awaiting.msg_id);
+    memcpy(out + 6, topic.name, topic.name_size);
+    OK_DETAIL("Registering %s", topic.name);
+    return out[0];
+  }
+
+  int build_subscribe(uint8_t* out, int capacity, int s, bool dup) {
+    auto const& sub = subscriptions[s];
+    int const filter_size = std::min<int>(strlen(sub.filter), capacity - 5);
+    out[0] = 5 + filter_size;
+    out[1] = SN_SUBSCRIBE;
+    out[2] = (sub.qos >= 1 ? SN_FLAG_QOS_1 : SN_FLAG_QOS_0) |
+        (dup ? SN_FLAG_DUP : 0) | SN_TOPIC_NORMAL;
+    put16(out + 3, awaiting.msg_id);
+    memcpy(out + 5, sub.filter, filter_size);
+    OK_DETAIL("Subscribing %s", sub.filter);
+    return out[0];
+  }
+
+  // Sends the outbox record at byte offset `at`, if its topic is ready;
+  // QoS 0/-1 are then done, QoS 1 (only sent from the head) stays there
+  // until PUBACK (for retries).
+  int build_outbox_publish(
+      uint8_t* out, int capacity, int at, bool dup, unsigned long now) {
+    uint8_t header[4];
+    outbox.peek(at, header, 4);
+    int const t = header[0];
+    int const qos = int8_t(header[1]);
+    int const size = header[2] | header[3] << 8;
+    auto const& topic = topics[t];
+    if (topic.id == 0) return 0;  // Waiting for registration
+    if (7 + size > capacity) return 0;
+
+    uint8_t flags = topic.predefined ? SN_TOPIC_PREDEFINED : SN_TOPIC_NORMAL;
+    if (qos == 1) flags |= SN_FLAG_QOS_1;
+    if (qos == -1) flags |= SN_FLAG_QOS_M1;
+    if (dup) flags |= SN_FLAG_DUP;
+
+    uint16_t msg_id = 0;
+    if (qos == 1) {
+      if (!dup) {
+        awaiting = {SN_PUBLISH, take_msg_id(), t, now};
+        retries = 0;
+      }
+      msg_id = awaiting.msg_id;
+    }
+
+    out[0] = 7 + size;
+    out[1] = SN_PUBLISH;
+    out[2] = flags;
+    put16(out + 3, topic.id);
+    put16(out + 5, msg_id);
+    outbox.peek(at + 4, out + 7, size);
+    OK_DETAIL("Publishing %s (%d bytes, qos %d)", topic.name, size, qos);
+    if (qos != 1) drop_outbox_record(at);
+    return out[0];
+  }
+
+  // Without a session only QoS -1 (predefined topic) publishes can go,
+  // passing any records held for the session
+  int build_publish_without_session(uint8_t* out, int capacity) {
+    for (int at = 0; at < outbox.size; at += 4 + record_size(at)) {
+      uint8_t qos;
+      outbox.peek(at + 1, &qos, 1);
+      if (int8_t(qos) == -1) {
+        return build_outbox_publish(out, capacity, at, false, millis());
+      }
+    }
+    return 0;
+  }
+
+  int record_size(int at) const {
+    uint8_t size[2];
+    outbox.peek(at + 2, size, 2);
+    return size[0] | size[1] << 8;
+  }
+
+  // Records sent from past the head are marked, and dropped once they reach
+  // it, so the ring stays contiguous
+  void drop_outbox_record(int at) {
+    if (at > 0) {
+      outbox.poke(at + 1, &SENT_QOS, 1);
+      return;
+    }
+
+    uint8_t qos;
+    do {
+      outbox.drop(4 + record_size(0));
+      if (outbox.size > 0) outbox.peek(1, &qos, 1);
+    } while (outbox.size > 0 && qos == SENT_QOS);
+  }
+};
+
+XBeeMQTTSNClient* make_xbee_mqttsn_client(
+    char const* client_id, int keepalive_sec, int outbox_size,
+    XBeeMQTTSNClient::MessageCallback on_message) {
+  return new XBeeMQTTSNClientDef(
+      client_id, keepalive_sec, nullptr, outbox_size, on_message);
+}
+
+XBeeMQTTSNClient* make_xbee_mqttsn_client(
+    XBeeMQTTSNClientStorage* storage, char const* client_id,
+    int keepalive_sec, uint8_t* outbox, int outbox_size,
+    XBeeMQTTSNClient::MessageCallback on_message) {
+  static_assert(
+      sizeof(XBeeMQTTSNClientDef) <= sizeof(XBeeMQTTSNClientStorage));
+  return new (storage->bytes) XBeeMQTTSNClientDef(
+      client_id, keepalive_sec, outbox, outbox_size, on_message);
+}
+
+char const* XBeeMQTTSNClient::state_text(State state) {
+  switch (state) {
+#define S(x) case x: return #x
+    S(DISCONNECTED);
+    S(CONNECTING);
+    S(ACTIVE);
+    S(ASLEEP);
+    S(AWAKE);
+#undef S
+  }
+  return "UNKNOWN_STATE";
+}
@@ -0,0 +1,66 @@
+// MQTT-SN (v1.2) client over an XBee UDP socket, a lighter alternative to
+// MQTT-C over TCP (xbee_mqtt_adapter.h) for periodic telemetry: no TCP
+// handshake, and each publish is one small datagram (a few header bytes).
+// See other/mqttsn_gateway.py for a gateway to run against.
+
+#pragma once
+
+#include <etl/delegate.h>
+
+#include "xbee_api.h"
+
+class XBeeMQTTSNClient {
+ public:
+  static constexpr int NAME_SPACE = 512;  // Client ID, topics and filters
+  enum State { DISCONNECTED, CONNECTING, ACTIVE, ASLEEP, AWAKE };
+
+  // Inbound publish, after topic ID lookup (topic is not NUL-terminated)
+  using MessageCallback = etl::delegate<void(
+      char const* topic, int topic_size, uint8_t const* data, int size)>;
+
+  virtual ~XBeeMQTTSNClient() = default;
+
+  virtual bool incoming_to_outgoing(
+      XBeeAPI::Frame const& incoming,
+      int outgoing_space, XBeeAPI::Frame* outgoing) = 0;
+
+  // Datagrams go by SocketSendTo if the gateway address is given,
+  // otherwise by SocketSend on a connected UDP socket.
+  virtual void use_socket(int socket, uint8_t const* ip4, int port) = 0;
+  virtual int active_socket() const = 0;
+
+  // After a rejected or unanswered CONNECT, stays DISCONNECTED for a
+  // minute before trying again (QoS -1 publishes still go meanwhile)
+  virtual State state() const = 0;
+
+  // Returns a topic index for publish(), or -1 if full. Normal topics are
+  // registered with the gateway on connect. Predefined IDs (known to the
+  // gateway ahead of time) are needed for QoS -1, which publishes without
+  // connecting.
+  virtual int add_topic(char const* name, int predefined_id = -1) = 0;
+  virtual void subscribe(char const* filter, int qos) = 0;
+
+  // QoS -1, 0, or 1; queued while asleep or (re)connecting.
+  // Returns false if the local outbox is full.
+  virtual bool publish(int topic, void const* data, int size, int qos) = 0;
+
+  // Asleep, the gateway buffers messages for us, which check_in() fetches;
+  // local publishes wait in the outbox until wake().
+  virtual void sleep(int seconds) = 0;
+  virtual void check_in() = 0;
+  virtual void wake() = 0;
+
+  static char const* state_text(State);
+};
+
+XBeeMQTTSNClient* make_xbee_mqttsn_client(
+    char const* client_id, int keepalive_sec, int outbox_size,
+    XBeeMQTTSNClient::MessageCallback);
+
+// Caller-provided space (e.g. a static) to make a client without the heap;
+// destroy with ~XBeeMQTTSNClient(), not delete. The outbox must outlive it.
+struct XBeeMQTTSNClientStorage { alignas(8) uint8_t bytes[1536]; };
+
+XBeeMQTTSNClient* make_xbee_mqttsn_client(
+    XBeeMQTTSNClientStorage*, char const* client_id, int keepalive_sec,
+    uint8_t* outbox, int outbox_size, XBeeMQTTSNClient::MessageCallback);
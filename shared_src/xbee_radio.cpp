@@ -1,11 +1,24 @@
 #include "xbee_radio.h"
 
+#include <algorithm>
+
 #include <Arduino.h>
 #include <CircularBuffer.hpp>
 #include <ok_logging.h>
 
+#include "metrics.h"
+#include "trace_log.h"
+
 static const OkLoggingContext OK_CONTEXT("xbee_radio");
 
+static MetricsCounter bytes_in("xbee.bytes_in");
+static MetricsCounter bytes_out("xbee.bytes_out");
+static MetricsCounter frames_in("xbee.frames_in");
+static MetricsCounter frames_out("xbee.frames_out");
+static MetricsCounter checksum_errors("xbee.checksum_errors");
+static MetricsCounter frames_dropped("xbee.frames_dropped");  // Either way
+static MetricsHistogram out_queue("xbee.out_queue");  // Bytes, after adding
+
 class XBeeRadioDef : public XBeeRadio {
  public:
   XBeeRadioDef(HardwareSerial* s) : serial(s) {}
@@ -17,6 +30,7 @@ class XBeeRadioDef : public XBeeRadio {
   virtual void add_outgoing(XBeeAPI::Frame const& frame) override {
     if (state != API_MODE) {
       OK_ERROR("Outgoing frame (0x%02x) queued before API ready, dropping");
+      frames_dropped.add();
       return;
     }
 
@@ -24,6 +38,7 @@ class XBeeRadioDef : public XBeeRadio {
       OK_ERROR(
           "Outgoing frame (0x%02x) too big (%d > %d), dropping",
           frame.type, frame.payload_size, XBeeAPI::MAX_PAYLOAD);
+      frames_dropped.add();
       return;
     }
 
@@ -32,6 +47,7 @@ class XBeeRadioDef : public XBeeRadio {
       OK_ERROR(
           "Outgoing frame too big for buffer (%d > %d), dropping",
           frame.payload_size + 5, space);
+      frames_dropped.add();
       return;
     }
 
@@ -47,6 +63,8 @@ class XBeeRadioDef : public XBeeRadio {
       checksum += frame.payload[i];
     }
     out_buf.push(0xFF - checksum);
+    frames_out.add();
+    out_queue.record(out_buf.size());
 
     OK_DETAIL(
         "Outgoing frame (0x%02x) %d bytes",
@@ -60,6 +78,7 @@ class XBeeRadioDef : public XBeeRadio {
       auto const ch = serial->read();
       if (ch < 0) break;  // Spurious available() seems to happen
       in_buf.push(ch);
+      bytes_in.add();
 
       // Return frames immediately to avoid circular buffer overflow
       if (state == API_MODE && frame != nullptr) {
@@ -72,6 +91,7 @@ class XBeeRadioDef : public XBeeRadio {
           OK_ERROR(
               "Incoming frame too big (%d > %d), ignoring",
               size, XBeeAPI::MAX_PAYLOAD);
+          frames_dropped.add();
           in_buf.shift();
           continue;
         }
@@ -82,6 +102,7 @@ class XBeeRadioDef : public XBeeRadio {
         for (int i = 3; i < size + 5; ++i) check += in_buf[i];
         if (check != 0xFF) {
           OK_ERROR("Bad incoming checksum (0x%02x != 0xFF), ignoring", check);
+          checksum_errors.add();
           in_buf.shift();
           continue;
         }
@@ -94,6 +115,7 @@ class XBeeRadioDef : public XBeeRadio {
         in_buf.shift();                              // Checksum
 
         OK_DETAIL("Incoming frame (0x%02x) %d bytes", frame->type, size);
+        frames_in.add();
         return true;
       }
     }
@@ -182,9 +204,9 @@ class XBeeRadioDef : public XBeeRadio {
           if (to_write <= 0) break;
           auto const write_space = serial->availableForWrite();
           if (write_space <= 0) break;
-          for (int i = 0; i < to_write && i < write_space; ++i) {
-            serial->write(out_buf.shift());
-          }
+          int const chunk = std::min<int>(to_write, write_space);
+          for (int i = 0; i < chunk; ++i) serial->write(out_buf.shift());
+          bytes_out.add(chunk);
         }
         break;
       }
@@ -199,6 +221,16 @@ class XBeeRadioDef : public XBeeRadio {
     return false;
   }
 
+  virtual bool has_pending_io() const override {
+    if (serial->available() > 0) return true;
+    return state == API_MODE && !out_buf.isEmpty() &&
+        serial->availableForWrite() > 0;
+  }
+
+  virtual bool has_pending_output() const override {
+    return state == API_MODE && !out_buf.isEmpty();
+  }
+
   virtual HardwareSerial* raw_serial() const override {
     return serial;
   }
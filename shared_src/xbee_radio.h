@@ -13,6 +13,8 @@ class XBeeRadio {
   virtual int outgoing_space() const = 0;
   virtual void add_outgoing(XBeeAPI::Frame const&) = 0;
   virtual bool poll_for_frame(XBeeAPI::Frame*) = 0;
+  virtual bool has_pending_io() const = 0;  // Bytes to read or write now
+  virtual bool has_pending_output() const = 0;  // Bytes not yet written
   virtual arduino::HardwareSerial* raw_serial() const = 0;
 };
 
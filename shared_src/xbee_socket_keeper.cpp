@@ -1,97 +1,187 @@
 #include "xbee_socket_keeper.h"
 
+#include <algorithm>
+#include <array>
 #include <cstdlib>
 #include <cstring>
+#include <new>
 
 #include <Arduino.h>
 #include <ok_logging.h>
 
+#include "metrics.h"
+#include "trace_log.h"
+
 static const OkLoggingContext OK_CONTEXT("xbee_socket_keeper");
 
+// All targets together; Metrics has them per target
+static MetricsCounter socket_attempts("socket.attempts");
+static MetricsCounter socket_connects("socket.connects");
+static MetricsCounter socket_failures("socket.failures");
+static MetricsHistogram connect_millis("socket.connect_ms");
+
 using namespace XBeeAPI;
 
+// Resolved addresses are reused for reconnects for this long, since the
+// XBee doesn't report DNS TTLs (and a bad address just falls back to DNS)
+static constexpr unsigned long DNS_CACHE_MILLIS = 60 * 60 * 1000;
+static constexpr unsigned long DNS_RETRY_MILLIS = 60 * 1000;
+
+// Give up on a create/connect/close reply after this long (lost frames)
+static constexpr unsigned long STEP_TIMEOUT_MILLIS = 75 * 1000;
+
+// Frame IDs identify the target for replies that don't carry a socket ID
+static constexpr int CREATE_FRAME_ID = 0x60;  // + target index
+static constexpr int LOOKUP_FRAME_ID = 0x70;  // + target index
+
 class XBeeSocketKeeperDef : public XBeeSocketKeeper {
  public:
-  XBeeSocketKeeperDef(
-      char const* host, int port, XBeeAPI::SocketCreate::Protocol proto) {
-    this->host = strdup(host);
-    this->host_size = strlen(host);
-    this->port = port;
-    this->proto = proto;
-    OK_NOTE("Starting: %s:%d (proto=%d)", host, port, proto);
+  XBeeSocketKeeperDef() {
+    OK_NOTE("Starting");
+    by_socket.fill(-1);
   }
 
   ~XBeeSocketKeeperDef() {
     OK_NOTE("Destroying");
-    free(host);
+    for (int t = 0; t < target_count; ++t) {
+      targets[t].send_queue.release();
+      targets[t].receive_queue.release();
+    }
   }
 
   virtual void on_incoming(XBeeAPI::Frame const& frame) override {
     if (auto* reply = frame.decode_as<SocketCreateResponse>()) {
-      if (next_step == CREATE_WAIT && reply->frame_id == 'K') {
+      int const t = reply->frame_id - CREATE_FRAME_ID;
+      if (t < 0 || t >= target_count) return;
+      auto* tg = &targets[t];
+      if (tg->step == CREATE_WAIT) {
         if (reply->status == SocketCreateResponse::OK) {
-          OK_DETAIL("Socket #%d created", reply->socket);
-          socket_id = reply->socket;
-          next_step = CONNECT;
+          OK_DETAIL("[%s] Socket #%d created", tg->name, reply->socket);
+          set_socket(tg, reply->socket);
+          bool const tls = (tg->proto == SocketCreate::Protocol::TLS);
+          set_step(tg, (tls && tg->tls_profile >= 0) ? OPTION : CONNECT);
+        } else {
+          OK_ERROR(
+              "[%s] Socket creation failed: %s",
+              tg->name, reply->status_text());
+          set_step(tg, READY);
+          note_failure(tg, NETWORK_DOWN);
+        }
+      }
+      return;
+    }
+
+    if (auto* reply = frame.decode_as<SocketOptionResponse>()) {
+      auto* tg = target_for_socket(reply->socket);
+      if (tg && tg->step == OPTION_WAIT) {
+        if (reply->status == SocketOptionResponse::OK) {
+          OK_DETAIL(
+              "[%s] Socket #%d using TLS profile %d",
+              tg->name, tg->socket_id, tg->tls_profile);
+          set_step(tg, CONNECT);
         } else {
-          OK_ERROR("Socket creation failed: %s", reply->status_text());
-          socket_id = -1;
-          next_step = READY;
+          OK_ERROR(
+              "[%s] TLS profile %d rejected: %s",
+              tg->name, tg->tls_profile, reply->status_text());
+          note_failure(tg, REFUSED);
+          set_step(tg, CLOSE);
         }
       }
       return;
     }
 
     if (auto* reply = frame.decode_as<SocketConnectResponse>()) {
-      if (reply->socket == socket_id) {
+      if (auto* tg = target_for_socket(reply->socket)) {
         if (reply->status == SocketConnectResponse::STARTED) {
-          OK_DETAIL("Socket #%d connecting", socket_id);
+          OK_DETAIL("[%s] Socket #%d connecting", tg->name, tg->socket_id);
           // This is temporary, wait for CONNECTED SocketStatus
         } else {
-          OK_ERROR("Connection aborted: %s", reply->status_text());
-          next_step = CLOSE;
+          OK_ERROR(
+              "[%s] Connection aborted: %s", tg->name, reply->status_text());
+          if (!forget_address_if_used(tg)) note_failure(tg, REFUSED);
+          set_step(tg, CLOSE);
         }
       }
+      return;
     }
 
     if (auto* status = frame.decode_as<SocketStatus>()) {
-      if (status->socket == socket_id) {
+      if (auto* tg = target_for_socket(status->socket)) {
         if (status->status == SocketStatus::CONNECTED) {
-          OK_NOTE("Socket #%d connected OK", socket_id);
-          next_step = READY;
+          OK_NOTE("[%s] Socket #%d connected OK", tg->name, tg->socket_id);
+          tg->connect_by_address = false;
+          note_success(tg);
+          set_step(tg, READY);
         } else {
-          OK_ERROR("Connection failed: %s", status->status_text());
-          socket_id = -1;  // Non-CONNECTED SocketStatus means it's closed
-          next_step = READY;
+          OK_ERROR(
+              "[%s] Connection failed: %s", tg->name, status->status_text());
+          if (tg->step == READY) {
+            note_failure(tg, LOST);
+          } else if (tg->step == CONNECT_WAIT && !forget_address_if_used(tg)) {
+            note_failure(tg, classify(status->status));
+          }
+          set_socket(tg, -1);  // Non-CONNECTED SocketStatus means it's closed
+          set_step(tg, READY);
         }
       }
       return;
     }
 
     if (auto* reply = frame.decode_as<SocketCloseResponse>()) {
-      if (reply->socket == socket_id &&
-          reply->status == SocketCloseResponse::OK) {
-        OK_NOTE("Socket #%d closed", socket_id);
-        socket_id = -1;
-        next_step = READY;
+      auto* tg = target_for_socket(reply->socket);
+      if (tg && reply->status == SocketCloseResponse::OK) {
+        OK_NOTE("[%s] Socket #%d closed", tg->name, tg->socket_id);
+        set_socket(tg, -1);
+        set_step(tg, READY);
+      }
+      return;
+    }
+
+    int extra_size;
+    if (auto* receive = frame.decode_as<SocketReceive>(&extra_size)) {
+      auto* tg = target_for_socket(receive->socket);
+      if (tg && tg->receive_queue.data) {
+        int const pushed = tg->receive_queue.push(receive->data, extra_size);
+        if (pushed < extra_size) {
+          OK_ERROR(
+              "[%s] Receive queue full, dropped %d/%d bytes",
+              tg->name, extra_size - pushed, extra_size);
+        }
       }
       return;
     }
 
     if (auto* status = frame.decode_as<ModemStatus>()) {
-      network_up = (status->status == ModemStatus::REGISTERED);
+      set_network_up(status->status == ModemStatus::REGISTERED);
       OK_DETAIL(
           "Modem status %s (network %s)", status->status_text(),
           network_up ? "UP" : "DOWN");
       return;
     }
 
-    int extra_size;
     if (auto* reply = frame.decode_as<ATCommandResponse>(&extra_size)) {
+      int const t = reply->frame_id - LOOKUP_FRAME_ID;
+      if (t >= 0 && t < target_count && !memcmp(reply->command, "LA", 2)) {
+        auto* tg = &targets[t];
+        if (reply->status == ATCommandResponse::OK && extra_size == 4) {
+          memcpy(tg->address, reply->data, 4);
+          tg->address_millis = millis();
+          tg->address_valid = true;
+          OK_DETAIL(
+              "[%s] Resolved %s: %d.%d.%d.%d", tg->name, tg->host,
+              tg->address[0], tg->address[1], tg->address[2], tg->address[3]);
+        } else {
+          OK_ERROR(
+              "[%s] Lookup failed (%s, %d bytes)",
+              tg->name, reply->status_text(), extra_size);
+        }
+        return;
+      }
+
       if (!memcmp(reply->command, "AI", 2) &&
           reply->status == ATCommandResponse::OK &&
           extra_size == 1) {
-        network_up = (reply->data[0] == 0x00);
+        set_network_up(reply->data[0] == 0x00);
         OK_DETAIL(
             "Assoc status 0x%02x (network %s)", reply->data[0],
             network_up ? "UP" : "DOWN");
@@ -100,84 +190,504 @@ class XBeeSocketKeeperDef : public XBeeSocketKeeper {
   }
 
   virtual bool maybe_make_outgoing(int space, XBeeAPI::Frame* frame) override {
-    switch (next_step) {
+    // Round-robin so one busy target can't starve the others
+    for (int i = 0; i < target_count; ++i) {
+      int const t = (next_target + i) % target_count;
+      if (target_outgoing(t, space, frame)) {
+        next_target = (t + 1) % target_count;
+        return true;
+      }
+    }
+    return false;
+  }
+
+  virtual int add_target(
+      char const* name, char const* host, int port,
+      XBeeAPI::SocketCreate::Protocol proto, int queue_size,
+      uint8_t* queue_buffers) override {
+    int const name_size = strlen(name) + 1, host_size = strlen(host) + 1;
+    if (target_count >= MAX_TARGETS ||
+        names_used + name_size + host_size > TARGET_NAME_SPACE) {
+      OK_ERROR("Can't add target \"%s\" (%d already)", name, target_count);
+      return -1;
+    }
+
+    auto* tg = &targets[target_count];
+    tg->name = &names[names_used];
+    memcpy(tg->name, name, name_size);
+    tg->host = &names[names_used + name_size];
+    memcpy(tg->host, host, host_size);
+    tg->host_size = host_size - 1;
+    names_used += name_size + host_size;
+    tg->port = port;
+    tg->proto = proto;
+    if (queue_size > 0) {
+      uint8_t* const buf = queue_buffers;
+      tg->send_queue.allocate(queue_size, buf);
+      tg->receive_queue.allocate(queue_size, buf ? buf + queue_size : nullptr);
+    }
+
+    OK_NOTE(
+        "[%s] Target %d: %s:%d (proto=%d queue=%d)",
+        name, target_count, host, port, proto, queue_size);
+    return target_count++;
+  }
+
+  virtual int find_target(char const* name) const override {
+    for (int t = 0; t < target_count; ++t) {
+      if (!strcmp(targets[t].name, name)) return t;
+    }
+    return -1;
+  }
+
+  virtual void set_tls_profile(int t, int profile) override {
+    if (auto* tg = target_at(t)) {
+      OK_FATAL_IF(profile < 0 || profile > 0xFF);
+      OK_FATAL_IF(tg->proto != SocketCreate::Protocol::TLS);
+      tg->tls_profile = profile;
+    }
+  }
+
+  virtual int socket(int t) const override {
+    auto const* tg = target_at(t);
+    return (tg && tg->step == READY) ? tg->socket_id : -1;
+  }
+
+  virtual bool address(int t, uint8_t* ip4) const override {
+    auto const* tg = target_at(t);
+    if (!tg || !address_fresh(tg)) return false;
+    memcpy(ip4, tg->address, 4);
+    return true;
+  }
+
+  virtual void reconnect(int t) override {
+    auto* tg = target_at(t);
+    if (tg && tg->step == READY && tg->socket_id >= 0) {
+      note_failure(tg, LOST);
+      set_step(tg, CLOSE);
+    }
+  }
+
+  virtual int send(int t, void const* data, int size) override {
+    auto* tg = target_at(t);
+    if (!tg || !tg->send_queue.data || tg->socket_id < 0) return 0;
+    return tg->send_queue.push(static_cast<uint8_t const*>(data), size);
+  }
+
+  virtual int receive(int t, void* data, int size) override {
+    auto* tg = target_at(t);
+    if (!tg || !tg->receive_queue.data) return 0;
+    return tg->receive_queue.pop(static_cast<uint8_t*>(data), size);
+  }
+
+  virtual int send_space(int t) const override {
+    auto const* tg = target_at(t);
+    if (!tg || tg->socket_id < 0) return 0;
+    return tg->send_queue.capacity - tg->send_queue.size;
+  }
+
+  virtual int receive_size(int t) const override {
+    auto const* tg = target_at(t);
+    return tg ? tg->receive_queue.size : 0;
+  }
+
+  virtual Health health(int t) const override {
+    auto const* tg = target_at(t);
+    if (!tg) return NO_NETWORK;
+    if (tg->step == READY && tg->socket_id >= 0) return CONNECTED;
+    if (tg->step != READY) return CONNECTING;
+    if (!network_up) return NO_NETWORK;
+    return BACKING_OFF;
+  }
+
+  virtual Metrics const& metrics(int t) const override {
+    static Metrics const no_metrics;
+    auto const* tg = target_at(t);
+    return tg ? tg->stats : no_metrics;
+  }
+
+  virtual void set_backoff(FailureClass fc, Backoff backoff) override {
+    OK_FATAL_IF(fc < 0 || fc >= FAILURE_CLASSES);
+    backoffs[fc] = backoff;
+  }
+
+ private:
+  enum Step {
+    READY, CREATE_WAIT, OPTION, OPTION_WAIT, CONNECT, CONNECT_WAIT,
+    CLOSE, CLOSE_WAIT
+  };
+
+  // Simple byte ring for the optional per-target send/receive queues
+  struct ByteQueue {
+    uint8_t* data = nullptr;
+    bool owned = false;  // Heap-allocated (no caller buffer)
+    int capacity = 0, head = 0, size = 0;
+
+    void allocate(int cap, uint8_t* buf) {
+      owned = (buf == nullptr);
+      data = owned ? new uint8_t[cap] : buf;
+      capacity = cap;
+    }
+
+    void release() { if (owned) delete[] data; }
+    void clear() { head = size = 0; }
+
+    int push(uint8_t const* in, int n) {
+      n = std::min(n, capacity - size);
+      for (int i = 0; i < n; ++i) data[(head + size + i) % capacity] = in[i];
+      size += n;
+      return n;
+    }
+
+    int pop(uint8_t* out, int n) {
+      n = std::min(n, size);
+      for (int i = 0; i < n; ++i) out[i] = data[(head + i) % capacity];
+      head = (head + n) % std::max(capacity, 1);
+      size -= n;
+      return n;
+    }
+  };
+
+  struct Target {
+    char* name = nullptr;
+    char* host = nullptr;
+    int host_size = 0;
+    int port = 0;
+    XBeeAPI::SocketCreate::Protocol proto = SocketCreate::Protocol::TCP;
+    int tls_profile = -1;  // -1 = don't set (XBee default)
+
+    int socket_id = -1;
+    Step step = READY;
+    unsigned long step_millis = 0;
+    unsigned long next_retry_millis = 0;
+
+    uint8_t address[4] = {};  // Cached result of "LA" lookup of host
+    bool address_valid = false;
+    bool connect_by_address = false;
+    unsigned long address_millis = 0;
+    unsigned long lookup_millis = 0;
+
+    Metrics stats;
+    unsigned long attempt_millis = 0;
+
+    ByteQueue send_queue, receive_queue;
+  };
+
+  std::array<Target, MAX_TARGETS> targets;
+  int target_count = 0;
+  std::array<char, TARGET_NAME_SPACE> names;  // Target names and hosts
+  int names_used = 0;
+  int next_target = 0;
+  std::array<int8_t, 256> by_socket;  // XBee socket ID => target index
+
+  // Shared by all targets, since they all use the same cellular link
+  bool network_up = false;
+  unsigned long network_retry_millis = 0;
+  int network_failures = 0;
+
+  Backoff backoffs[FAILURE_CLASSES] = {
+    {5000, 300000},   // NETWORK_DOWN: the modem will say when it's back
+    {10000, 600000},  // DNS_FAILED: rarely fixes itself quickly
+    {5000, 300000},   // REFUSED: server restarting, or misconfigured
+    {1000, 60000},    // LOST: usually a short drop, retry promptly
+  };
+
+  Target* target_at(int t) {
+    return (t >= 0 && t < target_count) ? &targets[t] : nullptr;
+  }
+
+  Target const* target_at(int t) const {
+    return (t >= 0 && t < target_count) ? &targets[t] : nullptr;
+  }
+
+  Target* target_for_socket(int socket_id) {
+    int const t = by_socket[socket_id & 0xFF];
+    return t >= 0 ? &targets[t] : nullptr;
+  }
+
+  void set_socket(Target* tg, int socket_id) {
+    if (tg->socket_id >= 0) by_socket[tg->socket_id & 0xFF] = -1;
+    if (socket_id >= 0) by_socket[socket_id & 0xFF] = tg - &targets[0];
+    tg->socket_id = socket_id;
+    tg->send_queue.clear();  // Stale data is meaningless on a new socket
+  }
+
+  void set_step(Target* tg, Step step) {
+    tg->step = step;
+    tg->step_millis = millis();
+  }
+
+  bool target_outgoing(int t, int space, XBeeAPI::Frame* frame) {
+    unsigned long const now = millis();
+    auto* tg = &targets[t];
+    switch (tg->step) {
       case READY:
-        if (socket_id < 0 && network_up &&
-            space >= wire_size_of<SocketCreate>()) {
-          auto const now = millis();
-          if (now > next_retry_millis) {
-            next_retry_millis = now + 3000;
-            auto* create = frame->setup_as<SocketCreate>();
-            create->frame_id = 'K';
-            create->protocol = proto;
-            next_step = CREATE_WAIT;
-            OK_DETAIL("Creating socket proto=%d", proto);
+        if (tg->socket_id >= 0 && tg->send_queue.size > 0 &&
+            space > wire_size_of<SocketSend>()) {
+          int const size = std::min(
+              space - wire_size_of<SocketSend>(),
+              int(MAX_PAYLOAD - sizeof(SocketSend)));
+          auto* send = frame->setup_as<SocketSend>(0);
+          send->frame_id = 0;  // Errors show up as SocketStatus anyway
+          send->socket = tg->socket_id;
+          frame->payload_size += tg->send_queue.pop(send->data, size);
+          OK_DETAIL(
+              "[%s] >> %d bytes queued => #%d",
+              tg->name, int(frame->payload_size - sizeof(SocketSend)),
+              tg->socket_id);
+          return true;
+        }
+
+        if (tg->socket_id >= 0 && !address_fresh(tg) && !is_tls(tg) &&
+            space >= wire_size_of<ATCommand>(tg->host_size)) {
+          // Resolve while connected, so the next reconnect can skip DNS
+          auto const since_lookup = now - tg->lookup_millis;
+          if (since_lookup >= DNS_RETRY_MILLIS || !tg->lookup_millis) {
+            tg->lookup_millis = now;
+            auto* command = frame->setup_as<ATCommand>(tg->host_size);
+            command->frame_id = LOOKUP_FRAME_ID + t;
+            memcpy(command->command, "LA", 2);
+            memcpy(command->data, tg->host, tg->host_size);
+            OK_DETAIL("[%s] Looking up %s", tg->name, tg->host);
             return true;
           }
         }
+
+        if (tg->socket_id < 0 && network_up &&
+            long(now - network_retry_millis) >= 0 &&
+            long(now - tg->next_retry_millis) >= 0 &&
+            space >= wire_size_of<SocketCreate>()) {
+          auto* create = frame->setup_as<SocketCreate>();
+          create->frame_id = CREATE_FRAME_ID + t;
+          create->protocol = tg->proto;
+          tg->attempt_millis = now;
+          ++tg->stats.attempts;
+          socket_attempts.add();
+          set_step(tg, CREATE_WAIT);
+          OK_DETAIL("[%s] Creating socket proto=%d", tg->name, tg->proto);
+          return true;
+        }
+        break;
+
+      case OPTION:
+        if (tg->socket_id < 0) {
+          set_step(tg, READY);
+        } else if (space >= wire_size_of<SocketOptionRequest>(1)) {
+          auto* option = frame->setup_as<SocketOptionRequest>(1);
+          option->frame_id = 1;
+          option->socket = tg->socket_id;
+          option->option = SocketOptionRequest::TLS_PROFILE;
+          option->data[0] = tg->tls_profile;
+          set_step(tg, OPTION_WAIT);
+          OK_DETAIL(
+              "[%s] Setting #%d TLS profile %d",
+              tg->name, tg->socket_id, tg->tls_profile);
+          return true;
+        }
         break;
 
       case CONNECT:
-        if (socket_id < 0) {
-          next_step = READY;
-        } else if (space >= wire_size_of<SocketConnect>(host_size)) {
-          auto* connect = frame->setup_as<SocketConnect>(host_size);
+        if (tg->socket_id < 0) {
+          set_step(tg, READY);
+        } else if (address_fresh(tg) && !is_tls(tg)) {
+          if (space >= wire_size_of<SocketConnect>(4)) {
+            auto* connect = frame->setup_as<SocketConnect>(4);
+            connect->frame_id = 1;
+            connect->socket = tg->socket_id;
+            connect->dest_port = tg->port;
+            connect->address_type = SocketConnect::IPV4;
+            memcpy(connect->address, tg->address, 4);
+            tg->connect_by_address = true;
+            set_step(tg, CONNECT_WAIT);
+            OK_NOTE(
+                "[%s] Connecting #%d to %d.%d.%d.%d:%d (%s)",
+                tg->name, tg->socket_id,
+                tg->address[0], tg->address[1], tg->address[2], tg->address[3],
+                tg->port, tg->host);
+            return true;
+          }
+        } else if (space >= wire_size_of<SocketConnect>(tg->host_size)) {
+          auto* connect = frame->setup_as<SocketConnect>(tg->host_size);
           connect->frame_id = 1;
-          connect->socket = socket_id;
-          connect->dest_port = port;
+          connect->socket = tg->socket_id;
+          connect->dest_port = tg->port;
           connect->address_type = SocketConnect::TEXT;
-          memcpy(connect->address, host, host_size);
-          next_step = CONNECT_WAIT;
+          memcpy(connect->address, tg->host, tg->host_size);
+          tg->connect_by_address = false;
+          set_step(tg, CONNECT_WAIT);
           OK_NOTE(
-              "Connecting #%d to %.*s:%d",
-              socket_id, host_size, connect->address, port);
+              "[%s] Connecting #%d to %s:%d",
+              tg->name, tg->socket_id, tg->host, tg->port);
           return true;
         }
         break;
 
       case CLOSE:
-        if (socket_id < 0) {
-          next_step = READY;
+        if (tg->socket_id < 0) {
+          set_step(tg, READY);
         } else if (space >= wire_size_of<SocketClose>()) {
           auto* close = frame->setup_as<SocketClose>();
           close->frame_id = 1;
-          close->socket = socket_id;
-          next_step = CLOSE_WAIT;
-          OK_NOTE("Closing socket #%d", socket_id);
+          close->socket = tg->socket_id;
+          set_step(tg, CLOSE_WAIT);
+          OK_NOTE("[%s] Closing socket #%d", tg->name, tg->socket_id);
           return true;
         }
         break;
+
+      case CREATE_WAIT:
+      case OPTION_WAIT:
+      case CONNECT_WAIT:
+      case CLOSE_WAIT:
+        if (now - tg->step_millis > STEP_TIMEOUT_MILLIS) {
+          OK_ERROR(
+              "[%s] No reply from XBee (step=%d), closing",
+              tg->name, tg->step);
+          if (tg->step != CLOSE_WAIT) note_failure(tg, NETWORK_DOWN);
+          set_step(tg, tg->socket_id >= 0 ? CLOSE : READY);
+        }
+        break;
     }
 
     return false;
   }
 
-  virtual int socket() const override {
-    return next_step == READY ? socket_id : -1;
+  void set_network_up(bool up) {
+    if (up && !network_up) {
+      network_retry_millis = millis();  // Try right away when service returns
+      for (int t = 0; t < target_count; ++t) {
+        targets[t].next_retry_millis = network_retry_millis;
+      }
+    }
+    network_up = up;
+  }
+
+  // TLS connects by name, which the XBee needs for SNI and certificate
+  // checks; an address-only connect fails against name-checked brokers
+  static bool is_tls(Target const* tg) {
+    return tg->proto == SocketCreate::Protocol::TLS;
+  }
+
+  static bool address_fresh(Target const* tg) {
+    return tg->address_valid &&
+        millis() - tg->address_millis < DNS_CACHE_MILLIS;
+  }
+
+  static bool forget_address_if_used(Target* tg) {
+    if (!tg->connect_by_address) return false;
+    OK_ERROR("[%s] Dropping cached address for %s", tg->name, tg->host);
+    tg->address_valid = tg->connect_by_address = false;
+    tg->next_retry_millis = millis();  // Retry by name right away
+    return true;
+  }
+
+  void note_success(Target* tg) {
+    auto& stats = tg->stats;
+    long const elapsed = millis() - tg->attempt_millis;
+    auto const prev = stats.typical_connect_millis;
+    stats.last_connect_millis = elapsed;
+    stats.typical_connect_millis =
+        prev < 0 ? elapsed : (prev * 7 + elapsed) / 8;
+    stats.consecutive_failures = 0;
+    ++stats.successes;
+    socket_connects.add();
+    connect_millis.record(elapsed);
+    network_failures = 0;  // The network evidently works
   }
 
-  virtual void reconnect() override {
-    if (next_step == READY && socket_id >= 0) {
-      next_step = CLOSE;
+  void note_failure(Target* tg, FailureClass fc) {
+    auto& stats = tg->stats;
+    ++stats.failures[fc];
+    ++stats.consecutive_failures;
+    socket_failures.add();
+
+    // Network trouble holds off every target; other failures are per target
+    int const n = (fc == NETWORK_DOWN)
+        ? ++network_failures : stats.consecutive_failures;
+    long const delay = backoff_delay(backoffs[fc], n);
+    unsigned long const retry = millis() + delay;
+    if (fc == NETWORK_DOWN) {
+      network_retry_millis = retry;
+    } else {
+      tg->next_retry_millis = retry;
     }
+
+    OK_NOTE(
+        "[%s] Failure #%d (%s), retry in %ldms",
+        tg->name, n, failure_text(fc), delay);
   }
 
- private:
-  char* host;
-  int host_size;
-  int port;
-  XBeeAPI::SocketCreate::Protocol proto;
+  static long backoff_delay(Backoff const& backoff, int failures) {
+    int const n = std::min(std::max(failures, 1), 16);
+    long const initial = std::max(backoff.initial_millis, 0L);
+    long const max = std::max(backoff.max_millis, 0L);
+    long const full = (initial > (max >> (n - 1)))
+        ? max : initial << (n - 1);  // Shifting past max could overflow
 
-  bool network_up = false;
-  long next_retry_millis = 0;
-  int socket_id = -1;
+    // "Equal jitter": half fixed, half random, so retries spread out
+    return full / 2 + random(full / 2 + 1);
+  }
 
-  enum {
-    READY, CREATE_WAIT, CONNECT, CONNECT_WAIT, CLOSE, CLOSE_WAIT
-  } next_step = READY;
+  static FailureClass classify(SocketStatus::Status status) {
+    switch (status) {
+      case SocketStatus::FAILED_DNS:
+      case SocketStatus::UNKNOWN_SERVER:
+        return DNS_FAILED;
+      case SocketStatus::CONNECTION_REFUSED:
+      case SocketStatus::RESET_BY_PEER:
+      case SocketStatus::HOST_UNREACHABLE:
+        return REFUSED;
+      default:
+        return NETWORK_DOWN;
+    }
+  }
 };
 
+XBeeSocketKeeper* make_xbee_socket_keeper() {
+  return new XBeeSocketKeeperDef();
+}
+
 XBeeSocketKeeper* make_xbee_socket_keeper(
     char const* host, int port, XBeeAPI::SocketCreate::Protocol proto) {
-  return new XBeeSocketKeeperDef(host, port, proto);
+  XBeeSocketKeeper* keeper = new XBeeSocketKeeperDef();
+  keeper->add_target("default", host, port, proto);
+  return keeper;
+}
+
+XBeeSocketKeeper* make_xbee_socket_keeper(XBeeSocketKeeperStorage* mem) {
+  static_assert(sizeof(XBeeSocketKeeperDef) <= sizeof(*mem));
+  return new (mem->bytes) XBeeSocketKeeperDef();
+}
+
+XBeeSocketKeeper* make_xbee_socket_keeper(
+    XBeeSocketKeeperStorage* mem,
+    char const* host, int port, XBeeAPI::SocketCreate::Protocol proto) {
+  XBeeSocketKeeper* keeper = make_xbee_socket_keeper(mem);
+  keeper->add_target("default", host, port, proto);
+  return keeper;
+}
+
+char const* XBeeSocketKeeper::health_text(Health health) {
+  switch (health) {
+#define S(x) case x: return #x
+    S(NO_NETWORK);
+    S(BACKING_OFF);
+    S(CONNECTING);
+    S(CONNECTED);
+#undef S
+  }
+  return "UNKNOWN_HEALTH";
+}
+
+char const* XBeeSocketKeeper::failure_text(FailureClass fc) {
+  switch (fc) {
+#define S(x) case x: return #x
+    S(NETWORK_DOWN);
+    S(DNS_FAILED);
+    S(REFUSED);
+    S(LOST);
+#undef S
+    default: break;
+  }
+  return "UNKNOWN_FAILURE";
 }
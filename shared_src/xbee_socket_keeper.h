@@ -1,4 +1,9 @@
-// Keeps an XBee socket connected to a designated Internet host.
+// Keeps XBee sockets connected to designated Internet hosts ("targets").
+// Host addresses are looked up (ATLA) and cached, so reconnects skip DNS
+// (except TLS targets, which always connect by name).
+// Failed attempts back off exponentially (with jitter) by failure class;
+// network-down backoff is shared by all targets, others are per target.
+// Targets may use TLS (SocketCreate::Protocol::TLS) with a chosen profile.
 
 #pragma once
 
@@ -6,13 +11,83 @@
 
 class XBeeSocketKeeper {
  public:
+  static constexpr int MAX_TARGETS = 8;
+  static constexpr int TARGET_NAME_SPACE = 512;  // Names and hosts, with NULs
+
+  enum FailureClass {
+    NETWORK_DOWN,  // Not registered, PDP deactivated, timeouts
+    DNS_FAILED,    // Name lookup failed
+    REFUSED,       // Host reachable but rejected or reset the connection
+    LOST,          // Connection dropped (or reconnect() requested)
+    FAILURE_CLASSES
+  };
+
+  enum Health { NO_NETWORK, BACKING_OFF, CONNECTING, CONNECTED };
+
+  struct Backoff {
+    long initial_millis;  // Delay after the first failure
+    long max_millis;      // Cap on the doubling delay
+  };
+
+  struct Metrics {
+    int attempts = 0;              // Socket creations started
+    int successes = 0;             // Connections established
+    int failures[FAILURE_CLASSES] = {};
+    int consecutive_failures = 0;
+    long last_connect_millis = -1;     // Create-to-connected time, last OK
+    long typical_connect_millis = -1;  // Moving average of the above
+
+    float success_ratio() const {
+      return attempts > 0 ? float(successes) / attempts : 0.0f;
+    }
+  };
+
   virtual ~XBeeSocketKeeper() = default;
   virtual void on_incoming(XBeeAPI::Frame const&) = 0;
   virtual bool maybe_make_outgoing(int space, XBeeAPI::Frame*) = 0;
 
-  virtual int socket() const = 0;  // -1 if not connected
-  virtual void reconnect() = 0;    // Disconnect and reconnect
+  // Returns the target index (for the calls below), or -1 if full.
+  // If queue_size > 0, the keeper buffers data for send() and receive(),
+  // in queue_buffers (2 * queue_size bytes, e.g. a static) or on the heap;
+  // otherwise the caller exchanges SocketSend/SocketReceive frames itself.
+  virtual int add_target(
+      char const* name, char const* host, int port,
+      XBeeAPI::SocketCreate::Protocol, int queue_size = 0,
+      uint8_t* queue_buffers = nullptr) = 0;
+  virtual int find_target(char const* name) const = 0;  // -1 if not found
+
+  // For TLS targets, selects the XBee TLS profile (AT$0..$2) by SocketOption
+  // before connecting; otherwise the XBee uses its default profile (0).
+  virtual void set_tls_profile(int target, int profile) = 0;
+
+  virtual int socket(int target = 0) const = 0;  // -1 if not connected
+  virtual bool address(int target, uint8_t* ip4) const = 0;  // If resolved
+  virtual void reconnect(int target = 0) = 0;    // Close and reconnect
+
+  virtual int send(int target, void const*, int size) = 0;  // Bytes queued
+  virtual int receive(int target, void*, int size) = 0;     // Bytes taken
+  virtual int send_space(int target) const = 0;
+  virtual int receive_size(int target) const = 0;
+
+  virtual Health health(int target = 0) const = 0;
+  virtual Metrics const& metrics(int target = 0) const = 0;
+  virtual void set_backoff(FailureClass, Backoff) = 0;
+
+  static char const* health_text(Health);
+  static char const* failure_text(FailureClass);
 };
 
+XBeeSocketKeeper* make_xbee_socket_keeper();  // Add targets separately
+
+// Makes a keeper with a single target (index 0)
+XBeeSocketKeeper* make_xbee_socket_keeper(
+    char const* host, int port, XBeeAPI::SocketCreate::Protocol proto);
+
+// Caller-provided space (e.g. a static) to make a keeper without the heap
+// (if queues also get caller buffers); destroy with ~XBeeSocketKeeper(),
+// not delete.
+struct XBeeSocketKeeperStorage { alignas(8) uint8_t bytes[2560]; };
+XBeeSocketKeeper* make_xbee_socket_keeper(XBeeSocketKeeperStorage*);
 XBeeSocketKeeper* make_xbee_socket_keeper(
+    XBeeSocketKeeperStorage*,
     char const* host, int port, XBeeAPI::SocketCreate::Protocol proto);
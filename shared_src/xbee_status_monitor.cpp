@@ -1,10 +1,14 @@
 #include "xbee_status_monitor.h"
 
+#include <algorithm>
 #include <array>
+#include <new>
 
 #include <Arduino.h>
 #include <ok_logging.h>
 
+#include "trace_log.h"
+
 static const OkLoggingContext OK_CONTEXT("xbee_status_monitor");
 
 using namespace XBeeAPI;
@@ -12,6 +16,8 @@ using namespace XBeeAPI;
 class XBeeStatusMonitorDef : public XBeeStatusMonitor {
  public:
   virtual void on_incoming(Frame const& frame) override {
+    last_incoming_millis = millis();  // Any frame means the modem is awake
+
     int extra;
     if (auto* r = frame.decode_as<ATCommandResponse>(&extra)) {
       if (r->frame_id < 128 || r->frame_id >= 128 + cyclics.size()) {
@@ -61,6 +67,22 @@ class XBeeStatusMonitorDef : public XBeeStatusMonitor {
   virtual bool maybe_make_outgoing(int space, Frame* out) override {
     if (space < wire_size_of<ATCommand>(1)) return false;
 
+    long const now = millis();
+    if (!radio_awake()) {
+      // Anything sent while asleep is lost, so just probe for the next wake,
+      // once the modem has surely dozed off (a probe before then would be
+      // activity, and keep it awake for another ST)
+      long const idle = now - last_incoming_millis;
+      if (idle < long(stat.wake_time_millis) * 5 / 4) return false;
+      if (now - next_probe_millis < 0) return false;
+      OK_FATAL_IF(memcmp(cyclics[ASSOC_CYCLIC].command, "AI", 2));
+      auto* command = out->setup_as<ATCommand>();
+      command->frame_id = 128 + ASSOC_CYCLIC;
+      memcpy(command->command, "AI", 2);
+      next_probe_millis = now + 1000;
+      return true;
+    }
+
     if (conf_carrier != UNKNOWN_PROFILE) {
       auto* command = out->setup_as<ATCommand>(1);
       command->frame_id = 0;  // No ack, we'll just poll immediately after
@@ -89,7 +111,34 @@ class XBeeStatusMonitorDef : public XBeeStatusMonitor {
       return true;
     }
 
-    long const now = millis();
+    if (conf_sleep_steps > 0) {
+      if (space < wire_size_of<ATCommand>(4)) return false;
+
+      // Timing first, so the modem never sleeps with stale SP/ST values
+      if (conf_sleep_steps == 1) {
+        OK_DETAIL("Requesting sleep mode %d", conf_sleep_mode);
+        auto* command = out->setup_as<ATCommand>(1);
+        memcpy(command->command, "SM", 2);
+        command->data[0] = conf_sleep_mode;
+        command->frame_id = 0;  // No ack, we'll just poll immediately after
+      } else {
+        bool const sp = (conf_sleep_steps == 3);
+        auto* command = out->setup_as<ATCommand>(4);
+        memcpy(command->command, sp ? "SP" : "ST", 2);
+        auto* value = reinterpret_cast<uint32_be*>(command->data);
+        *value = sp ? conf_sleep_millis : conf_wake_millis;
+        command->frame_id = 0;  // No ack, we'll just poll immediately after
+      }
+
+      if (--conf_sleep_steps == 0) {
+        for (int i = 2; i <= 4; ++i) {
+          cyclics[i].next_millis = 0;  // Check immediately after setting
+          cyclics[i].enabled = true;
+        }
+      }
+      return true;
+    }
+
     Cyclic* next = nullptr;
     for (auto& cyc : cyclics) {
       if (!cyc.enabled) continue;
@@ -103,7 +152,7 @@ class XBeeStatusMonitorDef : public XBeeStatusMonitor {
       auto* command = out->setup_as<ATCommand>();
       command->frame_id = 128 + (next - &cyclics[0]);
       memcpy(command->command, next->command, sizeof(command->command));
-      next->next_millis = now + 10000;  // 20s poll (or status change)
+      next->next_millis = now + poll_period();  // (Or on status change)
       return true;
     }
 
@@ -112,16 +161,34 @@ class XBeeStatusMonitorDef : public XBeeStatusMonitor {
 
   virtual Status const& status() const override { return stat; }
 
-  virtual void configure_carrier(CarrierProfile carrier) {
+  virtual void configure_carrier(CarrierProfile carrier) override {
     conf_carrier = carrier;
     cyclics[0].next_millis = 0;  // Force immediate set
   }
 
-  virtual void configure_apn(char const* apn) {
+  virtual void configure_apn(char const* apn) override {
     copy_text(apn, strlen(apn), conf_apn);
     cyclics[1].next_millis = 0;  // Force immediate set
   }
 
+  virtual void configure_sleep(
+      SleepMode mode, uint32_t sleep_millis, uint32_t wake_millis) override {
+    conf_sleep_mode = mode;
+    conf_sleep_millis = sleep_millis;
+    conf_wake_millis = wake_millis;
+    conf_sleep_steps = 3;  // SP, ST, then SM
+  }
+
+  virtual bool radio_awake() const override {
+    if (stat.sleep_mode == NO_SLEEP || stat.sleep_mode == UNKNOWN_SLEEP) {
+      return true;
+    }
+
+    // Margin for modem idle time we can't see (it only counts its own)
+    long const idle = millis() - last_incoming_millis;
+    return idle < long(stat.wake_time_millis) * 3 / 4;
+  }
+
  private:
   struct Cyclic {
     char command[3];
@@ -131,15 +198,19 @@ class XBeeStatusMonitorDef : public XBeeStatusMonitor {
     long next_millis = 0;
   };
 
-  std::array<Cyclic, 15> cyclics{{
+  static constexpr int ASSOC_CYCLIC = 10;
+  std::array<Cyclic, 18> cyclics{{
     { "CP", &XBeeStatusMonitorDef::handle_config_cp },   // Must be [0]
     { "AN", &XBeeStatusMonitorDef::handle_config_apn },  // Must be [1]
+    { "SP", &XBeeStatusMonitorDef::handle_sleep_period },  // Must be [2]
+    { "ST", &XBeeStatusMonitorDef::handle_wake_time },     // Must be [3]
+    { "SM", &XBeeStatusMonitorDef::handle_sleep_mode },    // Must be [4]
     { "HV", &XBeeStatusMonitorDef::handle_hver },
     { "VR", &XBeeStatusMonitorDef::handle_fver },
     { "S#", &XBeeStatusMonitorDef::handle_iccid },
     { "IM", &XBeeStatusMonitorDef::handle_imei },
     { "II", &XBeeStatusMonitorDef::handle_imsi },
-    { "AI", &XBeeStatusMonitorDef::handle_assoc },
+    { "AI", &XBeeStatusMonitorDef::handle_assoc },  // ASSOC_CYCLIC
     { "MN", &XBeeStatusMonitorDef::handle_operator },
     { "DT", &XBeeStatusMonitorDef::handle_time },
     { "OA", &XBeeStatusMonitorDef::handle_operating_apn },
@@ -153,6 +224,22 @@ class XBeeStatusMonitorDef : public XBeeStatusMonitor {
 
   CarrierProfile conf_carrier = UNKNOWN_PROFILE;
   char conf_apn[50] = "";
+  SleepMode conf_sleep_mode = UNKNOWN_SLEEP;
+  uint32_t conf_sleep_millis = 0, conf_wake_millis = 0;
+  int conf_sleep_steps = 0;  // SP/ST/SM commands left to send
+
+  long last_incoming_millis = 0;
+  long next_probe_millis = 0;
+
+  // Every poll is modem activity that restarts its ST idle timer, so in
+  // cyclic sleep each status is polled at most once per sleep cycle
+  long poll_period() const {
+    if (stat.sleep_mode != CYCLIC_SLEEP && stat.sleep_mode != CYCLIC_PIN_WAKE) {
+      return 10000;
+    }
+    long const cycle = stat.sleep_period_millis + stat.wake_time_millis;
+    return std::max(10000L, cycle);
+  }
 
   template <int N>
   void copy_text(void const* from, int from_size, char (&to)[N]) {
@@ -208,6 +295,42 @@ class XBeeStatusMonitorDef : public XBeeStatusMonitor {
     }
   }
 
+  static uint32_t number_value(ATCommandResponse const& r, int extra) {
+    uint32_t value = 0;  // Big-endian, but may omit leading zero bytes
+    for (int i = 0; i < extra && i < 4; ++i) value = value << 8 | r.data[i];
+    return value;
+  }
+
+  void handle_sleep_period(Cyclic* cyc, ATCommandResponse const& r, int extra) {
+    if (extra >= 1 && extra <= 4) {
+      stat.sleep_period_millis = number_value(r, extra);
+      OK_DETAIL("Sleep period %lums", (unsigned long) stat.sleep_period_millis);
+      cyc->enabled = false;  // Won't change (unless we change it)
+    } else if (extra != 0) {
+      OK_ERROR("Bad reply length (SP: %d bytes)", extra);
+    }
+  }
+
+  void handle_wake_time(Cyclic* cyc, ATCommandResponse const& r, int extra) {
+    if (extra >= 1 && extra <= 4) {
+      stat.wake_time_millis = number_value(r, extra);
+      OK_DETAIL("Wake time %lums", (unsigned long) stat.wake_time_millis);
+      cyc->enabled = false;  // Won't change (unless we change it)
+    } else if (extra != 0) {
+      OK_ERROR("Bad reply length (ST: %d bytes)", extra);
+    }
+  }
+
+  void handle_sleep_mode(Cyclic* cyc, ATCommandResponse const& r, int extra) {
+    if (extra == 1) {
+      stat.sleep_mode = (SleepMode) r.data[0];
+      OK_DETAIL("Sleep mode %s", stat.sleep_mode_text());
+      cyc->enabled = false;  // Won't change (unless we change it)
+    } else if (extra != 0) {
+      OK_ERROR("Bad reply length (SM: %d != 1 byte)", extra);
+    }
+  }
+
   void handle_assoc(Cyclic*, ATCommandResponse const& r, int extra) {
     if (extra == 1) {
       stat.assoc_status = (AssociationStatus) r.data[0];
@@ -291,6 +414,11 @@ XBeeStatusMonitor* make_xbee_status_monitor() {
   return new XBeeStatusMonitorDef();
 }
 
+XBeeStatusMonitor* make_xbee_status_monitor(XBeeStatusMonitorStorage* mem) {
+  static_assert(sizeof(XBeeStatusMonitorDef) <= sizeof(*mem));
+  return new (mem->bytes) XBeeStatusMonitorDef();
+}
+
 char const* XBeeStatusMonitor::Status::carrier_profile_text() const {
   switch (carrier_profile) {
 #define S(x) case x: return #x
@@ -326,6 +454,18 @@ char const* XBeeStatusMonitor::Status::assoc_text() const {
   }
 }
 
+char const* XBeeStatusMonitor::Status::sleep_mode_text() const {
+  switch (sleep_mode) {
+#define S(x) case x: return #x
+    S(NO_SLEEP);
+    S(PIN_SLEEP);
+    S(CYCLIC_SLEEP);
+    S(CYCLIC_PIN_WAKE);
+#undef S
+    default: return "UNKNOWN_SLEEP";
+  }
+}
+
 char const* XBeeStatusMonitor::Status::technology_text() const {
   switch (technology) {
 #define S(x) case x: return #x
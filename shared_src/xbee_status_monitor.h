@@ -24,6 +24,12 @@ class XBeeStatusMonitor {
     GSM = 0, LTE_M = 8, NB_IOT = 9, UNKNOWN_TECH = 0xFFFF,
   };
 
+  // SM values; cyclic sleep lets the modem use network power saving (PSM)
+  enum SleepMode : uint8_t {
+    NO_SLEEP = 0, PIN_SLEEP = 1, CYCLIC_SLEEP = 4, CYCLIC_PIN_WAKE = 5,
+    UNKNOWN_SLEEP = 0xFF,
+  };
+
   struct Status {
     uint16_t hardware_ver;
     uint32_t firmware_ver;
@@ -41,10 +47,14 @@ class XBeeStatusMonitor {
     float received_power;
     float received_quality;
     uint8_t ip_address[4];
+    SleepMode sleep_mode = UNKNOWN_SLEEP;
+    uint32_t sleep_period_millis;  // SP, time asleep per cycle
+    uint32_t wake_time_millis;     // ST, idle time before sleeping again
 
     char const* carrier_profile_text() const;
     char const* assoc_text() const;
     char const* technology_text() const;
+    char const* sleep_mode_text() const;
   };
 
   virtual ~XBeeStatusMonitor() = default;
@@ -54,6 +64,22 @@ class XBeeStatusMonitor {
   virtual Status const& status() const = 0;
   virtual void configure_carrier(CarrierProfile) = 0;
   virtual void configure_apn(char const*) = 0;
+
+  // Sets SM/SP/ST. While the modem sleeps it ignores UART input, so
+  // callers should only send (socket data etc) when radio_awake().
+  virtual void configure_sleep(
+      SleepMode, uint32_t sleep_millis, uint32_t wake_millis) = 0;
+
+  // Best guess from recent traffic; true if sleep is disabled or unknown.
+  // While asleep, the monitor probes periodically to notice the next wake.
+  // In cyclic sleep, status is polled once per cycle (not every 10s), so
+  // the monitor itself doesn't keep the modem awake.
+  virtual bool radio_awake() const = 0;
 };
 
 XBeeStatusMonitor* make_xbee_status_monitor();
+
+// Caller-provided space (e.g. a static) to make a monitor without the heap;
+// destroy with ~XBeeStatusMonitor(), not delete.
+struct XBeeStatusMonitorStorage { alignas(8) uint8_t bytes[1280]; };
+XBeeStatusMonitor* make_xbee_status_monitor(XBeeStatusMonitorStorage*);
@@ -0,0 +1,99 @@
+// Cycle counts for CellModemClient input handling: URC lines, and inbound
+// #XMQTTMSG payloads streamed to the message handler. The modem is a
+// FakeSerial, so only code time is counted.
+
+#include "cell_modem_client.h"
+
+#include <Arduino.h>
+#include <benchmarks.h>
+#include <fake_serial.h>
+#include <verifiers.h>
+
+static OkLoggingContext OK_CONTEXT("cell_modem_bench_test");
+
+static constexpr int ROUNDS = 5;
+static constexpr int URC_LINES = 100;
+static constexpr int MESSAGES = 4;
+static constexpr int MESSAGE_SIZE = 1000;
+
+static etl::string<1024> write_buf;
+static FakeSerial fake_serial(0, "", &write_buf);
+static etl::unique_ptr<CellModemClient> client;
+
+static etl::string<2048> urc_input;
+static etl::string<5000> message_input;
+static int received_bytes = 0;
+
+static void on_message_chunk(CellModemMessageChunk const& chunk) {
+  received_bytes += chunk.data.size();
+}
+
+static void setup_input() {
+  // Quiet URCs (PUBACK, SUBACK) so logging doesn't dominate
+  for (int i = 0; i < URC_LINES; ++i) {
+    urc_input.append(i % 2 ? "#XMQTTEVT: 7,0\r\n" : "#XMQTTEVT: 3,0\r\n");
+  }
+
+  etl::string_view const topic = "blub/bench/command";
+  for (int i = 0; i < MESSAGES; ++i) {
+    char header[40];
+    snprintf(
+      header, sizeof(header), "#XMQTTMSG: %d,%d\r\n",
+      (int) topic.size(), MESSAGE_SIZE
+    );
+    message_input.append(header);
+    message_input.append(topic.data(), topic.size());
+    message_input.append("\r\n");
+    for (int j = 0; j < MESSAGE_SIZE; ++j) {
+      message_input.push_back('a' + j % 26);
+    }
+    message_input.append("\r\n");
+  }
+}
+
+static void bench_urc_lines() {
+  OK_NOTE("#TEST# bench_urc_lines");
+  static int acks = 0;
+  auto const result = bench_fastest(ROUNDS, [] {
+    write_buf.clear();  // Bring-up commands, never answered
+    fake_serial.read_buf = urc_input;
+    acks = client->poll().mqtt_publish_acks;
+    return (int) urc_input.size();
+  });
+
+  VERIFY_A_OP_B(acks, ==, ROUNDS * URC_LINES / 2);
+  BENCH_REPORT("cell_modem_urc_line", result, "byte");
+}
+
+static void bench_message_receive() {
+  OK_NOTE("#TEST# bench_message_receive");
+  auto const result = bench_fastest(ROUNDS, [] {
+    write_buf.clear();
+    received_bytes = 0;
+    fake_serial.read_buf = message_input;
+    client->poll();
+    return (int) message_input.size();
+  });
+
+  VERIFY_A_OP_B(received_bytes, ==, MESSAGES * MESSAGE_SIZE);
+  VERIFY_A_OP_B(client->poll().mqtt_truncated, ==, 0);
+  BENCH_REPORT("cell_modem_message_receive", result, "byte");
+}
+
+void setup() {
+  Serial1.begin(115200);
+  ok_logging_stream = &Serial1;
+  OK_NOTE("#BEGIN-TESTS#");
+
+  setup_input();
+  client = make_cell_modem_client(&fake_serial, "mqtt-serv");
+  client->set_message_handler(
+    CellModemMessageHandler::create<on_message_chunk>()
+  );
+
+  bench_urc_lines();
+  bench_message_receive();
+  OK_NOTE("#END-TESTS#");
+}
+
+void loop() {}
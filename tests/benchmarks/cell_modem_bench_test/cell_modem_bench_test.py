@@ -0,0 +1,9 @@
+# The sketch times CellModemClient input parsing on a fake serial port
+# (no emulated devices); see ../conftest.py for baseline checks.
+
+
+def test_cell_modem_bench(benchmark_results):
+    assert benchmark_results.keys() == {
+        "cell_modem_message_receive",
+        "cell_modem_urc_line",
+    }
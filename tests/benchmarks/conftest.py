@@ -0,0 +1,57 @@
+import json
+import os
+import pytest
+import re
+from pathlib import Path
+
+BASELINE_PATH = Path(__file__).parent / "baseline.json"
+TOLERANCE = 0.05  # Emulated cycle counts barely vary, so this is generous
+BENCH_RE = re.compile(r"#BENCH# (\w+) cycles=(\d+) count=(\d+) unit=(\w+)")
+
+
+@pytest.fixture(scope="module")
+def benchmark_results(request, emulated_test_output) -> dict[str, dict]:
+    """Collects "#BENCH#" lines from the sketch (see test_lib/benchmarks.h)
+    as cycles per unit, saves them to output.tmp/benchmarks.json, and fails
+    if any is over its baseline.json entry by more than TOLERANCE, or has
+    no entry. With BLUB_BENCH_UPDATE=1, records them into baseline.json
+    instead."""
+
+    results: dict[str, dict] = {}
+    for line in emulated_test_output:
+        if match := BENCH_RE.search(line):
+            name, cycles, count, unit = match.groups()
+            per_unit = int(cycles) / max(int(count), 1)
+            results[name] = {"cycles": round(per_unit, 2), "unit": unit}
+
+    output_dir = Path(request.path).parent / "output.tmp"
+    output_json = json.dumps(results, indent=2, sort_keys=True)
+    (output_dir / "benchmarks.json").write_text(output_json + "\n")
+
+    baseline = json.loads(BASELINE_PATH.read_text())
+    if os.environ.get("BLUB_BENCH_UPDATE"):
+        baseline.update(results)
+        baseline_json = json.dumps(baseline, indent=2, sort_keys=True)
+        BASELINE_PATH.write_text(baseline_json + "\n")
+        print(f"💾 Updated baseline: {', '.join(results)}")
+        return results
+
+    regressions: list[str] = []
+    unrecorded: list[str] = []
+    for name, result in results.items():
+        text = f"{name}: {result['cycles']} cycles/{result['unit']}"
+        if not (base := baseline.get(name)):
+            print(f"❓ {text} (no baseline)")
+            unrecorded.append(text)
+            continue
+        change = result["cycles"] / base["cycles"] - 1
+        print(f"⏱️ {text} ({change:+.1%} vs. {base['cycles']})")
+        if change > TOLERANCE:
+            regressions.append(f"{text} > {base['cycles']}")
+
+    assert not regressions, f"Slower:\n  {'\n  '.join(regressions)}"
+    assert not unrecorded, (
+        f"No baseline (record with BLUB_BENCH_UPDATE=1):\n  "
+        f"{'\n  '.join(unrecorded)}"
+    )
+    return results
@@ -0,0 +1,97 @@
+// Cycle counts for building and serializing a telemetry document shaped
+// like power_station's status message, as measureJson() + serializeJson()
+// into an outgoing frame
+
+#include <Arduino.h>
+#include <ArduinoJson.h>
+#include <benchmarks.h>
+#include <ok_logging.h>
+#include <verifiers.h>
+
+static OkLoggingContext OK_CONTEXT("json_bench_test");
+
+static constexpr int ROUNDS = 5;
+static constexpr int DOCS = 20;
+
+static char const* const METER_NAMES[] = {"solar", "battery", "load"};
+
+static void build_telemetry(JsonDocument* doc, int seq) {
+  (*doc)["uptime"] = seq * 60.1;
+
+  auto json_meters = (*doc)["power"];
+  for (auto const* name : METER_NAMES) {
+    auto json_meter = json_meters[name];
+    json_meter["V"] = 12.345 + seq * 1e-3;
+    json_meter["A"] = -1.234;
+    json_meter["J"] = 98765.4;
+    json_meter["C"] = 31.5;
+  }
+
+  auto json_cell = (*doc)["cell_radio"];
+  json_cell["assoc"] = "connected";
+  json_cell["op"] = "AT&T";
+  json_cell["APN"] = "m2m.com.attz";
+  json_cell["tech"] = "LTE-M";
+  json_cell["RSRP"] = -97;
+  json_cell["RSRQ"] = -11;
+  json_cell["sleep"] = "pin";
+
+  auto json_loop = (*doc)["loop"];
+  json_loop["duty"] = 3.2;
+  json_loop["max_ms"] = 12.45;
+  json_loop["wakes"] = 612;
+
+  auto json_socket = (*doc)["socket"];
+  json_socket["tries"] = 3;
+  json_socket["OK"] = 2;
+  json_socket["ms"] = 4210;
+  json_socket["fail"]["lost"] = 1;
+}
+
+static void bench_telemetry_build() {
+  OK_NOTE("#TEST# bench_telemetry_build");
+  static int members = 0;
+  auto const result = bench_fastest(ROUNDS, [] {
+    for (int i = 0; i < DOCS; ++i) {
+      JsonDocument doc;
+      build_telemetry(&doc, i);
+      members = doc.size();
+    }
+    return DOCS;
+  });
+
+  VERIFY_A_OP_B(members, ==, 5);
+  BENCH_REPORT("json_telemetry_build", result, "doc");
+}
+
+static void bench_telemetry_serialize() {
+  OK_NOTE("#TEST# bench_telemetry_serialize");
+  static JsonDocument doc;
+  static char message[512];
+  static int size = 0;
+  build_telemetry(&doc, 1);
+
+  auto const result = bench_fastest(ROUNDS, [] {
+    for (int i = 0; i < DOCS; ++i) {
+      size = measureJson(doc);
+      serializeJson(doc, message, sizeof(message));
+    }
+    return DOCS;
+  });
+
+  VERIFY_A_OP_B(size, >, 300);
+  VERIFY_A_OP_B(size, ==, (int) strlen(message));
+  BENCH_REPORT("json_telemetry_serialize", result, "doc");
+  OK_NOTE("Telemetry: %db", size);
+}
+
+void setup() {
+  Serial1.begin(115200);
+  ok_logging_stream = &Serial1;
+  OK_NOTE("#BEGIN-TESTS#");
+  bench_telemetry_build();
+  bench_telemetry_serialize();
+  OK_NOTE("#END-TESTS#");
+}
+
+void loop() {}
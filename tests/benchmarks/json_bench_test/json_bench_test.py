@@ -0,0 +1,9 @@
+# The sketch times ArduinoJson telemetry building and serializing (no
+# emulated devices); see ../conftest.py for baseline checks.
+
+
+def test_json_bench(benchmark_results):
+    assert benchmark_results.keys() == {
+        "json_telemetry_build",
+        "json_telemetry_serialize",
+    }
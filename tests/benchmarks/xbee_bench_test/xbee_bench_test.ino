@@ -0,0 +1,180 @@
+// Cycle counts for XBee hot paths: API frame serializing and parsing in
+// XBeeRadio, and MQTT publishes through XBeeMQTTAdapter (copying and
+// zero-copy). The radio is on a FakeSerial, so only code time is counted.
+
+#include <Arduino.h>
+#include <benchmarks.h>
+#include <fake_serial.h>
+#include <ok_logging.h>
+#include <verifiers.h>
+
+#include "src/xbee_api.h"
+#include "src/xbee_mqtt_adapter.h"
+#include "src/xbee_radio.h"
+
+static OkLoggingContext OK_CONTEXT("xbee_bench_test");
+
+static constexpr int ROUNDS = 5;
+static constexpr int PUBLISHES = 50;
+static constexpr int PAYLOAD_SIZE = 200;  // About one telemetry message
+static constexpr int SPACE = XBeeAPI::MAX_PAYLOAD + 5;  // Empty radio buffer
+
+static etl::string<4096> written;
+static FakeSerial serial(0, "", &written);
+static XBeeRadio* radio = nullptr;
+static XBeeMQTTAdapter* mqtt = nullptr;
+static int topic = -1;
+
+// Traffic mix for the radio: bulky socket frames and small status frames
+static constexpr int TRAFFIC_FRAMES = 4;
+static XBeeAPI::Frame traffic[TRAFFIC_FRAMES];
+static etl::string<4096> traffic_wire;  // As serialized by the radio
+
+static XBeeAPI::Frame no_frame, ack_frame, out_frame;
+static uint8_t payload[PAYLOAD_SIZE];
+
+static void setup_traffic() {
+  using namespace XBeeAPI;
+  auto* receive = traffic[0].setup_as<SocketReceive>(1024);
+  for (int i = 0; i < 1024; ++i) receive->data[i] = i * 7;  // Mixed bytes
+  auto* status = traffic[1].setup_as<TransmitStatus>();
+  status->frame_id = 'Q';
+  auto* send = traffic[2].setup_as<SocketSend>(PAYLOAD_SIZE);
+  memset(send->data, 0x7E, PAYLOAD_SIZE);  // Start delimiters as data
+  auto* socket = traffic[3].setup_as<SocketStatus>();
+  socket->status = SocketStatus::CONNECTION_LOST;
+
+  auto* ack = ack_frame.setup_as<TransmitStatus>();
+  ack->frame_id = 'Q';  // The adapter's signature
+  for (int i = 0; i < PAYLOAD_SIZE; ++i) payload[i] = 'a' + i % 26;
+}
+
+// Plays the XBee side of XBeeRadio's command mode handshake
+static void start_api_mode() {
+  static XBeeAPI::Frame frame;
+  unsigned long const start = millis();
+  while (radio->outgoing_space() == 0 && millis() - start < 10000) {
+    radio->poll_for_frame(&frame);
+    if (written == "+++" || written == "AT\r") serial.read_buf = "OK\r";
+    if (written == "ATAP1,CN\r") serial.read_buf = "OK\rOK\r";
+    written.clear();
+    delay(10);
+  }
+  VERIFY_A_OP_B(radio->outgoing_space(), ==, SPACE);
+}
+
+// Takes a SocketSend from the adapter and confirms it as the XBee would
+static bool send_and_ack() {
+  if (!mqtt->incoming_to_outgoing(no_frame, SPACE, &out_frame)) return false;
+  mqtt->incoming_to_outgoing(ack_frame, SPACE, &out_frame);
+  return true;
+}
+
+static void connect_mqtt() {
+  using namespace XBeeAPI;
+  mqtt->use_socket(0);
+  mqtt_connect(
+      mqtt->client(), "BLUB Bench", nullptr, nullptr, 0, nullptr, nullptr,
+      MQTT_CONNECT_CLEAN_SESSION, 400);
+  VERIFY_A_OP_B(send_and_ack(), ==, true);
+
+  static Frame connack_frame;
+  static uint8_t const connack[] = {0x20, 0x02, 0x00, 0x00};
+  auto* receive = connack_frame.setup_as<SocketReceive>(sizeof(connack));
+  memcpy(receive->data, connack, sizeof(connack));
+  mqtt->incoming_to_outgoing(connack_frame, SPACE, &out_frame);
+  VERIFY_A_OP_B(mqtt->client()->typical_response_time, >=, 0);
+}
+
+static void bench_frame_serialize() {
+  OK_NOTE("#TEST# bench_frame_serialize");
+  auto const result = bench_fastest(ROUNDS, [] {
+    written.clear();
+    for (auto const& frame : traffic) {
+      radio->add_outgoing(frame);
+      radio->poll_for_frame(nullptr);  // Writes out the frame
+    }
+    return int(written.size());
+  });
+
+  int expected = 0;
+  for (auto const& frame : traffic) expected += frame.wire_size();
+  VERIFY_A_OP_B(result.count, ==, expected);
+  BENCH_REPORT("xbee_frame_serialize", result, "byte");
+  traffic_wire = written;
+}
+
+static void bench_frame_parse() {
+  OK_NOTE("#TEST# bench_frame_parse");
+  static XBeeAPI::Frame frame;
+  static int parsed = 0;
+  auto const result = bench_fastest(ROUNDS, [] {
+    serial.read_buf = traffic_wire;
+    for (parsed = 0; radio->poll_for_frame(&frame); ++parsed) {}
+    return int(traffic_wire.size());
+  });
+
+  VERIFY_A_OP_B(parsed, ==, TRAFFIC_FRAMES);
+  VERIFY_A_OP_B(frame.type, ==, traffic[TRAFFIC_FRAMES - 1].type);
+  BENCH_REPORT("xbee_frame_parse", result, "byte");
+}
+
+static void bench_mqtt_publish_copy() {
+  OK_NOTE("#TEST# bench_mqtt_publish_copy");
+  auto const result = bench_fastest(ROUNDS, [] {
+    int sent = 0;
+    while (sent < PUBLISHES) {
+      auto const err = mqtt->publish(
+          topic, payload, PAYLOAD_SIZE, MQTT_PUBLISH_QOS_0);
+      if (err != MQTT_OK || !send_and_ack()) break;
+      ++sent;
+    }
+    return sent;
+  });
+
+  VERIFY_A_OP_B(result.count, ==, PUBLISHES);
+  VERIFY_A_OP_B(mqtt->check_error(), ==, false);
+  BENCH_REPORT("xbee_mqtt_publish_copy", result, "publish");
+}
+
+static void bench_mqtt_publish_zero_copy() {
+  OK_NOTE("#TEST# bench_mqtt_publish_zero_copy");
+  auto const result = bench_fastest(ROUNDS, [] {
+    int sent = 0;
+    while (sent < PUBLISHES) {
+      int capacity = 0;
+      auto* data = mqtt->begin_publish(topic, 0, SPACE, &out_frame, &capacity);
+      if (data == nullptr || capacity < PAYLOAD_SIZE) break;
+      memcpy(data, payload, PAYLOAD_SIZE);
+      if (!mqtt->commit_publish(PAYLOAD_SIZE)) break;
+      mqtt->incoming_to_outgoing(ack_frame, SPACE, &out_frame);
+      ++sent;
+    }
+    return sent;
+  });
+
+  VERIFY_A_OP_B(result.count, ==, PUBLISHES);
+  VERIFY_A_OP_B(mqtt->check_error(), ==, false);
+  BENCH_REPORT("xbee_mqtt_publish_zero_copy", result, "publish");
+}
+
+void setup() {
+  Serial1.begin(115200);
+  ok_logging_stream = &Serial1;
+  OK_NOTE("#BEGIN-TESTS#");
+
+  setup_traffic();
+  radio = make_xbee_radio(&serial);
+  mqtt = make_xbee_mqtt_adapter(2048, 2048);
+  topic = mqtt->add_topic("blub/bench/telemetry");
+  start_api_mode();
+  connect_mqtt();
+
+  bench_frame_serialize();
+  bench_frame_parse();
+  bench_mqtt_publish_copy();
+  bench_mqtt_publish_zero_copy();
+  OK_NOTE("#END-TESTS#");
+}
+
+void loop() {}
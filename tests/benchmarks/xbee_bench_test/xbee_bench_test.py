@@ -0,0 +1,11 @@
+# The sketch times XBee frame handling and MQTT publishes on a fake serial
+# port (no emulated devices); see ../conftest.py for baseline checks.
+
+
+def test_xbee_bench(benchmark_results):
+    assert benchmark_results.keys() == {
+        "xbee_frame_parse",
+        "xbee_frame_serialize",
+        "xbee_mqtt_publish_copy",
+        "xbee_mqtt_publish_zero_copy",
+    }
@@ -12,6 +12,16 @@ static void test_modem_client_setup() {
   FakeSerial fake_serial(0, "", &write_buf);
   auto const client = make_cell_modem_client(&fake_serial, "mqtt-serv");
 
+  client->poll();
+  VERIFY_A_OP_B_STR(write_buf, ==, "ATE0\r\n");
+  write_buf.clear();
+  fake_serial.read_buf = "ATE0\r\nOK\r\n";  // Echo is on until then
+
+  client->poll();
+  VERIFY_A_OP_B_STR(write_buf, ==, "AT+CMEE=1\r\n");
+  write_buf.clear();
+  fake_serial.read_buf = "OK\r\n";
+
   client->poll();
   VERIFY_A_OP_B_STR(write_buf, ==, "AT+CGMM\r\n");
   write_buf.clear();
@@ -41,11 +51,396 @@ static void test_modem_client_setup() {
   VERIFY_A_OP_B_STR(status.versions[3], ==, "Fake Blub");
 }
 
+// Polls, checks what the client sent, then queues the modem's reply
+static void expect_exchange(
+  CellModemClient* client, FakeSerial* fake_serial,
+  etl::string_view expect, etl::string_view reply
+) {
+  client->poll();
+  VERIFY_A_OP_B_STR(*fake_serial->write_buf, ==, expect);
+  fake_serial->write_buf->clear();
+  fake_serial->read_buf = reply;
+}
+
+// Runs radio-on and MQTT config/connect exchanges (after a modem reset),
+// leaving the CONNACK queued for the next poll
+static void expect_radio_on(CellModemClient* c, FakeSerial* fake_serial) {
+  expect_exchange(c, fake_serial, "AT+CEREG=5\r\n", "OK\r\n");
+  expect_exchange(c, fake_serial, "AT%XSYSTEMMODE=1,0,0,0\r\n", "OK\r\n");
+  expect_exchange(
+    c, fake_serial, "AT+CFUN=1\r\n",
+    "OK\r\n+CEREG: 2,\"1A2B\",\"0101ABCD\",7\r\n"
+  );
+  expect_exchange(
+    c, fake_serial, "AT%XMONITOR\r\n",
+    "+CEREG: 1,\"1A2B\",\"0101ABCD\",7,,,\"11100000\",\"11100000\"\r\n"
+    "%XMONITOR: 1,\"\",\"\",\"24201\"\r\nOK\r\n"
+  );
+  expect_exchange(
+    c, fake_serial, "AT#XMQTTCFG=\"490154203237518\",400,1\r\n", "OK\r\n"
+  );
+  expect_exchange(
+    c, fake_serial, "AT#XMQTTCON=1,\"user\",\"pass\",\"mqtt-serv\",1883\r\n",
+    "OK\r\n#XMQTTEVT: 0,0\r\n"
+  );
+}
+
+// Runs session setup and identification, then expect_radio_on()
+static void expect_bring_up(CellModemClient* c, FakeSerial* fake_serial) {
+  expect_exchange(c, fake_serial, "ATE0\r\n", "OK\r\n");
+  expect_exchange(c, fake_serial, "AT+CMEE=1\r\n", "OK\r\n");
+  expect_exchange(c, fake_serial, "AT+CGMM\r\n", "HW\r\nOK\r\n");
+  expect_exchange(
+    c, fake_serial, "AT+CGSN=2\r\n", "+CGSN: \"490154203237518\"\r\nOK\r\n"
+  );
+  expect_exchange(c, fake_serial, "AT+CGMR\r\n", "Rev\r\nOK\r\n");
+  expect_exchange(
+    c, fake_serial, "AT#XSMVER\r\n", "#XSMVER: \"SM\",\"NCS\",\"B\"\r\nOK\r\n"
+  );
+  expect_radio_on(c, fake_serial);
+}
+
+static void test_modem_client_mqtt_publish() {
+  OK_NOTE("#TEST# test_modem_client_mqtt_publish");
+  etl::string<1024> write_buf;
+  FakeSerial fake_serial(0, "", &write_buf);
+  CellModemMQTTConfig mqtt;
+  mqtt.server = "mqtt-serv";
+  mqtt.user = "user";
+  mqtt.password = "pass";
+  auto const client = make_cell_modem_client(&fake_serial, mqtt);
+  auto* const c = client.get();
+
+  // Queued before connecting; should go out back to back once connected
+  VERIFY_A_OP_B(client->publish("blub/a", "hello", 1), ==, true);
+  VERIFY_A_OP_B(client->publish("blub/b", "x,\"y\"\r\n", 0, true), ==, true);
+  VERIFY_A_OP_B(client->publish("bad\"topic", "z"), ==, false);
+
+  expect_bring_up(c, &fake_serial);
+  expect_exchange(
+    c, &fake_serial, "AT#XMQTTPUB=\"blub/a\",\"\",1,0,5\r\n", "OK\r\n"
+  );
+  expect_exchange(c, &fake_serial, "hello", "#XDATAMODE: 0\r\n");
+  expect_exchange(
+    c, &fake_serial, "AT#XMQTTPUB=\"blub/b\",\"\",0,1,7\r\n", "OK\r\n"
+  );
+  expect_exchange(
+    c, &fake_serial, "x,\"y\"\r\n", "#XDATAMODE: 0\r\n#XMQTTEVT: 3,0\r\n"
+  );
+  expect_exchange(c, &fake_serial, "", "");
+
+  auto const& status = client->poll();
+  VERIFY_A_OP_B(status.mqtt_connected, ==, true);
+  VERIFY_A_OP_B(status.mqtt_connects, ==, 1);
+  VERIFY_A_OP_B(status.mqtt_published, ==, 2);
+  VERIFY_A_OP_B(status.mqtt_publish_acks, ==, 1);
+}
+
+static etl::string<8192> bulk_write_buf;
+static etl::string<7000> bulk_payload;
+
+static void test_modem_client_publish_pacing() {
+  OK_NOTE("#TEST# test_modem_client_publish_pacing");
+  FakeSerial fake_serial(0, "", &bulk_write_buf);
+  CellModemMQTTConfig mqtt;
+  mqtt.server = "mqtt-serv";
+  mqtt.user = "user";
+  mqtt.password = "pass";
+  auto const client = make_cell_modem_client(&fake_serial, mqtt);
+  auto* const c = client.get();
+
+  // Bigger than the modem's UART RX slab, so it can't all go at once
+  bulk_payload.assign(bulk_payload.max_size(), 'x');
+  VERIFY_A_OP_B(client->publish("blub/bulk", bulk_payload), ==, true);
+  expect_bring_up(c, &fake_serial);
+  expect_exchange(
+    c, &fake_serial, "AT#XMQTTPUB=\"blub/bulk\",\"\",0,0,7000\r\n", "OK\r\n"
+  );
+
+  auto const* status = &client->poll();
+  VERIFY_A_OP_B((int) bulk_write_buf.size(), >=, 5000);
+  VERIFY_A_OP_B((int) bulk_write_buf.size(), <, 7000);
+  VERIFY_A_OP_B(status->data_stalls, >, 0);
+
+  // The rest follows at about the UART rate as the modem drains
+  for (int i = 0; i < 100 && bulk_write_buf.size() < 7000; ++i) {
+    delay(10);
+    client->poll();
+  }
+  VERIFY_A_OP_B((int) bulk_write_buf.size(), ==, 7000);
+
+  fake_serial.read_buf = "#XDATAMODE: 0\r\n";
+  status = &client->poll();
+  VERIFY_A_OP_B(status->mqtt_published, ==, 1);
+  VERIFY_A_OP_B(status->data_rate, >, 0);
+  VERIFY_A_OP_B(status->data_rate, <=, 11520);
+}
+
+static etl::string<64> received_topic;
+static etl::string<64> received_data;
+static int received_chunks = 0;
+static int received_lasts = 0;
+static int message_start = 0;
+
+static void on_message_chunk(CellModemMessageChunk const& chunk) {
+  if (chunk.offset == 0) message_start = received_data.size();
+  VERIFY_A_OP_B(chunk.offset, ==, (int) received_data.size() - message_start);
+  received_topic = chunk.topic;
+  received_data.append(chunk.data.data(), chunk.data.size());
+  ++received_chunks;
+  if (chunk.last) ++received_lasts;
+}
+
+static void test_modem_client_mqtt_receive() {
+  OK_NOTE("#TEST# test_modem_client_mqtt_receive");
+  etl::string<1024> write_buf;
+  FakeSerial fake_serial(0, "", &write_buf);
+  CellModemMQTTConfig mqtt;
+  mqtt.server = "mqtt-serv";
+  mqtt.user = "user";
+  mqtt.password = "pass";
+  mqtt.max_message_size = 8;
+  auto const client = make_cell_modem_client(&fake_serial, mqtt);
+  auto* const c = client.get();
+  client->set_message_handler(
+    CellModemMessageHandler::create<on_message_chunk>()
+  );
+
+  VERIFY_A_OP_B(client->subscribe("blub/cmd/#", 1), ==, true);
+  expect_bring_up(c, &fake_serial);
+  expect_exchange(
+    c, &fake_serial, "AT#XMQTTSUB=\"blub/cmd/#\",1\r\n",
+    "OK\r\n#XMQTTEVT: 7,0\r\n"
+  );
+
+  // Payload has CR, LF, quote and comma; it arrives split across polls
+  expect_exchange(
+    c, &fake_serial, "", "#XMQTTMSG: 8,6\r\nblub/cmd\r\na\r"
+  );
+  expect_exchange(c, &fake_serial, "", "\n\",b\r\n#XMQTTEVT: 2,0\r\n");
+  VERIFY_A_OP_B(received_chunks, ==, 1);
+  VERIFY_A_OP_B_STR(received_data, ==, "a\r");
+
+  // Too big: the first max_message_size bytes come through, then it's cut
+  expect_exchange(
+    c, &fake_serial, "",
+    "#XMQTTMSG: 5,12\r\nblub/\r\n0123456789AB\r\n#XMQTTEVT: 2,0\r\n"
+  );
+
+  // A size that doesn't fit an int is rejected, not wrapped around
+  expect_exchange(c, &fake_serial, "", "#XMQTTMSG: 5,99999999999\r\n");
+
+  auto const& status = client->poll();
+  VERIFY_A_OP_B_STR(received_topic, ==, "blub/");
+  VERIFY_A_OP_B_STR(received_data, ==, "a\r\n\",b01234567");
+  VERIFY_A_OP_B(received_lasts, ==, 2);
+  VERIFY_A_OP_B(status.mqtt_received, ==, 2);
+  VERIFY_A_OP_B(status.mqtt_truncated, ==, 1);
+
+  // And the next message still parses
+  expect_exchange(c, &fake_serial, "", "#XMQTTMSG: 5,1\r\nblub/\r\nz\r\n");
+  VERIFY_A_OP_B(client->poll().mqtt_received, ==, 3);
+}
+
+static void test_modem_client_urc_interleave() {
+  OK_NOTE("#TEST# test_modem_client_urc_interleave");
+  etl::string<1024> write_buf;
+  FakeSerial fake_serial(0, "", &write_buf);
+  CellModemMQTTConfig mqtt;
+  mqtt.server = "mqtt-serv";
+  mqtt.user = "user";
+  mqtt.password = "pass";
+  auto const client = make_cell_modem_client(&fake_serial, mqtt);
+  auto* const c = client.get();
+
+  // URCs between a command and its OK are routed, not taken as its reply
+  VERIFY_A_OP_B(client->publish("blub/a", "hi"), ==, true);
+  expect_bring_up(c, &fake_serial);
+  expect_exchange(
+    c, &fake_serial, "AT#XMQTTPUB=\"blub/a\",\"\",0,0,2\r\n",
+    "+CEREG: 5,\"1A2B\",\"0101ABCD\",7\r\n#XMQTTEVT: 9,0\r\nOK\r\n"
+  );
+  expect_exchange(c, &fake_serial, "hi", "#XDATAMODE: 0\r\n#XMQTTEVT: 1,0\r\n");
+
+  auto const* status = &client->poll();
+  VERIFY_A_OP_B(status->registration, ==, 5);
+  VERIFY_A_OP_B(status->mqtt_published, ==, 1);
+  VERIFY_A_OP_B(status->mqtt_connected, ==, false);
+
+  // A modem restart drops everything in flight and starts over
+  fake_serial.read_buf = "Ready\r\n";
+  expect_exchange(c, &fake_serial, "ATE0\r\n", "");
+  status = &client->poll();
+  VERIFY_A_OP_B(status->registration, ==, -1);
+  VERIFY_A_OP_B(status->modem_restarts, ==, 1);
+}
+
+static void test_modem_client_late_reply() {
+  OK_NOTE("#TEST# test_modem_client_late_reply");
+  etl::string<1024> write_buf;
+  FakeSerial fake_serial(0, "", &write_buf);
+  CellModemMQTTConfig mqtt;
+  mqtt.server = "mqtt-serv";
+  mqtt.user = "user";
+  mqtt.password = "pass";
+  auto const client = make_cell_modem_client(&fake_serial, mqtt);
+  auto* const c = client.get();
+
+  // Everything up to #XMQTTCON, which the broker is slow to answer
+  expect_exchange(c, &fake_serial, "ATE0\r\n", "OK\r\n");
+  expect_exchange(c, &fake_serial, "AT+CMEE=1\r\n", "OK\r\n");
+  expect_exchange(c, &fake_serial, "AT+CGMM\r\n", "HW\r\nOK\r\n");
+  expect_exchange(
+    c, &fake_serial, "AT+CGSN=2\r\n", "+CGSN: \"490154203237518\"\r\nOK\r\n"
+  );
+  expect_exchange(c, &fake_serial, "AT+CGMR\r\n", "Rev\r\nOK\r\n");
+  expect_exchange(c, &fake_serial, "AT#XSMVER\r\n", "OK\r\n");
+  expect_exchange(c, &fake_serial, "AT+CEREG=5\r\n", "OK\r\n");
+  expect_exchange(c, &fake_serial, "AT%XSYSTEMMODE=1,0,0,0\r\n", "OK\r\n");
+  expect_exchange(
+    c, &fake_serial, "AT+CFUN=1\r\n",
+    "OK\r\n+CEREG: 1,\"1A2B\",\"0101ABCD\",7\r\n"
+  );
+  expect_exchange(
+    c, &fake_serial, "AT#XMQTTCFG=\"490154203237518\",400,1\r\n", "OK\r\n"
+  );
+  expect_exchange(
+    c, &fake_serial, "AT#XMQTTCON=1,\"user\",\"pass\",\"mqtt-serv\",1883\r\n",
+    ""
+  );
+
+  // Connecting takes seconds, so the command waits longer than most
+  delay(10000);
+  expect_exchange(c, &fake_serial, "", "");
+
+  // Once it does time out, nothing is sent for a while, in case its reply
+  // is still coming
+  delay(25000);
+  expect_exchange(c, &fake_serial, "", "");
+  expect_exchange(c, &fake_serial, "", "OK\r\n#XMQTTEVT: 0,0\r\n");
+
+  // The late OK is dropped, not taken as the next command's reply
+  expect_exchange(
+    c, &fake_serial, "AT%XMONITOR\r\n",
+    "%XMONITOR: 1,\"\",\"\",\"24201\"\r\nOK\r\n"
+  );
+  auto const& status = client->poll();
+  VERIFY_A_OP_B(status.mqtt_connected, ==, true);
+  VERIFY_A_OP_B(status.registration, ==, 1);
+}
+
+static void test_modem_client_recovery() {
+  OK_NOTE("#TEST# test_modem_client_recovery");
+  etl::string<1024> write_buf;
+  FakeSerial fake_serial(0, "", &write_buf);
+  CellModemMQTTConfig mqtt;
+  mqtt.server = "mqtt-serv";
+  mqtt.user = "user";
+  mqtt.password = "pass";
+  auto const client = make_cell_modem_client(&fake_serial, mqtt);
+  auto* const c = client.get();
+
+  expect_bring_up(c, &fake_serial);
+  auto const* status = &client->poll();
+  VERIFY_A_OP_B(status->mqtt_connected, ==, true);
+  VERIFY_A_OP_B(status->recoveries, ==, 0);  // First connect doesn't count
+
+  // libmodem restarts: the radio is left off, so bring-up starts over
+  fake_serial.read_buf = "#XMODEM: SHUTDOWN,0\r\n";
+  status = &client->poll();
+  VERIFY_A_OP_B(status->mqtt_connected, ==, false);
+  VERIFY_A_OP_B(status->registration, ==, -1);
+  VERIFY_A_OP_B_STR(write_buf, ==, "");
+
+  fake_serial.read_buf = "#XMODEM: INIT,0\r\n";
+  expect_radio_on(c, &fake_serial);
+  status = &client->poll();
+  VERIFY_A_OP_B(status->mqtt_connected, ==, true);
+  VERIFY_A_OP_B(status->mqtt_connects, ==, 2);
+  VERIFY_A_OP_B(status->modem_restarts, ==, 1);
+  VERIFY_A_OP_B(status->recoveries, ==, 1);
+  VERIFY_A_OP_B(status->last_recovery_millis, <, 1000);
+  VERIFY_A_OP_B(status->recovery_step, ==, 0);
+}
+
+static constexpr int LINE_RATE_MESSAGES = 10;
+static constexpr int LINE_RATE_SIZE = 1000;
+static etl::string<11000> line_rate_input;
+static int line_rate_bytes = 0;
+
+static void on_line_rate_chunk(CellModemMessageChunk const& chunk) {
+  line_rate_bytes += chunk.data.size();
+}
+
+static void test_modem_client_line_rate() {
+  OK_NOTE("#TEST# test_modem_client_line_rate");
+  etl::string<1024> write_buf;
+  FakeSerial fake_serial(0, "", &write_buf);
+  CellModemMQTTConfig mqtt;
+  mqtt.server = "mqtt-serv";
+  mqtt.user = "user";
+  mqtt.password = "pass";
+  auto const client = make_cell_modem_client(&fake_serial, mqtt);
+  auto* const c = client.get();
+  client->set_message_handler(
+    CellModemMessageHandler::create<on_line_rate_chunk>()
+  );
+  expect_bring_up(c, &fake_serial);
+  client->poll();  // CONNACK
+
+  for (int i = 0; i < LINE_RATE_MESSAGES; ++i) {
+    line_rate_input.append("#XMQTTMSG: 8,1000\r\nblub/cmd\r\n");
+    line_rate_input.append(LINE_RATE_SIZE, 'a' + i);
+    line_rate_input.append("\r\n");
+  }
+
+  // Messages stream in at 115200 baud in bursts, polled every 0-8ms;
+  // a 256 byte receive FIFO should be plenty
+  FakeSerial::Timing timing;
+  timing.rx_fifo = 256;
+  timing.max_chunk = 64;
+  fake_serial.begin(115200);
+  fake_serial.set_timing(timing);
+  fake_serial.read_buf = line_rate_input;
+  unsigned long const start = millis();
+  while (!fake_serial.read_buf.empty() || fake_serial.available() > 0) {
+    if (millis() - start > 5000) break;
+    client->poll();
+    delay(random(0, 9));
+  }
+
+  auto const& status = client->poll();
+  VERIFY_A_OP_B(fake_serial.rx_dropped, ==, 0);
+  VERIFY_A_OP_B(line_rate_bytes, ==, LINE_RATE_MESSAGES * LINE_RATE_SIZE);
+  VERIFY_A_OP_B(status.mqtt_received, ==, LINE_RATE_MESSAGES);
+  OK_NOTE(
+    "Line rate: %db in %lums, FIFO peak %d/%d",
+    (int) line_rate_input.size(), millis() - start,
+    fake_serial.rx_peak, timing.rx_fifo
+  );
+
+  // With the default 32 byte FIFO, a 20ms stall (230 bytes) overruns
+  timing.rx_fifo = 32;
+  fake_serial.set_timing(timing);
+  fake_serial.read_buf = line_rate_input;
+  fake_serial.available();  // Sending starts
+  delay(20);
+  VERIFY_A_OP_B(fake_serial.available(), ==, 32);
+  VERIFY_A_OP_B(fake_serial.rx_dropped, >, 100);  // Less a partial burst
+}
+
 void setup() {
   Serial1.begin(115200);
   ok_logging_stream = &Serial1;
   OK_NOTE("#BEGIN-TESTS#");
   test_modem_client_setup();
+  test_modem_client_mqtt_publish();
+  test_modem_client_publish_pacing();
+  test_modem_client_mqtt_receive();
+  test_modem_client_urc_interleave();
+  test_modem_client_late_reply();
+  test_modem_client_recovery();
+  test_modem_client_line_rate();
   OK_NOTE("#END-TESTS#");
 }
 
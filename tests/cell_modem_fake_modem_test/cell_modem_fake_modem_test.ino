@@ -0,0 +1,115 @@
+// End-to-end CellModemClient test against the emulator's fake nRF9151
+// (tests/emulator/fake_nrf9151.js) on Serial2, with real UART timing
+
+#include "cell_modem_client.h"
+
+#include <Arduino.h>
+#include <verifiers.h>
+
+static OkLoggingContext OK_CONTEXT("cell_modem_fake_modem_test");
+
+static constexpr int BULK_COUNT = 20;
+static constexpr int BULK_SIZE = 2000;
+
+static etl::unique_ptr<CellModemClient> client;
+static int received_messages = 0;
+static int received_bytes = 0;
+
+static void on_message_chunk(CellModemMessageChunk const& chunk) {
+  received_bytes += chunk.data.size();
+  if (chunk.last) ++received_messages;
+}
+
+// Polls until done(status) or the timeout; returns the time taken
+template <typename Done>
+static unsigned long poll_until(Done done, unsigned long timeout_millis) {
+  unsigned long const start = millis();
+  while (!done(client->poll()) && millis() - start < timeout_millis) {
+    delay(1);  // Emulated idle time costs no wall clock
+  }
+  return millis() - start;
+}
+
+static void test_fake_modem_bring_up() {
+  OK_NOTE("#TEST# test_fake_modem_bring_up");
+  auto const took = poll_until(
+    [](CellModemStatus const& s) { return s.mqtt_connected; }, 10000
+  );
+
+  auto const& status = client->poll();
+  VERIFY_A_OP_B(status.mqtt_connected, ==, true);
+  VERIFY_A_OP_B(status.registration, ==, 1);
+  VERIFY_A_OP_B_STR(status.hardware, ==, "nRF9151-LACA");
+  VERIFY_A_OP_B_STR(status.versions[3], ==, "blub");
+  OK_NOTE("Bring-up took %lums", took);
+}
+
+static void test_fake_modem_bulk_loopback() {
+  OK_NOTE("#TEST# test_fake_modem_bulk_loopback");
+  static char payload[BULK_SIZE];
+  memset(payload, 'x', sizeof(payload));
+
+  // Queue as many as fit, topping up as publishes complete
+  int queued = 0;
+  auto const took = poll_until(
+    [&](CellModemStatus const& s) {
+      etl::string_view const data(payload, sizeof(payload));
+      while (queued < BULK_COUNT && client->publish("blub/loop/bulk", data)) {
+        ++queued;
+      }
+      return s.mqtt_published == BULK_COUNT && received_messages == BULK_COUNT;
+    },
+    30000
+  );
+
+  auto const& status = client->poll();
+  VERIFY_A_OP_B(status.mqtt_published, ==, BULK_COUNT);
+  VERIFY_A_OP_B(received_messages, ==, BULK_COUNT);
+  VERIFY_A_OP_B(received_bytes, ==, BULK_COUNT * BULK_SIZE);
+  VERIFY_A_OP_B(status.mqtt_truncated, ==, 0);
+  OK_NOTE(
+    "Loopback: %db in %lums (%lub/s), data rate %db/s, %d stalls",
+    BULK_COUNT * BULK_SIZE, took, BULK_COUNT * BULK_SIZE * 1000ul / took,
+    status.data_rate, status.data_stalls
+  );
+}
+
+static void test_fake_modem_recovery() {
+  OK_NOTE("#TEST# test_fake_modem_recovery");
+
+  // The emulator script restarts libmodem (SHUTDOWN, INIT) at 15s
+  poll_until([](CellModemStatus const& s) { return s.modem_restarts; }, 20000);
+  poll_until(
+    [](CellModemStatus const& s) { return s.mqtt_connected; }, 10000
+  );
+
+  auto const& status = client->poll();
+  VERIFY_A_OP_B(status.modem_restarts, ==, 1);
+  VERIFY_A_OP_B(status.mqtt_connected, ==, true);
+  VERIFY_A_OP_B(status.recoveries, ==, 1);
+  VERIFY_A_OP_B(status.last_recovery_millis, <, 5000);
+  OK_NOTE("Recovered in %dms", status.last_recovery_millis);
+}
+
+void setup() {
+  Serial1.begin(115200);
+  ok_logging_stream = &Serial1;
+  OK_NOTE("#BEGIN-TESTS#");
+
+  Serial2.setFIFOSize(1024);  // Inbound messages arrive in bursts
+  Serial2.begin(115200);
+  CellModemMQTTConfig mqtt;
+  mqtt.server = "mqtt-serv";
+  client = make_cell_modem_client(&Serial2, mqtt);
+  client->set_message_handler(
+    CellModemMessageHandler::create<on_message_chunk>()
+  );
+  client->subscribe("blub/loop/#");
+
+  test_fake_modem_bring_up();
+  test_fake_modem_bulk_loopback();
+  test_fake_modem_recovery();
+  OK_NOTE("#END-TESTS#");
+}
+
+void loop() {}
@@ -0,0 +1,10 @@
+# The sketch drives CellModemClient on Serial2 against the emulator's fake
+# nRF9151; the modem restarts (libmodem SHUTDOWN/INIT) partway through.
+EMULATOR_ARGS = [
+    "--nrf9151=1",
+    '--nrf9151-options={"script": [{"atMillis": 15000, "fault": "shutdown"}]}',
+]
+
+
+def test_cell_modem_fake_modem(emulated_test_output):
+    pass
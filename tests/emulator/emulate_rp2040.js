@@ -1,10 +1,18 @@
 #!/usr/bin/env node
 // Runs an RP2040 .uf2 image under the rp2040js emulator.
 // Emulator diagnostics go to stderr, uart0 (arduino Serial1) output to stdout.
+//
+// Options:
+//   --nrf9151=N              fake nRF9151 serial modem on uartN (Serial2 = 1)
+//   --nrf9151-options=JSON   overrides for it (see fake_nrf9151.js)
+//   --xbee=N                 fake XBee Cellular on uartN
+//   --xbee-options=JSON      overrides for it (see fake_xbee.js)
 
 const fs = require('fs');
 const path = require('path');
 const { Simulator, ConsoleLogger, LogLevel } = require('rp2040js');
+const { FakeNRF9151 } = require('./fake_nrf9151');
+const { FakeXBee } = require('./fake_xbee');
 
 const FLASH_START = 0x10000000;
 const BOOTROM = path.join(__dirname, 'rp2040-bootrom-b1.bin');
@@ -25,7 +33,14 @@ function loadUF2(filename, mcu) {
   if (!blocks) throw new Error(`no UF2 blocks found in ${filename}`);
 }
 
-if (process.argv.length != 3) throw new Error("Usage: [script] fw.uf2");
+const [firmware, ...flags] = process.argv.slice(2);
+const options = {};
+for (const flag of flags) {
+  const [, name, value] = flag.match(/^--([\w-]+)=(.*)$/) ?? [];
+  if (!name) throw new Error(`Bad option: ${flag}`);
+  options[name] = value;
+}
+if (!firmware) throw new Error("Usage: [script] fw.uf2 [--option=value ...]");
 
 const simulator = new Simulator();
 const mcu = simulator.rp2040;
@@ -33,9 +48,25 @@ mcu.logger = new ConsoleLogger(LogLevel.Error);
 
 const rom = fs.readFileSync(BOOTROM);
 mcu.loadBootrom(new Uint32Array(rom.buffer, rom.byteOffset, rom.length / 4));
-loadUF2(process.argv[2], mcu);
+loadUF2(firmware, mcu);
 
 // Relay uart0 (arduino Serial1) output to stdout.
 mcu.uart[0].onByte = (val) => process.stdout.write(new Uint8Array([val]));
+
+// Attach fake devices, and print their counters when the test stops us.
+const fakes = { nrf9151: FakeNRF9151, xbee: FakeXBee };
+const devices = {};
+for (const [name, Fake] of Object.entries(fakes)) {
+  if (options[name] === undefined) continue;
+  const fakeOptions = JSON.parse(options[`${name}-options`] ?? '{}');
+  const uart = mcu.uart[+options[name]];
+  devices[name] = new Fake(simulator.clock, uart, fakeOptions);
+}
+process.on('SIGTERM', () => {
+  for (const [name, device] of Object.entries(devices)) {
+    console.error(`fake_${name} stats: ${JSON.stringify(device.stats)}`);
+  }
+  process.exit(0);
+});
 mcu.core.PC = FLASH_START;
 simulator.execute();
@@ -0,0 +1,428 @@
+// Fake nRF9151 Serial Modem on an emulated UART, for end-to-end tests of
+// cell_modem_client. Speaks the AT subset in cell_modem/at_cheat_sheet.md,
+// with byte timing at the line rate, the Serial Modem's buffer limits,
+// a loopback MQTT broker, and scripted faults.
+
+const DEFAULTS = {
+  baud: 115200,             // 8N1, so 10 bits per byte
+  rxSlabBytes: 6144,        // SM UART RX slab; overflow is silently lost
+  dataModeBufBytes: 8192,   // CONFIG_SM_DATAMODE_BUF_SIZE
+  urcRingBytes: 8192,       // CONFIG_SM_URC_BUFFER_SIZE; resets on overflow
+  commandMillis: 2,         // AT command processing
+  registerMillis: 1500,     // CFUN=1 until +CEREG: 1
+  connectMillis: 300,       // #XMQTTCON until OK (then CONNACK)
+  brokerMillis: 80,         // Broker round trip (PUBACK, SUBACK, loopback)
+  uplinkBytesPerSec: 20000, // LTE send rate; the SM doesn't drain the UART
+  restartMillis: 800,       // #XRESET until Ready, SHUTDOWN until INIT
+  imeisv: '3526560812345601',
+  script: [],               // [{ atMillis, fault, ...args }], see inject()
+};
+
+class FakeNRF9151 {
+  constructor(clock, uart, options = {}) {
+    this.clock = clock;
+    this.uart = uart;
+    this.opt = { ...DEFAULTS, ...options };
+    this.byteNanos = 10e9 / this.opt.baud;
+    this.stats = {
+      commands: 0, errors: 0, publishes: 0, publishBytes: 0, delivered: 0,
+      lostBytes: 0, maxSlabBytes: 0, midStreamSends: 0, urcOverflows: 0,
+      faults: 0, restarts: 0,
+    };
+
+    this.rxWire = [];  // [arrivalNanos, byte] from the MCU
+    this.txWire = [];  // [arrivalNanos, byte] to the MCU
+    this.rxTimer = this.txTimer = null;
+    this.slab = [];    // Received, not yet processed by the SM
+    this.busyUntil = 0;
+    this.drainTimer = null;
+    this.epoch = 0;    // Bumped on reset, so stale timers do nothing
+    this.restart();
+
+    uart.onByte = (value) => this.onWireByte(value);
+    for (const { atMillis, fault, ...args } of this.opt.script) {
+      this.clock.createTimer(atMillis * 1e6, () => this.inject(fault, args));
+    }
+  }
+
+  // Injects a fault (or inbound message) at the current time:
+  //   shutdown    #XMODEM: SHUTDOWN, then INIT (radio left off)
+  //   crash       #XMODEM: FAULT, then as shutdown
+  //   reset       SiP reboot, then Ready (all state lost)
+  //   deregister  Lose the cell for `millis`, then re-register
+  //   deny        Refuse registration for `millis`
+  //   hang        Stop reading the UART for `millis` (RX slab overflows)
+  //   disconnect  Broker drops the MQTT connection
+  //   message     Inbound publish of `payload` to `topic`
+  inject(fault, args = {}) {
+    console.error(`fake_nrf9151: injecting ${fault}`);
+    ++this.stats.faults;
+    const millis = args.millis ?? this.opt.registerMillis;
+    switch (fault) {
+      case 'crash':
+        this.urc('#XMODEM: FAULT,0x5,0x1234');
+      // falls through
+      case 'shutdown':
+        this.dropNetwork();
+        this.cfun = 0;
+        this.urc('#XMODEM: SHUTDOWN,0');
+        this.later(this.opt.restartMillis, () => this.urc('#XMODEM: INIT,0'));
+        break;
+      case 'reset':
+        this.reboot();
+        break;
+      case 'deregister':
+        this.setStat(2);
+        this.later(this.opt.brokerMillis, () => this.dropMQTT(-128));
+        this.later(millis, () => this.cfun === 1 && this.setStat(1));
+        break;
+      case 'deny':
+        this.denyUntil = this.clock.nanos + millis * 1e6;
+        if (this.cfun === 1) this.setStat(3);
+        this.dropMQTT(-128);
+        break;
+      case 'hang':
+        this.busy(millis);
+        break;
+      case 'disconnect':
+        this.dropMQTT(-104);
+        break;
+      case 'message':
+        this.deliver(args.topic, Buffer.from(args.payload ?? ''));
+        break;
+      default:
+        throw new Error(`fake_nrf9151: unknown fault "${fault}"`);
+    }
+  }
+
+  // Power-on state, as after Ready
+  restart() {
+    ++this.epoch;
+    this.echo = true;
+    this.cmee = false;
+    this.cfun = 0;
+    this.cereg = 0;
+    this.stat = 0;
+    this.denyUntil = 0;
+    this.line = '';
+    this.dataMode = null;  // { topic, qos, retain, left, bytes }
+    this.heldURCs = [];    // Queued during data mode
+    this.mqtt = { id: '', connected: false, subs: [] };
+  }
+
+  reboot() {
+    ++this.stats.restarts;
+    this.restart();
+    this.slab = [];
+    this.later(this.opt.restartMillis, () => this.urc('Ready'));
+  }
+
+  // MCU to SM: bytes land in the RX slab one line-time apart
+  onWireByte(value) {
+    const now = this.clock.nanos;
+    const last = this.rxWire.length ? this.rxWire.at(-1)[0] : now;
+    this.rxWire.push([Math.max(now, last) + this.byteNanos, value]);
+    if (!this.rxTimer) this.armWire('rx');
+  }
+
+  armWire(dir) {
+    const wire = dir === 'rx' ? this.rxWire : this.txWire;
+    const delay = Math.max(0, wire[0][0] - this.clock.nanos);
+    this[`${dir}Timer`] = this.clock.createTimer(delay, () => {
+      this[`${dir}Timer`] = null;
+      const now = this.clock.nanos;
+      while (wire.length && wire[0][0] <= now) {
+        const [, value] = wire.shift();
+        dir === 'rx' ? this.onSlabByte(value) : this.uart.feedByte(value);
+      }
+      if (wire.length) this.armWire(dir);
+    });
+  }
+
+  onSlabByte(value) {
+    if (this.slab.length >= this.opt.rxSlabBytes) {
+      ++this.stats.lostBytes;
+      return;
+    }
+    this.slab.push(value);
+    const stats = this.stats;
+    stats.maxSlabBytes = Math.max(stats.maxSlabBytes, this.slab.length);
+    this.drain();
+  }
+
+  // The SM thread: processes received bytes unless busy
+  drain() {
+    while (this.slab.length && this.clock.nanos >= this.busyUntil) {
+      const value = this.slab.shift();
+      this.dataMode ? this.onDataByte(value) : this.onCommandByte(value);
+    }
+    if (this.slab.length && !this.drainTimer) {
+      const delay = Math.max(0, this.busyUntil - this.clock.nanos);
+      this.drainTimer = this.clock.createTimer(delay, () => {
+        this.drainTimer = null;
+        this.drain();
+      });
+    }
+  }
+
+  busy(millis) {
+    const until = this.clock.nanos + millis * 1e6;
+    this.busyUntil = Math.max(this.busyUntil, until);
+  }
+
+  onCommandByte(value) {
+    if (this.echo) this.send(Buffer.from([value]));
+    if (value !== 0x0a) {  // SM default termination is CRLF
+      this.line += String.fromCharCode(value);
+      return;
+    }
+    const line = this.line.trim();
+    this.line = '';
+    if (!line) return;
+
+    ++this.stats.commands;
+    this.busy(this.opt.commandMillis);
+    const epoch = this.epoch;
+    this.later(this.opt.commandMillis, () => {
+      if (epoch === this.epoch) this.command(line);
+    });
+  }
+
+  command(line) {
+    const ok = (...lines) => this.reply(...lines, 'OK');
+    const quoted = (s) => s.match(/"([^"]*)"/g)?.map((q) => q.slice(1, -1));
+    const args = line.slice(line.indexOf('=') + 1);
+    const mqtt = this.mqtt;
+
+    if (line === 'AT') return ok();
+    if (line === 'ATE0' || line === 'ATE1') {
+      this.echo = line === 'ATE1';
+      return ok();
+    }
+    if (line === 'AT+CMEE=1') {
+      this.cmee = true;
+      return ok();
+    }
+    if (line === 'AT+CGMM') return ok('nRF9151-LACA');
+    if (line === 'AT+CGMR') return ok('mfw_nrf91x1_2.0.2');
+    if (line === 'AT+CGSN=2') return ok(`+CGSN: "${this.opt.imeisv}"`);
+    if (line === 'AT#XSMVER') return ok('#XSMVER: "1.0.0","v3.0.0","blub"');
+    if (line === 'AT+CFUN?') return ok(`+CFUN: ${this.cfun}`);
+    if (line === 'AT+CEREG?') return ok(`+CEREG: ${this.cereg},${this.stat}`);
+    if (line === 'AT%XMONITOR') {
+      return ok(`%XMONITOR: ${this.stat},"Fake","FAKE","24201","1A2B",7,20`);
+    }
+    if (line.startsWith('AT+CEREG=')) {
+      this.cereg = +args;
+      return ok();
+    }
+    if (line.startsWith('AT%XSYSTEMMODE=')) {
+      return this.cfun === 1 ? this.error() : ok();
+    }
+
+    if (line.startsWith('AT+CFUN=')) {
+      const mode = +args;
+      if (![0, 1, 4].includes(mode)) return this.error();
+      this.cfun = mode;
+      if (mode === 0) this.cereg = 0;  // Subscription resets at CFUN=0
+      if (mode !== 1) {
+        this.dropNetwork();
+      } else if (this.stat !== 1 && this.stat !== 5) {
+        this.setStat(2);
+        this.later(this.opt.registerMillis, () => this.tryRegister());
+      }
+      return ok();
+    }
+
+    if (line.startsWith('AT#XMQTTCFG=')) {
+      mqtt.id = quoted(args)?.[0] ?? '';
+      return mqtt.connected ? this.error() : ok();
+    }
+
+    if (line === 'AT#XMQTTCON=0') {
+      if (!mqtt.connected) return this.error();
+      ok();
+      return this.dropMQTT(0);
+    }
+
+    // The SM blocks (taking no commands) until the broker connection is
+    // up, then replies, then reports CONNACK
+    if (line.startsWith('AT#XMQTTCON=1')) {
+      if (mqtt.connected || !this.registered()) return this.error();
+      this.busy(this.opt.connectMillis);
+      return this.later(this.opt.connectMillis, () => {
+        if (!this.registered()) return this.error();
+        mqtt.connected = true;
+        mqtt.subs = [];  // Clean session
+        ok();
+        this.urc('#XMQTTEVT: 0,0');
+      });
+    }
+
+    if (line.startsWith('AT#XMQTTSUB=')) {
+      const filter = quoted(args)?.[0];
+      if (!mqtt.connected || !filter) return this.error();
+      mqtt.subs.push(filter);
+      ok();
+      const suback = () => this.urc('#XMQTTEVT: 7,0');
+      return this.later(this.opt.brokerMillis, suback);
+    }
+
+    if (line.startsWith('AT#XMQTTPUB=')) {
+      const [topic, msg] = quoted(args) ?? [];
+      const [qos, retain, len] = args.split(',').slice(2).map(Number);
+      if (!mqtt.connected || topic === undefined) return this.error();
+      if (msg) {
+        ok();
+        return this.publish(topic, Buffer.from(msg), qos);
+      }
+      if (!(len > 0)) return this.error();  // Only counted data mode
+      this.dataMode = { topic, qos, retain, left: len, bytes: [] };
+      return ok();
+    }
+
+    if (line === 'AT#XMODEMRESET') {
+      this.dropNetwork();
+      this.cfun = this.cereg = 0;
+      this.busy(this.opt.restartMillis);
+      return this.later(this.opt.restartMillis, () => {
+        this.reply('#XMODEMRESET: 0', 'OK');
+      });
+    }
+
+    if (line === 'AT#XRESET') {
+      ok();
+      return this.later(1, () => this.reboot());
+    }
+
+    return this.error();
+  }
+
+  onDataByte(value) {
+    const data = this.dataMode;
+    data.bytes.push(value);
+    if (data.bytes.length > this.opt.dataModeBufBytes) {
+      // Buffer full: the SM sends what it has, and stops reading meanwhile
+      ++this.stats.midStreamSends;
+      this.busy(this.uplinkMillis(data.bytes.length));
+      data.bytes = [];
+    }
+    if (--data.left > 0) return;
+
+    const payload = Buffer.from(data.bytes);
+    this.dataMode = null;
+    const millis = this.uplinkMillis(payload.length);
+    this.busy(millis);
+    this.later(millis, () => {
+      this.urc('#XDATAMODE: 0', true);
+      for (const text of this.heldURCs.splice(0)) this.urc(text);
+      this.publish(data.topic, payload, data.qos);
+    });
+  }
+
+  publish(topic, payload, qos) {
+    ++this.stats.publishes;
+    this.stats.publishBytes += payload.length;
+    this.later(this.opt.brokerMillis, () => {
+      if (!this.mqtt.connected) return;
+      if (qos === 1) this.urc('#XMQTTEVT: 3,0');
+      this.deliver(topic, payload);
+    });
+  }
+
+  // Loopback broker: echoes publishes back to matching subscriptions
+  deliver(topic, payload) {
+    if (!this.mqtt.connected) return;
+    if (!this.mqtt.subs.some((filter) => topicMatches(filter, topic))) return;
+    ++this.stats.delivered;
+    const header = `#XMQTTMSG: ${topic.length},${payload.length}\r\n`;
+    const body = Buffer.concat([
+      Buffer.from(`${header}${topic}\r\n`), payload, Buffer.from('\r\n'),
+    ]);
+    this.urc(body);
+    this.urc('#XMQTTEVT: 2,0');
+  }
+
+  registered() {
+    return this.cfun === 1 && (this.stat === 1 || this.stat === 5);
+  }
+
+  tryRegister() {
+    if (this.cfun !== 1 || this.registered()) return;
+    if (this.clock.nanos < this.denyUntil) {
+      this.setStat(3);
+      const retry = (this.denyUntil - this.clock.nanos) / 1e6;
+      return this.later(retry, () => this.tryRegister());
+    }
+    this.setStat(1);
+  }
+
+  setStat(stat) {
+    this.stat = stat;
+    if (this.cereg === 5) {
+      this.urc(`+CEREG: ${stat},"1A2B","0101ABCD",7,,,"11100000","11100000"`);
+    }
+  }
+
+  dropNetwork() {
+    if (this.stat !== 0) this.setStat(0);
+    this.dropMQTT(-128);
+  }
+
+  dropMQTT(result) {
+    if (!this.mqtt.connected) return;
+    this.mqtt.connected = false;
+    this.urc(`#XMQTTEVT: 1,${result}`);
+  }
+
+  error() {
+    ++this.stats.errors;
+    this.reply(this.cmee ? '+CME ERROR: 0' : 'ERROR');
+  }
+
+  reply(...lines) {
+    this.send(Buffer.from(lines.map((l) => `${l}\r\n`).join('')));
+  }
+
+  // URCs wait out data mode, and a full URC ring throws everything away
+  urc(text, now = false) {
+    if (this.dataMode && !now) return this.heldURCs.push(text);
+    const bytes = Buffer.isBuffer(text) ? text : Buffer.from(`${text}\r\n`);
+    if (this.txWire.length + bytes.length > this.opt.urcRingBytes) {
+      ++this.stats.urcOverflows;
+      this.txWire.length = 0;
+      return;
+    }
+    this.send(bytes);
+  }
+
+  // SM to MCU: bytes reach the RP2040 UART one line-time apart
+  send(bytes) {
+    const now = this.clock.nanos;
+    for (const value of bytes) {
+      const last = this.txWire.length ? this.txWire.at(-1)[0] : now;
+      this.txWire.push([Math.max(now, last) + this.byteNanos, value]);
+    }
+    if (!this.txTimer && this.txWire.length) this.armWire('tx');
+  }
+
+  later(millis, fn) {
+    const epoch = this.epoch;
+    this.clock.createTimer(millis * 1e6, () => epoch === this.epoch && fn());
+  }
+
+  uplinkMillis(bytes) {
+    return (bytes * 1000) / this.opt.uplinkBytesPerSec;
+  }
+}
+
+function topicMatches(filter, topic) {
+  const f = filter.split('/'), t = topic.split('/');
+  for (let i = 0; i < f.length; ++i) {
+    if (f[i] === '#') return true;
+    if (i >= t.length || (f[i] !== '+' && f[i] !== t[i])) return false;
+  }
+  return f.length === t.length;
+}
+
+module.exports = { FakeNRF9151, topicMatches };
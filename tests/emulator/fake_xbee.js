@@ -0,0 +1,870 @@
+// Fake Digi XBee Cellular on an emulated UART, for end-to-end tests of the
+// shared_src XBee stack (xbee_radio, xbee_status_monitor, xbee_socket_keeper,
+// xbee_mqtt_adapter). Speaks the +++ / AT command-mode handshake and API
+// frames (shared_src/xbee_api.h), with byte timing at the line rate, TCP
+// sockets over a latency- and bandwidth-limited network, cyclic sleep, a
+// loopback MQTT broker, and scripted faults.
+
+const { topicMatches } = require('./fake_nrf9151');
+
+const DEFAULTS = {
+  baud: 9600,               // Power-on BD (3) until changed by ATBD
+  rxBufferBytes: 2048,      // Serial receive buffer; overflow is lost
+  frameMillis: 1,           // API frame or AT command processing
+  registerMillis: 2500,     // Power-on until ModemStatus REGISTERED
+  dnsMillis: 150,           // Name lookup (ATLA, SocketConnect by name)
+  latencyMillis: 60,        // One-way network delay
+  tlsMillis: 400,           // Extra handshake time for TLS sockets
+  uplinkBytesPerSec: 20000, // LTE-M send rate
+  downlinkBytesPerSec: 40000,
+  maxPacketBytes: 1500,     // Largest SocketSend or SocketReceive payload
+  maxSockets: 6,
+  address: '10.64.1.23',    // Our IP (MY) while registered
+  brokerAddress: '10.8.0.1',
+  brokerPort: 1883,
+  hosts: {},                // Name => IP (null fails); others get the broker
+  iccid: '89014103211118510720',
+  imei: '354616090012345',
+  imsi: '310410123456789',
+  script: [],               // [{ atMillis, fault, ...args }], see inject()
+};
+
+// BD register values
+const BAUDS = [
+  1200, 2400, 4800, 9600, 19200, 38400, 57600, 115200, 230400, 460800, 921600,
+];
+
+// Settable registers: power-on value (kept over reset if saved by WR),
+// and which values are accepted
+const SETTINGS = {
+  BD: { init: 3, valid: (v) => v < BAUDS.length },
+  AP: { init: 0, valid: (v) => v <= 1 },  // No escaped API mode (2)
+  GT: { init: 1000, valid: (v) => v >= 2 },  // Guard time, ms
+  CT: { init: 100, valid: (v) => v >= 2 },   // Command mode timeout, 0.1s
+  CP: { init: 0, valid: (v) => v <= 4 },
+  SM: { init: 0, valid: (v) => [0, 1, 4, 5].includes(v) },
+  SP: { init: 1800000, valid: () => true },
+  ST: { init: 60000, valid: () => true },
+  AN: { init: '', text: true },
+};
+
+const TEXT_REGISTERS = ['AN', 'S#', 'IM', 'II', 'MN', 'OA'];
+const CONTROLS = ['AC', 'WR', 'FR'];  // Commands that act, not registers
+
+class FakeXBee {
+  constructor(clock, uart, options = {}) {
+    this.clock = clock;
+    this.uart = uart;
+    this.opt = { ...DEFAULTS, ...options };
+    this.stats = {
+      frames: 0, badFrames: 0, atCommands: 0, garbledBytes: 0, lostBytes: 0,
+      sockets: 0, connects: 0, sends: 0, uplinkBytes: 0, downlinkBytes: 0,
+      transmitErrors: 0, mqttConnects: 0, publishes: 0, publishBytes: 0,
+      delivered: 0, mqttErrors: 0, faults: 0, restarts: 0,
+      sleeps: 0, sleepMillis: 0, sleepLostBytes: 0,
+    };
+
+    this.saved = {};   // Settings written by ATWR
+    this.rxWire = [];  // [arrivalNanos, byte] from the MCU
+    this.txWire = [];  // [arrivalNanos, byte, baud] to the MCU
+    this.rxTimer = this.txTimer = null;
+    this.drainTimer = null;
+    this.epoch = 0;    // Bumped on reset, so stale timers do nothing
+    this.broker = new LoopbackBroker(this.stats);
+    this.sockets = new Map();
+    this.boot();
+
+    uart.onByte = (value) => this.onWireByte(value);
+    for (const { atMillis, fault, ...args } of this.opt.script) {
+      this.clock.createTimer(atMillis * 1e6, () => this.inject(fault, args));
+    }
+  }
+
+  // Injects a fault (or inbound message) at the current time:
+  //   deregister     Lose the cell for `millis` (sockets close), then return
+  //   drop           Every open socket loses its connection
+  //   disconnect     Broker hangs up on every client
+  //   transmitError  Fail the next `count` SocketSends (NETWORK_FAILURE)
+  //   hang           Stop reading the UART for `millis` (buffer overflows)
+  //   reset          Reboot; settings not saved by ATWR are lost
+  //   message        Broker publishes `payload` to `topic`
+  inject(fault, args = {}) {
+    console.error(`fake_xbee: injecting ${fault}`);
+    ++this.stats.faults;
+    const millis = args.millis ?? this.opt.registerMillis;
+    switch (fault) {
+      case 'deregister':
+        this.setRegistered(false);
+        this.later(millis, () => this.setRegistered(true));
+        break;
+      case 'drop':
+        for (const sock of [...this.sockets.values()]) {
+          if (sock.state !== 'open') this.closeSocket(sock, 0x07);
+        }
+        break;
+      case 'disconnect':
+        this.broker.hangUpAll();
+        break;
+      case 'transmitError':
+        this.transmitErrors += args.count ?? 1;
+        break;
+      case 'hang':
+        this.busy(millis);
+        break;
+      case 'reset':
+        this.reboot();
+        break;
+      case 'message':
+        this.broker.publish(args.topic, Buffer.from(args.payload ?? ''), 0);
+        break;
+      default:
+        throw new Error(`fake_xbee: unknown fault "${fault}"`);
+    }
+  }
+
+  // Power-on state, from saved settings
+  boot() {
+    ++this.epoch;
+    for (const sock of this.sockets.values()) this.broker.drop(sock.client);
+    this.sockets.clear();
+    this.regs = {};
+    for (const [name, { init, text }] of Object.entries(SETTINGS)) {
+      const value = text ? Buffer.from(init) : numberBuffer(init);
+      this.regs[name] = this.saved[name] ?? value;
+    }
+    this.pending = {};    // Queued settings, applied by AC or CN
+    this.baud = BAUDS[this.number('BD')];
+    this.commandMode = false;
+    this.line = '';
+    this.frameIn = [];
+    this.rxBuffer = [];
+    this.busyUntil = 0;
+    this.plusCount = 0;
+    this.lastRxNanos = -Infinity;
+    this.registered = false;
+    this.asleep = false;
+    this.assoc = 0x22;    // REGISTERING
+    this.transmitErrors = 0;
+    this.uplink = { rate: this.opt.uplinkBytesPerSec, freeAt: 0 };
+    this.downlink = { rate: this.opt.downlinkBytesPerSec, freeAt: 0 };
+
+    this.modemStatus(0x00);  // POWER_UP, if booting into API mode
+    this.later(this.opt.registerMillis, () => this.setRegistered(true));
+    this.touchSleep();  // If SM was saved
+  }
+
+  reboot() {
+    ++this.stats.restarts;
+    this.boot();
+  }
+
+  // MCU to XBee: bytes arrive one line-time apart, and only make sense
+  // if both ends agree on the baud rate
+  onWireByte(value) {
+    const now = this.clock.nanos;
+    const last = this.rxWire.length ? this.rxWire.at(-1)[0] : now;
+    this.rxWire.push([Math.max(now, last) + 10e9 / this.baud, value]);
+    if (!this.rxTimer) this.armWire('rx');
+  }
+
+  armWire(dir) {
+    const wire = dir === 'rx' ? this.rxWire : this.txWire;
+    const delay = Math.max(0, wire[0][0] - this.clock.nanos);
+    this[`${dir}Timer`] = this.clock.createTimer(delay, () => {
+      this[`${dir}Timer`] = null;
+      const now = this.clock.nanos;
+      while (wire.length && wire[0][0] <= now) {
+        const [, value, baud] = wire.shift();
+        if (dir === 'rx') {
+          this.onUartByte(value);
+        } else if (this.baudMatches(baud)) {
+          this.uart.feedByte(value);
+        } else {
+          ++this.stats.garbledBytes;
+        }
+      }
+      if (wire.length) this.armWire(dir);
+    });
+  }
+
+  // A UART tolerates a few percent of clock mismatch; rp2040js reports
+  // the MCU side's setting (if it doesn't, assume the firmware got it right)
+  baudMatches(baud) {
+    const mcu = this.uart.baudRate;
+    if (!Number.isFinite(mcu) || mcu <= 0) return true;
+    return Math.abs(mcu - baud) / baud < 0.03;
+  }
+
+  onUartByte(value) {
+    if (this.asleep) {
+      ++this.stats.sleepLostBytes;  // No flow control, so just lost
+      return;
+    }
+    if (!this.baudMatches(this.baud)) {
+      ++this.stats.garbledBytes;
+      this.lastRxNanos = this.clock.nanos;  // Noise still breaks up +++
+      this.plusCount = 0;
+      return;
+    }
+    if (!this.commandMode) this.checkEscape(value);
+    if (this.rxBuffer.length >= this.opt.rxBufferBytes) {
+      ++this.stats.lostBytes;
+      return;
+    }
+    this.rxBuffer.push(value);
+    this.drain();
+  }
+
+  // "+++" with GT of silence on both sides enters command mode
+  checkEscape(value) {
+    const now = this.clock.nanos;
+    const guard = this.number('GT') * 1e6;
+    const quiet = now - this.lastRxNanos >= guard;
+    this.lastRxNanos = now;
+    if (value !== 0x2b || this.plusCount >= 3 || (!this.plusCount && !quiet)) {
+      this.plusCount = 0;
+      return;
+    }
+    if (++this.plusCount < 3) return;
+    const epoch = this.epoch;
+    this.clock.createTimer(guard, () => {
+      if (epoch !== this.epoch || this.lastRxNanos !== now) return;
+      this.plusCount = 0;
+      this.commandMode = true;
+      this.rxBuffer = [];  // The +++ itself isn't data
+      this.line = '';
+      this.reply('OK');
+      this.touchCommandMode();
+    });
+  }
+
+  // The XBee's own thread: processes received bytes unless busy
+  drain() {
+    while (this.rxBuffer.length && this.clock.nanos >= this.busyUntil) {
+      const value = this.rxBuffer.shift();
+      if (this.commandMode) {
+        this.onCommandByte(value);
+      } else if (this.number('AP') === 1) {
+        this.onApiByte(value);
+      }  // Transparent mode data goes nowhere
+    }
+    if (this.rxBuffer.length && !this.drainTimer) {
+      const delay = Math.max(0, this.busyUntil - this.clock.nanos);
+      this.drainTimer = this.clock.createTimer(delay, () => {
+        this.drainTimer = null;
+        this.drain();
+      });
+    }
+  }
+
+  busy(millis) {
+    const until = this.clock.nanos + millis * 1e6;
+    this.busyUntil = Math.max(this.busyUntil, until);
+  }
+
+  //
+  // Command mode: "ATxx[param][,xx[param]...]\r", one reply per command
+  //
+
+  onCommandByte(value) {
+    if (value !== 0x0d) {
+      this.line += String.fromCharCode(value);
+      return;
+    }
+    const line = this.line.trim();
+    this.line = '';
+    this.touchCommandMode();
+    this.busy(this.opt.frameMillis);
+    this.after(this.opt.frameMillis, () => this.commandLine(line));
+  }
+
+  commandLine(line) {
+    if (!/^AT/i.test(line)) return this.reply('ERROR');
+    for (const part of line.slice(2).split(',')) {
+      if (!this.commandMode) break;  // After CN
+      ++this.stats.atCommands;
+      const name = part.slice(0, 2).toUpperCase();
+      const param = part.slice(2).trim();
+      if (!name) {
+        this.reply('OK');
+      } else if (name === 'CN') {
+        this.reply('OK');  // At the old rate, before changes apply
+        this.exitCommandMode();
+      } else if (CONTROLS.includes(name)) {
+        this.reply('OK');
+        this.control(name);
+      } else if (!param) {
+        const value = this.register(name);
+        if (!value) {
+          this.reply('ERROR');
+        } else if (TEXT_REGISTERS.includes(name)) {
+          this.reply(value.toString('latin1'));
+        } else {
+          this.reply(bufferNumber(value).toString(16).toUpperCase());
+        }
+      } else {
+        const text = SETTINGS[name]?.text;
+        const value = text ? Buffer.from(param, 'latin1') : hexBuffer(param);
+        const ok = value && !this.setRegister(name, value, true);
+        this.reply(ok ? 'OK' : 'ERROR');
+      }
+    }
+  }
+
+  // Exits after CT of no commands, as if CN had been sent
+  touchCommandMode() {
+    const token = this.commandToken = {};
+    this.later(this.number('CT') * 100, () => {
+      if (this.commandMode && token === this.commandToken) {
+        this.exitCommandMode();
+      }
+    });
+  }
+
+  exitCommandMode() {
+    this.applyChanges();
+    this.commandMode = false;
+    this.frameIn = [];
+  }
+
+  control(name) {
+    switch (name) {
+      case 'AC':
+        this.applyChanges();
+        break;
+      case 'WR':
+        this.applyChanges();
+        Object.assign(this.saved, this.regs);
+        break;
+      case 'FR':
+        this.later(100, () => this.reboot());
+        break;
+    }
+  }
+
+  applyChanges() {
+    Object.assign(this.regs, this.pending);
+    this.pending = {};
+    this.baud = BAUDS[this.number('BD')];
+    this.touchSleep();
+  }
+
+  // Cyclic sleep (SM 4 or 5): after ST with no frames from the MCU, sleeps
+  // for SP, then stays awake for at least ST again
+  touchSleep() {
+    const token = this.sleepToken = {};
+    if (![4, 5].includes(this.number('SM')) || this.asleep) return;
+    this.later(this.number('ST'), () => {
+      if (token !== this.sleepToken) return;
+      const millis = this.number('SP');
+      this.asleep = true;
+      ++this.stats.sleeps;
+      this.stats.sleepMillis += millis;
+      this.later(millis, () => {
+        this.asleep = false;
+        this.touchSleep();
+      });
+    });
+  }
+
+  //
+  // API mode: <0x7E> <len MSB> <len LSB> <type> <payload...> <checksum>
+  //
+
+  onApiByte(value) {
+    const f = this.frameIn;
+    if (!f.length && value !== 0x7e) return;  // Hunting for a delimiter
+    f.push(value);
+    if (f.length < 3) return;
+
+    const size = (f[1] << 8) | f[2];  // Including type
+    if (size < 1 || size > 1600) {
+      ++this.stats.badFrames;
+      this.frameIn = [];
+      return;
+    }
+    if (f.length < size + 4) return;
+
+    this.frameIn = [];
+    const body = Buffer.from(f.slice(3, 3 + size));
+    const check = body.reduce((sum, v) => sum + v, f[3 + size]);
+    if ((check & 0xff) !== 0xff) {
+      ++this.stats.badFrames;
+      return;
+    }
+
+    ++this.stats.frames;
+    this.touchSleep();
+    this.busy(this.opt.frameMillis);
+    this.after(this.opt.frameMillis, () => this.frame(body[0], body.slice(1)));
+  }
+
+  frame(type, payload) {
+    switch (type) {
+      case 0x08: return this.atFrame(payload, true);   // ATCommand
+      case 0x09: return this.atFrame(payload, false);  // ATCommandQueue
+      case 0x40: return this.socketCreate(payload);
+      case 0x41: return this.socketOption(payload);
+      case 0x42: return this.socketConnect(payload);
+      case 0x43: return this.socketClose(payload);
+      case 0x44: return this.socketSend(payload);
+    }
+    ++this.stats.badFrames;  // Not modeled (SMS, UDP, GNSS, ...)
+  }
+
+  atFrame(payload, now) {
+    ++this.stats.atCommands;
+    const [frameId] = payload;
+    const name = payload.toString('latin1', 1, 3);
+    const param = payload.subarray(3);
+    const respond = (status, data = []) => {
+      const head = [frameId, payload[1], payload[2], status];
+      if (frameId) this.sendFrame(0x88, head, data);
+    };
+
+    if (name === 'LA') return this.lookup(param.toString('latin1'), respond);
+    if (CONTROLS.includes(name)) {
+      respond(0);
+      return this.control(name);
+    }
+    if (!param.length) {
+      const value = this.register(name);
+      return value ? respond(0, value) : respond(2);  // BAD_COMMAND
+    }
+    respond(this.setRegister(name, param, !now));
+  }
+
+  // Returns an ATCommandResponse status
+  setRegister(name, value, queue) {
+    const setting = SETTINGS[name];
+    if (!setting) return 2;  // BAD_COMMAND
+    if (!setting.text && !setting.valid(bufferNumber(value))) return 3;
+    if (queue) {
+      this.pending[name] = value;
+    } else {
+      this.regs[name] = value;
+      this.applyChanges();
+    }
+    return 0;
+  }
+
+  number(name) {
+    return bufferNumber(this.regs[name]);  // In effect, not pending
+  }
+
+  register(name) {
+    if (this.regs[name]) return this.pending[name] ?? this.regs[name];
+    const up = this.registered;
+    const apn = this.regs.AN.toString('latin1');
+    switch (name) {
+      case 'AI': return Buffer.from([this.assoc]);
+      case 'HV': return numberBuffer(0x4c4a, 2);
+      case 'VR': return numberBuffer(0x11415, 4);
+      case 'S#': return Buffer.from(this.opt.iccid);
+      case 'IM': return Buffer.from(this.opt.imei);
+      case 'II': return Buffer.from(this.opt.imsi);
+      case 'MN': return Buffer.from(up ? 'Fake' : '');
+      case 'OA': return Buffer.from(up ? apn || 'broadband' : '');
+      case 'OT': return numberBuffer(up ? 8 : 0xffff, 2);  // LTE-M
+      case 'SQ': return numberBuffer(105, 2);              // -10.5dB
+      case 'SW': return numberBuffer(950, 2);              // -95.0dBm
+      case 'MY': return ipBuffer(up ? this.opt.address : '0.0.0.0');
+      case 'DT': {
+        const since2000 = 820454400 + this.clock.nanos / 1e9;  // 2026
+        return numberBuffer(Math.floor(since2000), 4);
+      }
+    }
+    return null;
+  }
+
+  lookup(name, respond) {
+    if (!this.registered) return respond(1);  // ERROR
+    this.later(this.opt.dnsMillis, () => {
+      const ip = this.resolve(name);
+      ip ? respond(0, ipBuffer(ip)) : respond(1);
+    });
+  }
+
+  resolve(name) {
+    const hosts = this.opt.hosts;
+    return name in hosts ? hosts[name] : this.opt.brokerAddress;
+  }
+
+  setRegistered(up) {
+    if (up === this.registered) return;
+    this.registered = up;
+    this.assoc = up ? 0x00 : 0x23;  // CONNECTED or CONNECTING
+    this.modemStatus(up ? 0x02 : 0x03);
+    if (up) return;
+    for (const sock of [...this.sockets.values()]) {
+      this.closeSocket(sock, 0x0e);  // PDP_DEACTIVATED
+    }
+  }
+
+  modemStatus(status) {
+    this.sendFrame(0x8a, [status]);
+  }
+
+  //
+  // Sockets: IDs are reused lowest-first, like the XBee's
+  //
+
+  socketCreate(payload) {
+    const [frameId, proto] = payload;
+    let status = 0x00, id = 0xff;
+    if (!this.registered) {
+      status = 0x22;  // NOT_REGISTERED
+    } else if (![1, 4].includes(proto)) {
+      status = 0x7b;  // BAD_PROTOCOL (no UDP here)
+    } else if (this.sockets.size >= this.opt.maxSockets) {
+      status = 0x32;  // RESOURCE_ERROR
+    } else {
+      for (id = 0; this.sockets.has(id); ++id);
+      this.sockets.set(id, { id, proto, state: 'open', client: null });
+      ++this.stats.sockets;
+    }
+    if (frameId) this.sendFrame(0xc0, [frameId, id, status]);
+  }
+
+  socketOption(payload) {
+    const [frameId, id, option] = payload;
+    const data = payload.subarray(3);
+    const sock = this.sockets.get(id);
+    let status = 0x00, value = [];
+    if (!sock) {
+      status = 0x20;  // BAD_SOCKET
+    } else if (option !== 0 || data.length > 1 || data[0] > 2) {
+      status = 0x01;  // BAD_PARAM
+    } else if (data.length) {
+      sock.tlsProfile = data[0];
+    } else {
+      value = [sock.tlsProfile ?? 0];
+    }
+    if (frameId) this.sendFrame(0xc1, [frameId, id, status, ...value]);
+  }
+
+  socketConnect(payload) {
+    const [frameId, id] = payload;
+    const port = payload.readUInt16BE(2);
+    const addressType = payload[4];
+    const address = payload.subarray(5);
+    const sock = this.sockets.get(id);
+    let status = 0x00;
+    if (!sock) {
+      status = 0x20;  // BAD_SOCKET
+    } else if (sock.state === 'connecting') {
+      status = 0x03;  // ALREADY_IN_PROGRESS
+    } else if (sock.state === 'connected') {
+      status = 0x04;  // ALREADY_CONNECTED
+    } else if (addressType > 1) {
+      status = 0x01;  // BAD_ADDRESS_TYPE
+    } else if (addressType === 0 && address.length !== 4) {
+      status = 0x02;  // BAD_PARAM
+    }
+    if (frameId) this.sendFrame(0xc2, [frameId, id, status]);
+    if (status) return;
+
+    sock.state = 'connecting';
+    const ip = addressType === 0 ? [...address].join('.') : null;
+    const tls = sock.proto === 4 ? this.opt.tlsMillis : 0;
+    const dns = ip ? 0 : this.opt.dnsMillis;
+    const handshake = 2 * this.opt.latencyMillis + tls;
+    this.forSocket(sock, dns + handshake, () => {
+      const dest = ip ?? this.resolve(address.toString('latin1'));
+      if (!dest) return this.closeSocket(sock, 0x01);  // FAILED_DNS
+      const { brokerAddress, brokerPort } = this.opt;
+      if (dest !== brokerAddress || port !== brokerPort) {
+        return this.closeSocket(sock, 0x02);  // CONNECTION_REFUSED
+      }
+
+      ++this.stats.connects;
+      sock.state = 'connected';
+      sock.client = this.broker.connect(
+        (bytes) => this.toSocket(sock, bytes),
+        () => this.toSocket(sock, null)
+      );
+      this.sendFrame(0xcf, [id, 0x00]);  // CONNECTED
+    });
+  }
+
+  socketClose(payload) {
+    const [frameId, id] = payload;
+    const all = id === 0xff;
+    const sock = this.sockets.get(id);
+    for (const s of all ? [...this.sockets.values()] : sock ? [sock] : []) {
+      this.broker.drop(s.client);
+      this.sockets.delete(s.id);
+    }
+    const status = all || sock ? 0x00 : 0x20;  // OK or BAD_SOCKET
+    if (frameId) this.sendFrame(0xc3, [frameId, id, status]);
+  }
+
+  socketSend(payload) {
+    const [frameId, id] = payload;
+    const data = payload.slice(3);
+    const sock = this.sockets.get(id);
+    let status = 0x00;
+    if (!sock || sock.state !== 'connected') {
+      status = 0x20;  // CONNECTION_NOT_FOUND
+    } else if (data.length > this.opt.maxPacketBytes) {
+      status = 0x74;  // MESSAGE_TOO_LONG
+    } else if (this.transmitErrors > 0) {
+      --this.transmitErrors;
+      ++this.stats.transmitErrors;
+      status = 0x21;  // NETWORK_FAILURE
+    }
+    if (status) {
+      if (frameId) this.sendFrame(0x89, [frameId, status]);
+      return;
+    }
+
+    ++this.stats.sends;
+    this.stats.uplinkBytes += data.length;
+    const sent = this.linkMillis(this.uplink, data.length);
+    this.later(sent, () => frameId && this.sendFrame(0x89, [frameId, 0x00]));
+    this.forSocket(sock, sent + this.opt.latencyMillis, () => {
+      this.broker.receive(sock.client, data);
+    });
+  }
+
+  // Network to XBee, then SocketReceive frames to the MCU;
+  // null is the far end closing, which arrives after any data
+  toSocket(sock, bytes) {
+    const size = bytes?.length ?? 0;
+    this.stats.downlinkBytes += size;
+    const link = this.linkMillis(this.downlink, size);
+    this.forSocket(sock, link + this.opt.latencyMillis, () => {
+      if (!bytes) return this.closeSocket(sock, 0x03);  // TRANSPORT_CLOSED
+      const chunk = this.opt.maxPacketBytes;
+      for (let i = 0; i < size; i += chunk) {
+        const data = bytes.subarray(i, i + chunk);
+        this.sendFrame(0xcd, [0x00, sock.id, 0x00], data);
+      }
+    });
+  }
+
+  closeSocket(sock, status) {
+    this.broker.drop(sock.client);
+    this.sockets.delete(sock.id);
+    this.sendFrame(0xcf, [sock.id, status]);
+  }
+
+  // Traffic on a link goes out in order at the link rate; returns the
+  // delay until these bytes are sent (not counting latency)
+  linkMillis(link, bytes) {
+    const now = this.clock.nanos;
+    link.freeAt = Math.max(now, link.freeAt) + (bytes * 1e9) / link.rate;
+    return (link.freeAt - now) / 1e6;
+  }
+
+  // Runs fn later if the socket is still open by then
+  forSocket(sock, millis, fn) {
+    this.later(millis, () => this.sockets.get(sock.id) === sock && fn());
+  }
+
+  //
+  // XBee to MCU
+  //
+
+  sendFrame(type, ...payload) {
+    if (this.number('AP') !== 1) return;  // Events are lost outside API mode
+    const parts = [[type], ...payload].map((part) => Buffer.from(part));
+    const body = Buffer.concat(parts);
+    const sum = body.reduce((total, v) => total + v, 0);
+    const head = Buffer.from([0x7e, body.length >> 8, body.length & 0xff]);
+    this.send(Buffer.concat([head, body, Buffer.from([0xff - (sum & 0xff)])]));
+  }
+
+  reply(text) {
+    this.send(Buffer.from(`${text}\r`, 'latin1'));
+  }
+
+  // Bytes reach the RP2040 UART one line-time apart, at the rate in use
+  // when they were sent
+  send(bytes) {
+    const now = this.clock.nanos;
+    for (const value of bytes) {
+      const last = this.txWire.length ? this.txWire.at(-1)[0] : now;
+      const arrival = Math.max(now, last) + 10e9 / this.baud;
+      this.txWire.push([arrival, value, this.baud]);
+    }
+    if (!this.txTimer && this.txWire.length) this.armWire('tx');
+  }
+
+  later(millis, fn) {
+    const epoch = this.epoch;
+    this.clock.createTimer(millis * 1e6, () => epoch === this.epoch && fn());
+  }
+
+  // Like later(), but for work the XBee thread was busy with
+  after(millis, fn) {
+    this.later(millis, () => {
+      fn();
+      this.drain();
+    });
+  }
+}
+
+// Minimal MQTT 3.1.1 broker for sockets that reach brokerAddress:brokerPort.
+// Handles CONNECT, SUBSCRIBE, UNSUBSCRIBE, PUBLISH (QoS 0/1), PINGREQ and
+// DISCONNECT, and loops publishes back to every matching subscription.
+class LoopbackBroker {
+  constructor(stats) {
+    this.stats = stats;
+    this.clients = new Set();
+  }
+
+  connect(send, close) {
+    const client = {
+      send: (bytes) => send(Buffer.from(bytes)), close,
+      input: Buffer.alloc(0), subs: [], pid: 1, connected: false,
+    };
+    this.clients.add(client);
+    return client;
+  }
+
+  drop(client) {
+    this.clients.delete(client);
+  }
+
+  hangUp(client) {
+    if (!this.clients.delete(client)) return;
+    client.close();
+  }
+
+  hangUpAll() {
+    for (const client of [...this.clients]) this.hangUp(client);
+  }
+
+  receive(client, bytes) {
+    client.input = Buffer.concat([client.input, bytes]);
+    while (this.clients.has(client)) {
+      const input = client.input;
+      let size = 0, at = 1, more = true;
+      for (let shift = 0; more && at < input.length; shift += 7) {
+        size |= (input[at] & 0x7f) << shift;
+        more = input[at++] & 0x80;
+      }
+      if (more || input.length < at + size) return;  // Not all here yet
+      client.input = input.subarray(at + size);
+      this.packet(client, input[0], input.subarray(at, at + size));
+    }
+  }
+
+  packet(client, header, body) {
+    const type = header >> 4;
+    if (!client.connected && type !== 1) return this.reject(client);
+    switch (type) {
+      case 1:  // CONNECT (clean session, whatever was asked)
+        ++this.stats.mqttConnects;
+        client.connected = true;
+        client.subs = [];
+        return client.send([0x20, 0x02, 0x00, 0x00]);
+
+      case 3: {  // PUBLISH
+        const qos = (header >> 1) & 3;
+        if (qos > 1) return this.reject(client);
+        const topicSize = body.readUInt16BE(0);
+        const topic = body.toString('utf8', 2, 2 + topicSize);
+        let at = 2 + topicSize;
+        if (qos) {
+          client.send([0x40, 0x02, body[at], body[at + 1]]);  // PUBACK
+          at += 2;
+        }
+        ++this.stats.publishes;
+        this.stats.publishBytes += body.length - at;
+        return this.publish(topic, body.subarray(at), qos);
+      }
+
+      case 4:  // PUBACK for a delivery
+        return;
+
+      case 8: {  // SUBSCRIBE
+        const granted = [];
+        for (let at = 2; at + 3 <= body.length;) {
+          const size = body.readUInt16BE(at);
+          const filter = body.toString('utf8', at + 2, at + 2 + size);
+          const qos = Math.min(body[at + 2 + size], 1);
+          client.subs = client.subs.filter((s) => s.filter !== filter);
+          client.subs.push({ filter, qos });
+          granted.push(qos);
+          at += 3 + size;
+        }
+        return client.send(mqttPacket(0x90, [body[0], body[1], ...granted]));
+      }
+
+      case 10: {  // UNSUBSCRIBE
+        for (let at = 2; at + 2 <= body.length;) {
+          const size = body.readUInt16BE(at);
+          const filter = body.toString('utf8', at + 2, at + 2 + size);
+          client.subs = client.subs.filter((s) => s.filter !== filter);
+          at += 2 + size;
+        }
+        return client.send([0xb0, 0x02, body[0], body[1]]);
+      }
+
+      case 12:  // PINGREQ
+        return client.send([0xd0, 0x00]);
+
+      case 14:  // DISCONNECT
+        return this.hangUp(client);
+    }
+    this.reject(client);
+  }
+
+  reject(client) {
+    ++this.stats.mqttErrors;
+    this.hangUp(client);
+  }
+
+  publish(topic, payload, qos) {
+    const topicBytes = Buffer.from(topic, 'utf8');
+    for (const client of this.clients) {
+      const subs = client.subs.filter((s) => topicMatches(s.filter, topic));
+      if (!client.connected || !subs.length) continue;
+      const q = Math.min(qos, Math.max(...subs.map((s) => s.qos)));
+      const pid = q ? [client.pid >> 8, client.pid & 0xff] : [];
+      if (q) client.pid = (client.pid % 0xffff) + 1;
+      const body = Buffer.concat([
+        numberBuffer(topicBytes.length, 2), topicBytes, Buffer.from(pid),
+        payload,
+      ]);
+      ++this.stats.delivered;
+      client.send(mqttPacket(0x30 | (q << 1), body));
+    }
+  }
+}
+
+function mqttPacket(header, body) {
+  const length = [];
+  let rest = body.length;
+  do {
+    length.push((rest & 0x7f) | (rest > 0x7f ? 0x80 : 0));
+    rest >>= 7;
+  } while (rest > 0);
+  return Buffer.concat([Buffer.from([header, ...length]), Buffer.from(body)]);
+}
+
+// Big-endian register value, at least `size` bytes
+function numberBuffer(value, size = 1) {
+  const bytes = [];
+  for (let v = value; v > 0 || bytes.length < size; v = Math.floor(v / 256)) {
+    bytes.unshift(v % 256);
+  }
+  return Buffer.from(bytes);
+}
+
+function bufferNumber(bytes) {
+  return bytes.reduce((value, v) => value * 256 + v, 0);
+}
+
+function hexBuffer(text) {
+  if (!/^[0-9a-f]{1,8}$/i.test(text)) return null;
+  return numberBuffer(parseInt(text, 16));
+}
+
+function ipBuffer(dotted) {
+  return Buffer.from(dotted.split('.').map(Number));
+}
+
+module.exports = { FakeXBee };
@@ -0,0 +1,65 @@
+// Host twins of tests/benchmarks/cell_modem_bench_test: CellModemClient
+// URC lines and inbound #XMQTTMSG payloads, on a FakeSerial
+
+#include <benchmark/benchmark.h>
+#include <fake_serial.h>
+
+#include "cell_modem_client.h"
+
+namespace {
+
+struct BenchClient {
+  etl::string<1024> written;
+  FakeSerial serial{0, "", &written};
+  etl::unique_ptr<CellModemClient> client =
+    make_cell_modem_client(&serial, "mqtt-serv");
+  int received_bytes = 0;
+
+  BenchClient() {
+    client->set_message_handler(
+      CellModemMessageHandler::create<BenchClient, &BenchClient::on_chunk>(
+        *this
+      )
+    );
+  }
+
+  void on_chunk(CellModemMessageChunk const& chunk) {
+    received_bytes += chunk.data.size();
+  }
+
+  void poll(etl::string_view input) {
+    written.clear();  // Bring-up commands, never answered
+    serial.read_buf = input;
+    client->poll();
+  }
+};
+
+}  // namespace
+
+static void BM_CellModemURCLines(benchmark::State& state) {
+  BenchClient bench;
+  std::string input;
+  for (int i = 0; i < 100; ++i) {  // Quiet URCs (PUBACK, SUBACK)
+    input += i % 2 ? "#XMQTTEVT: 7,0\r\n" : "#XMQTTEVT: 3,0\r\n";
+  }
+
+  for (auto _ : state) bench.poll(etl::string_view(input.data(), input.size()));
+  state.SetBytesProcessed(state.iterations() * input.size());
+}
+
+static void BM_CellModemMessageReceive(benchmark::State& state) {
+  BenchClient bench;
+  int const size = state.range(0);
+  std::string const topic = "blub/bench/command";
+  std::string input = "#XMQTTMSG: " + std::to_string(topic.size()) + "," +
+    std::to_string(size) + "\r\n" + topic + "\r\n";
+  for (int i = 0; i < size; ++i) input.push_back('a' + i % 26);
+  input += "\r\n";
+
+  for (auto _ : state) bench.poll(etl::string_view(input.data(), input.size()));
+  if (bench.received_bytes != state.iterations() * size) abort();
+  state.SetBytesProcessed(state.iterations() * input.size());
+}
+
+BENCHMARK(BM_CellModemURCLines);
+BENCHMARK(BM_CellModemMessageReceive)->Arg(100)->Arg(1000)->Arg(4000);
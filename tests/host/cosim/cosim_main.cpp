@@ -0,0 +1,61 @@
+#include "cosim_serial.h"
+
+#include <ok_logging.h>
+#include <unistd.h>
+
+static OkLoggingContext OK_CONTEXT("cosim");
+
+static constexpr int LINK_FD = 3;  // A socket to cosim_runner.js
+
+Print* ok_logging_stream = nullptr;
+LogSerial Serial1;
+CosimSerial Serial2(1), Serial3(2);
+
+// Exchanges pending bytes with the runner, at most once per microsecond of
+// host time unless forced (the far end moves no faster than that)
+void CosimSerial::sync(bool force) {
+  unsigned long const now = micros();
+  if (!force && tx.empty() && now == last_micros) return;
+  last_micros = now;
+
+  char head[64];
+  int const n = snprintf(head, sizeof(head), "%d %llu %lu ",
+      port, (unsigned long long) now * 1000, baud);
+  tx.insert(0, head, n);
+  tx.push_back('\n');
+  for (size_t done = 0; done < tx.size(); ) {
+    ssize_t const w = ::write(LINK_FD, tx.data() + done, tx.size() - done);
+    if (w <= 0) OK_FATAL("Lost the co-simulation runner (fd %d)", LINK_FD);
+    done += w;
+  }
+  tx.clear();
+
+  static char const DIGITS[] = "0123456789abcdef";
+  int high = -1;
+  for (;;) {
+    char buf[512];
+    ssize_t const r = ::read(LINK_FD, buf, sizeof(buf));
+    if (r <= 0) OK_FATAL("Lost the co-simulation runner (fd %d)", LINK_FD);
+    for (ssize_t i = 0; i < r; ++i) {
+      if (buf[i] == '\n') return;
+      int const digit = strchr(DIGITS, buf[i]) - DIGITS;
+      if (high < 0) {
+        high = digit;
+      } else if (rx.size() < fifo_size) {
+        rx.push_back(high << 4 | digit);
+        high = -1;
+      } else {
+        ++rx_dropped;
+        high = -1;
+      }
+    }
+  }
+}
+
+void setup();
+void loop();
+
+int main() {
+  setup();
+  for (;;) loop();
+}
@@ -0,0 +1,119 @@
+#!/usr/bin/env node
+// Runs a sketch built on the host (see cosim_serial.h) against the
+// emulator's fake devices, whose clock follows the sketch's host time.
+// The sketch's output (Serial1 and logs, both on its stderr) goes to
+// stdout, runner diagnostics to stderr. Exits when the sketch prints
+// "#END-TESTS#": 0 if nothing printed "#TEST-FAIL#", else 1.
+//
+// Options, as for ../../emulator/emulate_rp2040.js:
+//   --nrf9151=N              fake nRF9151 serial modem on uartN (Serial2 = 1)
+//   --nrf9151-options=JSON   overrides for it (see fake_nrf9151.js)
+//   --xbee=N                 fake XBee Cellular on uartN
+//   --xbee-options=JSON      overrides for it (see fake_xbee.js)
+
+const { spawn } = require('child_process');
+const readline = require('readline');
+const { FakeNRF9151 } = require('../../emulator/fake_nrf9151');
+const { FakeXBee } = require('../../emulator/fake_xbee');
+
+// The subset of rp2040js's clock the fakes use
+class SteppedClock {
+  constructor() {
+    this.nanos = 0;
+    this.timers = [];  // {at, seq, fn}, soonest first
+    this.seq = 0;
+  }
+
+  createTimer(delayNanos, fn) {
+    const timer = { at: this.nanos + delayNanos, seq: this.seq++, fn };
+    let lo = 0, hi = this.timers.length;
+    while (lo < hi) {
+      const mid = (lo + hi) >> 1;
+      const t = this.timers[mid];
+      if (t.at < timer.at || (t.at === timer.at && t.seq < timer.seq)) {
+        lo = mid + 1;
+      } else {
+        hi = mid;
+      }
+    }
+    this.timers.splice(lo, 0, timer);
+    return timer;
+  }
+
+  advanceTo(nanos) {
+    while (this.timers.length && this.timers[0].at <= nanos) {
+      const timer = this.timers.shift();
+      this.nanos = Math.max(this.nanos, timer.at);
+      timer.fn();
+    }
+    this.nanos = Math.max(this.nanos, nanos);
+  }
+}
+
+// The subset of an rp2040js UART the fakes use
+class SteppedUART {
+  constructor() {
+    this.baudRate = 0;
+    this.onByte = null;
+    this.fed = [];  // From the fake, not yet taken by the sketch
+  }
+
+  feedByte(value) { this.fed.push(value); }
+}
+
+const [sketch, ...flags] = process.argv.slice(2);
+const options = {};
+for (const flag of flags) {
+  const [, name, value] = flag.match(/^--([\w-]+)=(.*)$/) ?? [];
+  if (!name) throw new Error(`Bad option: ${flag}`);
+  options[name] = value;
+}
+if (!sketch) throw new Error("Usage: [script] sketch [--option=value ...]");
+
+const clock = new SteppedClock();
+const uarts = [0, 1, 2].map(() => new SteppedUART());
+const fakes = { nrf9151: FakeNRF9151, xbee: FakeXBee };
+const devices = {};
+for (const [name, Fake] of Object.entries(fakes)) {
+  if (options[name] === undefined) continue;
+  const fakeOptions = JSON.parse(options[`${name}-options`] ?? '{}');
+  devices[name] = new Fake(clock, uarts[+options[name]], fakeOptions);
+}
+
+// fd 3 carries "<port> <nanos> <baud> <hex sent>" lines from the sketch,
+// each answered with "<hex received>" once the clock has caught up
+const stdio = ['ignore', 'inherit', 'pipe', 'pipe'];
+const child = spawn(sketch, [], { stdio });
+const link = child.stdio[3];
+let partial = '';
+link.on('data', (chunk) => {
+  const lines = (partial + chunk).split('\n');
+  partial = lines.pop();
+  for (const line of lines) {
+    const [port, nanos, baud, sent = ''] = line.split(' ');
+    const uart = uarts[+port];
+    clock.advanceTo(+nanos);
+    uart.baudRate = +baud;
+    for (const value of Buffer.from(sent, 'hex')) uart.onByte?.(value);
+    link.write(Buffer.from(uart.fed.splice(0)).toString('hex') + '\n');
+  }
+});
+link.on('error', () => {});  // The sketch was stopped mid-exchange
+
+let failed = false, ended = false;
+readline.createInterface({ input: child.stderr }).on('line', (line) => {
+  console.log(line);
+  if (line.includes('#TEST-FAIL#')) failed = true;
+  if (line.includes('#END-TESTS#') && !ended) {
+    ended = true;
+    child.kill();
+  }
+});
+
+child.on('close', (code, signal) => {
+  for (const [name, device] of Object.entries(devices)) {
+    console.error(`fake_${name} stats: ${JSON.stringify(device.stats)}`);
+  }
+  if (!ended) console.error(`cosim: sketch exited (${signal ?? code})`);
+  process.exit(ended && !failed ? 0 : 1);
+});
@@ -0,0 +1,75 @@
+// Serial ports for sketch tests built on the host (see ../README.md):
+// Serial1 prints along with the logs, and Serial2 (or Serial3) trades bytes
+// with a fake device in cosim_runner.js, which steps its clock to host time
+
+#pragma once
+
+#include <Arduino.h>
+
+#include <deque>
+#include <string>
+
+extern arduino::Print* ok_logging_stream;  // Set by sketches; unused here
+
+// Writes to stderr, like the shim's logs, so the two stay in order
+class LogSerial : public arduino::HardwareSerial {
+ public:
+  void begin(unsigned long) override {}
+  void begin(unsigned long, uint16_t) override {}
+  void end() override {}
+  operator bool() override { return true; }
+  int available() override { return 0; }
+  int read() override { return -1; }
+  int peek() override { return -1; }
+  int availableForWrite() override { return 4096; }
+  size_t write(uint8_t c) override { return fputc(c, stderr) == c; }
+  size_t write(uint8_t const* data, size_t size) override {
+    return fwrite(data, 1, size, stderr);
+  }
+};
+
+// A UART whose far end is a fake device. Like rp2040js, transmitted bytes
+// leave at once (the fake paces them); received bytes wait in a FIFO of
+// setFIFOSize() bytes (as arduino-pico), and overruns are dropped.
+class CosimSerial : public arduino::HardwareSerial {
+ public:
+  explicit CosimSerial(int port) : port(port) {}
+
+  int rx_dropped = 0;  // Bytes lost to FIFO overrun
+
+  bool setFIFOSize(size_t size) { fifo_size = size; return true; }
+  void begin(unsigned long baud) override { sync(); this->baud = baud; }
+  void begin(unsigned long baud, uint16_t) override { begin(baud); }
+  void end() override { sync(); baud = 0; }
+  operator bool() override { return baud != 0; }
+
+  int available() override { sync(); return rx.size(); }
+  int read() override {
+    int const v = peek();
+    if (v >= 0) rx.pop_front();
+    return v;
+  }
+  int peek() override { sync(); return rx.empty() ? -1 : rx.front(); }
+
+  int availableForWrite() override { return 32; }  // The hardware FIFO
+  size_t write(uint8_t c) override {
+    static char const DIGITS[] = "0123456789abcdef";
+    tx.push_back(DIGITS[c >> 4]);
+    tx.push_back(DIGITS[c & 0xF]);
+    return 1;
+  }
+  void flush() override { sync(true); }
+
+ private:
+  int const port;
+  unsigned long baud = 0;
+  size_t fifo_size = 32;
+  std::deque<uint8_t> rx;
+  std::string tx;  // Hex, not yet sent to the runner
+  unsigned long last_micros = 0;
+
+  void sync(bool force = false);
+};
+
+extern LogSerial Serial1;
+extern CosimSerial Serial2, Serial3;
@@ -0,0 +1,28 @@
+// Stands in for libFuzzer's main() when not building with BLUB_FUZZ:
+// runs each input file named on the command line through the fuzz target,
+// e.g. to replay the seed corpus or a crash under the sanitizers
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include <vector>
+
+extern "C" int LLVMFuzzerTestOneInput(uint8_t const* data, size_t size);
+
+int main(int argc, char** argv) {
+  for (int i = 1; i < argc; ++i) {
+    FILE* file = fopen(argv[i], "rb");
+    if (file == nullptr) {
+      perror(argv[i]);
+      return 1;
+    }
+
+    std::vector<uint8_t> input;
+    for (int ch; (ch = fgetc(file)) != EOF; ) input.push_back(ch);
+    fclose(file);
+
+    fprintf(stderr, "Running: %s (%zu bytes)\n", argv[i], input.size());
+    LLVMFuzzerTestOneInput(input.data(), input.size());
+  }
+  return 0;
+}
@@ -0,0 +1,54 @@
+// Fuzzes XBeeRadio frame parsing, passing parsed frames on to an
+// XBeeMQTTAdapter with a connected socket (so MQTT-C parses payloads).
+// The first input byte sets the serial chunk size, to vary how frames
+// split across polls.
+
+#include <fake_serial.h>
+
+#include "xbee_api.h"
+#include "xbee_host_radio.h"
+#include "xbee_mqtt_adapter.h"
+#include "xbee_radio.h"
+
+static constexpr int SPACE = XBeeAPI::MAX_PAYLOAD + 5;
+
+static void on_message(mqtt_response_publish const& message) {
+  if (message.application_message_size > 2048) abort();
+}
+
+extern "C" int LLVMFuzzerTestOneInput(uint8_t const* data, size_t size) {
+  if (size < 1) return 0;
+  int const chunk_size = 1 + data[0] * 8;
+  etl::string_view input(reinterpret_cast<char const*>(data + 1), size - 1);
+
+  static etl::string<4096> written;
+  FakeSerial serial(0, "", &written);
+  etl::unique_ptr<XBeeRadio> radio(make_xbee_radio(&serial));
+  if (!start_fake_api_mode(radio.get(), &serial)) abort();
+
+  etl::unique_ptr<XBeeMQTTAdapter> mqtt(make_xbee_mqtt_adapter(2048, 2048));
+  mqtt->add_topic(
+      "blub/#", XBeeMQTTAdapter::MessageHandler::create<on_message>());
+  mqtt->use_socket(0);
+  mqtt_connect(
+      mqtt->client(), "BLUB Fuzz", nullptr, nullptr, 0, nullptr, nullptr,
+      MQTT_CONNECT_CLEAN_SESSION, 400);
+
+  static XBeeAPI::Frame in, out;
+  while (!input.empty()) {
+    auto const chunk = input.substr(0, chunk_size);
+    input.remove_prefix(chunk.size());
+    serial.read_buf = chunk;
+    while (radio->poll_for_frame(&in)) {
+      if (in.payload_size < 0 || in.payload_size > XBeeAPI::MAX_PAYLOAD) {
+        abort();
+      }
+      if (mqtt->incoming_to_outgoing(in, SPACE, &out)) {
+        if (out.payload_size > XBeeAPI::MAX_PAYLOAD) abort();
+      }
+    }
+    if (!serial.read_buf.empty()) abort();  // Polls must drain the input
+    written.clear();
+  }
+  return 0;
+}
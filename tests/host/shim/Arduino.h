@@ -0,0 +1,67 @@
+// Host stand-in for the parts of the Arduino core (arduino-pico) used by
+// shared_src and cell_modem, for the host build in tests/host
+
+#pragma once
+
+#include <math.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+namespace arduino {
+
+class Print {
+ public:
+  virtual ~Print() = default;
+  virtual size_t write(uint8_t) = 0;
+  virtual size_t write(uint8_t const* data, size_t size) {
+    size_t n = 0;
+    while (n < size && write(data[n])) ++n;
+    return n;
+  }
+  size_t write(char const* text) {
+    return write(reinterpret_cast<uint8_t const*>(text), strlen(text));
+  }
+  virtual int availableForWrite() { return 0; }
+  virtual void flush() {}
+  size_t print(char const* text) { return write(text); }
+};
+
+class Stream : public Print {
+ public:
+  virtual int available() = 0;
+  virtual int read() = 0;
+  virtual int peek() = 0;
+};
+
+class HardwareSerial : public Stream {
+ public:
+  virtual void begin(unsigned long baud) = 0;
+  virtual void begin(unsigned long baud, uint16_t config) = 0;
+  virtual void end() = 0;
+  virtual operator bool() = 0;
+};
+
+}  // namespace arduino
+
+using namespace arduino;
+
+// Host time starts at zero; delay() skips ahead instead of sleeping, so
+// (as in the emulator) idle time costs no wall clock
+unsigned long millis();
+unsigned long micros();
+void delay(unsigned long ms);
+void yield();
+
+long random(long max);            // [0, max)
+long random(long min, long max);  // [min, max)
+
+class RP2040 {
+ public:
+  uint32_t getCycleCount() { return getCycleCount64(); }
+  uint64_t getCycleCount64();  // Host time at F_CPU, not real cycles
+};
+
+extern RP2040 rp2040;
@@ -0,0 +1,51 @@
+#include <Arduino.h>
+#include <ok_logging.h>
+#include <stdarg.h>
+
+#include <chrono>
+
+RP2040 rp2040;
+OkLoggingLevel ok_logging_level = [] {
+  char const* env = getenv("OK_LOGGING_LEVEL");
+  if (env == nullptr) return OK_NOTE_LEVEL;
+  if (!strcmp(env, "detail")) return OK_DETAIL_LEVEL;
+  if (!strcmp(env, "error")) return OK_ERROR_LEVEL;
+  if (!strcmp(env, "fatal")) return OK_FATAL_LEVEL;
+  return OK_NOTE_LEVEL;
+}();
+
+static auto const start_time = std::chrono::steady_clock::now();
+static uint64_t skipped_nanos = 0;  // Time "spent" in delay()
+
+static uint64_t host_nanos() {
+  using namespace std::chrono;
+  auto const elapsed = steady_clock::now() - start_time;
+  return duration_cast<nanoseconds>(elapsed).count() + skipped_nanos;
+}
+
+unsigned long millis() { return host_nanos() / 1000000; }
+unsigned long micros() { return host_nanos() / 1000; }
+void delay(unsigned long ms) { skipped_nanos += ms * 1000000ull; }
+void yield() {}
+
+long random(long max) { return max > 0 ? ::random() % max : 0; }
+long random(long min, long max) { return min + random(max - min); }
+
+uint64_t RP2040::getCycleCount64() {
+  return host_nanos() * (F_CPU / 1000000) / 1000;
+}
+
+void ok_logging_report(
+  OkLoggingContext const& context, OkLoggingLevel level,
+  char const* file, int line, char const* format, ...
+) {
+  static char const* const level_text[] = {"", "", " ERROR", " FATAL"};
+  double const secs = host_nanos() * 1e-9;
+  fprintf(stderr, "%7.3f %s%s: ", secs, context.tag, level_text[level]);
+  va_list args;
+  va_start(args, format);
+  vfprintf(stderr, format, args);
+  va_end(args);
+  if (level == OK_FATAL_LEVEL) fprintf(stderr, " [%s:%d]", file, line);
+  fputc('\n', stderr);
+}
@@ -0,0 +1,37 @@
+// Host stand-in for the OK Logging library's macros, printing to stderr
+
+#pragma once
+
+enum OkLoggingLevel {
+  OK_DETAIL_LEVEL, OK_NOTE_LEVEL, OK_ERROR_LEVEL, OK_FATAL_LEVEL
+};
+
+struct OkLoggingContext {
+  explicit OkLoggingContext(char const* tag) : tag(tag) {}
+  char const* tag;
+};
+
+// Messages under this level are skipped (OK_NOTE_LEVEL unless changed,
+// or from $OK_LOGGING_LEVEL as "detail", "note", "error" or "fatal")
+extern OkLoggingLevel ok_logging_level;
+
+void ok_logging_report(
+  OkLoggingContext const&, OkLoggingLevel, char const* file, int line,
+  char const* format, ...
+) __attribute__((format(printf, 5, 6)));
+
+#define OK_REPORT_SOURCE(level, ...) ({  \
+    if ((level) >= ok_logging_level) {  \
+      ok_logging_report(OK_CONTEXT, level, __FILE__, __LINE__, __VA_ARGS__);  \
+    }  \
+  })
+
+#define OK_DETAIL(...) OK_REPORT_SOURCE(OK_DETAIL_LEVEL, __VA_ARGS__)
+#define OK_NOTE(...) OK_REPORT_SOURCE(OK_NOTE_LEVEL, __VA_ARGS__)
+#define OK_ERROR(...) OK_REPORT_SOURCE(OK_ERROR_LEVEL, __VA_ARGS__)
+#define OK_FATAL(...) ({  \
+    ok_logging_report(  \
+      OK_CONTEXT, OK_FATAL_LEVEL, __FILE__, __LINE__, __VA_ARGS__);  \
+    abort();  \
+  })
+#define OK_FATAL_IF(cond) ({ if (cond) OK_FATAL("%s", #cond); })
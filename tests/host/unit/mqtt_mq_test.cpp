@@ -0,0 +1,325 @@
+// Tests for the MQTT-C message queue (shared_src/MQTT-C/mqtt.c): the ring
+// of records, its packet ID index, and resending on ack timeout. mqtt.c is
+// built here against a fake PAL (not xbee_mqtt_adapter.cpp's).
+
+#include <Arduino.h>
+#include <ok_logging.h>
+#include <verifiers.h>
+
+#include <algorithm>
+#include <deque>
+#include <string>
+
+#include "MQTT-C/mqtt.h"
+
+static OkLoggingContext OK_CONTEXT("mqtt_mq_test");
+
+//
+// Fake PAL: sends collect in fake_sent, receives come from fake_incoming,
+// and the clock is fake_now
+//
+
+static std::string fake_sent, fake_incoming;
+static mqtt_pal_time_t fake_now = 0;
+
+extern "C" ssize_t mqtt_pal_sendall(
+    mqtt_pal_socket_handle, void const* data, size_t size, int) {
+  fake_sent.append(static_cast<char const*>(data), size);
+  return size;
+}
+
+extern "C" ssize_t mqtt_pal_recvall(
+    mqtt_pal_socket_handle, void* data, size_t size, int) {
+  size_t const n = std::min(size, fake_incoming.size());
+  memcpy(data, fake_incoming.data(), n);
+  fake_incoming.erase(0, n);
+  return n;
+}
+
+extern "C" mqtt_pal_time_t MQTT_PAL_TIME() { return fake_now; }
+
+//
+// Queue helpers
+//
+
+struct Record {
+  uint16_t pid;
+  size_t size;
+};
+
+static uint8_t constexpr QOS1_PUBLISH =
+    MQTT_CONTROL_PUBLISH << 4 | MQTT_PUBLISH_QOS_1;
+
+// Packs a QoS 1 PUBLISH-like record full of its packet ID's low byte; the
+// ID is set after registering, as mqtt_publish does
+static mqtt_queued_message* push(
+    mqtt_message_queue* mq, uint16_t pid, size_t size) {
+  mq->curr[0] = QOS1_PUBLISH;
+  memset(mq->curr + 1, pid & 0xFF, size - 1);
+  auto* const msg = mqtt_mq_register(mq, size);
+  msg->control_type = MQTT_CONTROL_PUBLISH;
+  msg->packet_id = pid;
+  return msg;
+}
+
+static mqtt_queued_message* find(mqtt_message_queue* mq, uint16_t pid) {
+  return mqtt_mq_find(mq, MQTT_CONTROL_PUBLISH, &pid);
+}
+
+static void complete(mqtt_message_queue* mq, uint16_t pid) {
+  auto* const msg = find(mq, pid);
+  VERIFY_A_OP_B(msg != nullptr, ==, true);
+  if (msg != nullptr) msg->state = MQTT_QUEUED_COMPLETE;
+}
+
+// Walks the queue, checking it against the model: same records in order,
+// intact, inside the buffer, and each found by its packet ID
+static void verify_queue(
+    mqtt_message_queue* mq, std::deque<Record> const& model) {
+  VERIFY_A_OP_B(mqtt_mq_length(mq), ==, model.size());
+  auto const* const mem_start = static_cast<uint8_t const*>(mq->mem_start);
+  auto const* const mem_end = static_cast<uint8_t const*>(mq->mem_end);
+  mqtt_queued_message* msg = mq->head;
+  for (auto const& record : model) {
+    VERIFY_A_OP_B(msg != nullptr, ==, true);
+    if (msg == nullptr) return;
+    VERIFY_A_OP_B(msg->packet_id, ==, record.pid);
+    VERIFY_A_OP_B(msg->size, ==, record.size);
+    VERIFY_A_OP_B((uint8_t const*) msg, >=, mem_start);
+    VERIFY_A_OP_B(msg->start + msg->size, <=, mem_end);
+    VERIFY_A_OP_B(msg->start[0], ==, QOS1_PUBLISH);
+    size_t intact = 1;
+    while (intact < msg->size && msg->start[intact] == (record.pid & 0xFF)) {
+      ++intact;
+    }
+    VERIFY_A_OP_B(intact, ==, record.size);
+    VERIFY_A_OP_B(find(mq, record.pid) == msg, ==, true);
+    msg = mqtt_mq_next(mq, msg);
+  }
+  VERIFY_A_OP_B(msg == nullptr, ==, true);
+}
+
+//
+// Tests
+//
+
+static void test_mq_wraparound() {
+  OK_NOTE("#TEST# test_mq_wraparound");
+  alignas(8) static uint8_t buf[600];
+  mqtt_message_queue mq;
+  mqtt_mq_init(&mq, buf, sizeof(buf));
+
+  // Mixed sizes, so records end at odd offsets and the ring wraps at
+  // different places; the oldest are acked (in order) to make room
+  std::deque<Record> model;
+  int wraps = 0;
+  for (uint16_t pid = 1; pid <= 1000; ++pid) {
+    size_t const size = 2 + random(0, 150);
+    bool const wrapped = mq.wrap != nullptr;
+    while (mq.curr_sz < size && !model.empty()) {
+      complete(&mq, model.front().pid);
+      model.pop_front();
+      mqtt_mq_clean(&mq);
+    }
+    push(&mq, pid, size);
+    model.push_back({pid, size});
+    if (!wrapped && mq.wrap != nullptr) ++wraps;
+    verify_queue(&mq, model);
+
+    if (random(0, 4) == 0) {  // Sometimes drain further
+      while (model.size() > 1) {
+        complete(&mq, model.front().pid);
+        model.pop_front();
+      }
+      mqtt_mq_clean(&mq);
+      verify_queue(&mq, model);
+    }
+  }
+  VERIFY_A_OP_B(wraps, >, 20);
+  OK_NOTE("Wrapped %d times", wraps);
+}
+
+static void test_mq_clean_out_of_order() {
+  OK_NOTE("#TEST# test_mq_clean_out_of_order");
+  alignas(8) static uint8_t buf[1024];
+  mqtt_message_queue mq;
+  mqtt_mq_init(&mq, buf, sizeof(buf));
+  std::deque<Record> model;
+  for (uint16_t pid = 1; pid <= 5; ++pid) {
+    push(&mq, pid, 30 + pid);
+    model.push_back({pid, size_t(30 + pid)});
+  }
+
+  // Acks for later messages only free space once the head is acked
+  size_t const full_sz = mq.curr_sz;
+  complete(&mq, 2);
+  complete(&mq, 3);
+  mqtt_mq_clean(&mq);
+  verify_queue(&mq, model);
+  VERIFY_A_OP_B(mq.curr_sz, ==, full_sz);
+  VERIFY_A_OP_B(find(&mq, 2)->state, ==, MQTT_QUEUED_COMPLETE);
+
+  complete(&mq, 1);
+  mqtt_mq_clean(&mq);
+  model.erase(model.begin(), model.begin() + 3);
+  verify_queue(&mq, model);
+  for (uint16_t pid = 1; pid <= 3; ++pid) {
+    VERIFY_A_OP_B(find(&mq, pid) == nullptr, ==, true);
+  }
+
+  // The space at the front is reused once the end runs out
+  for (uint16_t pid = 6; pid <= 40 && mq.wrap == nullptr; ++pid) {
+    push(&mq, pid, 40);
+    model.push_back({pid, 40});
+  }
+  VERIFY_A_OP_B(mq.wrap != nullptr, ==, true);
+  for (uint16_t pid = 41; pid <= 42; ++pid) {
+    push(&mq, pid, 40);
+    model.push_back({pid, 40});
+  }
+  verify_queue(&mq, model);
+
+  // Out of order across the wrap point; then everything, which resets
+  for (size_t i = 1; i < model.size(); i += 2) complete(&mq, model[i].pid);
+  mqtt_mq_clean(&mq);
+  verify_queue(&mq, model);
+  for (auto const& record : model) complete(&mq, record.pid);
+  mqtt_mq_clean(&mq);
+  VERIFY_A_OP_B(mqtt_mq_length(&mq), ==, 0);
+  VERIFY_A_OP_B(mq.wrap == nullptr, ==, true);
+  VERIFY_A_OP_B(mq.curr == buf + sizeof(mqtt_queued_message), ==, true);
+}
+
+static void test_mq_index() {
+  OK_NOTE("#TEST# test_mq_index");
+  alignas(8) static uint8_t buf[4096];
+  mqtt_message_queue mq;
+  mqtt_mq_init(&mq, buf, sizeof(buf));
+
+  // IDs 16 apart share a home slot; removing one of a probe chain must
+  // shift the rest back so they can still be found
+  std::deque<Record> model;
+  for (uint16_t pid : {1, 17, 2, 33, 3, 49}) {
+    push(&mq, pid, 20);
+    model.push_back({pid, 20});
+  }
+  verify_queue(&mq, model);  // Indexes all of them
+  complete(&mq, 1);
+  mqtt_mq_clean(&mq);
+  model.pop_front();
+  verify_queue(&mq, model);
+  VERIFY_A_OP_B(find(&mq, 1) == nullptr, ==, true);
+
+  complete(&mq, 33);  // Stays until 17 and 2 go
+  complete(&mq, 17);
+  complete(&mq, 2);
+  mqtt_mq_clean(&mq);
+  model.erase(model.begin(), model.begin() + 3);
+  verify_queue(&mq, model);
+
+  // Records registered since the last lookup are indexed lazily, and
+  // more than the index holds fall back to scanning
+  for (uint16_t pid = 100; pid < 120; ++pid) {
+    push(&mq, pid, 20);
+    model.push_back({pid, 20});
+  }
+  VERIFY_A_OP_B(mq.unindexed != nullptr, ==, true);
+  verify_queue(&mq, model);
+  VERIFY_A_OP_B(mq.unindexed == nullptr, ==, true);
+  VERIFY_A_OP_B(mq.index_overflow, ==, 1);
+  uint16_t const missing = 500;
+  VERIFY_A_OP_B(find(&mq, missing) == nullptr, ==, true);
+
+  // Removals while overflowed, then emptying the queue clears the flag
+  complete(&mq, 3);
+  complete(&mq, 49);
+  mqtt_mq_clean(&mq);
+  model.erase(model.begin(), model.begin() + 2);
+  verify_queue(&mq, model);
+  for (auto const& record : model) complete(&mq, record.pid);
+  mqtt_mq_clean(&mq);
+  VERIFY_A_OP_B(mq.index_overflow, ==, 0);
+  model.clear();
+  for (uint16_t pid = 200; pid < 210; ++pid) {
+    push(&mq, pid, 20);
+    model.push_back({pid, 20});
+  }
+  verify_queue(&mq, model);
+  VERIFY_A_OP_B(mq.index_overflow, ==, 0);
+}
+
+// Checks the control byte of each packet sent since the last check
+static void verify_sent(char const* types) {
+  std::string sent;
+  for (size_t at = 0; at + 1 < fake_sent.size(); ) {
+    sent.push_back(fake_sent[at]);
+    at += 2 + uint8_t(fake_sent[at + 1]);  // Short packets only
+  }
+  fake_sent.clear();
+  VERIFY_A_OP_B_STR(sent.c_str(), ==, types);
+}
+
+static void test_mq_timeout_resend() {
+  OK_NOTE("#TEST# test_mq_timeout_resend");
+  alignas(8) static uint8_t send_buf[1024], recv_buf[256];
+  static mqtt_client client;
+  fake_now = 0;
+  fake_sent.clear();
+  fake_incoming.clear();
+  mqtt_init(
+      &client, nullptr, send_buf, sizeof(send_buf),
+      recv_buf, sizeof(recv_buf), nullptr);
+  mqtt_connect(
+      &client, "test", nullptr, nullptr, 0, nullptr, nullptr,
+      MQTT_CONNECT_CLEAN_SESSION, 400);  // No PINGREQ during the test
+  VERIFY_A_OP_B(mqtt_sync(&client), ==, MQTT_OK);
+  verify_sent("\x10");
+  fake_incoming = std::string("\x20\x02\x00\x00", 4);  // CONNACK
+  VERIFY_A_OP_B(mqtt_sync(&client), ==, MQTT_OK);
+
+  // A at 0s, B at 10s; each is resent (with DUP) once 30s pass unacked
+  char const PUBLISH[] = "\x32", RESENT[] = "\x3A";  // DUP set
+  mqtt_publish(&client, "a", "A", 1, MQTT_PUBLISH_QOS_1);
+  uint16_t const pid_a = client.mq.tail->packet_id;
+  VERIFY_A_OP_B(mqtt_sync(&client), ==, MQTT_OK);
+  verify_sent(PUBLISH);
+
+  fake_now = 10000;
+  mqtt_publish(&client, "b", "B", 1, MQTT_PUBLISH_QOS_1);
+  VERIFY_A_OP_B(mqtt_sync(&client), ==, MQTT_OK);
+  verify_sent(PUBLISH);
+
+  fake_now = 30000;
+  VERIFY_A_OP_B(mqtt_sync(&client), ==, MQTT_OK);
+  verify_sent("");
+
+  fake_now = 30001;
+  VERIFY_A_OP_B(mqtt_sync(&client), ==, MQTT_OK);
+  verify_sent(RESENT);
+  VERIFY_A_OP_B(client.number_of_timeouts, ==, 1);
+
+  fake_now = 40001;
+  VERIFY_A_OP_B(mqtt_sync(&client), ==, MQTT_OK);
+  verify_sent(RESENT);
+
+  // Once A is acked, only B comes due again
+  char const puback[] = {0x40, 0x02, char(pid_a >> 8), char(pid_a & 0xFF)};
+  fake_incoming.assign(puback, sizeof(puback));
+  VERIFY_A_OP_B(mqtt_sync(&client), ==, MQTT_OK);
+  VERIFY_A_OP_B(find(&client.mq, pid_a)->state, ==, MQTT_QUEUED_COMPLETE);
+
+  fake_now = 70002;
+  VERIFY_A_OP_B(mqtt_sync(&client), ==, MQTT_OK);
+  verify_sent(RESENT);
+  VERIFY_A_OP_B(client.number_of_timeouts, ==, 3);
+}
+
+int main() {
+  OK_NOTE("#BEGIN-TESTS#");
+  test_mq_wraparound();
+  test_mq_clean_out_of_order();
+  test_mq_index();
+  test_mq_timeout_resend();
+  OK_NOTE("#END-TESTS#");
+  return 0;
+}
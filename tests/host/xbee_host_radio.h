@@ -0,0 +1,21 @@
+// Gets an XBeeRadio on a FakeSerial into API mode for host benchmarks and
+// fuzzing, playing the XBee's side of the command mode handshake
+// (the host's delay() costs no time, so this is quick)
+
+#pragma once
+
+#include <fake_serial.h>
+
+#include "xbee_radio.h"
+
+inline bool start_fake_api_mode(XBeeRadio* radio, FakeSerial* serial) {
+  auto* const written = serial->write_buf;
+  for (int i = 0; i < 1000 && radio->outgoing_space() == 0; ++i) {
+    radio->poll_for_frame(nullptr);
+    if (*written == "+++" || *written == "AT\r") serial->read_buf = "OK\r";
+    if (*written == "ATAP1,CN\r") serial->read_buf = "OK\rOK\r";
+    written->clear();
+    delay(10);
+  }
+  return radio->outgoing_space() > 0;
+}
@@ -0,0 +1,106 @@
+// Tests for the metrics registry (shared_src/metrics.h): histogram
+// buckets, and snapshots that stay well-formed when space runs out
+
+#include <Arduino.h>
+#include <ok_logging.h>
+#include <verifiers.h>
+
+#include "src/metrics.h"
+
+static OkLoggingContext OK_CONTEXT("metrics_test");
+
+static MetricsCounter test_counter("test.counter");
+static MetricsHistogram test_histogram("test.histogram");
+
+static void test_metrics_registry() {
+  OK_NOTE("#TEST# test_metrics_registry");
+  bool found_counter = false, found_histogram = false;
+  for (auto const* c = metrics_counters(); c != nullptr; c = c->next) {
+    found_counter = found_counter || c == &test_counter;
+  }
+  for (auto const* h = metrics_histograms(); h != nullptr; h = h->next) {
+    found_histogram = found_histogram || h == &test_histogram;
+  }
+  VERIFY_A_OP_B(found_counter, ==, true);
+  VERIFY_A_OP_B(found_histogram, ==, true);
+
+  test_counter.add();
+  test_counter.add(41);
+  VERIFY_A_OP_B(test_counter.value, ==, 42);
+}
+
+static void test_metrics_histogram_buckets() {
+  OK_NOTE("#TEST# test_metrics_histogram_buckets");
+  for (uint32_t v : {0u, 1u, 2u, 3u, 4u, 1000u, 0xFFFFFFFFu}) {
+    test_histogram.record(v);
+  }
+
+  auto const& b = test_histogram.buckets;
+  VERIFY_A_OP_B(b[0], ==, 1);   // 0
+  VERIFY_A_OP_B(b[1], ==, 1);   // 1
+  VERIFY_A_OP_B(b[2], ==, 2);   // 2-3
+  VERIFY_A_OP_B(b[3], ==, 1);   // 4-7
+  VERIFY_A_OP_B(b[10], ==, 1);  // 512-1023
+  VERIFY_A_OP_B(b[MetricsHistogram::BUCKETS - 1], ==, 1);  // Overflow
+  VERIFY_A_OP_B(test_histogram.count, ==, 7);
+  VERIFY_A_OP_B(test_histogram.max, ==, 0xFFFFFFFFu);
+  VERIFY_A_OP_B(test_histogram.sum, ==, 1010ull + 0xFFFFFFFFull);
+}
+
+static void test_metrics_snapshot() {
+  OK_NOTE("#TEST# test_metrics_snapshot");
+  static char buf[2048];
+  int const size = metrics_snapshot(buf, sizeof(buf));
+  VERIFY_A_OP_B(size, ==, (int) strlen(buf));
+  VERIFY_A_OP_B_STR(etl::string_view(buf, 6), ==, "{\"ms\":");
+  VERIFY_A_OP_B(buf[size - 1], ==, '}');
+  VERIFY_A_OP_B(strstr(buf, ",\"test.counter\":42,") != nullptr, ==, true);
+  VERIFY_A_OP_B(
+      strstr(buf, ",\"test.histogram\":{\"n\":7,\"sum\":4294968305,"
+                  "\"max\":4294967295,\"b\":[1,1,2,1,0,0,0,0,0,0,1,"
+                  "0,0,0,0,0,0,0,0,1]}") != nullptr, ==, true);
+  OK_NOTE("Snapshot: %db", size);
+
+  // Short buffers get whole metrics only, and still close the object
+  for (int const short_size : {3, 12, 40, size / 2, size}) {
+    static char short_buf[2048];
+    int const n = metrics_snapshot(short_buf, short_size);
+    VERIFY_A_OP_B(n, <, short_size);
+    VERIFY_A_OP_B(n, ==, (int) strlen(short_buf));
+    VERIFY_A_OP_B(short_buf[0], ==, '{');
+    VERIFY_A_OP_B(short_buf[n - 1], ==, '}');
+    VERIFY_A_OP_B(short_buf[n - 2], !=, ',');
+
+    // The same metrics as the full snapshot, up to where it stopped
+    auto const* rest = strchr(short_buf, ',');
+    if (rest != nullptr) {
+      int const rest_size = short_buf + n - 1 - rest;
+      VERIFY_A_OP_B(strncmp(rest, strchr(buf, ','), rest_size), ==, 0);
+    }
+  }
+}
+
+static void test_metrics_snapshot_without_ms() {
+  OK_NOTE("#TEST# test_metrics_snapshot_without_ms");
+  static MetricsCounter tiny("t");  // Registered now, so listed first
+  VERIFY_A_OP_B(metrics_counters() == &tiny, ==, true);
+  if (millis() < 10) delay(10);  // So "{\"ms\":NN" is longer than ",\"t\":0"
+
+  // Room for {"t":0} but not for "ms", so the first entry has no comma
+  static char buf[9];
+  int const n = metrics_snapshot(buf, sizeof(buf));
+  VERIFY_A_OP_B_STR(etl::string_view(buf, n), ==, "{\"t\":0}");
+}
+
+void setup() {
+  Serial1.begin(115200);
+  ok_logging_stream = &Serial1;
+  OK_NOTE("#BEGIN-TESTS#");
+  test_metrics_registry();
+  test_metrics_histogram_buckets();
+  test_metrics_snapshot();
+  test_metrics_snapshot_without_ms();
+  OK_NOTE("#END-TESTS#");
+}
+
+void loop() {}
@@ -0,0 +1,2 @@
+def test_metrics(emulated_test_output):
+    pass
@@ -0,0 +1,34 @@
+#pragma once
+
+#include <Arduino.h>
+#include <ok_logging.h>
+#include <stdint.h>
+
+// Cycle counts from benchmark sketches (see tests/benchmarks/), which
+// conftest.py compares to a baseline as cycles per unit of work
+struct BenchResult {
+  uint64_t cycles = UINT64_MAX;
+  int count = 0;  // Units of work (bytes, publishes, ...) in those cycles
+};
+
+// Runs round() (which returns its units of work) a few times and keeps
+// the fastest, so an interrupt landing in one round doesn't skew results
+template <typename Round>
+BenchResult bench_fastest(int rounds, Round&& round) {
+  BenchResult best;
+  for (int r = 0; r < rounds; ++r) {
+    uint64_t const start = rp2040.getCycleCount64();
+    int const count = round();
+    uint64_t const cycles = rp2040.getCycleCount64() - start;
+    if (cycles < best.cycles) best = {cycles, count};
+  }
+  return best;
+}
+
+#define BENCH_REPORT(name, result, unit) ({  \
+    BenchResult const _r = (result);  \
+    OK_NOTE(  \
+      "#BENCH# %s cycles=%llu count=%d unit=%s",  \
+      name, (unsigned long long) _r.cycles, _r.count, unit  \
+    );  \
+  })
@@ -1,12 +1,25 @@
 #pragma once
 
 #include <Arduino.h>
+#include <etl/algorithm.h>
 #include <etl/circular_buffer.h>
 #include <etl/memory.h>
+#include <etl/string.h>
 #include <stdint.h>
 
 class FakeSerial: public arduino::HardwareSerial {
  public:
+  static constexpr int MAX_FIFO = 4096;
+
+  // Optional line timing. Without it, all of read_buf is available at once
+  // and writes are taken until write_buf fills. With it, read_buf is what
+  // the far end sends, arriving at the baud rate by micros() (8N1).
+  struct Timing {
+    int rx_fifo = 32;    // Receive FIFO depth (as setFIFOSize()), overruns drop
+    int tx_fifo = 32;    // Writes wait here, draining at the baud rate
+    int max_chunk = 1;   // Bytes arrive in bursts of random(1, max_chunk + 1)
+  };
+
   FakeSerial(unsigned long baud, etl::string_view rbuf, etl::istring* wbuf)
     : baud(baud), read_buf(rbuf), write_buf(wbuf) {}
   virtual ~FakeSerial() = default;
@@ -15,28 +28,103 @@ class FakeSerial: public arduino::HardwareSerial {
   etl::string_view read_buf;
   etl::istring *write_buf = nullptr;
 
+  int rx_dropped = 0;  // Bytes lost to receive FIFO overrun (if timed)
+  int rx_peak = 0;     // Most bytes waiting in the receive FIFO (if timed)
+
+  void set_timing(Timing const& t) {
+    timing = t;
+    timing.rx_fifo = etl::clamp(timing.rx_fifo, 1, MAX_FIFO);
+    timing.max_chunk = etl::max(timing.max_chunk, 1);
+    timed = true;
+    last_micros = micros();
+    rx_credit = tx_credit = 0;
+    rx_idle = true;
+    tx_pending = 0;
+    next_chunk = random(1, timing.max_chunk + 1);
+  }
+
   void begin(unsigned long baud) override { this->baud = baud; }
   void begin(unsigned long baud, uint16_t conf) override { this->baud = baud; }
   void end() override { this->baud = 0; }
   operator bool() { return baud != 0; }
 
-  int available() override { return read_buf.size(); }
-  int peek() override { return read_buf.empty() ? -1 : read_buf.front(); }
+  int available() override {
+    if (!timed) return read_buf.size();
+    update();
+    return rx_buf.size();
+  }
+
+  int peek() override {
+    // Bytes as 0-255 like real serial ports, so binary data isn't "EOF"
+    if (!timed) return read_buf.empty() ? -1 : uint8_t(read_buf.front());
+    update();
+    return rx_buf.empty() ? -1 : uint8_t(rx_buf.front());
+  }
+
   int read() override {
     int const v = peek();
-    if (v >= 0) read_buf.remove_prefix(1);
+    if (v < 0) return v;
+    if (timed) rx_buf.pop(); else read_buf.remove_prefix(1);
     return v;
   }
 
   int availableForWrite() override {
-    return write_buf ? write_buf->available() : 0;
+    int const space = write_buf ? write_buf->available() : 0;
+    if (!timed) return space;
+    update();
+    return etl::min(space, timing.tx_fifo - tx_pending);
   }
 
   size_t write(uint8_t c) override {
     if (!availableForWrite()) return 0;
     write_buf->push_back(c);
+    if (timed) ++tx_pending;
     return 1;
   }
 
   void flush() override {}
+
+ private:
+  // Line time is counted in bit-microseconds (baud * elapsed micros)
+  static constexpr uint64_t BYTE_TIME = 10 * 1000000ull;  // Start+8+stop
+
+  bool timed = false;
+  Timing timing;
+  unsigned long last_micros = 0;
+  uint64_t rx_credit = 0, tx_credit = 0;
+  bool rx_idle = true;
+  int tx_pending = 0;
+  int next_chunk = 1;
+  etl::circular_buffer<char, MAX_FIFO> rx_buf;
+
+  void update() {
+    unsigned long const now = micros();
+    uint64_t const line_time = uint64_t(now - last_micros) * baud;
+    last_micros = now;
+
+    // Sending starts when read_buf is first seen filled (an idle line banks
+    // no time), and bytes arrive in whole chunks
+    rx_credit = rx_idle ? 0 : rx_credit + line_time;
+    rx_idle = read_buf.empty();
+    for (;;) {
+      int const size = etl::min<int>(next_chunk, read_buf.size());
+      if (size == 0 || rx_credit < size * BYTE_TIME) break;
+      rx_credit -= size * BYTE_TIME;
+      for (char const ch : read_buf.substr(0, size)) {
+        if ((int) rx_buf.size() < timing.rx_fifo) {
+          rx_buf.push(ch);
+        } else {
+          ++rx_dropped;
+        }
+      }
+      read_buf.remove_prefix(size);
+      next_chunk = random(1, timing.max_chunk + 1);
+    }
+    rx_peak = etl::max<int>(rx_peak, rx_buf.size());
+
+    tx_credit = tx_pending ? tx_credit + line_time : 0;
+    int const sent = etl::min<uint64_t>(tx_pending, tx_credit / BYTE_TIME);
+    tx_credit -= sent * BYTE_TIME;
+    tx_pending -= sent;
+  }
 };
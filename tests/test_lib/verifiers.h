@@ -10,3 +10,12 @@
       #a, #op, #b, #a, _av.size(), _av.data(), #b, _bv.size(), _bv.data()  \
     );  \
   })
+
+#define VERIFY_A_OP_B(a, op, b) ({  \
+    auto const _a = (a);  \
+    auto const _b = (b);  \
+    if (!(_a op _b)) OK_REPORT_SOURCE(  \
+      OK_ERROR_LEVEL, "#TEST-FAIL# %s %s %s\n  %s = %lld\n  %s = %lld",  \
+      #a, #op, #b, #a, (long long) _a, #b, (long long) _b  \
+    );  \
+  })
@@ -0,0 +1,96 @@
+// Tests for deferred trace logging (shared_src/trace_log.h): records in the
+// RAM ring, and "#TRACE#" lines that the .py decodes using the sketch ELF
+
+#define BLUB_LOG_DEFERRED 1  // For OK_DETAIL in this file only
+
+#include <Arduino.h>
+#include <ok_logging.h>
+#include <verifiers.h>
+
+#include "src/metrics.h"
+#include "src/trace_log.h"
+
+static OkLoggingContext OK_CONTEXT("trace_log_test");
+
+static uint8_t taken[TRACE_LOG_SIZE];
+
+static uint32_t read_u32(uint8_t const* p) {
+  return p[0] | p[1] << 8 | p[2] << 16 | uint32_t(p[3]) << 24;
+}
+
+static long dropped_records() {
+  for (auto const* c = metrics_counters(); c != nullptr; c = c->next) {
+    if (!strcmp(c->name, "trace.dropped")) return c->value;
+  }
+  return -1;
+}
+
+static void test_trace_log_discard() {
+  OK_NOTE("#TEST# test_trace_log_discard");
+  int evaluated = 0;
+  TRACE_LOG_DISCARD("Never %d", ++evaluated);
+  VERIFY_A_OP_B(evaluated, ==, 0);
+  VERIFY_A_OP_B(trace_log_take(taken, sizeof(taken)), ==, 0);
+}
+
+static void test_trace_log_record() {
+  OK_NOTE("#TEST# test_trace_log_record");
+  static char const format[] = "Frame (0x%02x) %d bytes";
+  uint32_t const before = micros();
+  OK_DETAIL(format, 0x90, -1200);
+
+  int const size = trace_log_take(taken, sizeof(taken));
+  VERIFY_A_OP_B(size, ==, 9 + 4 + 4);
+  VERIFY_A_OP_B(taken[0], ==, size);
+  VERIFY_A_OP_B(read_u32(taken + 1) - before, <, 1000);
+  VERIFY_A_OP_B(read_u32(taken + 5), ==, (uint32_t) (uintptr_t) format);
+  VERIFY_A_OP_B(read_u32(taken + 9), ==, 0x90);
+  VERIFY_A_OP_B((int32_t) read_u32(taken + 13), ==, -1200);
+  VERIFY_A_OP_B(trace_log_take(taken, sizeof(taken)), ==, 0);
+}
+
+static void test_trace_log_wrap() {
+  OK_NOTE("#TEST# test_trace_log_wrap");
+  long const dropped = dropped_records();
+  for (int i = 0; i < 1000; ++i) OK_DETAIL("Wrap %d", i);
+
+  // Only the newest records fit; the oldest were dropped whole
+  int const size = trace_log_take(taken, sizeof(taken));
+  VERIFY_A_OP_B(size, >, TRACE_LOG_SIZE - 13);
+  VERIFY_A_OP_B(size % 13, ==, 0);
+  VERIFY_A_OP_B(dropped_records() - dropped, ==, 1000 - size / 13);
+  VERIFY_A_OP_B(read_u32(taken + size - 4), ==, 999);
+
+  // Taking is by whole records
+  OK_DETAIL("Wrap %d", 1);
+  OK_DETAIL("Wrap %d", 2);
+  VERIFY_A_OP_B(trace_log_take(taken, 20), ==, 13);
+  VERIFY_A_OP_B(trace_log_take(taken, 12), ==, 0);
+  VERIFY_A_OP_B(trace_log_take(taken, 13), ==, 13);
+  VERIFY_A_OP_B(read_u32(taken + 9), ==, 2);
+}
+
+static void test_trace_log_dump() {
+  OK_NOTE("#TEST# test_trace_log_dump");
+  static char buffer[] = "abcdef";  // In RAM, so recorded by address only
+  OK_DETAIL(
+      "Types %s %d %u %lld %.2f %c %.*s", "constant", -5, 7u,
+      -1234567890123ll, 3.25, 'x', 3, "abcdef");
+  OK_DETAIL("RAM %s", buffer);
+  OK_DETAIL("Bare");
+  trace_log_dump(&Serial1);  // Checked by trace_log_test.py
+  VERIFY_A_OP_B(trace_log_take(taken, sizeof(taken)), ==, 0);
+}
+
+void setup() {
+  Serial1.begin(115200);
+  ok_logging_stream = &Serial1;
+  OK_NOTE("#BEGIN-TESTS#");
+  test_trace_log_discard();
+  test_trace_log_record();
+  test_trace_log_wrap();
+  test_trace_log_dump();
+  OK_NOTE("#END-TESTS#");
+}
+
+void loop() {}
@@ -0,0 +1,21 @@
+import subprocess
+import sys
+from pathlib import Path
+
+DECODER = Path(__file__).parents[2] / "other" / "decode_trace_log.py"
+
+
+def test_trace_log(emulated_test_output):
+    (elf,) = (Path(__file__).parent / "output.tmp").glob("*.elf")
+    result = subprocess.run(
+        [sys.executable, DECODER, elf],
+        input="\n".join(emulated_test_output),
+        capture_output=True,
+        check=True,
+        text=True,
+    )
+
+    messages = [line.split(None, 1)[1] for line in result.stdout.splitlines()]
+    assert messages[0] == "Types constant -5 7 -1234567890123 3.25 x abc"
+    assert messages[1].startswith("RAM <0x2")  # RP2040 RAM address
+    assert messages[2:] == ["Bare"]
@@ -0,0 +1,325 @@
+// End-to-end test of the XBee stack (radio, status monitor, socket keeper,
+// MQTT adapter) against the emulator's fake XBee (tests/emulator/fake_xbee.js)
+// on Serial2, with real UART timing and a loopback MQTT broker
+
+#include <algorithm>
+
+#include <Arduino.h>
+#include <ok_logging.h>
+#include <verifiers.h>
+
+#include "src/metrics.h"
+#include "src/xbee_api.h"
+#include "src/xbee_mqtt_adapter.h"
+#include "src/xbee_radio.h"
+#include "src/xbee_socket_keeper.h"
+#include "src/xbee_status_monitor.h"
+
+static OkLoggingContext OK_CONTEXT("xbee_fake_peer_test");
+
+static constexpr int BULK_COUNT = 20;
+static constexpr int BULK_SIZE = 1200;
+
+static XBeeRadio* radio = nullptr;
+static XBeeStatusMonitor* monitor = nullptr;
+static XBeeSocketKeeper* keeper = nullptr;
+static XBeeMQTTAdapter* mqtt = nullptr;
+static int loop_topic = -1;
+static int metrics_topic = -1;
+
+static int received_messages = 0;
+static int received_bytes = 0;
+static unsigned long last_frame_millis = 0;
+static unsigned long longest_silence = 0;  // Between frames from the XBee
+static char metrics_message[1024];
+static int metrics_size = 0;
+
+static void on_loop_message(mqtt_response_publish const& message) {
+  received_bytes += message.application_message_size;
+  ++received_messages;
+}
+
+static void on_metrics_message(mqtt_response_publish const& message) {
+  metrics_size = std::min<int>(
+      message.application_message_size, sizeof(metrics_message) - 1);
+  memcpy(metrics_message, message.application_message, metrics_size);
+  metrics_message[metrics_size] = '\0';
+}
+
+static long counter_value(char const* name) {
+  for (auto const* c = metrics_counters(); c != nullptr; c = c->next) {
+    if (!strcmp(c->name, name)) return c->value;
+  }
+  return -1;
+}
+
+static long histogram_count(char const* name) {
+  for (auto const* h = metrics_histograms(); h != nullptr; h = h->next) {
+    if (!strcmp(h->name, name)) return h->count;
+  }
+  return -1;
+}
+
+static bool mqtt_connected() {
+  return mqtt->active_socket() >= 0 &&
+      mqtt->client()->typical_response_time >= 0;  // Set by CONNACK
+}
+
+static void poll_stack() {
+  using namespace XBeeAPI;
+  static Frame in, out;
+
+  while (radio->poll_for_frame(&in)) {
+    longest_silence = std::max(longest_silence, millis() - last_frame_millis);
+    last_frame_millis = millis();
+    monitor->on_incoming(in);
+    keeper->on_incoming(in);
+    if (mqtt->incoming_to_outgoing(in, radio->outgoing_space(), &out)) {
+      radio->add_outgoing(out);
+    }
+  }
+
+  in.clear();
+  while (mqtt->incoming_to_outgoing(in, radio->outgoing_space(), &out)) {
+    radio->add_outgoing(out);
+  }
+  while (monitor->maybe_make_outgoing(radio->outgoing_space(), &out)) {
+    radio->add_outgoing(out);
+  }
+  while (keeper->maybe_make_outgoing(radio->outgoing_space(), &out)) {
+    radio->add_outgoing(out);
+  }
+
+  if (keeper->socket() != mqtt->active_socket()) {
+    mqtt->use_socket(keeper->socket());
+    if (keeper->socket() >= 0) {
+      mqtt_connect(
+          mqtt->client(), "BLUB Fake Peer Test",
+          nullptr, nullptr, 0, nullptr, nullptr,
+          MQTT_CONNECT_CLEAN_SESSION, 400);
+      mqtt->subscribe_topics();
+    }
+  }
+
+  if (mqtt->check_error()) {
+    OK_ERROR("MQTT error: %s", mqtt_error_str(mqtt->client()->error));
+    keeper->reconnect();
+  }
+}
+
+// Polls until done() or the timeout; returns the time taken
+template <typename Done>
+static unsigned long poll_until(Done done, unsigned long timeout_millis) {
+  unsigned long const start = millis();
+  while (!done() && millis() - start < timeout_millis) {
+    poll_stack();
+    delay(1);  // Emulated idle time costs no wall clock
+  }
+  return millis() - start;
+}
+
+static void test_fake_xbee_bring_up() {
+  OK_NOTE("#TEST# test_fake_xbee_bring_up");
+  auto const took = poll_until(mqtt_connected, 15000);
+
+  auto const& status = monitor->status();
+  VERIFY_A_OP_B(mqtt_connected(), ==, true);
+  VERIFY_A_OP_B(keeper->health(), ==, XBeeSocketKeeper::CONNECTED);
+  VERIFY_A_OP_B(status.assoc_status, ==, XBeeStatusMonitor::CONNECTED);
+  VERIFY_A_OP_B(status.firmware_ver, ==, 0x11415);
+  VERIFY_A_OP_B_STR(status.imei, ==, "354616090012345");
+  OK_NOTE(
+      "Bring-up took %lums (connect %ldms)",
+      took, keeper->metrics().last_connect_millis);
+}
+
+static void test_fake_xbee_publish() {
+  OK_NOTE("#TEST# test_fake_xbee_publish");
+  auto const err = mqtt->publish(loop_topic, "hello", 5, MQTT_PUBLISH_QOS_1);
+  VERIFY_A_OP_B(err, ==, MQTT_OK);
+
+  // The broker echoes it back through the wildcard subscription
+  poll_until([] { return received_messages == 1; }, 5000);
+  VERIFY_A_OP_B(received_messages, ==, 1);
+  VERIFY_A_OP_B(received_bytes, ==, 5);
+
+  // An abandoned zero-copy QoS 1 publish takes no packet ID, and can't be
+  // committed after all
+  static XBeeAPI::Frame frame;
+  int capacity = 0;
+  auto const begin = [&] {
+    return mqtt->begin_publish(
+        loop_topic, 1, radio->outgoing_space(), &frame, &capacity);
+  };
+  uint16_t const pid_state = mqtt->client()->pid_lfsr;
+  poll_until([&] { return begin() != nullptr; }, 5000);
+  mqtt->cancel_publish();
+  VERIFY_A_OP_B(mqtt->client()->pid_lfsr, ==, pid_state);
+  VERIFY_A_OP_B(mqtt->commit_publish(0), ==, false);
+
+  // A committed one goes, and is echoed back
+  auto* data = begin();
+  VERIFY_A_OP_B(data != nullptr, ==, true);
+  if (data == nullptr) return;
+  memcpy(data, "again", 5);
+  VERIFY_A_OP_B(mqtt->commit_publish(5), ==, true);
+  radio->add_outgoing(frame);
+  VERIFY_A_OP_B(mqtt->client()->pid_lfsr, !=, pid_state);
+  poll_until([] { return received_messages == 2; }, 5000);
+  VERIFY_A_OP_B(received_messages, ==, 2);
+}
+
+static void test_fake_xbee_bulk_loopback() {
+  OK_NOTE("#TEST# test_fake_xbee_bulk_loopback");
+  static char payload[BULK_SIZE];
+  memset(payload, 'x', sizeof(payload));
+  received_messages = received_bytes = 0;
+
+  // Zero-copy publishes, one SocketSend in flight at a time
+  int sent = 0;
+  auto const took = poll_until(
+      [&] {
+        static XBeeAPI::Frame frame;
+        int capacity = 0;
+        auto* data = sent < BULK_COUNT ? mqtt->begin_publish(
+            loop_topic, 0, radio->outgoing_space(), &frame, &capacity
+        ) : nullptr;
+        if (data && capacity >= BULK_SIZE) {
+          memcpy(data, payload, BULK_SIZE);
+          if (mqtt->commit_publish(BULK_SIZE)) {
+            radio->add_outgoing(frame);
+            ++sent;
+          }
+        }
+        return received_messages == BULK_COUNT;
+      },
+      20000);
+
+  VERIFY_A_OP_B(sent, ==, BULK_COUNT);
+  VERIFY_A_OP_B(received_messages, ==, BULK_COUNT);
+  VERIFY_A_OP_B(received_bytes, ==, BULK_COUNT * BULK_SIZE);
+  OK_NOTE(
+      "Loopback: %db in %lums (%lub/s)",
+      BULK_COUNT * BULK_SIZE, took, BULK_COUNT * BULK_SIZE * 1000ul / took);
+}
+
+static void test_fake_xbee_reconnect() {
+  OK_NOTE("#TEST# test_fake_xbee_reconnect");
+
+  // The emulator script drops the connection at 20s
+  poll_until([] { return !mqtt_connected(); }, 25000);
+  auto const took = poll_until(mqtt_connected, 10000);
+
+  auto const& metrics = keeper->metrics();
+  VERIFY_A_OP_B(mqtt_connected(), ==, true);
+  VERIFY_A_OP_B(metrics.successes, ==, 2);
+  VERIFY_A_OP_B(metrics.failures[XBeeSocketKeeper::LOST], ==, 1);
+
+  received_messages = received_bytes = 0;
+  mqtt->publish(loop_topic, "again", 5, MQTT_PUBLISH_QOS_0);
+  poll_until([] { return received_messages == 1; }, 5000);
+  VERIFY_A_OP_B(received_messages, ==, 1);
+  OK_NOTE("Reconnected in %lums", took);
+}
+
+static void test_fake_xbee_metrics() {
+  OK_NOTE("#TEST# test_fake_xbee_metrics");
+  VERIFY_A_OP_B(counter_value("xbee.bytes_in"), >, BULK_COUNT * BULK_SIZE);
+  VERIFY_A_OP_B(counter_value("xbee.bytes_out"), >, BULK_COUNT * BULK_SIZE);
+  VERIFY_A_OP_B(counter_value("xbee.frames_in"), >, BULK_COUNT);
+  VERIFY_A_OP_B(counter_value("xbee.frames_out"), >, BULK_COUNT);
+  VERIFY_A_OP_B(counter_value("xbee.checksum_errors"), ==, 0);
+  VERIFY_A_OP_B(counter_value("xbee.frames_dropped"), ==, 0);
+  VERIFY_A_OP_B(counter_value("mqtt.publishes"), >=, BULK_COUNT + 2);
+  VERIFY_A_OP_B(counter_value("socket.connects"), ==, 2);
+  VERIFY_A_OP_B(counter_value("socket.failures"), >=, 1);  // The drop
+  VERIFY_A_OP_B(histogram_count("mqtt.ack_ms"), >, BULK_COUNT);
+  VERIFY_A_OP_B(histogram_count("socket.connect_ms"), ==, 2);
+
+  // A snapshot published straight into the frame comes back from the broker
+  bool published = false;
+  poll_until(
+      [&] {
+        static XBeeAPI::Frame frame;
+        int capacity = 0;
+        auto* data = published ? nullptr : mqtt->begin_publish(
+            metrics_topic, 0, radio->outgoing_space(), &frame, &capacity
+        );
+        if (data && mqtt->commit_publish(
+                metrics_snapshot((char*) data, capacity))) {
+          radio->add_outgoing(frame);
+          published = true;
+        }
+        return metrics_size > 0;
+      },
+      5000);
+
+  VERIFY_A_OP_B(published, ==, true);
+  VERIFY_A_OP_B_STR(etl::string_view(metrics_message, 6), ==, "{\"ms\":");
+  VERIFY_A_OP_B(metrics_message[metrics_size - 1], ==, '}');
+  auto const* ack_json = strstr(metrics_message, "\"mqtt.ack_ms\":{\"n\":");
+  VERIFY_A_OP_B(ack_json != nullptr, ==, true);
+  OK_NOTE("Metrics: %db", metrics_size);
+}
+
+static void test_fake_xbee_cyclic_sleep() {
+  OK_NOTE("#TEST# test_fake_xbee_cyclic_sleep");
+  static constexpr uint32_t SLEEP_MILLIS = 20000, WAKE_MILLIS = 12000;
+  monitor->configure_sleep(
+      XBeeStatusMonitor::CYCLIC_SLEEP, SLEEP_MILLIS, WAKE_MILLIS);
+  auto const& status = monitor->status();
+  poll_until(
+      [&] { return status.sleep_mode == XBeeStatusMonitor::CYCLIC_SLEEP; },
+      5000);
+  VERIFY_A_OP_B(status.sleep_mode, ==, XBeeStatusMonitor::CYCLIC_SLEEP);
+  VERIFY_A_OP_B(status.wake_time_millis, ==, WAKE_MILLIS);
+
+  // Status polls and wake probes must leave the modem idle for ST, or it
+  // never sleeps; while it does, probes go unanswered for SP
+  long awake_polls = 0, polls = 0;
+  longest_silence = 0;
+  unsigned long const start = millis();
+  while (millis() - start < 100000) {
+    poll_stack();
+    awake_polls += monitor->radio_awake();
+    ++polls;
+    delay(20);  // Idle is free, but each poll is emulated instructions
+  }
+
+  VERIFY_A_OP_B(longest_silence, >, SLEEP_MILLIS);
+  VERIFY_A_OP_B(awake_polls, <, polls / 2);
+  VERIFY_A_OP_B(status.assoc_status, ==, XBeeStatusMonitor::CONNECTED);
+  OK_NOTE(
+      "Cyclic sleep: awake %ld%% of the time, longest silence %lums",
+      awake_polls * 100 / polls, longest_silence);
+}
+
+void setup() {
+  Serial1.begin(115200);
+  ok_logging_stream = &Serial1;
+  OK_NOTE("#BEGIN-TESTS#");
+
+  Serial2.setFIFOSize(1024);  // SocketReceive frames arrive in bursts
+  radio = make_xbee_radio(&Serial2);
+  monitor = make_xbee_status_monitor();
+  keeper = make_xbee_socket_keeper(
+      "broker.example", 1883, XBeeAPI::SocketCreate::Protocol::TCP);
+  mqtt = make_xbee_mqtt_adapter(2048, 2048);
+  loop_topic = mqtt->add_topic("blub/loop/bulk");
+  mqtt->add_topic(
+      "blub/loop/#",
+      XBeeMQTTAdapter::MessageHandler::create<on_loop_message>());
+  metrics_topic = mqtt->add_topic(
+      "blub/loop/metrics",
+      XBeeMQTTAdapter::MessageHandler::create<on_metrics_message>());
+
+  test_fake_xbee_bring_up();
+  test_fake_xbee_publish();
+  test_fake_xbee_bulk_loopback();
+  test_fake_xbee_reconnect();
+  test_fake_xbee_metrics();
+  test_fake_xbee_cyclic_sleep();
+  OK_NOTE("#END-TESTS#");
+}
+
+void loop() {}
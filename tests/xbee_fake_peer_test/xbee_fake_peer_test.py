@@ -0,0 +1,12 @@
+# The sketch drives the XBee stack (radio, monitor, socket keeper, MQTT
+# adapter) on Serial2 against the emulator's fake XBee; the connection
+# drops partway through, and at the end the modem goes into cyclic sleep.
+EMULATOR_ARGS = [
+    "--xbee=1",
+    '--xbee-options={"script": [{"atMillis": 20000, "fault": "drop"}]}',
+]
+EMULATOR_TIMEOUT = 120.0  # About two minutes of emulated time, mostly idle
+
+
+def test_xbee_fake_peer(emulated_test_output):
+    pass
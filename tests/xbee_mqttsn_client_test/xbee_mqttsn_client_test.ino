@@ -0,0 +1,273 @@
+// Tests for the MQTT-SN client (shared_src/xbee_mqttsn_client.h), playing
+// the gateway at the XBee frame level (SocketReceive in, SocketSendTo out).
+// Datagrams are written as hex to keep expectations readable.
+
+#include <Arduino.h>
+#include <etl/string.h>
+#include <ok_logging.h>
+#include <verifiers.h>
+
+#include "src/xbee_api.h"
+#include "src/xbee_mqttsn_client.h"
+
+using namespace XBeeAPI;
+
+static OkLoggingContext OK_CONTEXT("xbee_mqttsn_client_test");
+
+static uint8_t const GATEWAY_IP[4] = {192, 168, 1, 10};
+static constexpr int GATEWAY_PORT = 10000;
+static constexpr int SOCKET = 3;
+static constexpr unsigned long RETRY_MILLIS = 10 * 1000;  // As the client's
+
+static etl::string<128> received;  // "topic=payload" from the callback
+
+static void on_message(
+    char const* topic, int topic_size, uint8_t const* data, int size) {
+  received.assign(topic, topic_size);
+  received.append("=");
+  received.append(reinterpret_cast<char const*>(data), size);
+}
+
+// Hands the client a datagram from the gateway (if any), then returns what
+// it sends back as hex ("" if nothing, valid until the next call)
+static etl::string_view exchange(
+    XBeeMQTTSNClient* client, etl::string_view in_hex = "") {
+  static Frame incoming, outgoing;
+  incoming.clear();
+  if (!in_hex.empty()) {
+    int const size = in_hex.size() / 2;
+    auto* receive = incoming.setup_as<SocketReceive>(size);
+    receive->socket = SOCKET;
+    for (int i = 0; i < size; ++i) {
+      char const digits[3] = {in_hex[2 * i], in_hex[2 * i + 1], '\0'};
+      receive->data[i] = strtoul(digits, nullptr, 16);
+    }
+  }
+
+  static etl::string<512> out_hex;
+  out_hex.clear();
+  int const space = wire_size_of<SocketSendTo>(255);
+  if (!client->incoming_to_outgoing(incoming, space, &outgoing)) {
+    return out_hex;
+  }
+
+  int size = 0;
+  auto const* send = outgoing.decode_as<SocketSendTo>(&size);
+  VERIFY_A_OP_B(send != nullptr, ==, true);
+  if (send == nullptr) return out_hex;
+  VERIFY_A_OP_B(send->socket, ==, SOCKET);
+  VERIFY_A_OP_B(memcmp(send->dest_ip, GATEWAY_IP, 4), ==, 0);
+  VERIFY_A_OP_B(send->dest_port, ==, GATEWAY_PORT);
+  for (int i = 0; i < size; ++i) {
+    static char const DIGITS[] = "0123456789abcdef";
+    out_hex.push_back(DIGITS[send->data[i] >> 4]);
+    out_hex.push_back(DIGITS[send->data[i] & 0xF]);
+  }
+  return out_hex;
+}
+
+static XBeeMQTTSNClient* make_test_client() {
+  auto* client = make_xbee_mqttsn_client(
+      "test", 60, 256,
+      XBeeMQTTSNClient::MessageCallback::create<on_message>());
+  client->use_socket(SOCKET, GATEWAY_IP, GATEWAY_PORT);
+  return client;
+}
+
+// CONNECT as "test" (clean session), keepalive 60
+static char const CONNECT_HEX[] = "0a040401003c74657374";
+
+static void test_mqttsn_connect_register_publish() {
+  OK_NOTE("#TEST# test_mqttsn_connect_register_publish");
+  auto* client = make_test_client();
+  int const topic = client->add_topic("t/a");
+  int const predefined = client->add_topic("t/p", 5);
+  VERIFY_A_OP_B(client->state(), ==, XBeeMQTTSNClient::DISCONNECTED);
+
+  VERIFY_A_OP_B_STR(exchange(client), ==, CONNECT_HEX);
+  VERIFY_A_OP_B(client->state(), ==, XBeeMQTTSNClient::CONNECTING);
+  VERIFY_A_OP_B_STR(exchange(client), ==, "");  // Waiting for CONNACK
+
+  // CONNACK, then REGISTER "t/a" (msg 2) and REGACK as topic 0x100
+  VERIFY_A_OP_B_STR(exchange(client, "030500"), ==, "090a00000002742f61");
+  VERIFY_A_OP_B(client->state(), ==, XBeeMQTTSNClient::ACTIVE);
+  VERIFY_A_OP_B_STR(exchange(client), ==, "");  // Waiting for REGACK
+  VERIFY_A_OP_B_STR(exchange(client, "070b0100000200"), ==, "");
+
+  // QoS 0 goes once
+  VERIFY_A_OP_B(client->publish(topic, "hi", 2, 0), ==, true);
+  VERIFY_A_OP_B_STR(exchange(client), ==, "090c00010000006869");
+  VERIFY_A_OP_B_STR(exchange(client), ==, "");
+
+  // QoS 1 waits for PUBACK, resending (DUP) after the retry interval
+  VERIFY_A_OP_B(client->publish(topic, "hi", 2, 1), ==, true);
+  VERIFY_A_OP_B(client->publish(topic, "yo", 2, 0), ==, true);
+  VERIFY_A_OP_B_STR(exchange(client), ==, "090c20010000036869");
+  VERIFY_A_OP_B_STR(exchange(client), ==, "");
+  delay(RETRY_MILLIS + 100);
+  VERIFY_A_OP_B_STR(exchange(client), ==, "090ca0010000036869");
+  VERIFY_A_OP_B_STR(
+      exchange(client, "070d0100000300"), ==, "090c0001000000796f");
+
+  // QoS -1 to the predefined topic ID
+  VERIFY_A_OP_B(client->publish(predefined, "hi", 2, -1), ==, true);
+  VERIFY_A_OP_B_STR(exchange(client), ==, "090c61000500006869");
+  VERIFY_A_OP_B(client->publish(topic, "hi", 2, -1), ==, false);  // Normal
+
+  // A publish from the gateway (QoS 1) is delivered and acknowledged
+  received.clear();
+  VERIFY_A_OP_B_STR(
+      exchange(client, "0a0c2001000009686579"), ==, "070d0100000900");
+  VERIFY_A_OP_B_STR(received, ==, "t/a=hey");
+  delete client;
+}
+
+static void test_mqttsn_sleep_check_in() {
+  OK_NOTE("#TEST# test_mqttsn_sleep_check_in");
+  auto* client = make_test_client();
+  int const topic = client->add_topic("t/a");
+  VERIFY_A_OP_B_STR(exchange(client), ==, CONNECT_HEX);
+  VERIFY_A_OP_B_STR(exchange(client, "030500"), ==, "090a00000002742f61");
+  VERIFY_A_OP_B_STR(exchange(client, "070b0100000200"), ==, "");
+
+  // DISCONNECT with a duration; publishes then wait in the outbox
+  client->sleep(60);
+  VERIFY_A_OP_B_STR(exchange(client), ==, "0418003c");
+  VERIFY_A_OP_B(client->state(), ==, XBeeMQTTSNClient::ASLEEP);
+  VERIFY_A_OP_B(client->publish(topic, "zz", 2, 0), ==, true);
+  VERIFY_A_OP_B_STR(exchange(client), ==, "");
+
+  // Checking in fetches what the gateway buffered, until PINGRESP
+  received.clear();
+  client->check_in();
+  VERIFY_A_OP_B_STR(exchange(client), ==, "061674657374");
+  VERIFY_A_OP_B(client->state(), ==, XBeeMQTTSNClient::AWAKE);
+  VERIFY_A_OP_B_STR(exchange(client, "090c0001000000796f"), ==, "");
+  VERIFY_A_OP_B_STR(received, ==, "t/a=yo");
+  VERIFY_A_OP_B_STR(exchange(client, "0217"), ==, "");
+  VERIFY_A_OP_B(client->state(), ==, XBeeMQTTSNClient::ASLEEP);
+
+  // Unprompted, the client checks in before the sleep duration runs out
+  delay(50 * 1000);
+  VERIFY_A_OP_B_STR(exchange(client), ==, "");
+  delay(5 * 1000);
+  VERIFY_A_OP_B_STR(exchange(client), ==, "061674657374");
+  VERIFY_A_OP_B_STR(exchange(client, "0217"), ==, "");
+
+  // Waking reconnects (a clean session, so topics register again), then
+  // the held publish goes
+  client->wake();
+  VERIFY_A_OP_B_STR(exchange(client), ==, CONNECT_HEX);
+  VERIFY_A_OP_B_STR(exchange(client, "030500"), ==, "090a00000003742f61");
+  VERIFY_A_OP_B_STR(
+      exchange(client, "070b0101000300"), ==, "090c00010100007a7a");
+  VERIFY_A_OP_B(client->state(), ==, XBeeMQTTSNClient::ACTIVE);
+  delete client;
+}
+
+static void test_mqttsn_connect_hold_off() {
+  OK_NOTE("#TEST# test_mqttsn_connect_hold_off");
+  auto* client = make_test_client();
+  int const predefined = client->add_topic("t/p", 5);
+
+  // A rejected CONNECT isn't retried right away
+  VERIFY_A_OP_B_STR(exchange(client), ==, CONNECT_HEX);
+  VERIFY_A_OP_B_STR(exchange(client, "030503"), ==, "");
+  VERIFY_A_OP_B(client->state(), ==, XBeeMQTTSNClient::DISCONNECTED);
+  VERIFY_A_OP_B_STR(exchange(client), ==, "");
+
+  // After the hold-off it is, with retries; then unanswered, it gives up
+  delay(60 * 1000);
+  VERIFY_A_OP_B_STR(exchange(client), ==, CONNECT_HEX);
+  for (int retry = 1; retry <= 4; ++retry) {
+    delay(RETRY_MILLIS + 100);
+    VERIFY_A_OP_B_STR(exchange(client), ==, CONNECT_HEX);
+  }
+  delay(RETRY_MILLIS + 100);
+  VERIFY_A_OP_B_STR(exchange(client), ==, "");
+  VERIFY_A_OP_B(client->state(), ==, XBeeMQTTSNClient::DISCONNECTED);
+
+  // Holding off, QoS -1 publishes still go (they need no connection)
+  for (int i = 0; i < 5; ++i) {
+    delay(RETRY_MILLIS);
+    VERIFY_A_OP_B_STR(exchange(client), ==, "");
+  }
+  VERIFY_A_OP_B(client->publish(predefined, "hi", 2, -1), ==, true);
+  VERIFY_A_OP_B_STR(exchange(client), ==, "090c61000500006869");
+
+  delay(RETRY_MILLIS + 100);
+  VERIFY_A_OP_B_STR(exchange(client), ==, CONNECT_HEX);
+  delete client;
+}
+
+static void test_mqttsn_qos_m1_passes_held() {
+  OK_NOTE("#TEST# test_mqttsn_qos_m1_passes_held");
+  auto* client = make_test_client();
+  int const topic = client->add_topic("t/a");
+  int const predefined = client->add_topic("t/p", 5);
+  VERIFY_A_OP_B_STR(exchange(client), ==, CONNECT_HEX);
+  VERIFY_A_OP_B_STR(exchange(client, "030503"), ==, "");
+
+  // Without a session, QoS -1 goes past QoS 0/1 waiting for one
+  VERIFY_A_OP_B(client->publish(topic, "aa", 2, 0), ==, true);
+  VERIFY_A_OP_B(client->publish(predefined, "hi", 2, -1), ==, true);
+  VERIFY_A_OP_B(client->publish(topic, "bb", 2, 1), ==, true);
+  VERIFY_A_OP_B(client->publish(predefined, "yo", 2, -1), ==, true);
+  VERIFY_A_OP_B_STR(exchange(client), ==, "090c61000500006869");
+  VERIFY_A_OP_B_STR(exchange(client), ==, "090c6100050000796f");
+  VERIFY_A_OP_B_STR(exchange(client), ==, "");
+
+  // Connected, the held ones go in order, and the QoS -1 aren't resent
+  delay(60 * 1000);
+  VERIFY_A_OP_B_STR(exchange(client), ==, CONNECT_HEX);
+  VERIFY_A_OP_B_STR(exchange(client, "030500"), ==, "090a00000002742f61");
+  VERIFY_A_OP_B_STR(
+      exchange(client, "070b0100000200"), ==, "090c00010000006161");
+  VERIFY_A_OP_B_STR(exchange(client), ==, "090c20010000036262");
+  VERIFY_A_OP_B_STR(exchange(client, "070d0100000300"), ==, "");
+  VERIFY_A_OP_B_STR(exchange(client), ==, "");
+  delete client;
+}
+
+static void test_mqttsn_unknown_topic() {
+  OK_NOTE("#TEST# test_mqttsn_unknown_topic");
+  static XBeeMQTTSNClientStorage storage;
+  static uint8_t outbox[256];
+  auto* client = make_xbee_mqttsn_client(
+      &storage, "test", 60, outbox, sizeof(outbox),
+      XBeeMQTTSNClient::MessageCallback::create<on_message>());
+  client->use_socket(SOCKET, GATEWAY_IP, GATEWAY_PORT);
+  client->add_topic("t/a");
+  VERIFY_A_OP_B_STR(exchange(client), ==, CONNECT_HEX);
+  VERIFY_A_OP_B_STR(exchange(client, "030500"), ==, "090a00000002742f61");
+
+  // QoS 1 publishes to IDs we don't know, including 0 (which "t/a" has
+  // until REGACK), are refused with "invalid topic ID"
+  received.clear();
+  VERIFY_A_OP_B_STR(
+      exchange(client, "0a0c2000000009686579"), ==, "070d0000000902");
+  VERIFY_A_OP_B_STR(
+      exchange(client, "0a0c2001230009686579"), ==, "070d0123000902");
+  VERIFY_A_OP_B_STR(received, ==, "");
+
+  // Once registered, the topic is accepted
+  VERIFY_A_OP_B_STR(exchange(client, "070b0100000200"), ==, "");
+  VERIFY_A_OP_B_STR(
+      exchange(client, "0a0c2001000009686579"), ==, "070d0100000900");
+  VERIFY_A_OP_B_STR(received, ==, "t/a=hey");
+  client->~XBeeMQTTSNClient();
+}
+
+void setup() {
+  Serial1.begin(115200);
+  ok_logging_stream = &Serial1;
+  OK_NOTE("#BEGIN-TESTS#");
+  test_mqttsn_connect_register_publish();
+  test_mqttsn_sleep_check_in();
+  test_mqttsn_connect_hold_off();
+  test_mqttsn_qos_m1_passes_held();
+  test_mqttsn_unknown_topic();
+  OK_NOTE("#END-TESTS#");
+}
+
+void loop() {}
@@ -0,0 +1,2 @@
+def test_xbee_mqttsn_client(emulated_test_output):
+    pass
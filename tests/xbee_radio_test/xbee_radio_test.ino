@@ -0,0 +1,128 @@
+// Tests for the XBee radio driver (shared_src/xbee_radio.h) on a timed
+// FakeSerial: frames streamed at line rate must come through whole
+
+#include <Arduino.h>
+#include <etl/string.h>
+#include <fake_serial.h>
+#include <ok_logging.h>
+#include <verifiers.h>
+
+#include "src/xbee_api.h"
+#include "src/xbee_radio.h"
+
+using namespace XBeeAPI;
+
+static OkLoggingContext OK_CONTEXT("xbee_radio_test");
+
+static constexpr int LINE_RATE_FRAMES = 40;
+static constexpr int LINE_RATE_SIZE = 200;  // Socket data bytes per frame
+
+// Plays the XBee's side of the command mode handshake
+static bool start_api_mode(XBeeRadio* radio, FakeSerial* serial) {
+  auto* const written = serial->write_buf;
+  for (int i = 0; i < 1000 && radio->outgoing_space() == 0; ++i) {
+    radio->poll_for_frame(nullptr);
+    if (*written == "+++" || *written == "AT\r") serial->read_buf = "OK\r";
+    if (*written == "ATAP1,CN\r") serial->read_buf = "OK\rOK\r";
+    written->clear();
+    delay(10);
+  }
+  return radio->outgoing_space() > 0;
+}
+
+// SocketReceive frames on socket i, each full of 'a' + i % 26
+static void append_line_rate_frames(etl::istring* out) {
+  for (int i = 0; i < LINE_RATE_FRAMES; ++i) {
+    int const length = wire_size_of<SocketReceive>(LINE_RATE_SIZE) - 4;
+    char const head[] = {
+      char(0x7E), char(length >> 8), char(length & 0xFF),
+      char(SocketReceive::TYPE), 0, char(i), 0,
+    };
+    out->append(head, sizeof(head));
+    char const fill = 'a' + i % 26;
+    out->append(LINE_RATE_SIZE, fill);
+    uint8_t const check = SocketReceive::TYPE + i + LINE_RATE_SIZE * fill;
+    out->push_back(char(0xFF - check));
+  }
+}
+
+// Polls the radio until input runs out, checking each frame is whole and
+// in order; returns the number of frames received
+static int poll_line_rate_frames(XBeeRadio* radio, FakeSerial* serial) {
+  static Frame in;
+  int frames = 0, last_socket = -1;
+  unsigned long const start = millis();
+  while (!serial->read_buf.empty() || serial->available() > 0) {
+    if (millis() - start > 5000) break;
+    while (radio->poll_for_frame(&in)) {
+      int size = 0;
+      auto const* receive = in.decode_as<SocketReceive>(&size);
+      VERIFY_A_OP_B(receive != nullptr, ==, true);
+      if (receive == nullptr) continue;
+      VERIFY_A_OP_B(size, ==, LINE_RATE_SIZE);
+      VERIFY_A_OP_B(int(receive->socket), >, last_socket);
+      last_socket = receive->socket;
+      char const fill = 'a' + receive->socket % 26;
+      int intact = 0;
+      while (intact < size && receive->data[intact] == fill) ++intact;
+      VERIFY_A_OP_B(intact, ==, size);
+      ++frames;
+    }
+    delay(random(0, 9));
+  }
+  return frames;
+}
+
+static void test_xbee_radio_line_rate() {
+  OK_NOTE("#TEST# test_xbee_radio_line_rate");
+  etl::string<256> write_buf;
+  FakeSerial fake_serial(0, "", &write_buf);
+  auto* radio = make_xbee_radio(&fake_serial);
+  VERIFY_A_OP_B(start_api_mode(radio, &fake_serial), ==, true);
+
+  static etl::string<LINE_RATE_FRAMES * (LINE_RATE_SIZE + 8)> input;
+  input.clear();
+  append_line_rate_frames(&input);
+
+  // Frames stream in at 115200 baud in bursts, polled every 0-8ms;
+  // the 512 byte FIFO from blub_station_init() should be plenty
+  FakeSerial::Timing timing;
+  timing.rx_fifo = 512;
+  timing.max_chunk = 64;
+  fake_serial.set_timing(timing);
+  fake_serial.read_buf = input;
+  unsigned long const start = millis();
+  int const frames = poll_line_rate_frames(radio, &fake_serial);
+  VERIFY_A_OP_B(fake_serial.rx_dropped, ==, 0);
+  VERIFY_A_OP_B(frames, ==, LINE_RATE_FRAMES);
+  OK_NOTE(
+      "Line rate: %db in %lums, FIFO peak %d/%d",
+      (int) input.size(), millis() - start,
+      fake_serial.rx_peak, timing.rx_fifo);
+
+  // With the default 32 byte FIFO, a 20ms stall (230 bytes) overruns;
+  // damaged frames are skipped and later ones still come through
+  timing.rx_fifo = 32;
+  fake_serial.set_timing(timing);
+  fake_serial.read_buf = input;
+  fake_serial.available();  // Sending starts
+  delay(20);
+  VERIFY_A_OP_B(fake_serial.available(), ==, 32);
+  VERIFY_A_OP_B(fake_serial.rx_dropped, >, 100);  // Less a partial burst
+  timing.rx_fifo = 512;
+  fake_serial.set_timing(timing);
+  int const after = poll_line_rate_frames(radio, &fake_serial);
+  VERIFY_A_OP_B(after, <, LINE_RATE_FRAMES);
+  VERIFY_A_OP_B(after, >=, LINE_RATE_FRAMES - 2);
+  delete radio;
+}
+
+void setup() {
+  Serial1.begin(115200);
+  ok_logging_stream = &Serial1;
+  OK_NOTE("#BEGIN-TESTS#");
+  test_xbee_radio_line_rate();
+  OK_NOTE("#END-TESTS#");
+}
+
+void loop() {}
@@ -0,0 +1,2 @@
+def test_xbee_radio(emulated_test_output):
+    pass